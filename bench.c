@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define UPRINTF_IMPLEMENTATION
+#include "uprintf.h"
+
+// Prevent the compiler from optimizing away benchmark results
+static volatile size_t bench_sink;
+
+static double bench_seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Report formats: aligned text for people, CSV or JSON lines for tracking
+enum { BENCH_TEXT, BENCH_CSV, BENCH_JSON };
+static int bench_format = BENCH_TEXT;
+
+static void bench_report(const char* name, long calls, double seconds, size_t bytes) {
+    double ns = calls > 0 ? seconds * 1e9 / calls : 0.0;
+    double rate = seconds > 0 ? bytes / seconds : 0.0;
+
+    switch (bench_format) {
+        case BENCH_CSV:
+            printf("%s,%ld,%.2f,%.0f\n", name, calls, ns, rate);
+            break;
+
+        case BENCH_JSON:
+            printf("{\"name\":\"%s\",\"calls\":%ld,\"ns_per_call\":%.2f,\"bytes_per_sec\":%.0f}\n",
+                   name, calls, ns, rate);
+            break;
+
+        default:
+            printf("%-28s %9.1f ns/call %10.1f MB/s\n", name, ns, rate / 1e6);
+            break;
+    }
+}
+
+// One benchmark body: does call `i` and returns the bytes it produced
+typedef size_t (*bench_fn_t)(long i);
+
+static double bench_run(const char* name, bench_fn_t fn, long iterations) {
+    size_t bytes = 0;
+
+    for (long i = 0; i < iterations / 16; i++) {
+        bench_sink += fn(i); // Warm caches and branch predictors
+    }
+
+    clock_t start = clock();
+    for (long i = 0; i < iterations; i++) {
+        bytes += fn(i);
+    }
+    double seconds = bench_seconds(start);
+
+    bench_sink += bytes;
+    bench_report(name, iterations, seconds, bytes);
+    return seconds;
+}
+
+// Reference: the original one-digit-per-division conversion with a reverse pass
+static char* legacy_utoa(uint64_t value, char* str, int base, bool uppercase) {
+    char* ptr = str;
+    char* low = ptr;
+
+    do {
+        int digit = value % base;
+        *ptr++ = digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10;
+        value /= base;
+    } while (value);
+
+    *ptr = '\0';
+    u_strrev(low, ptr - 1);
+    return str;
+}
+
+// Current conversion, terminated for comparison with the reference
+static char* bench_utoa_end(uint64_t value, char* str, int base) {
+    char* start = u_utoa_end(value, str + 71, base, false);
+    str[71] = '\0';
+    return start;
+}
+
+// Value generator covering short, 32-bit and full 64-bit magnitudes
+static uint64_t bench_value(uint64_t i) {
+    uint64_t x = i * 0x9E3779B97F4A7C15ull;
+    return x >> (i % 64);
+}
+
+static int bench_base;
+static char bench_digits[72];
+
+static size_t bench_legacy_utoa(long i) {
+    legacy_utoa(bench_value(i), bench_digits, bench_base, false);
+    return strlen(bench_digits);
+}
+
+static size_t bench_current_utoa(long i) {
+    return (size_t)(bench_digits + 71 - bench_utoa_end(bench_value(i), bench_digits, bench_base));
+}
+
+static void bench_utoa(const char* name, int base, long iterations) {
+    char legacy_name[40], current_name[40];
+    snprintf(legacy_name, sizeof(legacy_name), "%s_legacy", name);
+    snprintf(current_name, sizeof(current_name), "%s_utoa_end", name);
+
+    bench_base = base;
+    double legacy = bench_run(legacy_name, bench_legacy_utoa, iterations);
+    double current = bench_run(current_name, bench_current_utoa, iterations);
+
+    if (bench_format == BENCH_TEXT) {
+        printf("%-28s %9.2fx\n", "  speedup", current > 0 ? legacy / current : 0.0);
+    }
+}
+
+// Sanity check: both routines must agree before timing them
+static int bench_verify(void) {
+    static const int bases[] = {2, 8, 10, 16, 36};
+    char a[72], b[72];
+
+    for (uint64_t i = 0; i < 100000; i++) {
+        for (size_t j = 0; j < sizeof(bases) / sizeof(bases[0]); j++) {
+            legacy_utoa(bench_value(i), a, bases[j], false);
+            const char* c = bench_utoa_end(bench_value(i), b, bases[j]);
+            if (strcmp(a, c) != 0) {
+                printf("Mismatch for base %d: %s != %s\n", bases[j], a, c);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Formatting bodies, each paired with its libc equivalent where one exists
+static char bench_buffer[8192];
+static char bench_payload[4097];
+
+static size_t bench_libc_int(long i) {
+    return (size_t)snprintf(bench_buffer, 128, "id=%ld count=%u delta=%d", i,
+                            (unsigned)(i * 7), (int)(i % 201) - 100);
+}
+
+static size_t bench_u_int(long i) {
+    return (size_t)u_snprintf(bench_buffer, 128, "id=%ld count=%u delta=%d", i,
+                              (unsigned)(i * 7), (int)(i % 201) - 100);
+}
+
+static size_t bench_libc_hex(long i) {
+    return (size_t)snprintf(bench_buffer, 128, "%08x %#llx %X", (unsigned)i,
+                            (unsigned long long)bench_value(i), (unsigned)(i * 31));
+}
+
+static size_t bench_u_hex(long i) {
+    return (size_t)u_snprintf(bench_buffer, 128, "%08x %#llx %X", (unsigned)i,
+                              (unsigned long long)bench_value(i), (unsigned)(i * 31));
+}
+
+static size_t bench_libc_float(long i) {
+    double v = (double)i * 1.37 + 0.25;
+    return (size_t)snprintf(bench_buffer, 128, "%.3f %g %e", v, v / 7, v * 1e9);
+}
+
+static size_t bench_u_float(long i) {
+    double v = (double)i * 1.37 + 0.25;
+    return (size_t)u_snprintf(bench_buffer, 128, "%.3f %g %e", v, v / 7, v * 1e9);
+}
+
+static size_t bench_libc_sprintf(long i) {
+    return (size_t)sprintf(bench_buffer, "[%s] %c%d", "sensor", 'T', (int)(i & 1023));
+}
+
+static size_t bench_u_sprintf(long i) {
+    return (size_t)u_sprintf(bench_buffer, "[%s] %c%d", "sensor", 'T', (int)(i & 1023));
+}
+
+static size_t bench_u_args(long i) {
+    u_arg_t args[] = {u_arg_str("sensor"), u_arg_int('T'), u_arg_int(i & 1023)};
+    return (size_t)u_snprintf_args(bench_buffer, sizeof(bench_buffer), "[%s] %c%d", args, 3);
+}
+
+static size_t bench_libc_large_s(long i) {
+    (void)i;
+    return (size_t)snprintf(bench_buffer, sizeof(bench_buffer), "<%s>", bench_payload);
+}
+
+static size_t bench_u_large_s(long i) {
+    (void)i;
+    return (size_t)u_snprintf(bench_buffer, sizeof(bench_buffer), "<%s>", bench_payload);
+}
+
+// Callback sinks: count what arrives
+static size_t bench_bytes;
+
+static void bench_putc(char c, void* ctx) {
+    (void)ctx;
+    (void)c;
+    bench_bytes++;
+}
+
+static void bench_write(const char* data, size_t len, void* ctx) {
+    (void)ctx;
+    (void)data;
+    bench_bytes += len;
+}
+
+static const u_template_var_t bench_vars[] = {
+    {"host", "db1.example.org"}, {"state", "up"}, {"load", "0.42"}
+};
+static int bench_template_id;
+static const char* bench_template_values[3];
+
+static size_t bench_template_format(long i) {
+    (void)i;
+    bench_bytes = 0;
+    u_template_format(bench_putc, NULL, "{{host}} is {{state}} (load {{load}})\n",
+                      bench_vars, 3);
+    return bench_bytes;
+}
+
+static size_t bench_template_render(long i) {
+    (void)i;
+    bench_bytes = 0;
+    u_template_render(bench_putc, NULL, bench_template_id, bench_template_values, 3);
+    return bench_bytes;
+}
+
+static u_string_builder_t bench_builder;
+
+static size_t bench_builder_format(long i) {
+    u_string_builder_clear(&bench_builder);
+    u_string_builder_append_format(&bench_builder, "id=%ld ", i);
+    u_string_builder_append_format(&bench_builder, "name=%s ", "sensor");
+    u_string_builder_append_format(&bench_builder, "value=%05u\n", (unsigned)(i & 0xFFFF));
+    return bench_builder.pos;
+}
+
+// One JSON log record: hand-built with append_format against u_record_*
+static u_record_key_t bench_key_id, bench_key_name, bench_key_temp;
+
+static size_t bench_json_format(long i) {
+    u_string_builder_clear(&bench_builder);
+    u_string_builder_append_format(&bench_builder, "{\"id\":%ld,", i);
+    u_string_builder_append_format(&bench_builder, "\"name\":\"%s\",", "sensor \\\"A\\\"");
+    u_string_builder_append_format(&bench_builder, "\"temp\":%r}", (double)(i & 0xFF) / 8);
+    return bench_builder.pos;
+}
+
+static size_t bench_json_record(long i) {
+    u_record_t rec;
+    u_string_builder_clear(&bench_builder);
+    u_record_begin_builder(&rec, U_RECORD_JSON, &bench_builder);
+    u_record_int(&rec, &bench_key_id, i);
+    u_record_str(&rec, &bench_key_name, "sensor \"A\"");
+    u_record_float(&rec, &bench_key_temp, (double)(i & 0xFF) / 8);
+    return (size_t)u_record_end(&rec);
+}
+
+static char bench_identity(char c, void* ctx) {
+    (void)ctx;
+    return c;
+}
+
+static u_context_t bench_pipeline;
+
+static size_t bench_printf_ex(long i) {
+    bench_bytes = 0;
+    u_context_printf_ex(&bench_pipeline, bench_putc, NULL, "tick %ld: status ok\n", i);
+    return bench_bytes;
+}
+
+static u_context_t bench_streams;
+
+static size_t bench_broadcast(long i) {
+    bench_bytes = 0;
+    u_context_output_broadcast_printf(&bench_streams, "tick %ld: status ok\n", i);
+    return bench_bytes;
+}
+
+// A 64-byte packet as hex: one %02x per byte against the encoder handler
+static size_t bench_hex_loop(long i) {
+    size_t n = 0;
+    bench_payload[0] = (char)i;
+    for (int k = 0; k < 64; k++) {
+        n += (size_t)u_snprintf(bench_buffer + n, 3, "%02x", (unsigned char)bench_payload[k]);
+    }
+    return n;
+}
+
+static size_t bench_hex_handler(long i) {
+    bench_payload[0] = (char)i;
+    return (size_t)u_snprintf(bench_buffer, sizeof(bench_buffer), "%.*H", 64, bench_payload);
+}
+
+// An ISO-8601 log timestamp: calendar fields through %02d against the
+// handler with its cached date prefix
+static size_t bench_time_fields(long i) {
+    int second = (int)(i % 60);
+    return (size_t)u_snprintf(bench_buffer, sizeof(bench_buffer), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+                              2026, 10, 14, 17, 51, second, (int)(i % 1000));
+}
+
+static size_t bench_time_handler(long i) {
+    long long ns = 1791999060000000000LL + (i % 60) * 1000000000LL + (i % 1000) * 1000000LL;
+    return (size_t)u_snprintf(bench_buffer, sizeof(bench_buffer), "%T", ns);
+}
+
+static void bench_formatting(long iterations) {
+    bench_run("snprintf_int_libc", bench_libc_int, iterations);
+    bench_run("snprintf_int", bench_u_int, iterations);
+    bench_run("snprintf_hex_libc", bench_libc_hex, iterations);
+    bench_run("snprintf_hex", bench_u_hex, iterations);
+    bench_run("snprintf_float_libc", bench_libc_float, iterations);
+    bench_run("snprintf_float", bench_u_float, iterations);
+    bench_run("sprintf_mixed_libc", bench_libc_sprintf, iterations);
+    bench_run("sprintf_mixed", bench_u_sprintf, iterations);
+    bench_run("sprintf_mixed_args", bench_u_args, iterations);
+
+    memset(bench_payload, 'p', sizeof(bench_payload) - 1);
+    bench_run("snprintf_4k_s_libc", bench_libc_large_s, iterations / 10);
+    bench_run("snprintf_4k_s", bench_u_large_s, iterations / 10);
+
+    u_register_format_handler('H', u_hex_handler);
+    bench_run("hex64_per_byte", bench_hex_loop, iterations / 10);
+    bench_run("hex64_handler", bench_hex_handler, iterations / 10);
+    u_unregister_format_handler('H');
+
+    u_register_format_handler('T', u_time_handler);
+    bench_run("timestamp_fields", bench_time_fields, iterations);
+    bench_run("timestamp_handler", bench_time_handler, iterations);
+    u_unregister_format_handler('T');
+}
+
+static void bench_features(long iterations) {
+    bench_run("template_format", bench_template_format, iterations);
+
+    u_template_load("bench", "{{host}} is {{state}} (load {{load}})\n");
+    bench_template_id = u_template_find("bench");
+    for (int i = 0; i < 3; i++) {
+        bench_template_values[u_template_slot(bench_template_id, bench_vars[i].key)] =
+            bench_vars[i].value;
+    }
+    bench_run("template_render", bench_template_render, iterations);
+
+    bench_builder = u_string_builder_create(64);
+    bench_run("builder_append_format", bench_builder_format, iterations);
+    u_record_key_init(&bench_key_id, U_RECORD_JSON, "id");
+    u_record_key_init(&bench_key_name, U_RECORD_JSON, "name");
+    u_record_key_init(&bench_key_temp, U_RECORD_JSON, "temp");
+    bench_run("json_append_format", bench_json_format, iterations);
+    bench_run("json_record", bench_json_record, iterations);
+    u_string_builder_free(&bench_builder);
+
+    // The enhanced path with 0, 1 and 4 processors
+    static const int stages[] = {0, 1, 4};
+    u_context_init(&bench_pipeline);
+    for (size_t n = 0; n < sizeof(stages) / sizeof(stages[0]); n++) {
+        while (bench_pipeline.processor_count < stages[n]) {
+            if (bench_pipeline.processor_count % 2) {
+                u_context_add_stream_processor(&bench_pipeline, bench_identity, NULL);
+            } else {
+                u_context_add_block_processor(&bench_pipeline, u_processor_upper, NULL);
+            }
+        }
+        char name[40];
+        snprintf(name, sizeof(name), "printf_ex_%d_processors", stages[n]);
+        bench_run(name, bench_printf_ex, iterations);
+    }
+
+    // Broadcast to 1 and 4 block streams
+    static const int fanout[] = {1, 4};
+    u_context_init(&bench_streams);
+    for (size_t n = 0; n < sizeof(fanout) / sizeof(fanout[0]); n++) {
+        while (bench_streams.stream_count < fanout[n]) {
+            u_output_stream_t stream = {NULL, NULL, true, bench_write, NULL, 0};
+            u_context_output_add_stream(&bench_streams, stream);
+        }
+        char name[40];
+        snprintf(name, sizeof(name), "broadcast_%d_streams", fanout[n]);
+        bench_run(name, bench_broadcast, iterations);
+    }
+}
+
+int main(int argc, char** argv) {
+    long iterations = 2000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            bench_format = BENCH_CSV;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            bench_format = BENCH_JSON;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atol(argv[++i]);
+        } else {
+            printf("usage: %s [--csv | --json] [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 16) iterations = 16;
+
+    if (bench_format == BENCH_TEXT) {
+        printf("Running uprintf benchmarks...\n\n");
+    } else if (bench_format == BENCH_CSV) {
+        printf("name,calls,ns_per_call,bytes_per_sec\n");
+    }
+    if (bench_verify()) return 1;
+
+    bench_utoa("utoa_base10", 10, iterations);
+    bench_utoa("utoa_base16", 16, iterations);
+    bench_utoa("utoa_base8", 8, iterations);
+    bench_formatting(iterations);
+    bench_features(iterations);
+
+    if (bench_format == BENCH_TEXT) printf("\nDone.\n");
+    return 0;
+}
@@ -4,6 +4,18 @@
 #include <setjmp.h>
 #include <stdlib.h>
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#define UPRINTF_ASYNC
+#endif
+
+#ifndef UPRINTF_STATS
+#define UPRINTF_STATS 1
+#endif
+
+// Count call sites rejected by the checked macros
+static int test_mismatches;
+#define UPRINTF_ON_MISMATCH(fmt) ((void)(fmt), test_mismatches++)
+
 #define UPRINTF_IMPLEMENTATION
 #include "uprintf.h"
 
@@ -67,6 +79,11 @@ static void test_integer_formatting() {
     u_printf(test_output_cb, &ctx, "%-5d", 42);
     assert(strcmp(ctx.buffer, "42   ") == 0);
     
+    // Test zero padding after the sign
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "%05d|%+.3d", -42, 7);
+    assert(strcmp(ctx.buffer, "-0042|+007") == 0);
+    
     printf("✓ Integer formatting tests passed\n");
 }
 
@@ -110,6 +127,11 @@ static void test_hex_formatting() {
     u_printf(test_output_cb, &ctx, "%#X", 0xABC);
     assert(strcmp(ctx.buffer, "0XABC") == 0);
     
+    // Test zero padding after the prefix
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "%#08x", 0xABC);
+    assert(strcmp(ctx.buffer, "0x000abc") == 0);
+    
     printf("✓ Hexadecimal tests passed\n");
 }
 
@@ -217,6 +239,53 @@ static void test_float_formatting() {
 #endif
 }
 
+// Full float engine tests
+static void test_float_engine() {
+#if UPRINTF_FLOAT_SUPPORT && UPRINTF_FLOAT_ENGINE == UPRINTF_FLOAT_ENGINE_FULL
+    char buffer[512];
+    
+    // Exact %f beyond the int64_t range and at long precisions
+    u_snprintf(buffer, sizeof(buffer), "%f", 1e20);
+    assert(strcmp(buffer, "100000000000000000000.000000") == 0);
+    u_snprintf(buffer, sizeof(buffer), "%.20f", 0.1);
+    assert(strcmp(buffer, "0.10000000000000000555") == 0);
+    u_snprintf(buffer, sizeof(buffer), "%.0f|%.0f|%.1f", 0.5, 1.5, 0.25);
+    assert(strcmp(buffer, "0|2|0.2") == 0);
+    u_snprintf(buffer, sizeof(buffer), "%.0f", 1.7976931348623157e308);
+    assert(strlen(buffer) == 309);
+    
+    // %e and %g
+    u_snprintf(buffer, sizeof(buffer), "%e|%.2E|%e", 12345.678, -0.000123, 0.0);
+    assert(strcmp(buffer, "1.234568e+04|-1.23E-04|0.000000e+00") == 0);
+    u_snprintf(buffer, sizeof(buffer), "%g|%g|%g|%#g|%G", 100000.0, 1000000.0, 0.0001, 1.5, 1e-10);
+    assert(strcmp(buffer, "100000|1e+06|0.0001|1.50000|1E-10") == 0);
+    u_snprintf(buffer, sizeof(buffer), "%e", 5e-324);
+    assert(strcmp(buffer, "4.940656e-324") == 0);
+    
+    // %a
+    u_snprintf(buffer, sizeof(buffer), "%a|%A|%.1a", 1.0, -0.5, 1.96875);
+    assert(strcmp(buffer, "0x1p+0|-0X1P-1|0x2.0p+0") == 0);
+    
+    // Shortest round-trip %r
+    u_snprintf(buffer, sizeof(buffer), "%r|%r|%r|%r", 0.1, 1.0 / 3, 1e23, 5e-324);
+    assert(strcmp(buffer, "0.1|0.3333333333333333|1e+23|5e-324") == 0);
+    u_snprintf(buffer, sizeof(buffer), "%r|%R|%r", 1.7976931348623157e308, 1e16, 123.456);
+    assert(strcmp(buffer, "1.7976931348623157e+308|1E+16|123.456") == 0);
+    
+    // Flags, width and special values
+    u_snprintf(buffer, sizeof(buffer), "[%+010.2f][%-8.1e][%08f]", 3.14159, 2.5, -1.0 / 0.0);
+    assert(strcmp(buffer, "[+000003.14][2.5e+00 ][    -inf]") == 0);
+    u_snprintf(buffer, sizeof(buffer), "%F|%e", 0.0 / 0.0, 1.0 / 0.0);
+    assert(strcmp(buffer, "NAN|inf") == 0 || strcmp(buffer, "-NAN|inf") == 0);
+    
+    // Long double arguments are accepted and narrowed
+    u_snprintf(buffer, sizeof(buffer), "%.3Lf", (long double)2.5);
+    assert(strcmp(buffer, "2.500") == 0);
+    
+    printf("✓ Float engine tests passed\n");
+#endif
+}
+
 // Length modifier tests
 static void test_length_modifiers() {
     test_ctx_t ctx;
@@ -239,6 +308,15 @@ static void test_length_modifiers() {
     u_printf(test_output_cb, &ctx, "%lld", ll);
     assert(strcmp(ctx.buffer, "123456789012345") == 0);
     
+    // Test 64-bit extremes
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "%llu %lld", 18446744073709551615ULL, (-9223372036854775807LL - 1));
+    assert(strcmp(ctx.buffer, "18446744073709551615 -9223372036854775808") == 0);
+    
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "%llx %llo", 0xFEDCBA9876543210ULL, 01777777777777777777777ULL);
+    assert(strcmp(ctx.buffer, "fedcba9876543210 1777777777777777777777") == 0);
+    
     printf("✓ Length modifier tests passed\n");
 }
 
@@ -256,6 +334,16 @@ static void test_buffer_functions() {
     assert(strcmp(buffer, "Hello, Wo") == 0);
     assert(len == 9);
     
+    // Test truncation inside padding
+    len = u_snprintf(buffer, 6, "ab%8d", 1);
+    assert(strcmp(buffer, "ab   ") == 0);
+    assert(len == 5);
+    
+    // Test long literal and string segments
+    len = u_sprintf(buffer, "%-12s|%08x|literal tail", "left", 0xBEEF);
+    assert(strcmp(buffer, "left        |0000beef|literal tail") == 0);
+    assert(len == 34);
+    
     printf("✓ Buffer function tests passed\n");
 }
 
@@ -306,10 +394,1381 @@ static void test_custom_handlers() {
     reset_test_ctx(&ctx);
     u_printf(test_output_cb, &ctx, "%K");
     assert(strcmp(ctx.buffer, "%K") == 0);
+    assert(u_unregister_format_handler('K') == -1);
+    
+    // Re-registering replaces the handler without using another slot
+    for (int i = 0; i < UPRINTF_MAX_HANDLERS; i++) {
+        assert(u_register_format_handler((char)('a' + i), custom_handler) == 0);
+        assert(u_register_format_handler((char)('a' + i), custom_handler) == 0);
+    }
+    assert(u_register_format_handler('@', custom_handler) == -1);
+    for (int i = 0; i < UPRINTF_MAX_HANDLERS; i++) {
+        assert(u_unregister_format_handler((char)('a' + i)) == 0);
+    }
+    assert(u_register_format_handler((char)0xC3, custom_handler) == -1);
     
     printf("✓ Custom handler tests passed\n");
 }
 
+static void test_deferred_log() {
+    test_ctx_t ctx;
+    char expected[256];
+    unsigned char storage[512];
+    u_deferred_log_t log;
+    
+    assert(u_deferred_init(&log, storage, 500, NULL) == -1);
+    assert(u_deferred_init(&log, storage, sizeof(storage), NULL) == 0);
+    
+    // Strings are copied by value when the record is taken
+    char name[16];
+    strcpy(name, "sensor");
+    assert(u_deferred_printf(&log, "%s=%d [%-*.*s] %lld %hhx|%5.2f%%\n",
+                             name, -42, 8, 3, "abcdef", -1234567890123LL, 0x1ff, 3.14159) > 0);
+    strcpy(name, "other");
+    u_deferred_printf(&log, "%c %zu %p %s %lu %Lf\n", 'z', (size_t)7, (void*)0x1234,
+                      (const char*)NULL, 4000000000UL, 2.5L);
+    
+    reset_test_ctx(&ctx);
+    assert(u_deferred_drain(&log, test_output_cb, &ctx, 0) == 2);
+    u_snprintf(expected, sizeof(expected), "%s=%d [%-*.*s] %lld %hhx|%5.2f%%\n%c %zu %p %s %lu %Lf\n",
+               "sensor", -42, 8, 3, "abcdef", -1234567890123LL, 0x1ff, 3.14159,
+               'z', (size_t)7, (void*)0x1234, (const char*)NULL, 4000000000UL, 2.5L);
+    assert(strcmp(ctx.buffer, expected) == 0);
+    assert(u_deferred_drain(&log, test_output_cb, &ctx, 0) == 0);
+    
+    // Unsupported conversions are refused, a full log drops and counts
+    assert(u_deferred_printf(&log, "%n", (int*)NULL) == -1);
+    u_register_format_handler('K', custom_handler);
+    assert(u_deferred_printf(&log, "%K") == -1);
+    u_unregister_format_handler('K');
+    int i = 0;
+    reset_test_ctx(&ctx);
+    while (u_deferred_printf(&log, "%d,", i) > 0) i++;
+    assert(u_deferred_dropped(&log) == 1);
+    assert(u_deferred_drain(&log, test_output_cb, &ctx, 1) == 1);
+    assert(strcmp(ctx.buffer, "0,") == 0);
+    assert(u_deferred_drain(&log, test_output_cb, &ctx, 0) == (size_t)i - 1);
+    
+    // Records wrap around the end of the storage
+    for (int round = 0; round < 10; round++) {
+        reset_test_ctx(&ctx);
+        u_deferred_printf(&log, "round %d %s", round, "wrapping text");
+        u_deferred_drain(&log, test_output_cb, &ctx, 0);
+        u_snprintf(expected, sizeof(expected), "round %d %s", round, "wrapping text");
+        assert(strcmp(ctx.buffer, expected) == 0);
+    }
+    
+    printf("✓ Deferred log tests passed\n");
+}
+
+static void test_context() {
+    test_ctx_t ctx;
+    char buffer[64];
+    u_context_t context;
+    u_context_init(&context);
+    
+    // Configuration stays local to the context
+    assert(u_context_register_format_handler(&context, 'K', custom_handler) == 0);
+    u_context_set_locale(&context, ",");
+    
+    reset_test_ctx(&ctx);
+    u_context_printf(&context, test_output_cb, &ctx, "%K %.2f", 1.5);
+    assert(strcmp(ctx.buffer, "CUSTOM 1,50") == 0);
+    
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "%K %.2f", 1.5);
+    assert(strcmp(ctx.buffer, "%K 1.50") == 0);
+    
+    u_context_snprintf(&context, buffer, sizeof(buffer), "[%K]", 0);
+    assert(strcmp(buffer, "[CUSTOM]") == 0);
+    assert(u_context_snprintf(&context, buffer, 4, "%.1f", 2.25) == 3);
+    assert(strcmp(buffer, "2,2") == 0);
+    
+    // Default output and staging buffer
+    char storage[16];
+    reset_test_ctx(&ctx);
+    assert(u_context_printf_simple(&context, "x") == -1);
+    u_context_set_default_output(&context, test_output_cb, &ctx);
+    u_context_set_default_output_buffer(&context, storage, sizeof(storage));
+    u_context_printf_simple(&context, "%d-%K", 7);
+    assert(strcmp(ctx.buffer, "7-CUSTOM") == 0);
+    u_context_set_default_output_buffer(&context, NULL, 0);
+    
+    assert(u_context_unregister_format_handler(&context, 'K') == 0);
+    assert(u_context_default() != &context);
+    
+    printf("✓ Context tests passed\n");
+}
+
+static uint64_t stats_ticks;
+
+static uint64_t stats_clock(void) {
+    return stats_ticks += 10;
+}
+
+static void test_stats() {
+    u_stats_t stats;
+    test_ctx_t ctx;
+    char buf[8];
+    
+    u_stats_reset();
+    u_stats_get(&stats);
+    assert(stats.bytes == 0 && stats.conversions['d'] == 0);
+    
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "a=%d b=%s", 1, "xy");
+    u_snprintf(buf, sizeof(buf), "%x%x", 0xFFFFu, 0xFFFFu);
+    u_stats_get(&stats);
+#if UPRINTF_STATS
+    assert(stats.conversions['d'] == 1 && stats.conversions['s'] == 1);
+    assert(stats.conversions['x'] == 2);
+    assert(stats.bytes == strlen("a=1 b=xy") + 7);
+    assert(stats.callbacks == strlen("a=1 b=xy")); // One per character
+    assert(stats.truncations == 1);
+    
+    // Pipeline stages are timed with the user clock
+    u_context_t context;
+    u_context_init(&context);
+    u_context_add_block_processor(&context, u_processor_upper, NULL);
+    u_stats_set_clock(stats_clock);
+    reset_test_ctx(&ctx);
+    u_context_printf_ex(&context, test_output_cb, &ctx, "hi");
+    u_stats_set_clock(NULL);
+    u_stats_get(&stats);
+    assert(stats.processor_time > 0 && stats.hook_time > 0);
+#else
+    assert(stats.bytes == 0 && stats.truncations == 0);
+#endif
+    
+    u_stats_reset();
+    u_stats_get(&stats);
+    assert(stats.bytes == 0 && stats.conversions['x'] == 0);
+    
+    printf("✓ Stats tests passed\n");
+}
+
+// Scanning kernels against byte loops, at every alignment and length
+static void test_scanning() {
+    char buf[96];
+    
+    for (int off = 0; off < 16; off++) {
+        for (int len = 0; len < 64; len++) {
+            char* s = buf + off;
+            for (int i = 0; i < len; i++) s[i] = (char)('a' + (i * 7 + off) % 26);
+            s[len] = '\0';
+            assert(u_strlen(s) == (size_t)len);
+            assert(u_scan_until(s, '%') == s + len);
+            if (len) {
+                s[len - 1] = '%';
+                assert(u_scan_until(s, '%') == s + len - 1);
+                s[len / 2] = '%';
+                assert(u_scan_until(s, '%') == s + len / 2);
+            }
+        }
+    }
+    
+    // Case mapping leaves non-letters and bytes above 0x7F alone
+    char upper[256], expect[256];
+    for (int c = 0; c < 256; c++) {
+        upper[c] = (char)c;
+        expect[c] = (char)((c >= 'a' && c <= 'z') ? c - 32 : c);
+    }
+    u_case_span(upper, sizeof(upper), 'a', 'z');
+    assert(memcmp(upper, expect, sizeof(upper)) == 0);
+    u_case_span(upper + 3, sizeof(upper) - 3, 'A', 'Z');
+    for (int c = 3; c < 256; c++) {
+        assert(upper[c] == (char)((c >= 'A' && c <= 'Z') ? c + 32 : c));
+    }
+    
+    // Search agrees with a naive scan; needles hit block edges
+    char hay[200];
+    for (int i = 0; i < 200; i++) hay[i] = (char)('a' + (i * i) % 3);
+    const char* needles[] = {"a", "ab", "bca", "cab", "abcab", "aaaa", "bbbbbbbbbbbbbbbbbbbbb"};
+    for (size_t n = 0; n < sizeof(needles) / sizeof(needles[0]); n++) {
+        size_t nlen = strlen(needles[n]);
+        for (size_t hlen = 0; hlen <= sizeof(hay); hlen += 7) {
+            const char* expect_at = NULL;
+            for (size_t i = 0; i + nlen <= hlen && !expect_at; i++) {
+                if (memcmp(hay + i, needles[n], nlen) == 0) expect_at = hay + i;
+            }
+            assert(u_find(hay, hlen, needles[n], nlen) == expect_at);
+        }
+    }
+    assert(u_find(hay, 5, "", 0) == hay);
+    
+    printf("✓ Scanning tests passed\n");
+}
+
+// Block sink that counts calls
+typedef struct {
+    test_ctx_t out;
+    int calls;
+} test_block_t;
+
+static void test_block_cb(const char* data, size_t len, void* ctx) {
+    test_block_t* block = (test_block_t*)ctx;
+    block->calls++;
+    for (size_t i = 0; i < len; i++) test_output_cb(data[i], &block->out);
+}
+
+static void test_broadcast() {
+    test_ctx_t ctx;
+    test_block_t a, b;
+    u_context_t context;
+    u_context_init(&context);
+    reset_test_ctx(&ctx);
+    reset_test_ctx(&a.out);
+    reset_test_ctx(&b.out);
+    a.calls = b.calls = 0;
+    
+    // Per-char stream, block stream, and a warning-only block stream
+    u_output_stream_t plain = {test_output_cb, &ctx, true, NULL, NULL, 0};
+    u_output_stream_t block = {NULL, &a, true, test_block_cb, NULL, 0};
+    u_output_stream_t warn = {NULL, &b, true, test_block_cb, NULL, 2};
+    u_context_output_add_stream(&context, plain);
+    u_context_output_add_stream(&context, block);
+    u_context_output_add_stream(&context, warn);
+    
+    // Formatted once, each stream gets one block
+    assert(u_context_output_broadcast_printf(&context, "x=%d %s", 42, "ok") == 7);
+    assert(strcmp(ctx.buffer, "x=42 ok") == 0);
+    assert(strcmp(a.out.buffer, "x=42 ok") == 0 && a.calls == 1);
+    assert(strcmp(b.out.buffer, "x=42 ok") == 0 && b.calls == 1);
+    
+    // Leveled: below the filter a stream sees nothing
+    reset_test_ctx(&b.out);
+    u_context_output_broadcast_log(&context, 1, "info");
+    assert(strcmp(a.out.buffer, "x=42 okinfo") == 0);
+    assert(b.out.position == 0 && b.calls == 1);
+    u_context_output_broadcast_log(&context, 2, "warn");
+    assert(strcmp(b.out.buffer, "warn") == 0);
+    
+    // No eligible stream: nothing is formatted
+    assert(u_context_output_broadcast_log(&context, -1, "%d", 1) == 0);
+    
+    // Output larger than the staging buffer arrives in ordered chunks
+    char big[300];
+    memset(big, 'z', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    reset_test_ctx(&a.out);
+    assert(u_context_output_broadcast_printf(&context, "<%s>", big) == 301);
+    assert(a.out.position == 301 && a.out.buffer[0] == '<' && a.out.buffer[300] == '>');
+    
+    // Disabled streams are skipped; raw strings go out as one block
+    context.streams[0].enabled = false;
+    reset_test_ctx(&ctx);
+    reset_test_ctx(&a.out);
+    a.calls = 0;
+    u_context_output_broadcast_str(&context, "raw");
+    assert(ctx.position == 0);
+    assert(strcmp(a.out.buffer, "raw") == 0 && a.calls == 1);
+    
+    // Buffered streams hold output until flushed
+    char storage[64];
+    u_output_buffer_t ob;
+    u_output_buffer_init(&ob, storage, sizeof(storage), test_output_cb, &ctx);
+    context.streams[0].enabled = true;
+    context.streams[0].buffer = &ob;
+    reset_test_ctx(&ctx);
+    u_context_output_broadcast_printf(&context, "%s", "held");
+    u_context_output_broadcast(&context, '!');
+    assert(ctx.position == 0);
+    u_context_output_broadcast_flush(&context);
+    assert(strcmp(ctx.buffer, "held!") == 0);
+    
+    printf("✓ Broadcast tests passed\n");
+}
+
+static char pipeline_rot(char c, void* ctx) {
+    (void)ctx;
+    return c == 'X' ? 'Y' : c;
+}
+
+// Hooks see the sink's own ctx; a test_ctx_t here
+static void pipeline_count_hook(char c, void* ctx, void* user_data) {
+    (void)c;
+    assert(((test_ctx_t*)ctx)->max_size == 1024);
+    (*(int*)user_data)++;
+}
+
+static void pipeline_block_hook(const char* data, size_t len, void* ctx, void* user_data) {
+    (void)data;
+    assert(((test_ctx_t*)ctx)->max_size == 1024);
+    *(size_t*)user_data += len;
+}
+
+static void test_pipeline() {
+    u_context_t context;
+    u_context_init(&context);
+    test_ctx_t ctx;
+    
+    // Nothing registered: the caller's ctx reaches the sink
+    reset_test_ctx(&ctx);
+    assert(u_context_printf_ex(&context, test_output_cb, &ctx, "n=%d", 5) == 3);
+    assert(strcmp(ctx.buffer, "n=5") == 0);
+    
+    // Built-in processors
+    char text[64] = "Mixed Case 123 \xc3\xa9 abcdefghijklmnopqrstuvwxyz";
+    u_processor_upper(text, strlen(text), sizeof(text), NULL);
+    assert(strcmp(text, "MIXED CASE 123 \xc3\xa9 ABCDEFGHIJKLMNOPQRSTUVWXYZ") == 0);
+    u_processor_lower(text, strlen(text), sizeof(text), NULL);
+    assert(strcmp(text, "mixed case 123 \xc3\xa9 abcdefghijklmnopqrstuvwxyz") == 0);
+    
+    strcpy(text, "a\nb\n\n");
+    size_t len = u_processor_crlf(text, strlen(text), sizeof(text), NULL);
+    assert(len == 8 && memcmp(text, "a\r\nb\r\n\r\n", 8) == 0);
+    strcpy(text, "a\nb");
+    assert(u_processor_crlf(text, 4, 4, NULL) == 4 && memcmp(text, "a\r\nb", 4) == 0);
+    
+    u_ansi_strip_t ansi = {0};
+    strcpy(text, "\x1b[1;31mred\x1b[0m ok\x1b[3");
+    len = u_processor_strip_ansi(text, strlen(text), sizeof(text), &ansi);
+    assert(len == 6 && memcmp(text, "red ok", 6) == 0 && ansi.state == 2);
+    strcpy(text, "2mx");
+    assert(u_processor_strip_ansi(text, 3, sizeof(text), &ansi) == 1 && text[0] == 'x');
+    
+    assert(u_crc32_update(0, "123456789", 9) == 0xCBF43926u);
+    assert(u_crc32_update(u_crc32_update(0, "1234", 4), "56789", 5) == 0xCBF43926u);
+    
+    // Char and block stages run in registration order over whole spans
+    int chars = 0;
+    size_t bytes = 0;
+    uint32_t crc = 0;
+    u_context_add_block_processor(&context, u_processor_upper, NULL);
+    u_context_add_stream_processor(&context, pipeline_rot, NULL);
+    u_context_add_block_processor(&context, u_processor_crlf, NULL);
+    u_context_add_output_hook(&context, pipeline_count_hook, &chars);
+    u_context_add_block_hook(&context, pipeline_block_hook, &bytes);
+    u_context_add_block_hook(&context, u_hook_crc32, &crc);
+    reset_test_ctx(&ctx);
+    assert(u_context_printf_ex(&context, test_output_cb, &ctx, "x=%d\n", 7) == 4);
+    assert(strcmp(ctx.buffer, "Y=7\r\n") == 0);
+    assert(chars == 5 && bytes == 5);
+    assert(crc == u_crc32_update(0, "Y=7\r\n", 5));
+    
+    // Long output passes through in chunks
+    char big[300];
+    memset(big, 'q', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    reset_test_ctx(&ctx);
+    u_context_printf_ex(&context, test_output_cb, &ctx, "%s", big);
+    assert(ctx.position == 299 && ctx.buffer[298] == 'Q');
+    
+    // Growth carries across stages: a later processor still gets room to
+    // double, so chained expansions lose nothing
+    u_context_t grow;
+    u_context_init(&grow);
+    u_context_add_block_processor(&grow, u_processor_crlf, NULL);
+    u_context_add_block_processor(&grow, u_processor_crlf, NULL);
+    char lines[201];
+    memset(lines, '\n', 200);
+    lines[200] = '\0';
+    test_ctx_t wide;
+    reset_test_ctx(&wide);
+    u_context_printf_ex(&grow, test_output_cb, &wide, "%s", lines);
+    assert(wide.position == 600 && memcmp(wide.buffer + 594, "\r\r\n\r\r\n", 6) == 0);
+    
+    u_context_remove_block_processor(&context, u_processor_crlf);
+    u_context_remove_block_hook(&context, u_hook_crc32);
+    u_context_remove_output_hook(&context, pipeline_count_hook);
+    assert(context.processor_count == 2 && context.hook_count == 1);
+    reset_test_ctx(&ctx);
+    u_context_printf_ex(&context, test_output_cb, &ctx, "x\n");
+    assert(strcmp(ctx.buffer, "Y\n") == 0);
+    
+    // Staging buffers take the processed chunks as blocks
+    u_context_remove_block_hook(&context, pipeline_block_hook);
+    char storage[16];
+    u_output_buffer_t ob;
+    u_output_buffer_init(&ob, storage, sizeof(storage), test_output_cb, &ctx);
+    ob.auto_flush = false;
+    reset_test_ctx(&ctx);
+    u_context_printf_ex(&context, u_output_buffer_cb, &ob, "ab%s", "X");
+    assert(ctx.position == 0 && ob.pos == 3 && memcmp(storage, "ABY", 3) == 0);
+    u_flush(&ob);
+    assert(strcmp(ctx.buffer, "ABY") == 0);
+    
+    printf("✓ Pipeline tests passed\n");
+}
+
+#ifdef UPRINTF_ASYNC
+static void drain_wait(void* ctx) {
+    u_async_drain((u_async_ring_t*)ctx, 1);
+}
+
+static void stop_idle(void* ctx) {
+    atomic_store((atomic_bool*)ctx, true);
+}
+
+static void test_async_ring() {
+    test_ctx_t ctx;
+    u_async_slot_t slots[4];
+    u_async_ring_t ring;
+    u_context_t context;
+    u_context_init(&context);
+    u_output_stream_t stream = {test_output_cb, &ctx, true, NULL, NULL, 0};
+    u_context_output_add_stream(&context, stream);
+    
+    assert(u_async_init(&ring, slots, 3, &context, false) == -1);
+    assert(u_async_init(&ring, slots, 4, &context, false) == 0);
+    
+    // Nothing reaches the stream until the ring is drained
+    reset_test_ctx(&ctx);
+    assert(u_async_printf(&ring, "a%d,", 1) == 3);
+    u_async_printf(&ring, "b%s,", "2");
+    assert(ctx.position == 0);
+    assert(u_async_drain(&ring, 1) == 1);
+    assert(strcmp(ctx.buffer, "a1,") == 0);
+    assert(u_async_drain(&ring, 0) == 1);
+    assert(strcmp(ctx.buffer, "a1,b2,") == 0);
+    assert(u_async_drain(&ring, 0) == 0);
+    
+    // Non-blocking: a full ring drops and counts
+    reset_test_ctx(&ctx);
+    for (int i = 0; i < 6; i++) {
+        u_async_printf(&ring, "%d", i);
+    }
+    assert(u_async_dropped(&ring) == 2);
+    assert(u_async_drain(&ring, 0) == 4);
+    assert(strcmp(ctx.buffer, "0123") == 0);
+    
+    // Long messages are cut to the slot and counted
+    char long_text[UPRINTF_ASYNC_MESSAGE_SIZE + 8];
+    memset(long_text, 'x', sizeof(long_text) - 1);
+    long_text[sizeof(long_text) - 1] = '\0';
+    assert(u_async_printf(&ring, "%s", long_text) == UPRINTF_ASYNC_MESSAGE_SIZE);
+    assert(u_async_overruns(&ring) == 1);
+    u_async_drain(&ring, 0);
+    
+    // Blocking: the wait callback makes room instead of dropping
+    reset_test_ctx(&ctx);
+    assert(u_async_init(&ring, slots, 4, &context, true) == 0);
+    u_async_set_wait(&ring, drain_wait, &ring);
+    for (int i = 0; i < 6; i++) {
+        u_async_printf(&ring, "%d", i);
+    }
+    assert(u_async_dropped(&ring) == 0);
+    u_async_drain(&ring, 0);
+    assert(strcmp(ctx.buffer, "012345") == 0);
+    
+    // The consumer loop drains until stopped, then once more
+    reset_test_ctx(&ctx);
+    atomic_bool stop;
+    atomic_init(&stop, false);
+    u_async_printf(&ring, "x");
+    u_async_printf(&ring, "y");
+    u_async_run(&ring, &stop, stop_idle, &stop);
+    assert(strcmp(ctx.buffer, "xy") == 0);
+    u_async_printf(&ring, "z");
+    u_async_run(&ring, &stop, NULL, NULL);
+    assert(strcmp(ctx.buffer, "xyz") == 0);
+    
+    printf("✓ Async ring tests passed\n");
+}
+#endif
+
+// Span output test
+typedef struct {
+    char buffer[256];
+    size_t position;
+    int calls;
+} span_ctx_t;
+
+static void test_span_cb(const char* data, size_t len, void* ctx) {
+    span_ctx_t* context = (span_ctx_t*)ctx;
+    memcpy(context->buffer + context->position, data, len);
+    context->position += len;
+    context->buffer[context->position] = '\0';
+    context->calls++;
+}
+
+static void test_span_output() {
+    span_ctx_t ctx = {{0}, 0, 0};
+    
+    int len = u_printf_span(test_span_cb, &ctx, "Value: %5d|%-4s|", 42, "ab");
+    assert(strcmp(ctx.buffer, "Value:    42|ab  |") == 0);
+    assert(len == 18);
+    // "Value: ", padding, "42", "|", "ab", padding, "|"
+    assert(ctx.calls == 7);
+    
+    printf("✓ Span output tests passed\n");
+}
+
+// Staged output buffer test
+static void test_output_buffer() {
+    span_ctx_t sink = {{0}, 0, 0};
+    char storage[16];
+    u_output_buffer_t ob;
+    
+    // One flush at the end of the call
+    u_output_buffer_init_span(&ob, storage, sizeof(storage), test_span_cb, &sink);
+    u_printf(u_output_buffer_cb, &ob, "%d-%s", 7, "ok");
+    assert(strcmp(sink.buffer, "7-ok") == 0);
+    assert(sink.calls == 1);
+    
+    // Flush when the storage fills, keep the rest until u_flush()
+    sink.position = 0;
+    sink.calls = 0;
+    ob.auto_flush = false;
+    u_printf(u_output_buffer_cb, &ob, "0123456789%s", "abcdefghij");
+    assert(sink.calls == 1);
+    u_flush(&ob);
+    assert(strcmp(sink.buffer, "0123456789abcdefghij") == 0);
+    assert(sink.calls == 2);
+    
+    // Default output staging with a per-character sink
+    test_ctx_t ctx;
+    reset_test_ctx(&ctx);
+    u_set_default_output(test_output_cb, &ctx);
+    u_set_default_output_buffer(storage, sizeof(storage));
+    u_printf_simple("Staged %d", 1);
+    assert(strcmp(ctx.buffer, "Staged 1") == 0);
+    u_set_default_output_buffer(NULL, 0);
+    u_set_default_output(NULL, NULL);
+    
+    printf("✓ Output buffer tests passed\n");
+}
+
+// C99 bounded formatting tests
+static int test_vsnprintf_wrapper(char* buffer, size_t size, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_vsnprintf(buffer, size, fmt, args);
+    va_end(args);
+    return result;
+}
+
+static void test_vsnprintf() {
+    char buffer[16];
+    
+    // Truncated output reports the full length
+    int len = test_vsnprintf_wrapper(buffer, 10, "Hello, %s!", "World");
+    assert(strcmp(buffer, "Hello, Wo") == 0);
+    assert(len == 13);
+    
+    // Measuring mode
+    len = test_vsnprintf_wrapper(NULL, 0, "%d-%5s", 123, "ab");
+    assert(len == 9);
+    
+    // Exact fit
+    len = test_vsnprintf_wrapper(buffer, 4, "%x", 0xabc);
+    assert(strcmp(buffer, "abc") == 0);
+    assert(len == 3);
+    
+    printf("✓ C99 vsnprintf tests passed\n");
+}
+
+// Compiled format tests
+static void test_format_compile() {
+    test_ctx_t ctx;
+    char storage[512];
+    const char* fmt = "x=%d y=%-5s|%#06x|%*d|100%%|%c";
+    
+    size_t needed = u_format_compile_size(fmt);
+    assert(needed > 0 && needed <= sizeof(storage));
+    assert(u_format_compile(fmt, storage, needed - 1) == NULL);
+    
+    u_format_compiled_t* compiled = u_format_compile(fmt, storage, sizeof(storage));
+    assert(compiled != NULL);
+    
+    // Rendering many times gives the same result as the interpreted path
+    for (int i = 0; i < 3; i++) {
+        reset_test_ctx(&ctx);
+        u_printf_compiled(test_output_cb, &ctx, compiled, -42 + i, "ab", 0xab, 4, 7, 'z');
+        char expected[64];
+        u_sprintf(expected, fmt, -42 + i, "ab", 0xab, 4, 7, 'z');
+        assert(strcmp(ctx.buffer, expected) == 0);
+    }
+    assert(strcmp(ctx.buffer, "x=-40 y=ab   |0x00ab|   7|100%|z") == 0);
+    
+    // Invalid formats are rejected up front
+    assert(u_format_compile_size("%q") == 0);
+    assert(u_format_compile_size("trailing %5") == 0);
+    assert(u_format_compile_size("%Ld") == 0);
+    assert(u_format_compile(NULL, storage, sizeof(storage)) == NULL);
+    
+    printf("✓ Compiled format tests passed\n");
+}
+
+// Checked call-site macro tests
+static void test_checked_macros() {
+    test_ctx_t ctx;
+    reset_test_ctx(&ctx);
+    
+    // The cached call site renders the same way on every pass
+    for (int i = 0; i < 3; i++) {
+        U_PRINTF(test_output_cb, &ctx, "[%d:%s]", 5 + i, "ok");
+    }
+    assert(strcmp(ctx.buffer, "[5:ok][6:ok][7:ok]") == 0);
+    
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+    // A mismatched call site is rejected before any argument is fetched
+    reset_test_ctx(&ctx);
+    U_PRINTF(test_output_cb, &ctx, "%s", 42);
+    U_PRINTF(test_output_cb, &ctx, "%d %d", 1);
+    assert(ctx.position == 0 && test_mismatches == 2);
+    
+    reset_test_ctx(&ctx);
+    long big = 1L << 20;
+    U_PRINTF(test_output_cb, &ctx, "%ld %.2f %p", big, 1.5f, (void*)0);
+    assert(strncmp(ctx.buffer, "1048576 1.50 0x", 15) == 0);
+#endif
+    
+    const unsigned char tags[] = {U_ARG_INT, U_ARG_STR, U_ARG_DOUBLE};
+    
+    // A site another thread is still compiling is checked and interpreted
+    u_format_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    cache.state = 2;
+    reset_test_ctx(&ctx);
+    assert(u_printf_cached(&cache, tags, 2, test_output_cb, &ctx, "%d:%s", 3, "x") == 3);
+    assert(u_printf_cached(&cache, tags, 2, test_output_cb, &ctx, "%s", "x") == -1);
+    assert(strcmp(ctx.buffer, "3:x") == 0 && cache.state == 2 && !cache.compiled);
+    
+    assert(u_format_check("%*s %f", tags, 3) == 0);
+    assert(u_format_check("%d %s %f", tags, 3) == 0);
+    assert(u_format_check("%s %d %f", tags, 3) == -1);
+    assert(u_format_check("%d %s", tags, 3) == -1);
+    assert(u_format_check("%d %s %Lf", tags, 3) == -1);
+    assert(u_format_check("100%% %d", tags, 1) == 0);
+    
+    printf("✓ Checked macro tests passed\n");
+}
+
+// String builder tests
+static void test_templates() {
+    test_ctx_t ctx;
+    u_template_var_t vars[] = {{"name", "World"}, {"n", "3"}, {"unused", "x"}};
+    
+    reset_test_ctx(&ctx);
+    u_template_format(test_output_cb, &ctx, "Hello {{name}}, {{n}} {{missing}}new{ {{name}}", vars, 3);
+    assert(strcmp(ctx.buffer, "Hello World, 3 new{ World") == 0);
+    
+    // Pre-parsed named templates render the same text
+    u_template_load("greet", "Hello {{name}}, {{n}} {{missing}}new{ {{name}}");
+    u_template_load("open", "a{{n}}b{{name");
+    reset_test_ctx(&ctx);
+    u_template_format_named(test_output_cb, &ctx, "greet", vars, 3);
+    assert(strcmp(ctx.buffer, "Hello World, 3 new{ World") == 0);
+    reset_test_ctx(&ctx);
+    u_template_format_named(test_output_cb, &ctx, "open", vars, 3);
+    assert(strcmp(ctx.buffer, "a3b") == 0);
+    reset_test_ctx(&ctx);
+    u_template_format_named(test_output_cb, &ctx, "nope", vars, 3);
+    assert(strcmp(ctx.buffer, "[Template 'nope' not found]") == 0);
+    
+    // Binding by slot index
+    int id = u_template_find("greet");
+    assert(id >= 0 && u_template_find("nope") == -1);
+    const char* values[3] = {NULL, NULL, NULL};
+    values[u_template_slot(id, "name")] = "you";
+    values[u_template_slot(id, "n")] = "7";
+    assert(u_template_slot(id, "unused") == -1);
+    reset_test_ctx(&ctx);
+    u_template_render(test_output_cb, &ctx, id, values, 3);
+    assert(strcmp(ctx.buffer, "Hello you, 7 new{ you") == 0);
+    
+    // Reloading a name replaces its text
+    u_template_load("greet", "Bye {{name}}");
+    assert(u_template_find("greet") == id);
+    reset_test_ctx(&ctx);
+    u_template_format_named(test_output_cb, &ctx, "greet", vars, 3);
+    assert(strcmp(ctx.buffer, "Bye World") == 0);
+    
+    printf("✓ Template tests passed\n");
+}
+
+// Concatenate a segment list
+static void iov_join(const u_iov_list_t* list, char* out) {
+    size_t pos = 0;
+    for (int i = 0; i < list->count; i++) {
+        memcpy(out + pos, list->iov[i].base, list->iov[i].len);
+        pos += list->iov[i].len;
+    }
+    out[pos] = '\0';
+    assert(pos == list->total);
+}
+
+static bool iov_points_at(const u_iov_list_t* list, const void* ptr) {
+    for (int i = 0; i < list->count; i++) {
+        if (list->iov[i].base == ptr) return true;
+    }
+    return false;
+}
+
+static void test_iov_output() {
+    u_iovec_t iov[8];
+    char scratch[32];
+    char out[256];
+    u_iov_list_t list;
+    u_iov_init(&list, iov, 8, scratch, sizeof(scratch));
+    
+    // Long literals and strings are referenced, numbers land in scratch
+    const char* fmt = "GET /index.html HTTP/1.1\r\nContent-Length: %d\r\nServer: %s%8s";
+    const char* server = "uprintf-test-server";
+    int n = u_iov_printf(&list, fmt, 1234, server, "x");
+    assert(n == (int)list.total);
+    iov_join(&list, out);
+    assert(strcmp(out, "GET /index.html HTTP/1.1\r\nContent-Length: 1234\r\nServer: "
+                       "uprintf-test-server       x") == 0);
+    assert(list.iov[0].base == fmt);
+    assert(iov_points_at(&list, server));
+    assert(list.scratch_used < 16);
+    
+    // A call that does not fit leaves the list untouched
+    int count = list.count;
+    size_t total = list.total;
+    assert(u_iov_printf(&list, "%s%s%s%s%s%s%s", server, server, server, server, server,
+                        server, server) == -1);
+    assert(list.count == count && list.total == total);
+    
+    // Padding references constant runs, so any width fits the scratch area
+    u_iov_reset(&list);
+    assert(u_iov_printf(&list, "[%100d]", -42) == 102);
+    iov_join(&list, out);
+    char expect[256];
+    snprintf(expect, sizeof(expect), "[%100d]", -42);
+    assert(strcmp(out, expect) == 0);
+    assert(list.scratch_used < 16);
+    u_iov_reset(&list);
+    assert(u_iov_printf(&list, "%-70s|%050d", "ab", 7) == 121);
+    iov_join(&list, out);
+    snprintf(expect, sizeof(expect), "%-70s|%050d", "ab", 7);
+    assert(strcmp(out, expect) == 0);
+    
+    // Templates render as spans of the template text and the values
+    u_iov_reset(&list);
+    u_template_load("iov", "HTTP/1.1 {{status}} {{reason}}\r\n");
+    u_template_var_t vars[] = {{"status", "200"}, {"reason", "OK but longer"}};
+    assert(u_iov_template_format_named(&list, "iov", vars, 2) == 28);
+    iov_join(&list, out);
+    assert(strcmp(out, "HTTP/1.1 200 OK but longer\r\n") == 0);
+    assert(iov_points_at(&list, vars[1].value));
+    assert(u_iov_template_format_named(&list, "missing", vars, 2) == -1);
+    
+    printf("✓ Scatter/gather tests passed\n");
+}
+
+static void test_text_layout() {
+    test_ctx_t ctx;
+    
+    reset_test_ctx(&ctx);
+    u_text_wrap(test_output_cb, &ctx, "The quick brown fox jumps over", 10, "> ");
+    assert(strcmp(ctx.buffer, "> The quick\n> brown fox\n> jumps over") == 0);
+    
+    // Long words are split; '\n' ends a paragraph
+    reset_test_ctx(&ctx);
+    u_text_wrap(test_output_cb, &ctx, "abcdefghijk lm\n\nno", 5, NULL);
+    assert(strcmp(ctx.buffer, "abcde\nfghij\nk lm\n\nno") == 0);
+    
+    // Justified paragraph, last line ragged, transform applied to the text only
+    test_block_t block;
+    reset_test_ctx(&block.out);
+    block.calls = 0;
+    u_text_layout_t layout = {12, U_ALIGN_JUSTIFY, U_TRANSFORM_CAPITALIZE, "| ", '.', false};
+    u_text_layout_span(test_block_cb, &block, "a bb ccc dd e f g", &layout);
+    assert(strcmp(block.out.buffer, "| A..Bb.Ccc.Dd\n| E F G") == 0);
+    assert(block.calls == 2); // One span per line
+    
+    layout.align = U_ALIGN_CENTER;
+    layout.transform = U_TRANSFORM_UPPERCASE;
+    layout.pad = true;
+    layout.prefix = NULL;
+    layout.width = 7;
+    reset_test_ctx(&ctx);
+    u_text_layout(test_output_cb, &ctx, "up and away", &layout);
+    assert(strcmp(ctx.buffer, "UP AND.\n.AWAY..") == 0);
+    
+    // Single-line alignment and fill
+    reset_test_ctx(&ctx);
+    u_text_align(test_output_cb, &ctx, "Text", 10, U_ALIGN_CENTER);
+    assert(strcmp(ctx.buffer, "   Text   ") == 0);
+    reset_test_ctx(&ctx);
+    u_text_align(test_output_cb, &ctx, "a b c", 9, U_ALIGN_JUSTIFY);
+    assert(strcmp(ctx.buffer, "a   b   c") == 0);
+    reset_test_ctx(&ctx);
+    u_format_fill(test_output_cb, &ctx, "ab cd", 8, U_ALIGN_JUSTIFY, '-');
+    assert(strcmp(ctx.buffer, "ab----cd") == 0);
+    reset_test_ctx(&ctx);
+    u_format_fill(test_output_cb, &ctx, "abc", 6, U_ALIGN_RIGHT, '*');
+    assert(strcmp(ctx.buffer, "***abc") == 0);
+    
+    // Transforms stream past any staging size
+    static char big[1000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[0] = 'a';
+    big[sizeof(big) - 1] = '\0';
+    reset_test_ctx(&ctx);
+    u_text_transform(test_output_cb, &ctx, big, U_TRANSFORM_UPPERCASE);
+    assert(ctx.position == 999 && ctx.buffer[0] == 'A' && ctx.buffer[998] == 'X');
+    reset_test_ctx(&ctx);
+    u_text_transform(test_output_cb, &ctx, big, U_TRANSFORM_REVERSE);
+    assert(ctx.position == 999 && ctx.buffer[0] == 'x' && ctx.buffer[998] == 'a');
+    reset_test_ctx(&ctx);
+    u_text_transform(test_output_cb, &ctx, "hello big world", U_TRANSFORM_CAPITALIZE);
+    assert(strcmp(ctx.buffer, "Hello Big World") == 0);
+    
+    printf("✓ Text layout tests passed\n");
+}
+
+// Recursive matcher, as the reference
+static bool ref_match(const char* str, const char* pattern) {
+    while (*pattern) {
+        if (*pattern == '*') {
+            pattern++;
+            for (; *str; str++) {
+                if (ref_match(str, pattern)) return true;
+            }
+            while (*pattern == '*') pattern++;
+            return !*pattern;
+        }
+        if (!*str || (*pattern != '?' && *pattern != *str)) return false;
+        pattern++;
+        str++;
+    }
+    return !*str;
+}
+
+static void test_replace_match() {
+    char* r = u_str_replace("a-b-c", "-", "::");
+    assert(strcmp(r, "a::b::c") == 0);
+    free(r);
+    
+    // Shorter replacement, removal, empty find, overlapping candidates
+    r = u_str_replace("xxabcxxabc", "abc", "Z");
+    assert(strcmp(r, "xxZxxZ") == 0);
+    free(r);
+    r = u_str_replace("a, b, c", ", ", NULL);
+    assert(strcmp(r, "abc") == 0);
+    free(r);
+    r = u_str_replace("same", "", "x");
+    assert(strcmp(r, "same") == 0);
+    free(r);
+    r = u_str_replace("aaaaa", "aa", "b");
+    assert(strcmp(r, "bba") == 0);
+    free(r);
+    
+    // Caller buffer: truncated but terminated, full length reported
+    char buf[8];
+    assert(u_str_replace_buffer(buf, sizeof(buf), "one two", "o", "00") == 9);
+    assert(strcmp(buf, "00ne tw") == 0);
+    assert(u_str_replace_buffer(NULL, 0, "one two", "o", "00") == 9);
+    
+    // Long needles take the Horspool path; check against a naive loop
+    static char big[20000];
+    const char* needle = "needle-in-the-haystack";
+    for (int i = 0; i < 19999; i++) big[i] = "needl-in-the-haystack"[i % 21];
+    big[19999] = '\0';
+    memcpy(big + 5000, needle, strlen(needle));
+    memcpy(big + 19999 - strlen(needle), needle, strlen(needle));
+    u_string_builder_t sb = u_string_builder_create(16);
+    u_string_builder_append_replace(&sb, big, needle, "<N>");
+    assert(sb.pos == 19999 - 2 * (strlen(needle) - 3));
+    assert(memcmp(sb.buffer + 5000, "<N>", 3) == 0);
+    assert(strcmp(sb.buffer + sb.pos - 3, "<N>") == 0);
+    u_string_builder_free(&sb);
+    
+    // Glob matching agrees with the recursive reference
+    const char* strs[] = {"", "a", "ab", "abc", "aXbXc", "hello.c", "abcabc", "aaab"};
+    const char* pats[] = {"", "*", "?", "a*", "*c", "a*c", "a?c", "*b*", "**", "a*b*c",
+                          "*.c", "h*o.?", "abc*abc", "*a*a*b", "???", "a*?*c", "*x*", "a**"};
+    for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        for (size_t j = 0; j < sizeof(pats) / sizeof(pats[0]); j++) {
+            assert(u_str_match_pattern(strs[i], pats[j]) == ref_match(strs[i], pats[j]));
+        }
+    }
+    
+    // Adversarial pattern on a long subject: no blow-up
+    memset(big, 'a', 5000);
+    big[5000] = '\0';
+    u_pattern_t p;
+    u_pattern_compile(&p, "*a*a*a*a*a*a*a*a*a*a*b");
+    assert(!u_pattern_match(&p, big));
+    big[4999] = 'b';
+    assert(u_pattern_match(&p, big));
+    
+    // Spans of a larger text
+    u_pattern_compile(&p, "a*b");
+    assert(u_pattern_match_n(&p, "aab--", 3));
+    assert(!u_pattern_match_n(&p, "aab--", 4));
+    
+    printf("✓ Replace and match tests passed\n");
+}
+
+static int pack_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                        const char** fmt, int width, int precision, unsigned int flags) {
+    (void)fmt; (void)width; (void)precision; (void)flags;
+    int value = va_arg(*args, int);
+    output_cb((char)('0' + value), ctx);
+    return 1;
+}
+
+static void test_arg_pack() {
+    test_ctx_t ctx;
+    char buf[64];
+    
+    // Values are taken in order, whatever the length modifier
+    u_arg_t mixed[] = {u_arg_int(42), u_arg_str("ok"), u_arg_double(3.5), u_arg_uint(255)};
+    assert(u_snprintf_args(buf, sizeof(buf), "%d %s %.1f %#x", mixed, 4) == 14);
+    assert(strcmp(buf, "42 ok 3.5 0xff") == 0);
+    
+    // Integers are narrowed the way va_arg would read them
+    u_arg_t narrow[] = {u_arg_int(300), u_arg_int(-1), u_arg_int(-1), u_arg_int(-9000000000LL),
+                        u_arg_uint(0xDEADBEEFCAFEULL)};
+    u_snprintf_args(buf, sizeof(buf), "%hhd %hu %u %lld %llx", narrow, 5);
+    assert(strcmp(buf, "44 65535 4294967295 -9000000000 deadbeefcafe") == 0);
+    
+    // '*' values come from the pack too
+    u_arg_t star[] = {u_arg_int(5), u_arg_int(42), u_arg_int(-4), u_arg_str("ab"),
+                      u_arg_int(2), u_arg_str("xyz")};
+    u_snprintf_args(buf, sizeof(buf), "%*d|%*s|%.*s", star, 6);
+    assert(strcmp(buf, "   42|ab  |xy") == 0);
+    
+    // Characters, pointers, NULL strings and literals
+    int marker = 0;
+    u_arg_t misc[] = {u_arg_int('Z'), u_arg_str(NULL), u_arg_ptr(NULL), u_arg_ptr(&marker)};
+    u_snprintf_args(buf, sizeof(buf), "%c%s%%%p%n", misc, 4);
+    assert(strcmp(buf, "Z(null)%0x0") == 0);
+    
+    // Missing values and wrong kinds are errors
+    assert(u_snprintf_args(buf, sizeof(buf), "%d %d", mixed, 1) == -1);
+    assert(u_snprintf_args(buf, sizeof(buf), "%d", mixed + 1, 1) == -1);
+    assert(u_snprintf_args(buf, sizeof(buf), "%s", mixed, 1) == -1);
+    assert(u_snprintf_args(buf, sizeof(buf), "plain", NULL, 0) == 5);
+    
+    // Measuring and truncation follow u_vsnprintf
+    assert(u_snprintf_args(NULL, 0, "%d-%s", mixed, 2) == 5);
+    assert(u_snprintf_args(buf, 4, "%d-%s", mixed, 2) == 5 && strcmp(buf, "42-") == 0);
+    
+    // A pack is only read, so it renders the same every time
+    for (int i = 0; i < 2; i++) {
+        reset_test_ctx(&ctx);
+        u_arg_t again[] = {mixed[1], mixed[0]};
+        assert(u_printf_args(test_output_cb, &ctx, "[%s:%d]", again, 2) == 7);
+        assert(strcmp(ctx.buffer, "[ok:42]") == 0);
+    }
+    
+    // Output buffers are filled in spans
+    char storage[32];
+    u_output_buffer_t ob;
+    reset_test_ctx(&ctx);
+    u_output_buffer_init(&ob, storage, sizeof(storage), test_output_cb, &ctx);
+    u_printf_args(u_output_buffer_cb, &ob, "<%s>", mixed + 1, 1);
+    assert(strcmp(ctx.buffer, "<ok>") == 0);
+    assert(u_printf_args(u_output_buffer_cb, NULL, "<%s>", mixed + 1, 1) == 4);
+    
+    // Custom handlers get the value through an argument list
+    u_arg_t digit[] = {u_arg_int(7)};
+    u_register_format_handler('K', pack_handler);
+    u_snprintf_args(buf, sizeof(buf), "%K!", digit, 1);
+    assert(strcmp(buf, "7!") == 0);
+    u_unregister_format_handler('K');
+    
+    // One pack, every stream
+    test_block_t a, b;
+    reset_test_ctx(&a.out);
+    reset_test_ctx(&b.out);
+    a.calls = b.calls = 0;
+    u_context_t context;
+    u_context_init(&context);
+    u_output_stream_t sa = {NULL, &a, true, test_block_cb, NULL, 0};
+    u_output_stream_t sb = {NULL, &b, true, test_block_cb, NULL, 0};
+    u_context_output_add_stream(&context, sa);
+    u_context_output_add_stream(&context, sb);
+    assert(u_context_output_broadcast_args(&context, "x=%d", mixed, 1) == 4);
+    assert(strcmp(a.out.buffer, "x=42") == 0 && a.calls == 1);
+    assert(strcmp(b.out.buffer, "x=42") == 0 && b.calls == 1);
+    
+    printf("✓ Argument pack tests passed\n");
+}
+
+// Prints 'y' if it receives the long double exactly
+static long double test_ldouble;
+
+static int ldouble_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                           const char** fmt, int width, int precision, unsigned int flags) {
+    (void)fmt; (void)width; (void)precision; (void)flags;
+    output_cb(va_arg(*args, long double) == test_ldouble ? 'y' : 'n', ctx);
+    return 1;
+}
+
+static void test_positional() {
+    char buf[128];
+    
+    // Any order, with reuse; each argument is read from the va_list once
+    u_snprintf(buf, sizeof(buf), "%2$s %1$d %2$s", 7, "dwarfs");
+    assert(strcmp(buf, "dwarfs 7 dwarfs") == 0);
+    u_snprintf(buf, sizeof(buf), "%3$.2f|%1$lld|%2$c|%4$#x", -9000000000LL, 'q', 2.5, 255u);
+    assert(strcmp(buf, "2.50|-9000000000|q|0xff") == 0);
+    
+    // Numbered '*' values, flags and literals before the first conversion
+    u_snprintf(buf, sizeof(buf), "[%2$*1$d|%3$-*1$s|%3$.*4$s]", 5, 42, "abc", 2);
+    assert(strcmp(buf, "[   42|abc  |ab]") == 0);
+    u_snprintf(buf, sizeof(buf), "v%1$05d %%", 42);
+    assert(strcmp(buf, "v00042 %") == 0);
+    
+    // Lengths narrow as usual and unsigned reuse of a signed argument is fine
+    u_snprintf(buf, sizeof(buf), "%1$hhd %1$hhu %2$zu", 300, (size_t)12);
+    assert(strcmp(buf, "44 44 12") == 0);
+    
+    // Long doubles keep their type through the pack
+    u_snprintf(buf, sizeof(buf), "%2$.3Lf|%1$d|%2$Le", 3, 0.125L);
+    assert(strcmp(buf, "0.125|3|1.250000e-01") == 0);
+    test_ldouble = 1.0L + 1.0L / (1ULL << 60);
+    u_arg_t wide[] = {u_arg_ldouble(test_ldouble)};
+    u_register_format_handler('W', ldouble_handler);
+    u_snprintf_args(buf, sizeof(buf), "%W", wide, 1);
+    assert(strcmp(buf, "y") == 0);
+    u_snprintf_args(buf, sizeof(buf), "%.1Lf", wide, 1);
+    assert(strcmp(buf, "1.0") == 0);
+    u_unregister_format_handler('W');
+    
+    // Mixing, gaps, conflicting uses and too many positions are errors,
+    // also for plain u_snprintf and for sequential conversions first
+    assert(u_snprintf(buf, sizeof(buf), "%d %1$d", 1, 2) == -1);
+    assert(u_snprintf(buf, sizeof(buf), "%2$d", 1, 2) == -1);
+    assert(test_vsnprintf_wrapper(buf, sizeof(buf), "%d %1$d", 1, 2) < 0);
+    assert(test_vsnprintf_wrapper(buf, sizeof(buf), "%1$d %d", 1, 2) < 0);
+    assert(test_vsnprintf_wrapper(buf, sizeof(buf), "%2$d", 1, 2) < 0);
+    assert(test_vsnprintf_wrapper(buf, sizeof(buf), "%1$d %1$s", 1, 2) < 0);
+    assert(test_vsnprintf_wrapper(buf, sizeof(buf), "%17$d", 1) < 0);
+    
+    // Typed packs index directly and can pick any value
+    u_arg_t args[] = {u_arg_str("world"), u_arg_str("hello")};
+    assert(u_snprintf_args(buf, sizeof(buf), "%2$s, %1$s! %2$s", args, 2) == 19);
+    assert(strcmp(buf, "hello, world! hello") == 0);
+    assert(u_snprintf_args(buf, sizeof(buf), "%s %1$s", args, 2) == -1);
+    assert(u_snprintf_args(buf, sizeof(buf), "%1$*d", args, 2) == -1);
+    
+    // Compiled formats take arguments in order only; checked call sites
+    // fall back to the interpreter for positional formats
+    char storage[128];
+    assert(u_format_compile("%1$d", storage, sizeof(storage)) == NULL);
+    test_ctx_t ctx;
+    reset_test_ctx(&ctx);
+    U_PRINTF(test_output_cb, &ctx, "%2$s-%1$d", 1, "a");
+    assert(strcmp(ctx.buffer, "a-1") == 0);
+    
+    printf("✓ Positional argument tests passed\n");
+}
+
+typedef struct {
+    const char* data;
+    size_t pos;
+    size_t limit;   // Bytes per read, to force several chunks
+    int reads;
+} test_reader_t;
+
+static size_t test_read(char* buffer, size_t capacity, void* ctx) {
+    test_reader_t* reader = (test_reader_t*)ctx;
+    size_t left = strlen(reader->data + reader->pos);
+    size_t n = capacity < reader->limit ? capacity : reader->limit;
+    if (n > left) n = left;
+    memcpy(buffer, reader->data + reader->pos, n);
+    reader->pos += n;
+    reader->reads++;
+    return n;
+}
+
+static void test_source_output() {
+    test_ctx_t ctx;
+    char buf[64];
+    test_reader_t reader = {"streamed payload", 0, 5, 0};
+    u_source_t src = {test_read, &reader, 16};
+    
+    // Padding comes from the declared length; content arrives in chunks
+    reset_test_ctx(&ctx);
+    assert(u_printf(test_output_cb, &ctx, "[%20S]", &src) == 22);
+    assert(strcmp(ctx.buffer, "[    streamed payload]") == 0);
+    assert(reader.reads == 4);
+    
+    // Precision stops reading early; buffers are read into directly
+    reader.pos = 0;
+    reader.reads = 0;
+    assert(u_snprintf(buf, sizeof(buf), "%-10.8S|", &src) == 11);
+    assert(strcmp(buf, "streamed  |") == 0);
+    assert(reader.reads == 2);
+    
+    // Past the end of a bounded buffer the rest is counted, not read
+    reader.pos = 0;
+    reader.reads = 0;
+    assert(test_vsnprintf_wrapper(buf, 6, "%S", &src) == 16);
+    assert(strcmp(buf, "strea") == 0 && reader.reads == 1);
+    
+    // A source that ends early stops the value; NULL prints nothing
+    test_reader_t short_reader = {"abc", 0, 64, 0};
+    u_source_t short_src = {test_read, &short_reader, 10};
+    u_snprintf(buf, sizeof(buf), "<%S><%S>", &short_src, (u_source_t*)NULL);
+    assert(strcmp(buf, "<abc><>") == 0);
+    
+    // Typed packs take the source as a pointer
+    reader.pos = 0;
+    u_arg_t args[] = {u_arg_ptr(&src)};
+    u_snprintf_args(buf, sizeof(buf), "%.6S", args, 1);
+    assert(strcmp(buf, "stream") == 0);
+    
+    printf("✓ Source output tests passed\n");
+}
+
+static void test_encoders() {
+    test_ctx_t ctx;
+    char buf[512];
+    unsigned char pkt[40];
+    for (int i = 0; i < 40; i++) pkt[i] = (unsigned char)(i * 7 + 30);
+    u_register_format_handler('H', u_hex_handler);
+    u_register_format_handler('B', u_base64_handler);
+    u_register_format_handler('Q', u_escape_handler);
+    
+    // Hex digits with optional grouping
+    u_snprintf(buf, sizeof(buf), "[%.*H] [%4.*H] [%.0H]", 5, pkt, 6, pkt, pkt);
+    assert(strcmp(buf, "[1e252c333a] [1e252c33 3a41] []") == 0);
+    
+    // Dump lines: offset, grouped bytes, aligned ASCII column
+    assert(u_snprintf(buf, sizeof(buf), "%#.*H", 20, pkt) == 2 * 78 - 12);
+    assert(strcmp(buf,
+        "00000000  1e 25 2c 33 3a 41 48 4f 56 5d 64 6b 72 79 80 87  |.%,3:AHOV]dkry..|\n"
+        "00000010  8e 95 9c a3                                      |....|\n") == 0);
+    u_snprintf(buf, sizeof(buf), "%#4.*H", 4, pkt);
+    assert(strcmp(buf, "00000000  1e252c33                             |.%,3|\n") == 0);
+    
+    // Base64, padded and URL-safe; long inputs span several chunks
+    u_snprintf(buf, sizeof(buf), "%s|%.*B|%#.*B|%B|%-6B|", "x", 5, "hello", 5, "hello", "fo", "a");
+    assert(strcmp(buf, "x|aGVsbG8=|aGVsbG8|Zm8=|YQ==  |") == 0);
+    const char* text = "Many hands make light work. Many hands make light work. Many hands?";
+    u_snprintf(buf, sizeof(buf), "%B", text);
+    assert(strcmp(buf, "TWFueSBoYW5kcyBtYWtlIGxpZ2h0IHdvcmsuIE1hbnkgaGFuZHMgbWFrZSBsaWdodCB3"
+                       "b3JrLiBNYW55IGhhbmRzPw==") == 0);
+    
+    // C escapes: short forms, bounded octal, padding from the escaped length
+    u_snprintf(buf, sizeof(buf), "[%Q] [%.*Q] [%8Q]", "a\"b\\c\n\t\001" "9\x80", 3, "x\ny", "a\n");
+    assert(strcmp(buf, "[a\\\"b\\\\c\\n\\t\\0019\\200] [x\\ny] [     a\\n]") == 0);
+    u_snprintf(buf, sizeof(buf), "%Q", "\r\n\x7f");
+    assert(strcmp(buf, "\\r\\n\\177") == 0);
+    
+    // Long runs of escapes are batched; per-character sinks see the same text
+    char ctrl[41];
+    memset(ctrl, 1, 40);
+    ctrl[40] = '\0';
+    assert(u_snprintf(buf, sizeof(buf), "%Q", ctrl) == 160);
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "%Q|%.*H|%B", ctrl, 2, pkt, "hi");
+    assert(ctx.position == 160 + 1 + 4 + 1 + 4 && strncmp(buf, ctx.buffer, 160) == 0);
+    assert(strcmp(ctx.buffer + 160, "|1e25|aGk=") == 0);
+    
+    // Missing data prints like %s does
+    u_snprintf(buf, sizeof(buf), "%H%B%Q", (void*)NULL, (void*)NULL, (void*)NULL);
+    assert(strcmp(buf, "(null)(null)(null)") == 0);
+    
+    u_unregister_format_handler('H');
+    u_unregister_format_handler('B');
+    u_unregister_format_handler('Q');
+    printf("✓ Encoder handler tests passed\n");
+}
+
+static void test_timestamps() {
+    test_ctx_t ctx;
+    char buf[256];
+    u_register_format_handler('T', u_time_handler);
+    u_register_format_handler('D', u_duration_handler);
+    
+    // Epoch nanoseconds, millisecond fraction by default
+    u_snprintf(buf, sizeof(buf), "%T", 0LL);
+    assert(strcmp(buf, "1970-01-01T00:00:00.000Z") == 0);
+    u_snprintf(buf, sizeof(buf), "%T|%.9T|%.0T", 1700000000123456789LL, 1700000000123456789LL,
+               1700000039999999999LL);
+    assert(strcmp(buf, "2023-11-14T22:13:20.123Z|2023-11-14T22:13:20.123456789Z|2023-11-14T22:13:59Z") == 0);
+    
+    // Leap days and century years; the cached prefix follows minute changes
+    u_snprintf(buf, sizeof(buf), "%.0T %.0T %.0T %.0T", 951782400000000000LL, 951868799000000000LL,
+               4107456000000000000LL, 951782400000000000LL);
+    assert(strcmp(buf, "2000-02-29T00:00:00Z 2000-02-29T23:59:59Z 2100-02-28T00:00:00Z "
+                       "2000-02-29T00:00:00Z") == 0);
+    
+    // Before the epoch seconds round down, as gmtime does
+    u_snprintf(buf, sizeof(buf), "%.9T %.0T %#T", -1LL, -94608000000000000LL, -1LL);
+    assert(strcmp(buf, "1969-12-31T23:59:59.999999999Z 1967-01-02T00:00:00Z "
+                       "1969-12-31T23:59:59.999Z") == 0);
+    u_snprintf(buf, sizeof(buf), "%.0T", (-9223372036854775807LL - 1));
+    assert(strcmp(buf, "1677-09-21T00:12:43Z") == 0);
+    
+    // Ticks, space separator and padding
+    u_snprintf(buf, sizeof(buf), "[%#T] [% .1T] [%26.0T] [%-22.0T]", 1700000000250LL,
+               1700000000500000000LL, 0LL, 0LL);
+    assert(strcmp(buf, "[2023-11-14T22:13:20.250Z] [2023-11-14 22:13:20.5Z] "
+                       "[      1970-01-01T00:00:00Z] [1970-01-01T00:00:00Z  ]") == 0);
+    
+    // Per-character sinks see the same text
+    reset_test_ctx(&ctx);
+    u_printf(test_output_cb, &ctx, "%T", 1700000000123456789LL);
+    assert(strcmp(ctx.buffer, "2023-11-14T22:13:20.123Z") == 0);
+    
+    // Durations pick the unit, round and trim
+    u_snprintf(buf, sizeof(buf), "%D %D %D %D %D %D", 850LL, 1234LL, 1230000LL, 4500000000LL,
+               999999LL, 999999999LL);
+    assert(strcmp(buf, "850ns 1.23us 1.23ms 4.5s 1ms 1s") == 0);
+    u_snprintf(buf, sizeof(buf), "%.0D %.3D %D %D %D", 1500000LL, 1234567LL, 125000000000LL,
+               3720000000000LL, -2500LL);
+    assert(strcmp(buf, "2ms 1.235ms 2m05s 1h02m -2.5us") == 0);
+    
+    // The unit follows the rounded value across every boundary
+    u_snprintf(buf, sizeof(buf), "%D %D %.3D %D %D %D %D", 59999999999LL, 59994999999LL,
+               59994999999LL, 999994LL, 3599499999999LL, 3599500000000LL, 3629999999999LL);
+    assert(strcmp(buf, "1m00s 59.99s 59.995s 999.99us 59m59s 1h00m 1h00m") == 0);
+    u_snprintf(buf, sizeof(buf), "%.0D %D %D", 999500LL, 119500000000LL, -59999999999LL);
+    assert(strcmp(buf, "1ms 2m00s -1m00s") == 0);
+    u_snprintf(buf, sizeof(buf), "[%8D] [%-8D] [%#D]", 1000LL, 1000LL, 1500LL);
+    assert(strcmp(buf, "[     1us] [1us     ] [1.5s]") == 0);
+    
+    u_unregister_format_handler('T');
+    u_unregister_format_handler('D');
+    printf("✓ Timestamp handler tests passed\n");
+}
+
+static void test_records() {
+    u_record_key_t id, name, temp, msg, odd;
+    u_record_key_t lid, lname, ltemp, lmsg, lodd;
+    assert(u_record_key_init(&id, U_RECORD_JSON, "id") == 0);
+    assert(u_record_key_init(&name, U_RECORD_JSON, "name") == 0);
+    assert(u_record_key_init(&temp, U_RECORD_JSON, "temp") == 0);
+    assert(u_record_key_init(&msg, U_RECORD_JSON, "msg") == 0);
+    assert(u_record_key_init(&odd, U_RECORD_JSON, "a\"b") == 0);
+    assert(u_record_key_init(&lid, U_RECORD_LOGFMT, "id") == 0);
+    assert(u_record_key_init(&lname, U_RECORD_LOGFMT, "name") == 0);
+    assert(u_record_key_init(&ltemp, U_RECORD_LOGFMT, "temp") == 0);
+    assert(u_record_key_init(&lmsg, U_RECORD_LOGFMT, "msg") == 0);
+    assert(u_record_key_init(&lodd, U_RECORD_LOGFMT, "a b=c") == 0);
+    
+    // JSON into a builder: escaped strings, integers, shortest floats
+    u_string_builder_t sb = u_string_builder_create(8);
+    u_record_t rec;
+    u_record_begin_builder(&rec, U_RECORD_JSON, &sb);
+    u_record_int(&rec, &id, -42);
+    u_record_str(&rec, &name, "sensor \"A\"\n\x01");
+    u_record_float(&rec, &temp, 21.5);
+    u_record_str(&rec, &msg, NULL);
+    u_record_float(&rec, &odd, 0.0 / 0.0);
+    assert(u_record_end(&rec) == (int)sb.pos);
+    assert(strcmp(sb.buffer, "{\"id\":-42,\"name\":\"sensor \\\"A\\\"\\n\\u0001\",\"temp\":21.5,"
+                             "\"msg\":null,\"a\\\"b\":null}") == 0);
+    
+    // Empty records and keys that do not fit
+    u_string_builder_clear(&sb);
+    u_record_begin_builder(&rec, U_RECORD_JSON, &sb);
+    assert(u_record_key_init(&odd, U_RECORD_JSON, "0123456789012345678901234567890") == -1);
+    u_record_int(&rec, &odd, 1);
+    assert(u_record_end(&rec) == 2 && strcmp(sb.buffer, "{}") == 0);
+    
+    // logfmt quotes only values that need it
+    u_string_builder_clear(&sb);
+    u_record_begin_builder(&rec, U_RECORD_LOGFMT, &sb);
+    u_record_int(&rec, &lid, 9223372036854775807LL);
+    u_record_str(&rec, &lname, "sensor");
+    u_record_float(&rec, &ltemp, -1.0 / 0.0);
+    u_record_str(&rec, &lmsg, "disk \"full\"");
+    u_record_str(&rec, &lodd, "");
+    u_record_end(&rec);
+    assert(strcmp(sb.buffer, "id=9223372036854775807 name=sensor temp=-inf msg=\"disk \\\"full\\\"\" "
+                             "a_b_c=\"\"") == 0);
+    
+    // Floats: short decimals directly, the rest through the float engine
+    u_string_builder_clear(&sb);
+    u_record_begin_builder(&rec, U_RECORD_LOGFMT, &sb);
+    u_record_float(&rec, &ltemp, -0.001);
+    u_record_float(&rec, &ltemp, 1234567.125);
+    u_record_float(&rec, &ltemp, 1.0 / 3);
+    u_record_float(&rec, &ltemp, 1e20);
+    u_record_float(&rec, &ltemp, -0.0);
+    u_record_end(&rec);
+    assert(strcmp(sb.buffer, "temp=-0.001 temp=1234567.125 temp=0.3333333333333333 temp=1e+20 temp=-0") == 0);
+    
+    // Long values through a span callback match the builder output
+    char text[200];
+    for (int i = 0; i < 199; i++) text[i] = i % 20 == 0 ? '\t' : (char)('a' + i % 26);
+    text[199] = '\0';
+    test_block_t block;
+    reset_test_ctx(&block.out);
+    block.calls = 0;
+    u_record_begin(&rec, U_RECORD_JSON, test_block_cb, &block);
+    u_record_str(&rec, &msg, text);
+    u_record_str(&rec, &name, text);
+    int len = u_record_end(&rec);
+    u_string_builder_clear(&sb);
+    u_record_begin_builder(&rec, U_RECORD_JSON, &sb);
+    u_record_str(&rec, &msg, text);
+    u_record_str(&rec, &name, text);
+    assert(u_record_end(&rec) == len && len == 438);
+    assert(block.calls <= 8 && block.out.position == (size_t)len && memcmp(block.out.buffer, sb.buffer, (size_t)len) == 0);
+    
+    u_string_builder_free(&sb);
+    printf("✓ Structured record tests passed\n");
+}
+
+static void test_string_builder() {
+    u_string_builder_t sb = u_string_builder_create(8);
+    
+    u_string_builder_append(&sb, "id=");
+    u_string_builder_append_format(&sb, "%d", 7);
+    u_string_builder_append_format(&sb, " name=%s value=%05u", "sensor", 42u);
+    assert(strcmp(sb.buffer, "id=7 name=sensor value=00042") == 0);
+    assert(sb.pos == strlen(sb.buffer));
+    
+    u_string_builder_clear(&sb);
+    assert(sb.pos == 0 && sb.buffer[0] == '\0');
+    u_string_builder_free(&sb);
+    
+    // Stack storage spills to the allocator only on overflow
+    char stack[16];
+    u_string_builder_init(&sb, stack, sizeof(stack), u_allocator_heap());
+    u_string_builder_append_format(&sb, "%s", "short");
+    assert(sb.buffer == stack && !sb.dynamic);
+    for (int i = 0; i < 100; i++) {
+        u_string_builder_append_format(&sb, "%d,", i);
+    }
+    assert(sb.buffer != stack && sb.dynamic);
+    assert(strncmp(sb.buffer, "short0,1,2,", 11) == 0 && sb.pos == strlen(sb.buffer));
+    assert(sb.size >= sb.pos + 1 && sb.size <= 2 * (sb.pos + 1));
+    u_string_builder_free(&sb);
+    
+    // Without an allocator the storage is fixed and output is truncated
+    u_string_builder_init(&sb, stack, sizeof(stack), NULL);
+    u_string_builder_append(&sb, "0123456789");
+    u_string_builder_append_format(&sb, "%s", "abcdefghij");
+    assert(strcmp(stack, "0123456789abcde") == 0);
+    
+    // Arena: growth of the latest allocation stays in place
+    static char arena_storage[512];
+    u_arena_t arena;
+    u_arena_init(&arena, arena_storage, sizeof(arena_storage));
+    u_allocator_t arena_alloc = u_arena_allocator(&arena);
+    sb = u_string_builder_create_with(8, &arena_alloc);
+    char* first = sb.buffer;
+    for (int i = 0; i < 20; i++) {
+        u_string_builder_append(&sb, "abcd");
+    }
+    assert(sb.buffer == first && sb.pos == 80);
+    u_string_builder_free(&sb);
+    assert(arena.used == 0);
+    
+    // Pool: one block per builder, never larger
+    static void* pool_storage[2][8];
+    u_pool_t pool;
+    u_pool_init(&pool, pool_storage, sizeof(pool_storage[0]), 2);
+    u_allocator_t pool_alloc = u_pool_allocator(&pool);
+    u_string_builder_t a = u_string_builder_create_with(16, &pool_alloc);
+    u_string_builder_t b = u_string_builder_create_with(16, &pool_alloc);
+    u_string_builder_t c = u_string_builder_create_with(16, &pool_alloc);
+    assert(a.buffer && b.buffer && a.buffer != b.buffer && !c.buffer);
+    u_string_builder_append_format(&a, "%0*d", 80, 1);
+    assert(a.pos == a.size - 1 && a.size == 16);
+    u_string_builder_free(&a);
+    c = u_string_builder_create_with(16, &pool_alloc);
+    assert(c.buffer);
+    u_string_builder_free(&b);
+    u_string_builder_free(&c);
+    
+    printf("✓ String builder tests passed\n");
+}
+
 // Main test function
 int main() {
     printf("Running uprintf tests...\n\n");
@@ -323,10 +1782,36 @@ int main() {
     test_string_formatting();
     test_pointer_formatting();
     test_float_formatting();
+    test_float_engine();
     test_length_modifiers();
     test_buffer_functions();
     test_edge_cases();
     test_custom_handlers();
+    test_context();
+    test_stats();
+    test_scanning();
+    test_broadcast();
+    test_pipeline();
+    test_deferred_log();
+#ifdef UPRINTF_ASYNC
+    test_async_ring();
+#endif
+    test_span_output();
+    test_output_buffer();
+    test_vsnprintf();
+    test_format_compile();
+    test_checked_macros();
+    test_templates();
+    test_iov_output();
+    test_text_layout();
+    test_replace_match();
+    test_string_builder();
+    test_arg_pack();
+    test_positional();
+    test_source_output();
+    test_encoders();
+    test_timestamps();
+    test_records();
     
     printf("\nAll tests passed! \n");
     return 0;
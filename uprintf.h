@@ -27,6 +27,94 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/**
+ * @brief Subsystem switches
+ * 
+ * Set any UPRINTF_ENABLE_* to 0 to compile that subsystem out together with
+ * its state in u_context_t. They change the layout of u_context_t, so every
+ * translation unit must see the same values. UPRINTF_PROFILE_CORE defaults
+ * all of them to 0 and also drops float conversions, leaving the integer
+ * formatter, the sprintf family, output buffers, compiled formats and
+ * contexts.
+ */
+#ifdef UPRINTF_PROFILE_CORE
+#define U_ENABLE_DEFAULT 0
+#else
+#define U_ENABLE_DEFAULT 1
+#endif
+
+#ifndef UPRINTF_ENABLE_HANDLERS
+#define UPRINTF_ENABLE_HANDLERS U_ENABLE_DEFAULT        /**< Runtime format handler table */
+#endif
+
+#ifndef UPRINTF_ENABLE_TEMPLATES
+#define UPRINTF_ENABLE_TEMPLATES U_ENABLE_DEFAULT       /**< Named and ad-hoc templates */
+#endif
+
+#ifndef UPRINTF_ENABLE_BROADCAST
+#define UPRINTF_ENABLE_BROADCAST U_ENABLE_DEFAULT       /**< Broadcast streams */
+#endif
+
+#ifndef UPRINTF_ENABLE_HOOKS
+#define UPRINTF_ENABLE_HOOKS U_ENABLE_DEFAULT           /**< u_printf_ex output hooks */
+#endif
+
+#ifndef UPRINTF_ENABLE_PROCESSORS
+#define UPRINTF_ENABLE_PROCESSORS U_ENABLE_DEFAULT      /**< u_printf_ex stream processors */
+#endif
+
+#ifndef UPRINTF_ENABLE_STRING_BUILDER
+#define UPRINTF_ENABLE_STRING_BUILDER U_ENABLE_DEFAULT  /**< String builder and allocators */
+#endif
+
+#ifndef UPRINTF_ENABLE_TEXT
+#define UPRINTF_ENABLE_TEXT U_ENABLE_DEFAULT            /**< Text layout, alignment and fill */
+#endif
+
+#ifndef UPRINTF_ENABLE_STRING_UTILS
+#define UPRINTF_ENABLE_STRING_UTILS U_ENABLE_DEFAULT    /**< Wildcards, replace and trim */
+#endif
+
+#ifndef UPRINTF_ENABLE_DEFERRED
+#define UPRINTF_ENABLE_DEFERRED U_ENABLE_DEFAULT        /**< Deferred logging */
+#endif
+
+#ifndef UPRINTF_ENABLE_IOV
+#define UPRINTF_ENABLE_IOV U_ENABLE_DEFAULT             /**< Scatter/gather output */
+#endif
+
+#ifndef UPRINTF_ENABLE_STATE_MACHINE
+#define UPRINTF_ENABLE_STATE_MACHINE U_ENABLE_DEFAULT   /**< State machine */
+#endif
+
+#ifndef UPRINTF_ENABLE_TERMINAL
+#define UPRINTF_ENABLE_TERMINAL U_ENABLE_DEFAULT        /**< ANSI cursor helpers */
+#endif
+
+#ifndef UPRINTF_ENABLE_ENCODERS
+#define UPRINTF_ENABLE_ENCODERS U_ENABLE_DEFAULT        /**< Hex, base64 and escape handlers */
+#endif
+
+#ifndef UPRINTF_ENABLE_TIME
+#define UPRINTF_ENABLE_TIME U_ENABLE_DEFAULT            /**< Timestamp and duration handlers */
+#endif
+
+#ifndef UPRINTF_ENABLE_RECORDS
+#define UPRINTF_ENABLE_RECORDS U_ENABLE_DEFAULT         /**< JSON and logfmt records */
+#endif
+
+/**
+ * @brief 64-bit integer division
+ * 
+ * With 0, 64-bit values are converted with 32-bit divisions only, so 32-bit
+ * targets link no libgcc helpers (__udivdi3, __aeabi_uldivmod) for integer
+ * output. Values that fit in 32 bits take the same path either way. The
+ * float engines still need 64-bit arithmetic.
+ */
+#ifndef UPRINTF_ENABLE_64BIT_DIVISION
+#define UPRINTF_ENABLE_64BIT_DIVISION U_ENABLE_DEFAULT
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -38,6 +126,36 @@ extern "C" {
  */
 typedef void (*u_output_cb_t)(char c, void* ctx);
 
+/**
+ * @brief Span output callback function type
+ * @param data Pointer to the characters to output (not null-terminated)
+ * @param len Number of characters in the span
+ * @param ctx User context pointer
+ */
+typedef void (*u_write_cb_t)(const char* data, size_t len, void* ctx);
+
+/**
+ * @brief Pull-based reader behind a %S source
+ * @param buffer Destination for the next bytes
+ * @param capacity Bytes wanted, at most
+ * @param ctx Reader state
+ * @return Bytes stored; 0 ends the value early
+ */
+typedef size_t (*u_read_cb_t)(char* buffer, size_t capacity, void* ctx);
+
+/**
+ * @brief Value for %S: `length` bytes pulled through `read` in chunks
+ * 
+ * The content is streamed to the output as it is read, so it never has to
+ * be in memory as a whole or be NUL-terminated. Width and precision work as
+ * for %s, using `length` instead of a scan; a NULL source prints nothing.
+ */
+typedef struct {
+    u_read_cb_t read;  /**< Reader called until `length` bytes are delivered */
+    void* ctx;         /**< Reader state */
+    size_t length;     /**< Bytes the source delivers */
+} u_source_t;
+
 /**
  * @brief Custom format handler function type
  */
@@ -76,24 +194,218 @@ typedef struct {
 } u_template_var_t;
 
 /**
- * @brief Output stream configuration
+ * @brief Memory allocator hooks
+ * 
+ * Sizes are passed back to realloc and free so arena and pool allocators
+ * need no headers.
  */
 typedef struct {
-    u_output_cb_t output; /**< Output callback function */
-    void* ctx;            /**< Context for output callback */
-    bool enabled;         /**< Whether stream is enabled */
-} u_output_stream_t;
+    void* (*alloc)(void* user, size_t size);                                /**< Allocate */
+    void* (*realloc)(void* user, void* ptr, size_t old_size, size_t new_size); /**< Resize */
+    void (*free)(void* user, void* ptr, size_t size);                       /**< Release */
+    void* user;                                                             /**< Allocator state */
+} u_allocator_t;
+
+/**
+ * @brief Bump allocator over caller storage
+ * 
+ * The most recent allocation can grow and shrink in place; everything is
+ * released at once with u_arena_reset.
+ */
+typedef struct {
+    char* base;     /**< Storage */
+    size_t size;    /**< Storage size */
+    size_t used;    /**< Bytes handed out */
+    size_t last;    /**< Offset of the most recent allocation */
+} u_arena_t;
+
+/**
+ * @brief Fixed-size block allocator over caller storage
+ */
+typedef struct {
+    char* storage;      /**< Block storage */
+    size_t block_size;  /**< Bytes per block */
+    void* free_list;    /**< First free block */
+} u_pool_t;
 
 /**
  * @brief String builder structure
+ * 
+ * A builder without an allocator has a fixed size and truncates. With one
+ * it grows geometrically; caller storage is used until it overflows and
+ * then moved to the allocator.
  */
 typedef struct {
     char* buffer;   /**< Character buffer */
     size_t size;    /**< Buffer size */
     size_t pos;     /**< Current position in buffer */
     bool dynamic;   /**< Whether buffer is dynamically allocated */
+    u_allocator_t allocator; /**< Where the buffer grows (alloc NULL: fixed size) */
 } u_string_builder_t;
 
+/**
+ * @brief Staged output buffer
+ * 
+ * Collects output in caller-provided storage and hands it to the real sink
+ * only when the storage fills up or the buffer is flushed.
+ */
+typedef struct {
+    char* buffer;          /**< Staging storage */
+    size_t size;           /**< Storage size */
+    size_t pos;            /**< Number of staged characters */
+    u_write_cb_t write;    /**< Span sink to flush to (preferred if set) */
+    u_output_cb_t output;  /**< Per-character sink used when write is NULL */
+    void* ctx;             /**< Context for the real sink */
+    bool auto_flush;       /**< Flush at the end of every printf call */
+} u_output_buffer_t;
+
+/**
+ * @brief Output stream configuration
+ * 
+ * Broadcasts hand each stream whole blocks: to its staging buffer if it has
+ * one, else to write, else character by character to output.
+ */
+typedef struct {
+    u_output_cb_t output; /**< Output callback function */
+    void* ctx;            /**< Context for output callback */
+    bool enabled;         /**< Whether stream is enabled */
+    u_write_cb_t write;   /**< Block sink, used instead of output if set */
+    u_output_buffer_t* buffer; /**< Optional staging buffer in front of the stream */
+    int level;            /**< Lowest level of leveled broadcasts it receives */
+} u_output_stream_t;
+
+/**
+ * @brief Parsed conversion descriptor
+ */
+typedef struct {
+    unsigned int flags;   /**< U_FLAG_* bits */
+    int width;            /**< Field width, -1 if absent */
+    int precision;        /**< Precision, -1 if absent */
+    signed char length;   /**< Length modifier (0 none, -2 hh, -1 h, 1 l, 2 ll, 3 z, 4 t, 5 j, 6 L) */
+    char specifier;       /**< Conversion character */
+    unsigned char position;            /**< "%N$" argument number, 0 if taken in order */
+    unsigned char width_position;      /**< "*N$" width argument number, or 0 */
+    unsigned char precision_position;  /**< ".*N$" precision argument number, or 0 */
+} u_format_spec_t;
+
+/**
+ * @brief One step of a compiled format: a literal span or a conversion
+ */
+typedef struct {
+    const char* text;      /**< Literal start, or the format position after the specifier */
+    int len;               /**< Literal length (0 for conversions) */
+    u_format_spec_t spec;  /**< Conversion descriptor (specifier is 0 for literals) */
+} u_format_op_t;
+
+/**
+ * @brief Compiled format string
+ * 
+ * Literal ops point into the original format string, which must outlive
+ * the compiled form (string literals are the usual case).
+ */
+typedef struct {
+    const u_format_op_t* ops;  /**< Op list */
+    int count;                 /**< Number of ops */
+} u_format_compiled_t;
+
+/**
+ * @brief Argument type tags used to check call sites against their format
+ */
+typedef enum {
+    U_ARG_OTHER,    /**< Type that no conversion accepts */
+    U_ARG_INT,      /**< int and types promoted to it */
+    U_ARG_UINT,     /**< unsigned int */
+    U_ARG_LONG,     /**< long */
+    U_ARG_ULONG,    /**< unsigned long */
+    U_ARG_LLONG,    /**< long long */
+    U_ARG_ULLONG,   /**< unsigned long long */
+    U_ARG_DOUBLE,   /**< double (and float) */
+    U_ARG_LDOUBLE,  /**< long double */
+    U_ARG_STR,      /**< char* / const char* */
+    U_ARG_PTR       /**< Any other pointer */
+} u_arg_tag_t;
+
+/**
+ * @brief One value of a typed argument pack
+ * 
+ * Packs are plain arrays the engine indexes directly, so they can be built
+ * once and rendered any number of times. %L conversions and handlers take
+ * long doubles from ld; the float engine itself works in double precision.
+ */
+typedef struct {
+    u_arg_tag_t type;  /**< Which member of value is set */
+    union {
+        long long i;           /**< Signed integers */
+        unsigned long long u;  /**< Unsigned integers */
+        double d;              /**< Floating point */
+        const char* s;         /**< Strings */
+        const void* p;         /**< Pointers */
+    } value;
+    long double ld;    /**< Long double (U_ARG_LDOUBLE); outside the union, which GCC
+                            would otherwise flag for an old parameter passing change */
+} u_arg_t;
+
+/** @brief Pack a signed integer */
+static inline u_arg_t u_arg_int(long long value) {
+    u_arg_t arg;
+    arg.type = U_ARG_LLONG;
+    arg.value.i = value;
+    return arg;
+}
+
+/** @brief Pack an unsigned integer */
+static inline u_arg_t u_arg_uint(unsigned long long value) {
+    u_arg_t arg;
+    arg.type = U_ARG_ULLONG;
+    arg.value.u = value;
+    return arg;
+}
+
+/** @brief Pack a floating point value */
+static inline u_arg_t u_arg_double(double value) {
+    u_arg_t arg;
+    arg.type = U_ARG_DOUBLE;
+    arg.value.d = value;
+    return arg;
+}
+
+/** @brief Pack a long double, for %L conversions */
+static inline u_arg_t u_arg_ldouble(long double value) {
+    u_arg_t arg;
+    arg.type = U_ARG_LDOUBLE;
+    arg.ld = value;
+    return arg;
+}
+
+/** @brief Pack a string (NULL prints as "(null)") */
+static inline u_arg_t u_arg_str(const char* value) {
+    u_arg_t arg;
+    arg.type = U_ARG_STR;
+    arg.value.s = value;
+    return arg;
+}
+
+/** @brief Pack a pointer, for %p or the int* of %n */
+static inline u_arg_t u_arg_ptr(const void* value) {
+    u_arg_t arg;
+    arg.type = U_ARG_PTR;
+    arg.value.p = value;
+    return arg;
+}
+
+/**
+ * @brief Per-call-site storage for the U_PRINTF macros
+ */
+#ifndef UPRINTF_CACHE_STORAGE
+#define UPRINTF_CACHE_STORAGE 256
+#endif
+
+typedef struct {
+    int state;                      /**< 0 before first use, 2 compiling, 1 ready, -1 rejected */
+    u_format_compiled_t* compiled;  /**< Compiled format, NULL if it did not fit */
+    void* storage[UPRINTF_CACHE_STORAGE / sizeof(void*)]; /**< Op list storage */
+} u_format_cache_t;
+
 /**
  * @brief Format flags
  */
@@ -106,6 +418,19 @@ typedef struct {
 #define U_FLAG_WIDTH_ARG     (1 << 6)  /**< Width from argument */
 #define U_FLAG_PRECISION_ARG (1 << 7)  /**< Precision from argument */
 
+/**
+ * @brief Optional printf format checking by the compiler
+ * 
+ * Define UPRINTF_FORMAT_CHECK to let GCC and Clang check format strings of
+ * the printf-style entry points. Leave it off when custom specifiers are in
+ * use, since the compiler does not know them.
+ */
+#if defined(UPRINTF_FORMAT_CHECK) && (defined(__GNUC__) || defined(__clang__))
+#define U_FORMAT_ATTR(fmt_index, args_index) __attribute__((format(printf, fmt_index, args_index)))
+#else
+#define U_FORMAT_ATTR(fmt_index, args_index)
+#endif
+
 /**
  * @brief Main printf function
  * @param output_cb Character output callback
@@ -114,7 +439,7 @@ typedef struct {
  * @param ... Arguments to format
  * @return Number of characters written, or negative value on error
  */
-int u_printf(u_output_cb_t output_cb, void* ctx, const char* fmt, ...);
+int u_printf(u_output_cb_t output_cb, void* ctx, const char* fmt, ...) U_FORMAT_ATTR(3, 4);
 
 /**
  * @brief Varargs version of printf
@@ -124,8 +449,33 @@ int u_printf(u_output_cb_t output_cb, void* ctx, const char* fmt, ...);
  * @param args Variable arguments list
  * @return Number of characters written, or negative value on error
  */
-int u_vprintf(u_output_cb_t output_cb, void* ctx, const char* fmt, va_list args);
+int u_vprintf(u_output_cb_t output_cb, void* ctx, const char* fmt, va_list args) U_FORMAT_ATTR(3, 0);
+
+/**
+ * @brief Printf to a span sink
+ * 
+ * Literal runs, converted fields, string payloads and padding are each
+ * delivered to the sink as a single span instead of one call per character.
+ * 
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_printf_span(u_write_cb_t write_cb, void* ctx, const char* fmt, ...) U_FORMAT_ATTR(3, 4);
+
+/**
+ * @brief Varargs version of span printf
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param args Variable arguments list
+ * @return Number of characters written, or negative value on error
+ */
+int u_vprintf_span(u_write_cb_t write_cb, void* ctx, const char* fmt, va_list args) U_FORMAT_ATTR(3, 0);
 
+#if UPRINTF_ENABLE_HANDLERS
 /**
  * @brief Register a custom format handler
  * @param specifier Format specifier character
@@ -140,6 +490,66 @@ int u_register_format_handler(char specifier, u_format_handler_t handler);
  * @return 0 on success, -1 on failure
  */
 int u_unregister_format_handler(char specifier);
+#endif
+
+#if UPRINTF_ENABLE_ENCODERS
+/**
+ * @brief Binary-to-text handlers to register on specifiers of your choice
+ * 
+ * Each takes a pointer to the data with its length as the precision, e.g.
+ * u_register_format_handler('H', u_hex_handler) and then "%.*H", len, buf.
+ * Without a precision the data is a NUL-terminated string; NULL prints
+ * "(null)". They also work as U_STATIC_HANDLER entries.
+ * 
+ * - u_hex_handler: lowercase hex digits; a width groups that many bytes
+ *   between spaces. '#' makes a dump: 16 bytes per line with an offset and
+ *   an ASCII column, bytes grouped by the width (default 1).
+ * - u_base64_handler: RFC 4648 base64; '#' selects the URL-safe alphabet
+ *   without padding. A width pads the result like %s.
+ * - u_escape_handler: C string escapes (\n, \r, \t, \", \\, other bytes
+ *   outside printable ASCII as three octal digits). A width pads the
+ *   result like %s.
+ */
+int u_hex_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                  const char** fmt, int width, int precision, unsigned int flags);
+
+/** @brief Base64 encoder, see u_hex_handler */
+int u_base64_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                     const char** fmt, int width, int precision, unsigned int flags);
+
+/** @brief C-escape encoder, see u_hex_handler */
+int u_escape_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                     const char** fmt, int width, int precision, unsigned int flags);
+#endif
+
+#if UPRINTF_ENABLE_TIME
+/**
+ * @brief ISO-8601 UTC timestamp handler, e.g. 2026-10-14T17:51:53.123Z
+ * 
+ * Takes a long long of nanoseconds since the Unix epoch, or with '#' of
+ * ticks at UPRINTF_TIME_TICK_HZ. The precision is the number of fraction
+ * digits (default 3, at most 9, truncated); ' ' puts a space in place of
+ * the 'T'. Negative values are times before 1970 and round down like
+ * gmtime. The date, hour and minute part is cached per thread, so lines
+ * within the same minute only convert the seconds and fraction. A width
+ * pads the result like %s.
+ */
+int u_time_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                   const char** fmt, int width, int precision, unsigned int flags);
+
+/**
+ * @brief Compact duration handler for latencies: 850ns, 1.23ms, 4.5s, 2m05s, 1h02m
+ * 
+ * Takes a long long of nanoseconds (or ticks with '#'). Below a minute the
+ * value is shown in the largest unit that keeps it under 1000, rounded to
+ * the precision in decimals (default 2) with trailing zeros dropped. The
+ * unit is picked after rounding, so 59.999s prints as 1m00s; the two-unit
+ * forms round to the nearest second or minute. A width pads the result
+ * like %s.
+ */
+int u_duration_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                       const char** fmt, int width, int precision, unsigned int flags);
+#endif
 
 /**
  * @brief Write formatted output to a string
@@ -149,7 +559,7 @@ int u_unregister_format_handler(char specifier);
  * @return Number of characters written (excluding null terminator),
  *         or negative value on error
  */
-int u_sprintf(char* buffer, const char* fmt, ...);
+int u_sprintf(char* buffer, const char* fmt, ...) U_FORMAT_ATTR(2, 3);
 
 /**
  * @brief Write formatted output to a string with size limit
@@ -160,7 +570,142 @@ int u_sprintf(char* buffer, const char* fmt, ...);
  * @return Number of characters actually written to buffer (excluding null terminator),
  *         or negative value on error
  */
-int u_snprintf(char* buffer, size_t size, const char* fmt, ...);
+int u_snprintf(char* buffer, size_t size, const char* fmt, ...) U_FORMAT_ATTR(3, 4);
+
+/**
+ * @brief C99-conformant bounded formatting
+ * 
+ * Writes at most size - 1 characters plus a null terminator. With a NULL
+ * buffer or size 0 nothing is written and only the length is measured.
+ * 
+ * @param buffer Output buffer (can be NULL when size is 0)
+ * @param size Buffer size
+ * @param fmt Format string
+ * @param args Variable arguments list
+ * @return Number of characters that would have been written had the buffer
+ *         been large enough (excluding null terminator), or negative value on error
+ */
+int u_vsnprintf(char* buffer, size_t size, const char* fmt, va_list args) U_FORMAT_ATTR(3, 0);
+
+/**
+ * @brief Format from a typed argument pack instead of a va_list
+ * 
+ * Conversions take values in order, '*' included. Integers are read at the
+ * width of the length modifier the way va_arg would, so any integer value
+ * suits any integer conversion; other kinds must match. The pack is only
+ * read and can be rendered again.
+ * 
+ * @param output_cb Character output callback
+ * @param ctx User context passed to callback
+ * @param fmt Format string
+ * @param args Argument pack
+ * @param count Number of values in the pack
+ * @return Number of characters written, or -1 if a value is missing or of the wrong kind
+ */
+int u_printf_args(u_output_cb_t output_cb, void* ctx, const char* fmt,
+                  const u_arg_t* args, int count);
+
+/**
+ * @brief Bounded formatting from a typed argument pack, with u_vsnprintf semantics
+ * @param buffer Output buffer (can be NULL when size is 0)
+ * @param size Buffer size
+ * @param fmt Format string
+ * @param args Argument pack
+ * @param count Number of values in the pack
+ * @return Number of characters that would have been written, or -1 on error
+ */
+int u_snprintf_args(char* buffer, size_t size, const char* fmt, const u_arg_t* args, int count);
+
+/**
+ * @brief Storage needed to compile a format string
+ * @param fmt Format string
+ * @return Size in bytes for u_format_compile, or 0 if the format is invalid
+ */
+size_t u_format_compile_size(const char* fmt);
+
+/**
+ * @brief Parse and validate a format string once for repeated rendering
+ * 
+ * Every conversion must be complete, use a known specifier (standard or
+ * registered at compile time) and a length modifier that fits it.
+ * 
+ * @param fmt Format string
+ * @param storage Caller-provided storage for the op list
+ * @param size Storage size (see u_format_compile_size)
+ * @return Compiled format inside storage, or NULL if the format is invalid
+ *         or the storage is too small
+ */
+u_format_compiled_t* u_format_compile(const char* fmt, void* storage, size_t size);
+
+/**
+ * @brief Printf with a compiled format
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param compiled Compiled format
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_printf_compiled(u_output_cb_t output_cb, void* ctx, const u_format_compiled_t* compiled, ...);
+
+/**
+ * @brief Varargs version of compiled printf
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param compiled Compiled format
+ * @param args Variable arguments list
+ * @return Number of characters written, or negative value on error
+ */
+int u_vprintf_compiled(u_output_cb_t output_cb, void* ctx, const u_format_compiled_t* compiled,
+                       va_list args);
+
+/**
+ * @brief Check argument types against a format string
+ * 
+ * Conversions after a custom specifier are not checked, since its handler
+ * may consume any arguments.
+ * 
+ * @param fmt Format string
+ * @param tags Argument type tags, in call order
+ * @param count Number of tags
+ * @return 0 if the arguments match, -1 otherwise
+ */
+int u_format_check(const char* fmt, const unsigned char* tags, int count);
+
+/**
+ * @brief Printf through a per-call-site cache (used by U_PRINTF)
+ * 
+ * On first use the format is checked against the argument tags and compiled
+ * into the cache; later calls render the compiled form directly. A rejected
+ * call site prints nothing and returns -1, after calling
+ * UPRINTF_ON_MISMATCH(fmt) once. The cache is published with an atomic
+ * release store (GCC/Clang builtins or MSVC interlocked calls), so threads
+ * may make their first calls concurrently; calls that find another thread
+ * compiling check and interpret the format themselves. On other compilers
+ * make the first call of each site from one thread.
+ * 
+ * @param cache Call site cache (zero-initialized)
+ * @param tags Argument type tags
+ * @param tag_count Number of tags
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_printf_cached(u_format_cache_t* cache, const unsigned char* tags, int tag_count,
+                    u_output_cb_t output_cb, void* ctx, const char* fmt, ...);
+
+/**
+ * @brief Simplified printf through a per-call-site cache (used by U_PRINTF_SIMPLE)
+ * @param cache Call site cache (zero-initialized)
+ * @param tags Argument type tags
+ * @param tag_count Number of tags
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_printf_simple_cached(u_format_cache_t* cache, const unsigned char* tags, int tag_count,
+                           const char* fmt, ...);
 
 /**
  * @brief Set locale for number formatting (minimal implementation)
@@ -187,7 +732,68 @@ void u_set_default_output(u_output_cb_t output_cb, void* ctx);
  * @param ... Arguments to format
  * @return Number of characters written, or negative value on error
  */
-int u_printf_simple(const char* fmt, ...);
+int u_printf_simple(const char* fmt, ...) U_FORMAT_ATTR(1, 2);
+
+/**
+ * @brief Set a span sink as the default output for simplified usage
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ */
+void u_set_default_write(u_write_cb_t write_cb, void* ctx);
+
+/**
+ * @brief Stage default output in a buffer before it reaches the default sink
+ * @param storage Staging storage (NULL disables staging)
+ * @param size Storage size
+ */
+void u_set_default_output_buffer(char* storage, size_t size);
+
+/**
+ * @brief Initialize a staged output buffer in front of a per-character sink
+ * @param ob Output buffer instance
+ * @param storage Staging storage
+ * @param size Storage size
+ * @param output_cb Character output callback receiving flushed data
+ * @param ctx Context pointer for callback
+ */
+void u_output_buffer_init(u_output_buffer_t* ob, char* storage, size_t size, 
+                          u_output_cb_t output_cb, void* ctx);
+
+/**
+ * @brief Initialize a staged output buffer in front of a span sink
+ * @param ob Output buffer instance
+ * @param storage Staging storage
+ * @param size Storage size
+ * @param write_cb Span output callback receiving flushed data
+ * @param ctx Context pointer for callback
+ */
+void u_output_buffer_init_span(u_output_buffer_t* ob, char* storage, size_t size, 
+                               u_write_cb_t write_cb, void* ctx);
+
+/**
+ * @brief Character callback that stages into a u_output_buffer_t
+ * 
+ * Pass it to u_printf() with the buffer as context. The engine recognizes it
+ * and copies spans into the staging storage directly.
+ * 
+ * @param c Character to stage
+ * @param ctx Pointer to a u_output_buffer_t
+ */
+void u_output_buffer_cb(char c, void* ctx);
+
+/**
+ * @brief Span callback that stages into a u_output_buffer_t
+ * @param data Characters to stage
+ * @param len Number of characters
+ * @param ctx Pointer to a u_output_buffer_t
+ */
+void u_output_buffer_write(const char* data, size_t len, void* ctx);
+
+/**
+ * @brief Hand all staged output to the real sink
+ * @param ob Output buffer instance (NULL flushes the default output buffer)
+ */
+void u_flush(u_output_buffer_t* ob);
 
 /**
  * @brief Extended printf with advanced features
@@ -209,23 +815,24 @@ int u_printf_ex(u_output_cb_t output_cb, void* ctx, const char* fmt, ...);
  */
 int u_vprintf_ex(u_output_cb_t output_cb, void* ctx, const char* fmt, va_list args);
 
+#if UPRINTF_ENABLE_TEMPLATES
 /**
  * @brief Format text using template with variables
  * @param output_cb Character output callback
  * @param ctx Context pointer for callback
- * @param template Template string with {{variable}} placeholders
+ * @param tmpl Template string with {{variable}} placeholders
  * @param vars Array of template variables
  * @param count Number of variables in array
  */
 void u_template_format(u_output_cb_t output_cb, void* ctx, 
-                      const char* template, const u_template_var_t* vars, int count);
+                      const char* tmpl, const u_template_var_t* vars, int count);
 
 /**
  * @brief Load a template for later use
  * @param name Template name
- * @param template Template content
+ * @param tmpl Template content
  */
-void u_template_load(const char* name, const char* template);
+void u_template_load(const char* name, const char* tmpl);
 
 /**
  * @brief Format text using a named template
@@ -239,8 +846,40 @@ void u_template_format_named(u_output_cb_t output_cb, void* ctx,
                             const char* name, const u_template_var_t* vars, int count);
 
 /**
- * @brief Add an output stream to the broadcast system
- * @param stream Output stream configuration
+ * @brief Look up a loaded template
+ * @param name Template name
+ * @return Template id for u_template_slot and u_template_render, or -1 if not loaded
+ */
+int u_template_find(const char* name);
+
+/**
+ * @brief Slot index of a variable in a loaded template
+ * 
+ * Each distinct {{name}} of a template gets one slot, numbered in order of
+ * first appearance. Templates too large to pre-parse have no slots.
+ * 
+ * @param id Template id from u_template_find
+ * @param var Variable name
+ * @return Slot index, or -1 if the template does not use the variable
+ */
+int u_template_slot(int id, const char* var);
+
+/**
+ * @brief Render a loaded template with values bound by slot
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param id Template id from u_template_find
+ * @param values Value for each slot; NULL or missing slots render empty
+ * @param count Number of values
+ */
+void u_template_render(u_output_cb_t output_cb, void* ctx, int id,
+                       const char* const* values, int count);
+#endif
+
+#if UPRINTF_ENABLE_BROADCAST
+/**
+ * @brief Add an output stream to the broadcast system
+ * @param stream Output stream configuration
  */
 void u_output_add_stream(u_output_stream_t stream);
 
@@ -262,6 +901,51 @@ void u_output_broadcast(char c);
  */
 void u_output_broadcast_str(const char* str);
 
+/**
+ * @brief Format once and broadcast the result to all enabled streams
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters formatted, 0 if no stream is enabled, or negative on error
+ */
+int u_output_broadcast_printf(const char* fmt, ...) U_FORMAT_ATTR(1, 2);
+
+/**
+ * @brief Leveled broadcast: only streams whose level is at most `level` receive it
+ * 
+ * Nothing is formatted when no stream accepts the level.
+ * 
+ * @param level Message level (higher is more severe)
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters formatted, 0 if no stream accepts it, or negative on error
+ */
+int u_output_broadcast_log(int level, const char* fmt, ...) U_FORMAT_ATTR(2, 3);
+
+/**
+ * @brief Leveled broadcast with a va_list
+ * @param level Message level
+ * @param fmt Format string
+ * @param args Argument list
+ * @return Number of characters formatted, or negative on error
+ */
+int u_output_broadcast_vlog(int level, const char* fmt, va_list args);
+
+/**
+ * @brief Format a typed argument pack once and broadcast it to all enabled streams
+ * @param fmt Format string
+ * @param args Argument pack
+ * @param count Number of values in the pack
+ * @return Number of characters formatted, 0 if no stream is enabled, or negative on error
+ */
+int u_output_broadcast_args(const char* fmt, const u_arg_t* args, int count);
+
+/**
+ * @brief Flush the staging buffers of all streams
+ */
+void u_output_broadcast_flush(void);
+#endif
+
+#if UPRINTF_ENABLE_STRING_BUILDER
 /**
  * @brief Create a string builder
  * @param initial_size Initial buffer size
@@ -269,6 +953,68 @@ void u_output_broadcast_str(const char* str);
  */
 u_string_builder_t u_string_builder_create(size_t initial_size);
 
+/**
+ * @brief Create a string builder that allocates through the given hooks
+ * @param initial_size Initial buffer size
+ * @param allocator Allocator (NULL for the heap)
+ * @return String builder instance; buffer is NULL if the allocation failed
+ */
+u_string_builder_t u_string_builder_create_with(size_t initial_size,
+                                                const u_allocator_t* allocator);
+
+/**
+ * @brief Start a string builder in caller storage (e.g. on the stack)
+ * @param sb String builder instance
+ * @param storage Initial storage
+ * @param size Storage size
+ * @param allocator Where to spill on overflow, NULL to truncate instead
+ */
+void u_string_builder_init(u_string_builder_t* sb, char* storage, size_t size,
+                           const u_allocator_t* allocator);
+
+/**
+ * @brief Allocator backed by malloc, realloc and free
+ * @return Heap allocator
+ */
+const u_allocator_t* u_allocator_heap(void);
+
+/**
+ * @brief Initialize an arena over caller storage
+ * @param arena Arena
+ * @param storage Storage
+ * @param size Storage size
+ */
+void u_arena_init(u_arena_t* arena, void* storage, size_t size);
+
+/**
+ * @brief Release everything allocated from an arena
+ * @param arena Arena
+ */
+void u_arena_reset(u_arena_t* arena);
+
+/**
+ * @brief Allocator hooks drawing from an arena
+ * @param arena Arena
+ * @return Allocator
+ */
+u_allocator_t u_arena_allocator(u_arena_t* arena);
+
+/**
+ * @brief Initialize a pool of fixed-size blocks over caller storage
+ * @param pool Pool
+ * @param storage Storage for block_count blocks, pointer aligned
+ * @param block_size Bytes per block
+ * @param block_count Number of blocks
+ */
+void u_pool_init(u_pool_t* pool, void* storage, size_t block_size, size_t block_count);
+
+/**
+ * @brief Allocator hooks drawing from a pool; requests above the block size fail
+ * @param pool Pool
+ * @return Allocator
+ */
+u_allocator_t u_pool_allocator(u_pool_t* pool);
+
 /**
  * @brief Append a string to the string builder
  * @param sb String builder instance
@@ -284,6 +1030,16 @@ void u_string_builder_append(u_string_builder_t* sb, const char* str);
  */
 void u_string_builder_append_format(u_string_builder_t* sb, const char* fmt, ...);
 
+/**
+ * @brief Append a string with all occurrences of a substring replaced
+ * @param sb String builder instance
+ * @param str Original string
+ * @param find Substring to find (empty: nothing is replaced)
+ * @param replace Replacement string (NULL: matches are removed)
+ */
+void u_string_builder_append_replace(u_string_builder_t* sb, const char* str,
+                                     const char* find, const char* replace);
+
 /**
  * @brief Clear the string builder
  * @param sb String builder instance
@@ -295,7 +1051,111 @@ void u_string_builder_clear(u_string_builder_t* sb);
  * @param sb String builder instance
  */
 void u_string_builder_free(u_string_builder_t* sb);
+#endif
+
+#if UPRINTF_ENABLE_RECORDS
+/**
+ * @brief Bytes of an encoded record key, separator and quotes included
+ */
+#ifndef UPRINTF_RECORD_KEY_SIZE
+#define UPRINTF_RECORD_KEY_SIZE 32
+#endif
+
+/**
+ * @brief Structured record encodings
+ */
+typedef enum {
+    U_RECORD_JSON,    /**< {"key":value,...} */
+    U_RECORD_LOGFMT   /**< key=value key="quoted value" ... */
+} u_record_format_t;
+
+/**
+ * @brief Key encoded once for one record format by u_record_key_init
+ */
+typedef struct {
+    char text[UPRINTF_RECORD_KEY_SIZE]; /**< Separator, key and the value introducer */
+    unsigned short length;              /**< Encoded length, 0 if the key did not fit */
+} u_record_key_t;
+
+/**
+ * @brief Record being written
+ */
+typedef struct {
+    u_write_cb_t write;        /**< Destination */
+    void* ctx;                 /**< Context pointer for write */
+    size_t length;             /**< Bytes written so far */
+    int fields;                /**< Fields written so far */
+    u_record_format_t format;  /**< Encoding */
+} u_record_t;
+
+/**
+ * @brief Encode a key for reuse across records
+ * @param key Key to fill
+ * @param format Encoding the key is used with
+ * @param name Key name; JSON escapes it, logfmt replaces spaces, '=' and '"' with '_'
+ * @return 0 on success, -1 if the encoded key does not fit UPRINTF_RECORD_KEY_SIZE
+ *         (fields with that key are skipped)
+ */
+int u_record_key_init(u_record_key_t* key, u_record_format_t format, const char* name);
+
+/**
+ * @brief Start a record written as spans to a callback
+ * @param rec Record
+ * @param format Encoding
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ */
+void u_record_begin(u_record_t* rec, u_record_format_t format, u_write_cb_t write_cb, void* ctx);
+
+#if UPRINTF_ENABLE_STRING_BUILDER
+/**
+ * @brief Start a record appended to a string builder
+ * @param rec Record
+ * @param format Encoding
+ * @param sb String builder the record is appended to
+ */
+void u_record_begin_builder(u_record_t* rec, u_record_format_t format, u_string_builder_t* sb);
+#endif
+
+/**
+ * @brief Add an integer field
+ * @param rec Record
+ * @param key Key from u_record_key_init with the record's format
+ * @param value Value
+ */
+void u_record_int(u_record_t* rec, const u_record_key_t* key, long long value);
+
+/**
+ * @brief Add a string field, escaped (and in logfmt quoted) as needed
+ * @param rec Record
+ * @param key Key from u_record_key_init with the record's format
+ * @param value Value, NULL for null
+ */
+void u_record_str(u_record_t* rec, const u_record_key_t* key, const char* value);
+
+/**
+ * @brief Add a floating point field with the shortest digits that read back exactly
+ * 
+ * The decimal point is always '.'. Values with up to nine decimals take an
+ * integer fast path; the small float engine writes other values with six
+ * decimals. JSON writes NaN and infinities as null, as it does
+ * every value when floats are compiled out.
+ * 
+ * @param rec Record
+ * @param key Key from u_record_key_init with the record's format
+ * @param value Value
+ */
+void u_record_float(u_record_t* rec, const u_record_key_t* key, double value);
+
+/**
+ * @brief Finish a record
+ * @param rec Record
+ * @return Bytes the record wrote
+ */
+int u_record_end(u_record_t* rec);
+#endif
 
+#if UPRINTF_ENABLE_TEXT
 /**
  * @brief Align text within a specified width
  * @param output_cb Character output callback
@@ -319,15 +1179,55 @@ void u_text_transform(u_output_cb_t output_cb, void* ctx, const char* text,
 
 /**
  * @brief Wrap text to specified width with optional prefix
+ * 
+ * Lines break at blanks, '\n' ends a paragraph, and words longer than the
+ * width are split.
+ * 
  * @param output_cb Character output callback
  * @param ctx Context pointer for callback
  * @param text Text to wrap
- * @param width Maximum line width
+ * @param width Maximum line width, excluding the prefix
  * @param prefix Prefix for each line (can be NULL)
  */
 void u_text_wrap(u_output_cb_t output_cb, void* ctx, const char* text, 
                 int width, const char* prefix);
 
+/**
+ * @brief Layout of a block of text for u_text_layout
+ */
+typedef struct {
+    int width;                    /**< Line width, excluding the prefix (<= 0: no wrapping) */
+    u_text_align_t align;         /**< Line alignment; justified lines but a paragraph's last fill the width */
+    u_text_transform_t transform; /**< Applied to the text, not the prefix (not U_TRANSFORM_REVERSE) */
+    const char* prefix;           /**< Written before every line, or NULL */
+    char fill;                    /**< Padding character, '\0' for space */
+    bool pad;                     /**< Also pad after left-aligned and centered lines */
+} u_text_layout_t;
+
+/**
+ * @brief Wrap, align and transform text in one pass
+ * 
+ * Lines are assembled in a UPRINTF_LAYOUT_BUFFER staging buffer and written
+ * one span per line; input of any length needs no more memory than that.
+ * 
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param text Text to lay out
+ * @param layout Layout settings
+ */
+void u_text_layout(u_output_cb_t output_cb, void* ctx, const char* text,
+                   const u_text_layout_t* layout);
+
+/**
+ * @brief u_text_layout writing lines to a span callback
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ * @param text Text to lay out
+ * @param layout Layout settings
+ */
+void u_text_layout_span(u_write_cb_t write_cb, void* ctx, const char* text,
+                        const u_text_layout_t* layout);
+
 /**
  * @brief Format value using a pattern
  * @param output_cb Character output callback
@@ -338,15 +1238,17 @@ void u_text_wrap(u_output_cb_t output_cb, void* ctx, const char* text,
  */
 void u_format_pattern(u_output_cb_t output_cb, void* ctx, const char* pattern, 
                      const char* value, const char* default_pattern);
+#endif
 
 /**
  * @brief Output hook function type
  * @param c Character being output
- * @param ctx Context pointer
+ * @param ctx Context pointer of the sink being written
  * @param user_data User-defined data
  */
 typedef void (*u_output_hook_t)(char c, void* ctx, void* user_data);
 
+#if UPRINTF_ENABLE_HOOKS
 /**
  * @brief Add an output hook for monitoring output
  * @param hook Hook function
@@ -359,6 +1261,7 @@ void u_add_output_hook(u_output_hook_t hook, void* user_data);
  * @param hook Hook function to remove
  */
 void u_remove_output_hook(u_output_hook_t hook);
+#endif
 
 /**
  * @brief Stream processor function type
@@ -368,6 +1271,7 @@ void u_remove_output_hook(u_output_hook_t hook);
  */
 typedef char (*u_stream_processor_t)(char c, void* ctx);
 
+#if UPRINTF_ENABLE_PROCESSORS
 /**
  * @brief Add a stream processor for character transformation
  * @param processor Processor function
@@ -380,12 +1284,136 @@ void u_add_stream_processor(u_stream_processor_t processor, void* ctx);
  * @param processor Processor function to remove
  */
 void u_remove_stream_processor(u_stream_processor_t processor);
+#endif
+
+/**
+ * @brief Block output hook: observes a whole span at once
+ * @param data Span being output
+ * @param len Span length
+ * @param ctx Context pointer of the sink being written
+ * @param user_data User-defined data
+ */
+typedef void (*u_block_hook_t)(const char* data, size_t len, void* ctx, void* user_data);
+
+/**
+ * @brief Block stream processor: transforms a span in place
+ * 
+ * The span may shrink or grow up to `capacity`, which is always at least
+ * twice its length: when an earlier processor grew the text, the rest of
+ * the pipeline runs on it in pieces. Only growth beyond double has to be
+ * truncated.
+ * 
+ * @param data Span to transform
+ * @param len Span length
+ * @param capacity Bytes available at `data`
+ * @param ctx Processor context
+ * @return New span length
+ */
+typedef size_t (*u_block_processor_t)(char* data, size_t len, size_t capacity, void* ctx);
+
+#if UPRINTF_ENABLE_HOOKS
+/**
+ * @brief Add a block output hook; runs in registration order with char hooks
+ * @param hook Hook function
+ * @param user_data User data to pass to hook
+ */
+void u_add_block_hook(u_block_hook_t hook, void* user_data);
+
+/**
+ * @brief Remove a block output hook
+ * @param hook Hook function to remove
+ */
+void u_remove_block_hook(u_block_hook_t hook);
+#endif
+
+#if UPRINTF_ENABLE_PROCESSORS
+/**
+ * @brief Add a block stream processor; runs in registration order with char processors
+ * @param processor Processor function
+ * @param ctx Processor context
+ */
+void u_add_block_processor(u_block_processor_t processor, void* ctx);
+
+/**
+ * @brief Remove a block stream processor
+ * @param processor Processor function to remove
+ */
+void u_remove_block_processor(u_block_processor_t processor);
+
+/**
+ * @brief Built-in processor: ASCII letters to upper case, vectorized
+ * @param data Span to transform
+ * @param len Span length
+ * @param capacity Bytes available (unused)
+ * @param ctx Unused
+ * @return len
+ */
+size_t u_processor_upper(char* data, size_t len, size_t capacity, void* ctx);
+
+/**
+ * @brief Built-in processor: ASCII letters to lower case, vectorized
+ * @param data Span to transform
+ * @param len Span length
+ * @param capacity Bytes available (unused)
+ * @param ctx Unused
+ * @return len
+ */
+size_t u_processor_lower(char* data, size_t len, size_t capacity, void* ctx);
+
+/**
+ * @brief Built-in processor: translate LF to CRLF
+ * @param data Span to transform
+ * @param len Span length
+ * @param capacity Bytes available
+ * @param ctx Unused
+ * @return New span length
+ */
+size_t u_processor_crlf(char* data, size_t len, size_t capacity, void* ctx);
+
+/**
+ * @brief ANSI stripping state, kept across spans
+ */
+typedef struct {
+    int state; /**< 0 text, 1 after ESC, 2 inside a CSI sequence */
+} u_ansi_strip_t;
+
+/**
+ * @brief Built-in processor: remove ANSI escape sequences
+ * @param data Span to transform
+ * @param len Span length
+ * @param capacity Bytes available (unused)
+ * @param ctx u_ansi_strip_t* so sequences may span calls, or NULL
+ * @return New span length
+ */
+size_t u_processor_strip_ansi(char* data, size_t len, size_t capacity, void* ctx);
+#endif
+
+#if UPRINTF_ENABLE_HOOKS
+/**
+ * @brief Update a CRC-32 (IEEE 802.3, as zlib's crc32) over a span
+ * @param crc CRC of the preceding data, 0 to start
+ * @param data Data
+ * @param len Data length
+ * @return CRC including the span
+ */
+uint32_t u_crc32_update(uint32_t crc, const void* data, size_t len);
+
+/**
+ * @brief Built-in block hook: accumulate a CRC-32 of everything output
+ * @param data Span being output
+ * @param len Span length
+ * @param ctx Unused
+ * @param user_data uint32_t* running CRC, 0 to start
+ */
+void u_hook_crc32(const char* data, size_t len, void* ctx, void* user_data);
+#endif
 
 /**
  * @brief State machine structure (opaque)
  */
 typedef struct u_state_machine u_state_machine_t;
 
+#if UPRINTF_ENABLE_STATE_MACHINE
 /**
  * @brief Create a new state machine
  * @return New state machine instance
@@ -414,7 +1442,9 @@ void u_state_machine_transition(u_state_machine_t* sm, const char* state);
  * @param sm State machine to free
  */
 void u_state_machine_free(u_state_machine_t* sm);
+#endif
 
+#if UPRINTF_ENABLE_TERMINAL
 /**
  * @brief Move cursor to specified position
  * @param output_cb Character output callback
@@ -451,7 +1481,9 @@ void u_output_clear_line(u_output_cb_t output_cb, void* ctx);
  * @param ctx Context pointer for callback
  */
 void u_output_clear_screen(u_output_cb_t output_cb, void* ctx);
+#endif
 
+#if UPRINTF_ENABLE_TEXT
 /**
  * @brief Output a character repeated multiple times
  * @param output_cb Character output callback
@@ -472,23 +1504,85 @@ void u_format_repeat(u_output_cb_t output_cb, void* ctx, char c, int count);
  */
 void u_format_fill(u_output_cb_t output_cb, void* ctx, const char* text, 
                   int width, u_text_align_t align, char fill_char);
+#endif
 
+#if UPRINTF_ENABLE_STRING_UTILS
 /**
  * @brief Check if string matches a pattern with wildcards
+ * 
+ * Runs without recursion or backtracking across '*'; see u_pattern_t.
+ * 
  * @param str String to check
  * @param pattern Pattern with wildcards (* and ?)
  * @return true if string matches pattern, false otherwise
  */
 bool u_str_match_pattern(const char* str, const char* pattern);
 
+/**
+ * @brief Pre-scanned wildcard pattern for repeated matching
+ * 
+ * Matching checks the text before the first '*' and after the last one,
+ * then finds each segment in between at its leftmost position. A segment
+ * is never revisited, so adversarial patterns cannot blow up.
+ */
+typedef struct {
+    const char* pattern; /**< Pattern text, must stay valid */
+    size_t length;       /**< Pattern length */
+    size_t prefix_len;   /**< Characters before the first '*' */
+    size_t suffix_len;   /**< Characters after the last '*' */
+    size_t min_len;      /**< Shortest string that can match */
+    bool has_star;       /**< Whether the pattern contains '*' */
+} u_pattern_t;
+
+/**
+ * @brief Pre-scan a wildcard pattern
+ * @param p Pattern object to fill
+ * @param pattern Pattern with wildcards (* and ?)
+ */
+void u_pattern_compile(u_pattern_t* p, const char* pattern);
+
+/**
+ * @brief Match a string against a pre-scanned pattern
+ * @param p Pattern object
+ * @param str String to check
+ * @return true if string matches pattern, false otherwise
+ */
+bool u_pattern_match(const u_pattern_t* p, const char* str);
+
+/**
+ * @brief Match `len` characters (a line of a larger blob, say) against a pattern
+ * @param p Pattern object
+ * @param str Characters to check
+ * @param len Number of characters
+ * @return true if they match the pattern, false otherwise
+ */
+bool u_pattern_match_n(const u_pattern_t* p, const char* str, size_t len);
+
+#if UPRINTF_ENABLE_STRING_BUILDER
 /**
  * @brief Replace all occurrences of a substring
  * @param str Original string
- * @param find Substring to find
- * @param replace Replacement string
- * @return New string with replacements (must be freed by caller)
+ * @param find Substring to find (empty: nothing is replaced)
+ * @param replace Replacement string (NULL: matches are removed)
+ * @return New string with replacements (must be freed by caller), or NULL
  */
 char* u_str_replace(const char* str, const char* find, const char* replace);
+#endif
+
+/**
+ * @brief Replace all occurrences of a substring into a caller buffer
+ * 
+ * One pass over `str`; long substrings are searched with Horspool skips.
+ * 
+ * @param buffer Destination, always terminated when size > 0
+ * @param size Size of the destination
+ * @param str Original string
+ * @param find Substring to find (empty: nothing is replaced)
+ * @param replace Replacement string (NULL: matches are removed)
+ * @return Length of the full result; it was truncated if >= size
+ */
+size_t u_str_replace_buffer(char* buffer, size_t size, const char* str,
+                            const char* find, const char* replace);
 
 /**
  * @brief Trim whitespace from string
@@ -497,1085 +1591,6964 @@ char* u_str_replace(const char* str, const char* find, const char* replace);
  * @param max_len Maximum length of output buffer
  */
 void u_str_trim(const char* str, char* output, size_t max_len);
-
-#ifdef __cplusplus
-}
 #endif
 
-#endif // UPRINTF_H
-
-/******************************************************************************/
-/* IMPLEMENTATION SECTION                                                     */
-/******************************************************************************/
+/**
+ * @brief Pre-parsed template sizes
+ * 
+ * Templates with more parts (literal runs and placeholders) or distinct
+ * variables than this are kept as text and rendered by u_template_format.
+ */
+#ifndef UPRINTF_TEMPLATE_PARTS
+#define UPRINTF_TEMPLATE_PARTS 16
+#endif
 
-#ifdef UPRINTF_IMPLEMENTATION
+#ifndef UPRINTF_TEMPLATE_SLOTS
+#define UPRINTF_TEMPLATE_SLOTS 8
+#endif
 
-#include <string.h>
-#include <stdlib.h>
-#include <ctype.h>
+/**
+ * @brief One literal run or placeholder of a pre-parsed template
+ */
+typedef struct {
+    uint16_t offset;  /**< Start in the template text (the name for placeholders) */
+    uint16_t len;     /**< Length of the run or name */
+    int8_t slot;      /**< Slot index, or -1 for literal text */
+} u_template_part_t;
 
-#ifndef UPRINTF_BUFFER_SIZE
-#define UPRINTF_BUFFER_SIZE 32
-#endif
+/**
+ * @brief Named template split into parts by u_template_load
+ */
+typedef struct {
+    const char* name;                              /**< Template name */
+    const char* tmpl;                              /**< Template text */
+    uint32_t hash;                                 /**< Hash of the name */
+    int part_count;                                /**< Parts, or -1 if not pre-parsed */
+    int slot_count;                                /**< Distinct variables */
+    u_template_part_t parts[UPRINTF_TEMPLATE_PARTS];  /**< Parts in order */
+    uint8_t slot_part[UPRINTF_TEMPLATE_SLOTS];     /**< First part naming each slot */
+} u_template_compiled_t;
 
-#ifndef UPRINTF_MAX_HANDLERS
-#define UPRINTF_MAX_HANDLERS 16
+/**
+ * @brief Formatting context
+ * 
+ * Holds everything the configuration functions change: handlers, locale,
+ * default output, templates, streams, hooks and processors. Each thread or
+ * subsystem can own one. Formatting only reads the context, so threads can
+ * share one without locking as long as nobody reconfigures it meanwhile;
+ * printing to the default output also uses its staging buffer. The global
+ * functions operate on the default context.
+ */
+typedef struct u_context {
+    u_output_cb_t default_output_cb;   /**< Default character sink */
+    u_write_cb_t default_write_cb;     /**< Default span sink (preferred if set) */
+    void* default_ctx;                 /**< Context for the default sink */
+    u_output_buffer_t default_buffer;  /**< Staging buffer for the default sink */
+    char decimal_point;                /**< Decimal point character */
+    bool float_support;                /**< Float conversions enabled */
+#if UPRINTF_ENABLE_HANDLERS
+    u_format_handler_t handlers[128];  /**< Custom handlers indexed by specifier */
+    int handler_count;                 /**< Number of registered handlers */
 #endif
-
-#ifndef UPRINTF_FLOAT_SUPPORT
-#define UPRINTF_FLOAT_SUPPORT 1
+    
+#if UPRINTF_ENABLE_BROADCAST
+    u_output_stream_t streams[16];     /**< Broadcast streams */
+    int stream_count;                  /**< Number of streams */
 #endif
-
-// Internal state
-static struct {
-    u_output_cb_t default_output_cb;
-    void* default_ctx;
-    char decimal_point;
-    bool float_support;
-    struct {
-        char specifier;
-        u_format_handler_t handler;
-    } handlers[UPRINTF_MAX_HANDLERS];
     
-    // Extended state
-    u_output_stream_t streams[16];
-    int stream_count;
+#if UPRINTF_ENABLE_TEMPLATES
+    u_template_compiled_t templates[32]; /**< Named, pre-parsed templates */
+    int template_count;                /**< Number of templates */
+    unsigned char template_index[64];  /**< Name hash index: template + 1, 0 if empty */
+#endif
     
+#if UPRINTF_ENABLE_HOOKS
     struct {
-        const char* name;
-        const char* template;
-    } templates[32];
-    int template_count;
+        u_output_hook_t hook;          /**< Per-character hook, or NULL */
+        u_block_hook_t block;          /**< Block hook, or NULL */
+        void* user_data;
+    } hooks[16];                       /**< Output hooks */
+    int hook_count;                    /**< Number of hooks */
+#endif
     
+#if UPRINTF_ENABLE_PROCESSORS
     struct {
-        u_output_hook_t hook;
-        void* user_data;
-    } hooks[16];
+        u_stream_processor_t processor; /**< Per-character processor, or NULL */
+        u_block_processor_t block;     /**< Block processor, or NULL */
+        void* ctx;
+    } processors[16];                  /**< Stream processors */
+    int processor_count;               /**< Number of processors */
+#endif
+} u_context_t;
+
+/**
+ * @brief Initialize a context with the default configuration
+ * @param context Context to initialize
+ */
+void u_context_init(u_context_t* context);
+
+/**
+ * @brief Get the default context used by the global functions
+ * @return Default context
+ */
+u_context_t* u_context_default(void);
+
+#if UPRINTF_ENABLE_HANDLERS
+/**
+ * @brief Context-aware u_register_format_handler
+ * @param context Context
+ * @param specifier Format specifier character
+ * @param handler Handler function
+ * @return 0 on success, -1 on failure
+ */
+int u_context_register_format_handler(u_context_t* context, char specifier,
+                                      u_format_handler_t handler);
+
+/**
+ * @brief Context-aware u_unregister_format_handler
+ * @param context Context
+ * @param specifier Format specifier character
+ * @return 0 on success, -1 on failure
+ */
+int u_context_unregister_format_handler(u_context_t* context, char specifier);
+#endif
+
+/**
+ * @brief Context-aware u_set_locale
+ * @param context Context
+ * @param locale Locale string (currently only supports decimal point)
+ */
+void u_context_set_locale(u_context_t* context, const char* locale);
+
+/**
+ * @brief Context-aware u_set_float_support
+ * @param context Context
+ * @param enabled True to enable, false to disable
+ */
+void u_context_set_float_support(u_context_t* context, bool enabled);
+
+/**
+ * @brief Context-aware u_set_default_output
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ */
+void u_context_set_default_output(u_context_t* context, u_output_cb_t output_cb, void* ctx);
+
+/**
+ * @brief Context-aware u_set_default_write
+ * @param context Context
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ */
+void u_context_set_default_write(u_context_t* context, u_write_cb_t write_cb, void* ctx);
+
+/**
+ * @brief Context-aware u_set_default_output_buffer
+ * @param context Context
+ * @param storage Staging storage (NULL disables staging)
+ * @param size Storage size
+ */
+void u_context_set_default_output_buffer(u_context_t* context, char* storage, size_t size);
+
+/**
+ * @brief Flush the default staging buffer of a context
+ * @param context Context
+ */
+void u_context_flush(u_context_t* context);
+
+/**
+ * @brief Context-aware u_printf
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_printf(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                     const char* fmt, ...) U_FORMAT_ATTR(4, 5);
+
+/**
+ * @brief Context-aware u_vprintf
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param args Variable arguments list
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_vprintf(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                      const char* fmt, va_list args) U_FORMAT_ATTR(4, 0);
+
+/**
+ * @brief Context-aware u_printf_span
+ * @param context Context
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_printf_span(const u_context_t* context, u_write_cb_t write_cb, void* ctx,
+                          const char* fmt, ...) U_FORMAT_ATTR(4, 5);
+
+/**
+ * @brief Context-aware u_vprintf_span
+ * @param context Context
+ * @param write_cb Span output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param args Variable arguments list
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_vprintf_span(const u_context_t* context, u_write_cb_t write_cb, void* ctx,
+                           const char* fmt, va_list args) U_FORMAT_ATTR(4, 0);
+
+/**
+ * @brief Context-aware u_sprintf
+ * @param context Context
+ * @param buffer Output buffer
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written (excluding null terminator),
+ *         or negative value on error
+ */
+int u_context_sprintf(const u_context_t* context, char* buffer, const char* fmt, ...)
+    U_FORMAT_ATTR(3, 4);
+
+/**
+ * @brief Context-aware u_snprintf
+ * @param context Context
+ * @param buffer Output buffer
+ * @param size Buffer size
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Same as u_snprintf
+ */
+int u_context_snprintf(const u_context_t* context, char* buffer, size_t size,
+                       const char* fmt, ...) U_FORMAT_ATTR(4, 5);
+
+/**
+ * @brief Context-aware u_vsnprintf
+ * @param context Context
+ * @param buffer Output buffer (can be NULL when size is 0)
+ * @param size Buffer size
+ * @param fmt Format string
+ * @param args Variable arguments list
+ * @return Same as u_vsnprintf
+ */
+int u_context_vsnprintf(const u_context_t* context, char* buffer, size_t size,
+                        const char* fmt, va_list args) U_FORMAT_ATTR(4, 0);
+
+/**
+ * @brief Context-aware u_printf_args
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx User context passed to callback
+ * @param fmt Format string
+ * @param args Argument pack
+ * @param count Number of values in the pack
+ * @return Same as u_printf_args
+ */
+int u_context_printf_args(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                          const char* fmt, const u_arg_t* args, int count);
+
+/**
+ * @brief Context-aware u_snprintf_args
+ * @param context Context
+ * @param buffer Output buffer (can be NULL when size is 0)
+ * @param size Buffer size
+ * @param fmt Format string
+ * @param args Argument pack
+ * @param count Number of values in the pack
+ * @return Same as u_snprintf_args
+ */
+int u_context_snprintf_args(const u_context_t* context, char* buffer, size_t size,
+                            const char* fmt, const u_arg_t* args, int count);
+
+/**
+ * @brief Context-aware u_printf_simple
+ * @param context Context
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_printf_simple(u_context_t* context, const char* fmt, ...) U_FORMAT_ATTR(2, 3);
+
+/**
+ * @brief Context-aware u_vprintf_compiled
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param compiled Compiled format
+ * @param args Variable arguments list
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_vprintf_compiled(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                               const u_format_compiled_t* compiled, va_list args);
+
+/**
+ * @brief Context-aware u_printf_ex
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_printf_ex(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                        const char* fmt, ...) U_FORMAT_ATTR(4, 5);
+
+/**
+ * @brief Context-aware u_vprintf_ex
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param fmt Format string
+ * @param args Variable arguments list
+ * @return Number of characters written, or negative value on error
+ */
+int u_context_vprintf_ex(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                         const char* fmt, va_list args) U_FORMAT_ATTR(4, 0);
+
+#if UPRINTF_ENABLE_TEMPLATES
+/**
+ * @brief Context-aware u_template_load
+ * @param context Context
+ * @param name Template name
+ * @param tmpl Template content
+ */
+void u_context_template_load(u_context_t* context, const char* name, const char* tmpl);
+
+/**
+ * @brief Context-aware u_template_format_named
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param name Name of the template to use
+ * @param vars Array of template variables
+ * @param count Number of variables in array
+ */
+void u_context_template_format_named(const u_context_t* context, u_output_cb_t output_cb,
+                                     void* ctx, const char* name,
+                                     const u_template_var_t* vars, int count);
+
+/**
+ * @brief Context-aware u_template_find
+ * @param context Context
+ * @param name Template name
+ * @return Template id, or -1 if not loaded
+ */
+int u_context_template_find(const u_context_t* context, const char* name);
+
+/**
+ * @brief Context-aware u_template_slot
+ * @param context Context
+ * @param id Template id
+ * @param var Variable name
+ * @return Slot index, or -1
+ */
+int u_context_template_slot(const u_context_t* context, int id, const char* var);
+
+/**
+ * @brief Context-aware u_template_render
+ * @param context Context
+ * @param output_cb Character output callback
+ * @param ctx Context pointer for callback
+ * @param id Template id
+ * @param values Value for each slot
+ * @param count Number of values
+ */
+void u_context_template_render(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                               int id, const char* const* values, int count);
+#endif
+
+#if UPRINTF_ENABLE_BROADCAST
+/**
+ * @brief Context-aware u_output_add_stream
+ * @param context Context
+ * @param stream Output stream configuration
+ */
+void u_context_output_add_stream(u_context_t* context, u_output_stream_t stream);
+
+/**
+ * @brief Context-aware u_output_remove_stream
+ * @param context Context
+ * @param output_cb Output callback to remove
+ */
+void u_context_output_remove_stream(u_context_t* context, u_output_cb_t output_cb);
+
+/**
+ * @brief Context-aware u_output_broadcast
+ * @param context Context
+ * @param c Character to broadcast
+ */
+void u_context_output_broadcast(const u_context_t* context, char c);
+
+/**
+ * @brief Context-aware u_output_broadcast_str
+ * @param context Context
+ * @param str String to broadcast
+ */
+void u_context_output_broadcast_str(const u_context_t* context, const char* str);
+
+/**
+ * @brief Context-aware u_output_broadcast_printf
+ * @param context Context
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters formatted, or negative on error
+ */
+int u_context_output_broadcast_printf(const u_context_t* context, const char* fmt, ...)
+    U_FORMAT_ATTR(2, 3);
+
+/**
+ * @brief Context-aware u_output_broadcast_log
+ * @param context Context
+ * @param level Message level
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters formatted, or negative on error
+ */
+int u_context_output_broadcast_log(const u_context_t* context, int level, const char* fmt, ...)
+    U_FORMAT_ATTR(3, 4);
+
+/**
+ * @brief Context-aware u_output_broadcast_vlog
+ * @param context Context
+ * @param level Message level
+ * @param fmt Format string
+ * @param args Argument list
+ * @return Number of characters formatted, or negative on error
+ */
+int u_context_output_broadcast_vlog(const u_context_t* context, int level,
+                                    const char* fmt, va_list args);
+
+/**
+ * @brief Context-aware u_output_broadcast_args
+ * @param context Context
+ * @param fmt Format string
+ * @param args Argument pack
+ * @param count Number of values in the pack
+ * @return Number of characters formatted, or negative on error
+ */
+int u_context_output_broadcast_args(const u_context_t* context, const char* fmt,
+                                    const u_arg_t* args, int count);
+
+/**
+ * @brief Context-aware u_output_broadcast_flush
+ * @param context Context
+ */
+void u_context_output_broadcast_flush(const u_context_t* context);
+#endif
+
+#if UPRINTF_ENABLE_HOOKS
+/**
+ * @brief Context-aware u_add_output_hook
+ * @param context Context
+ * @param hook Hook function
+ * @param user_data User data to pass to hook
+ */
+void u_context_add_output_hook(u_context_t* context, u_output_hook_t hook, void* user_data);
+
+/**
+ * @brief Context-aware u_remove_output_hook
+ * @param context Context
+ * @param hook Hook function to remove
+ */
+void u_context_remove_output_hook(u_context_t* context, u_output_hook_t hook);
+#endif
+
+#if UPRINTF_ENABLE_PROCESSORS
+/**
+ * @brief Context-aware u_add_stream_processor
+ * @param context Context
+ * @param processor Processor function
+ * @param ctx Processor context
+ */
+void u_context_add_stream_processor(u_context_t* context, u_stream_processor_t processor,
+                                    void* ctx);
+
+/**
+ * @brief Context-aware u_remove_stream_processor
+ * @param context Context
+ * @param processor Processor function to remove
+ */
+void u_context_remove_stream_processor(u_context_t* context, u_stream_processor_t processor);
+#endif
+
+#if UPRINTF_ENABLE_HOOKS
+/**
+ * @brief Context-aware u_add_block_hook
+ * @param context Context
+ * @param hook Hook function
+ * @param user_data User data to pass to hook
+ */
+void u_context_add_block_hook(u_context_t* context, u_block_hook_t hook, void* user_data);
+
+/**
+ * @brief Context-aware u_remove_block_hook
+ * @param context Context
+ * @param hook Hook function to remove
+ */
+void u_context_remove_block_hook(u_context_t* context, u_block_hook_t hook);
+#endif
+
+#if UPRINTF_ENABLE_PROCESSORS
+/**
+ * @brief Context-aware u_add_block_processor
+ * @param context Context
+ * @param processor Processor function
+ * @param ctx Processor context
+ */
+void u_context_add_block_processor(u_context_t* context, u_block_processor_t processor,
+                                   void* ctx);
+
+/**
+ * @brief Context-aware u_remove_block_processor
+ * @param context Context
+ * @param processor Processor function to remove
+ */
+void u_context_remove_block_processor(u_context_t* context, u_block_processor_t processor);
+#endif
+
+/*
+ * Performance counters
+ * 
+ * Compiled in with UPRINTF_STATS=1; otherwise every counting site expands
+ * to nothing and u_stats_get reports zeros. Counters are global and plain,
+ * so counts from concurrent callers are best effort. Diff two snapshots
+ * for the cost of a single call.
+ */
+
+/**
+ * @brief Clock for timing counters, in any monotonic unit (cycles, ticks, ns)
+ * @return Current time
+ */
+typedef uint64_t (*u_stats_clock_t)(void);
+
+/**
+ * @brief Cumulative counters
+ */
+typedef struct {
+    uint64_t conversions[128]; /**< Conversions rendered, by specifier character */
+    uint64_t bytes;            /**< Bytes the engine emitted */
+    uint64_t callbacks;        /**< Output callback invocations */
+    uint64_t truncations;      /**< u_snprintf / u_vsnprintf results that did not fit */
+    uint64_t handler_hits;     /**< Conversions dispatched to custom handlers */
+    uint64_t processor_time;   /**< Clock time in stream processors */
+    uint64_t hook_time;        /**< Clock time in output hooks */
+    uint64_t stream_drops;     /**< Async and deferred messages dropped or cut */
+} u_stats_t;
+
+/**
+ * @brief Copy the counters
+ * @param stats Destination
+ */
+void u_stats_get(u_stats_t* stats);
+
+/**
+ * @brief Zero the counters
+ */
+void u_stats_reset(void);
+
+/**
+ * @brief Set the clock used for processor and hook time
+ * @param clock Clock function, or NULL to stop timing
+ */
+void u_stats_set_clock(u_stats_clock_t clock);
+
+#ifdef UPRINTF_ASYNC
+/*
+ * Asynchronous output
+ * 
+ * Producers on any thread format straight into a slot of a lock-free
+ * multi-producer ring; a single consumer (a thread on hosted targets, an
+ * ISR or idle hook on bare metal) later drains the slots in order to the
+ * streams of the ring's context. Needs C11 atomics.
+ */
+#if defined(__cplusplus) || !defined(__STDC_VERSION__) || __STDC_VERSION__ < 201112L || \
+    defined(__STDC_NO_ATOMICS__)
+#error "UPRINTF_ASYNC requires C11 atomics"
+#endif
+
+#if !UPRINTF_ENABLE_BROADCAST
+#error "UPRINTF_ASYNC drains to broadcast streams and needs UPRINTF_ENABLE_BROADCAST"
+#endif
+
+#include <stdatomic.h>
+
+#ifndef UPRINTF_ASYNC_MESSAGE_SIZE
+#define UPRINTF_ASYNC_MESSAGE_SIZE 120
+#endif
+
+/**
+ * @brief One message slot of an async ring
+ */
+typedef struct {
+    atomic_size_t seq;                      /**< Turn counter (internal) */
+    size_t len;                             /**< Message length */
+    char data[UPRINTF_ASYNC_MESSAGE_SIZE];  /**< Formatted message */
+} u_async_slot_t;
+
+/**
+ * @brief Multi-producer, single-consumer message ring
+ * 
+ * Initialize with u_async_init; the fields are internal.
+ */
+typedef struct {
+    u_async_slot_t* slots;          /**< Slot storage */
+    size_t mask;                    /**< Slot count - 1 */
+    const u_context_t* context;     /**< Formatting configuration and streams */
+    bool blocking;                  /**< Wait for space instead of dropping */
+    void (*wait)(void* wait_ctx);   /**< Called while a blocking producer waits */
+    void* wait_ctx;                 /**< Context for wait */
+    atomic_ulong dropped;           /**< Messages lost because the ring was full */
+    atomic_ulong overruns;          /**< Messages cut to the slot size */
+    char pad[64];                   /**< Keeps producers and consumer apart */
+    atomic_size_t head;             /**< Next slot to claim (producers) */
+    char pad2[64];
+    size_t tail;                    /**< Next slot to drain (consumer) */
+} u_async_ring_t;
+
+/**
+ * @brief Initialize an async ring over caller-provided slots
+ * @param ring Ring to initialize
+ * @param slots Slot storage
+ * @param count Number of slots, a power of two
+ * @param context Context whose configuration and streams are used (NULL for the default)
+ * @param blocking Wait for space when full instead of dropping the message
+ * @return 0 on success, -1 on invalid arguments
+ */
+int u_async_init(u_async_ring_t* ring, u_async_slot_t* slots, size_t count,
+                 const u_context_t* context, bool blocking);
+
+/**
+ * @brief Set what a blocking producer does while the ring is full
+ * 
+ * Without one the producer spins. When the consumer is not a separate
+ * thread, the callback may drain the ring itself, as long as only one
+ * caller drains at a time.
+ * 
+ * @param ring Ring
+ * @param wait Wait callback (e.g. a yield)
+ * @param wait_ctx Context for the callback
+ */
+void u_async_set_wait(u_async_ring_t* ring, void (*wait)(void* wait_ctx), void* wait_ctx);
+
+/**
+ * @brief Format a message into the ring
+ * @param ring Ring
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters queued, or -1 if the message was dropped
+ */
+int u_async_printf(u_async_ring_t* ring, const char* fmt, ...) U_FORMAT_ATTR(2, 3);
+
+/**
+ * @brief Format a message into the ring with a va_list
+ * @param ring Ring
+ * @param fmt Format string
+ * @param args Argument list
+ * @return Number of characters queued, or -1 if the message was dropped
+ */
+int u_async_vprintf(u_async_ring_t* ring, const char* fmt, va_list args);
+
+/**
+ * @brief Emit queued messages to the context's streams
+ * 
+ * Only one caller may drain a ring at a time.
+ * 
+ * @param ring Ring
+ * @param max_messages Maximum number of messages to drain, 0 for all ready ones
+ * @return Number of messages drained
+ */
+size_t u_async_drain(u_async_ring_t* ring, size_t max_messages);
+
+/**
+ * @brief Consumer loop for a dedicated drain thread
+ * 
+ * Drains until *stop is set, then once more, so every message queued
+ * before the stop reaches the streams. The library starts no threads:
+ * call this from the body of a thread or task the caller creates
+ * (pthread_create, thrd_create, an RTOS task). idle runs after each pass
+ * that found the ring empty, e.g. a short sleep or a wait on a semaphore
+ * the producers post; without one the loop spins.
+ * 
+ * @param ring Ring
+ * @param stop Flag another thread sets to end the loop
+ * @param idle Called when the ring is empty, or NULL
+ * @param idle_ctx Context for idle
+ */
+void u_async_run(u_async_ring_t* ring, const atomic_bool* stop,
+                 void (*idle)(void* idle_ctx), void* idle_ctx);
+
+/**
+ * @brief Number of messages lost because the ring was full
+ * @param ring Ring
+ * @return Drop counter
+ */
+unsigned long u_async_dropped(const u_async_ring_t* ring);
+
+/**
+ * @brief Number of messages cut to UPRINTF_ASYNC_MESSAGE_SIZE characters
+ * 
+ * Slots hold a length and are not NUL-terminated, so the whole slot is text.
+ * 
+ * @param ring Ring
+ * @return Overrun counter
+ */
+unsigned long u_async_overruns(const u_async_ring_t* ring);
+#endif // UPRINTF_ASYNC
+
+/*
+ * Deferred logging
+ * 
+ * The hot path only records the format pointer and the raw argument bytes
+ * (strings by value) into a binary log; formatting happens when the log is
+ * drained, on another core or later from a dump made by the same binary.
+ * One producer and one consumer per log. With UPRINTF_ASYNC the indices
+ * are C11 atomics, so the two may run on different cores.
+ */
+#ifndef UPRINTF_DEFERRED_RECORD_SIZE
+#define UPRINTF_DEFERRED_RECORD_SIZE 256
+#endif
+
+#ifdef UPRINTF_ASYNC
+typedef atomic_size_t u_sync_size_t;
+#else
+typedef volatile size_t u_sync_size_t;
+#endif
+
+/**
+ * @brief Binary log of deferred records
+ * 
+ * Initialize with u_deferred_init; the fields are internal.
+ */
+typedef struct {
+    unsigned char* data;         /**< Record storage */
+    size_t mask;                 /**< Storage size - 1 */
+    const u_context_t* context;  /**< Configuration used when rendering */
+    u_sync_size_t head;          /**< Bytes written (producer) */
+    u_sync_size_t tail;          /**< Bytes consumed (consumer) */
+    u_sync_size_t dropped;       /**< Records lost because the log was full */
+} u_deferred_log_t;
+
+#if UPRINTF_ENABLE_DEFERRED
+/**
+ * @brief Initialize a deferred log over caller-provided storage
+ * @param log Log to initialize
+ * @param storage Record storage
+ * @param size Storage size in bytes, a power of two
+ * @param context Context used when rendering (NULL for the default)
+ * @return 0 on success, -1 on invalid arguments
+ */
+int u_deferred_init(u_deferred_log_t* log, void* storage, size_t size,
+                    const u_context_t* context);
+
+/**
+ * @brief Record a message without formatting it
+ * 
+ * The format must stay valid until the record is drained (a literal).
+ * %n and custom specifiers are rejected, since their arguments cannot be
+ * captured.
+ * 
+ * @param log Log
+ * @param fmt Format string
+ * @param ... Arguments to capture
+ * @return Bytes recorded, or -1 if the format is not supported, the record
+ *         exceeds UPRINTF_DEFERRED_RECORD_SIZE or the log is full
+ */
+int u_deferred_printf(u_deferred_log_t* log, const char* fmt, ...) U_FORMAT_ATTR(2, 3);
+
+/**
+ * @brief Record a message with a va_list
+ * @param log Log
+ * @param fmt Format string
+ * @param args Argument list
+ * @return Bytes recorded, or -1 on failure
+ */
+int u_deferred_vprintf(u_deferred_log_t* log, const char* fmt, va_list args);
+
+/**
+ * @brief Format recorded messages
+ * @param log Log
+ * @param output_cb Output callback
+ * @param ctx Context for the callback
+ * @param max_records Maximum number of records, 0 for all
+ * @return Number of records rendered
+ */
+size_t u_deferred_drain(u_deferred_log_t* log, u_output_cb_t output_cb, void* ctx,
+                        size_t max_records);
+
+/**
+ * @brief Number of records lost because the log was full
+ * @param log Log
+ * @return Drop counter
+ */
+size_t u_deferred_dropped(const u_deferred_log_t* log);
+#endif
+
+/*
+ * Scatter/gather output
+ * 
+ * Renders into a list of {pointer, length} segments for writev, sendmsg or a
+ * DMA descriptor chain. Format literals, string arguments and template text
+ * are referenced where they live, padding points at constant runs of
+ * spaces or zeros; converted numbers and short spans are copied into a
+ * caller-provided scratch area. The referenced memory and the scratch area
+ * must stay valid until the list is sent.
+ */
+#ifndef UPRINTF_IOV_MIN_REF
+#define UPRINTF_IOV_MIN_REF 8
+#endif
+
+/**
+ * @brief One output segment, laid out like POSIX struct iovec
+ */
+typedef struct {
+    const void* base;  /**< Start of the segment */
+    size_t len;        /**< Length in bytes */
+} u_iovec_t;
+
+/**
+ * @brief Segment list being rendered into
+ */
+typedef struct {
+    u_iovec_t* iov;       /**< Segment storage */
+    int capacity;         /**< Segments available */
+    int count;            /**< Segments used */
+    char* scratch;        /**< Storage for copied bytes */
+    size_t scratch_size;  /**< Scratch size */
+    size_t scratch_used;  /**< Scratch bytes used */
+    size_t min_ref;       /**< Spans shorter than this are copied (UPRINTF_IOV_MIN_REF) */
+    size_t total;         /**< Bytes described by the list */
+    bool overflow;        /**< The last call ran out of segments or scratch */
+} u_iov_list_t;
+
+#if UPRINTF_ENABLE_IOV
+/**
+ * @brief Initialize an empty segment list
+ * @param list List to initialize
+ * @param iov Segment storage
+ * @param capacity Number of segments
+ * @param scratch Storage for copied bytes
+ * @param scratch_size Scratch size
+ */
+void u_iov_init(u_iov_list_t* list, u_iovec_t* iov, int capacity,
+                char* scratch, size_t scratch_size);
+
+/**
+ * @brief Empty a list so it can be reused
+ * @param list List
+ */
+void u_iov_reset(u_iov_list_t* list);
+
+/**
+ * @brief Append formatted output as segments
+ * 
+ * If the segments or the scratch area run out, nothing is appended.
+ * 
+ * @param list List
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_iov_printf(u_iov_list_t* list, const char* fmt, ...) U_FORMAT_ATTR(2, 3);
+
+/**
+ * @brief Append formatted output as segments with a va_list
+ * @param list List
+ * @param fmt Format string
+ * @param args Argument list
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_iov_vprintf(u_iov_list_t* list, const char* fmt, va_list args);
+
+#if UPRINTF_ENABLE_TEMPLATES
+/**
+ * @brief Append a loaded template with values bound by slot
+ * @param list List
+ * @param id Template id from u_template_find
+ * @param values Value for each slot
+ * @param count Number of values
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_iov_template_render(u_iov_list_t* list, int id, const char* const* values, int count);
+
+/**
+ * @brief Append a named template with variables
+ * @param list List
+ * @param name Name of the template to use
+ * @param vars Array of template variables
+ * @param count Number of variables in array
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_iov_template_format_named(u_iov_list_t* list, const char* name,
+                                const u_template_var_t* vars, int count);
+#endif
+
+/**
+ * @brief Context-aware u_iov_vprintf
+ * @param context Context
+ * @param list List
+ * @param fmt Format string
+ * @param args Argument list
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_context_iov_vprintf(const u_context_t* context, u_iov_list_t* list,
+                          const char* fmt, va_list args);
+
+/**
+ * @brief Context-aware u_iov_printf
+ * @param context Context
+ * @param list List
+ * @param fmt Format string
+ * @param ... Arguments to format
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_context_iov_printf(const u_context_t* context, u_iov_list_t* list,
+                         const char* fmt, ...) U_FORMAT_ATTR(3, 4);
+
+#if UPRINTF_ENABLE_TEMPLATES
+/**
+ * @brief Context-aware u_iov_template_render
+ * @param context Context
+ * @param list List
+ * @param id Template id
+ * @param values Value for each slot
+ * @param count Number of values
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_context_iov_template_render(const u_context_t* context, u_iov_list_t* list, int id,
+                                  const char* const* values, int count);
+
+/**
+ * @brief Context-aware u_iov_template_format_named
+ * @param context Context
+ * @param list List
+ * @param name Name of the template to use
+ * @param vars Array of template variables
+ * @param count Number of variables in array
+ * @return Number of characters appended, or -1 on overflow or error
+ */
+int u_context_iov_template_format_named(const u_context_t* context, u_iov_list_t* list,
+                                        const char* name, const u_template_var_t* vars,
+                                        int count);
+#endif
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Checked call-site macros
+ * 
+ *   U_PRINTF(output_cb, ctx, "x=%d y=%s\n", x, name);
+ *   U_PRINTF_SIMPLE("x=%d\n", x);
+ * 
+ * Each call site keeps its own compiled format, so the format is parsed
+ * once, and passes the static types of its arguments along: a mismatch is
+ * rejected instead of reaching va_arg. C++14 checks literal formats at
+ * compile time. C11 _Generic only captures the types; the format is checked
+ * against them on the first call of the site, which then prints nothing
+ * and reports it through UPRINTF_ON_MISMATCH. Up to 16 arguments follow
+ * the format; both are statements.
+ */
+#define U_PP_CAT_(a, b) a##b
+#define U_PP_CAT(a, b) U_PP_CAT_(a, b)
+#define U_PP_EXPAND(x) x
+#define U_PP_NARGS(...) U_PP_EXPAND(U_PP_NARGS_(__VA_ARGS__, 17, 16, 15, 14, 13, 12, 11, 10, \
+                                                  9, 8, 7, 6, 5, 4, 3, 2, 1, 0))
+#define U_PP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, \
+                    _16, _17, n, ...) n
+#define U_PP_FIRST(...) U_PP_EXPAND(U_PP_FIRST_(__VA_ARGS__, 0))
+#define U_PP_FIRST_(first, ...) first
+
+#define U_ARG_TAGS(...) U_PP_EXPAND(U_PP_CAT(U_ARG_TAGS_, U_PP_NARGS(__VA_ARGS__))(__VA_ARGS__))
+#define U_ARG_TAGS_1(a) U_ARG_TAG(a)
+#define U_ARG_TAGS_2(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_1(__VA_ARGS__))
+#define U_ARG_TAGS_3(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_2(__VA_ARGS__))
+#define U_ARG_TAGS_4(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_3(__VA_ARGS__))
+#define U_ARG_TAGS_5(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_4(__VA_ARGS__))
+#define U_ARG_TAGS_6(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_5(__VA_ARGS__))
+#define U_ARG_TAGS_7(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_6(__VA_ARGS__))
+#define U_ARG_TAGS_8(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_7(__VA_ARGS__))
+#define U_ARG_TAGS_9(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_8(__VA_ARGS__))
+#define U_ARG_TAGS_10(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_9(__VA_ARGS__))
+#define U_ARG_TAGS_11(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_10(__VA_ARGS__))
+#define U_ARG_TAGS_12(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_11(__VA_ARGS__))
+#define U_ARG_TAGS_13(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_12(__VA_ARGS__))
+#define U_ARG_TAGS_14(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_13(__VA_ARGS__))
+#define U_ARG_TAGS_15(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_14(__VA_ARGS__))
+#define U_ARG_TAGS_16(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_15(__VA_ARGS__))
+#define U_ARG_TAGS_17(a, ...) U_ARG_TAG(a), U_PP_EXPAND(U_ARG_TAGS_16(__VA_ARGS__))
+
+#if defined(__cplusplus) && (__cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L))
+#include <type_traits>
+
+namespace u_detail {
+
+template <typename T> struct arg_tag {
+    static constexpr unsigned char value =
+        std::is_enum<T>::value ? U_ARG_INT :
+        (std::is_pointer<T>::value || std::is_null_pointer<T>::value) ? U_ARG_PTR : U_ARG_OTHER;
+};
+
+#define U_ARG_TAG_OF(type, tag) \
+    template <> struct arg_tag<type> { static constexpr unsigned char value = tag; };
+U_ARG_TAG_OF(bool, U_ARG_INT)
+U_ARG_TAG_OF(char, U_ARG_INT)
+U_ARG_TAG_OF(signed char, U_ARG_INT)
+U_ARG_TAG_OF(unsigned char, U_ARG_INT)
+U_ARG_TAG_OF(short, U_ARG_INT)
+U_ARG_TAG_OF(unsigned short, U_ARG_INT)
+U_ARG_TAG_OF(int, U_ARG_INT)
+U_ARG_TAG_OF(unsigned int, U_ARG_UINT)
+U_ARG_TAG_OF(long, U_ARG_LONG)
+U_ARG_TAG_OF(unsigned long, U_ARG_ULONG)
+U_ARG_TAG_OF(long long, U_ARG_LLONG)
+U_ARG_TAG_OF(unsigned long long, U_ARG_ULLONG)
+U_ARG_TAG_OF(float, U_ARG_DOUBLE)
+U_ARG_TAG_OF(double, U_ARG_DOUBLE)
+U_ARG_TAG_OF(long double, U_ARG_LDOUBLE)
+U_ARG_TAG_OF(char*, U_ARG_STR)
+U_ARG_TAG_OF(const char*, U_ARG_STR)
+#undef U_ARG_TAG_OF
+
+template <typename... A> struct types {};
+template <typename... A> types<typename std::decay<A>::type...> arg_types(A&&...);
+
+constexpr int tag_size(unsigned char tag) {
+    return tag == U_ARG_INT || tag == U_ARG_UINT ? (int)sizeof(int) :
+           tag == U_ARG_LONG || tag == U_ARG_ULONG ? (int)sizeof(long) :
+           tag == U_ARG_LLONG || tag == U_ARG_ULLONG ? (int)sizeof(long long) : 0;
+}
+
+// 1 if the tag fits the conversion, 0 if not, -1 for non-standard specifiers
+constexpr int tag_fits(char conv, int length, unsigned char tag) {
+    switch (conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            if (length <= 0) return tag == U_ARG_INT || tag == U_ARG_UINT;
+            if (length == 1) return tag == U_ARG_LONG || tag == U_ARG_ULONG;
+            if (length == 2) return tag == U_ARG_LLONG || tag == U_ARG_ULLONG;
+            if (length == 3) return tag_size(tag) == (int)sizeof(size_t);
+            if (length == 4) return tag_size(tag) == (int)sizeof(ptrdiff_t);
+            if (length == 5) return tag_size(tag) == (int)sizeof(intmax_t);
+            return 0;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        case 'a': case 'A': case 'r': case 'R':
+            return length == 6 ? tag == U_ARG_LDOUBLE : tag == U_ARG_DOUBLE;
+        case 's':
+            return tag == U_ARG_STR;
+        case 'p':
+            return tag == U_ARG_PTR || tag == U_ARG_STR;
+        case 'S':
+        case 'n':
+            return tag == U_ARG_PTR;
+        default:
+            return -1;
+    }
+}
+
+constexpr bool format_matches(const char* f, const unsigned char* tags, int count) {
+    int used = 0;
+    while (*f) {
+        if (*f++ != '%') continue;
+        while (*f == '-' || *f == '+' || *f == ' ' || *f == '0' || *f == '#') f++;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*f != '.') break;
+                f++;
+            }
+            if (*f == '*') {
+                if (used >= count || tags[used++] != U_ARG_INT) return false;
+                f++;
+            }
+            while (*f >= '0' && *f <= '9') f++;
+        }
+        
+        int length = 0;
+        if (*f == 'h') length = f[1] == 'h' ? -2 : -1;
+        else if (*f == 'l') length = f[1] == 'l' ? 2 : 1;
+        else if (*f == 'z') length = 3;
+        else if (*f == 't') length = 4;
+        else if (*f == 'j') length = 5;
+        else if (*f == 'L') length = 6;
+        f += length == -2 || length == 2 ? 2 : length ? 1 : 0;
+        
+        char conv = *f;
+        if (!conv) return false;
+        f++;
+        if (conv == '%') continue;
+        
+        int fit = tag_fits(conv, length, used < count ? tags[used] : (unsigned char)U_ARG_OTHER);
+        if (fit < 0) return true; // Custom handler: argument use is unknown
+        if (!fit || used >= count) return false;
+        used++;
+    }
+    return used == count;
+}
+
+template <typename F, typename... A> constexpr bool check(types<F, A...>, const char* fmt) {
+    constexpr unsigned char tags[] = {arg_tag<A>::value..., U_ARG_OTHER};
+    return format_matches(fmt, tags, (int)sizeof...(A));
+}
+
+} // namespace u_detail
+
+#define U_ARG_TAG(x) u_detail::arg_tag<typename std::decay<decltype(x)>::type>::value
+#define U_FORMAT_STATIC_CHECK(...) \
+    static_assert(u_detail::check(decltype(u_detail::arg_types(__VA_ARGS__))(), \
+                                  U_PP_FIRST(__VA_ARGS__)), \
+                  "uprintf: arguments do not match the format")
+#elif !defined(__cplusplus) && defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define U_ARG_TAG(x) _Generic((x), \
+    _Bool: U_ARG_INT, char: U_ARG_INT, signed char: U_ARG_INT, unsigned char: U_ARG_INT, \
+    short: U_ARG_INT, unsigned short: U_ARG_INT, int: U_ARG_INT, unsigned int: U_ARG_UINT, \
+    long: U_ARG_LONG, unsigned long: U_ARG_ULONG, \
+    long long: U_ARG_LLONG, unsigned long long: U_ARG_ULLONG, \
+    float: U_ARG_DOUBLE, double: U_ARG_DOUBLE, long double: U_ARG_LDOUBLE, \
+    char*: U_ARG_STR, const char*: U_ARG_STR, default: U_ARG_PTR)
+#define U_FORMAT_STATIC_CHECK(...) ((void)0)
+#endif
+
+#ifdef U_ARG_TAG
+#define U_PRINTF(output_cb, ctx, ...) do { \
+    U_FORMAT_STATIC_CHECK(__VA_ARGS__); \
+    static u_format_cache_t u_site_cache_; \
+    static const unsigned char u_site_tags_[] = {U_ARG_TAGS(__VA_ARGS__)}; \
+    u_printf_cached(&u_site_cache_, u_site_tags_ + 1, (int)sizeof(u_site_tags_) - 1, \
+                    output_cb, ctx, __VA_ARGS__); \
+} while (0)
+#define U_PRINTF_SIMPLE(...) do { \
+    U_FORMAT_STATIC_CHECK(__VA_ARGS__); \
+    static u_format_cache_t u_site_cache_; \
+    static const unsigned char u_site_tags_[] = {U_ARG_TAGS(__VA_ARGS__)}; \
+    u_printf_simple_cached(&u_site_cache_, u_site_tags_ + 1, (int)sizeof(u_site_tags_) - 1, \
+                           __VA_ARGS__); \
+} while (0)
+#else
+// No type information before C11 / C++14: plain calls
+#define U_PRINTF(output_cb, ctx, ...) ((void)u_printf(output_cb, ctx, __VA_ARGS__))
+#define U_PRINTF_SIMPLE(...) ((void)u_printf_simple(__VA_ARGS__))
+#endif
+
+#endif // UPRINTF_H
+
+/******************************************************************************/
+/* IMPLEMENTATION SECTION                                                     */
+/******************************************************************************/
+
+#ifdef UPRINTF_IMPLEMENTATION
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+
+#ifndef UPRINTF_BUFFER_SIZE
+#define UPRINTF_BUFFER_SIZE 32
+#endif
+
+#ifndef UPRINTF_MAX_HANDLERS
+#define UPRINTF_MAX_HANDLERS 16
+#endif
+
+#ifndef UPRINTF_FLOAT_SUPPORT
+#define UPRINTF_FLOAT_SUPPORT U_ENABLE_DEFAULT
+#endif
+
+// Float engines: the small one keeps code size down, the full one is exact
+#define UPRINTF_FLOAT_ENGINE_SMALL 0
+#define UPRINTF_FLOAT_ENGINE_FULL 1
+
+#ifndef UPRINTF_FLOAT_ENGINE
+#define UPRINTF_FLOAT_ENGINE UPRINTF_FLOAT_ENGINE_FULL
+#endif
+
+#ifndef UPRINTF_SNPRINTF_C99
+#define UPRINTF_SNPRINTF_C99 0
+#endif
+
+#ifndef UPRINTF_BROADCAST_BUFFER_SIZE
+#define UPRINTF_BROADCAST_BUFFER_SIZE 128
+#endif
+
+#ifndef UPRINTF_MAX_POSITIONAL
+#define UPRINTF_MAX_POSITIONAL 16
+#endif
+
+#ifndef UPRINTF_SOURCE_CHUNK
+#define UPRINTF_SOURCE_CHUNK 128
+#endif
+
+#ifndef UPRINTF_TIME_TICK_HZ
+#define UPRINTF_TIME_TICK_HZ 1000
+#endif
+
+#ifndef UPRINTF_PIPELINE_CHUNK
+#define UPRINTF_PIPELINE_CHUNK 64
+#endif
+
+#ifndef UPRINTF_LAYOUT_BUFFER
+#define UPRINTF_LAYOUT_BUFFER 128
+#endif
+
+#ifndef UPRINTF_STATS
+#define UPRINTF_STATS 0
+#endif
+
+// Counting sites; compiled out entirely without UPRINTF_STATS
+#if UPRINTF_STATS
+static u_stats_t u_stats;
+static u_stats_clock_t u_stats_clock;
+#define U_STAT_ADD(field, n) (u_stats.field += (uint64_t)(n))
+#define U_STAT_TIME_BEGIN(t) uint64_t t = u_stats_clock ? u_stats_clock() : 0
+#define U_STAT_TIME_END(field, t) \
+    do { if (u_stats_clock) u_stats.field += u_stats_clock() - (t); } while (0)
+#else
+#define U_STAT_ADD(field, n) ((void)0)
+#define U_STAT_TIME_BEGIN(t) ((void)0)
+#define U_STAT_TIME_END(field, t) ((void)0)
+#endif
+
+// Scanning kernels: 0 keeps plain byte loops, 1 scans a word at a time and
+// uses SSE2 or NEON when the target has them
+#ifndef UPRINTF_SIMD
+#define UPRINTF_SIMD 1
+#endif
+
+#if UPRINTF_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#define U_SCAN_SSE2 1
+#define U_SCAN_ALIGN 16
+#elif UPRINTF_SIMD && defined(__ARM_NEON) && defined(__BYTE_ORDER__) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define U_SCAN_NEON 1
+#define U_SCAN_ALIGN 16
+#else
+#define U_SCAN_ALIGN 8
+#endif
+
+// Default context behind the global functions
+static u_context_t u_state = {
+    .default_output_cb = NULL,
+    .default_write_cb = NULL,
+    .default_ctx = NULL,
+    .default_buffer = {NULL, 0, 0, NULL, NULL, NULL, true},
+    .decimal_point = '.',
+    .float_support = UPRINTF_FLOAT_SUPPORT ? true : false
+};
+
+void u_context_init(u_context_t* context) {
+    if (!context) return;
+    memset(context, 0, sizeof(*context));
+    context->default_buffer.auto_flush = true;
+    context->decimal_point = '.';
+    context->float_support = UPRINTF_FLOAT_SUPPORT ? true : false;
+}
+
+u_context_t* u_context_default(void) {
+    return &u_state;
+}
+
+#ifdef UPRINTF_STATIC_HANDLERS
+// Dispatch table fixed at compile time so it can live in flash, e.g.
+//   #define UPRINTF_STATIC_HANDLERS U_STATIC_HANDLER('T', timer_handler)
+#define U_STATIC_HANDLER(specifier, handler) [(unsigned char)(specifier) & 0x7F] = (handler),
+static const u_format_handler_t u_static_handlers[128] = {UPRINTF_STATIC_HANDLERS};
+#endif
+
+// Custom handler registered for a specifier, or NULL
+static u_format_handler_t u_find_handler(const u_context_t* context, char specifier) {
+    unsigned char index = (unsigned char)specifier;
+    if (index >= 128) return NULL;
+#ifdef UPRINTF_STATIC_HANDLERS
+    (void)context;
+    return u_static_handlers[index];
+#elif UPRINTF_ENABLE_HANDLERS
+    return context->handler_count ? context->handlers[index] : NULL;
+#else
+    (void)context;
+    return NULL;
+#endif
+}
+
+// Internal functions
+
+// Scanning kernels. Wide loads are aligned, so they never cross into an
+// unmapped page, but the last one may read past the terminator within its
+// block; address sanitizers are told that is intended.
+#if defined(__GNUC__) || defined(__clang__)
+#define U_SCAN_FN __attribute__((no_sanitize_address))
+typedef uint64_t __attribute__((may_alias)) u_scan_word_t;
+#else
+#define U_SCAN_FN
+typedef uint64_t u_scan_word_t;
+#endif
+
+#define U_SWAR_ONES 0x0101010101010101ull
+#define U_SWAR_HIGH 0x8080808080808080ull
+
+// Nonzero if any byte of x is zero
+static inline uint64_t u_swar_zero(uint64_t x) {
+    return (x - U_SWAR_ONES) & ~x & U_SWAR_HIGH;
+}
+
+// First `c` or terminator at or after s
+U_SCAN_FN static const char* u_scan_until(const char* s, char c) {
+#if UPRINTF_SIMD
+    // Short runs end before the first aligned block
+    while ((uintptr_t)s & (U_SCAN_ALIGN - 1)) {
+        if (*s == c || !*s) return s;
+        s++;
+    }
+#if defined(U_SCAN_SSE2)
+    const __m128i vc = _mm_set1_epi8(c);
+    const __m128i zero = _mm_setzero_si128();
+    for (;; s += 16) {
+        __m128i v = _mm_load_si128((const __m128i*)s);
+        int hit = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero),
+                                                 _mm_cmpeq_epi8(v, vc)));
+        if (hit) return s + __builtin_ctz((unsigned)hit);
+    }
+#elif defined(U_SCAN_NEON)
+    const uint8x16_t vc = vdupq_n_u8((uint8_t)c);
+    const uint8x16_t zero = vdupq_n_u8(0);
+    for (;; s += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)s);
+        uint8x16_t hit = vorrq_u8(vceqq_u8(v, zero), vceqq_u8(v, vc));
+        // Narrow to four bits per byte so the mask fits one 64-bit lane
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (bits) return s + (__builtin_ctzll(bits) >> 2);
+    }
+#else
+    const uint64_t pattern = U_SWAR_ONES * (unsigned char)c;
+    for (;; s += 8) {
+        uint64_t x = *(const u_scan_word_t*)s;
+        if (u_swar_zero(x) | u_swar_zero(x ^ pattern)) break;
+    }
+#endif
+#endif
+    while (*s != c && *s) s++;
+    return s;
+}
+
+static size_t u_strlen(const char* str) {
+    if (!str) return 0;
+    return (size_t)(u_scan_until(str, '\0') - str);
+}
+
+#if UPRINTF_ENABLE_TEXT || UPRINTF_ENABLE_PROCESSORS
+// Flip the case of the ASCII letters between `lo` and `hi`; 0x20 is the
+// case bit. Bytes above 0x7F are left alone.
+static void u_case_span(char* data, size_t len, unsigned char lo, unsigned char hi) {
+    size_t i = 0;
+    
+#if defined(U_SCAN_SSE2)
+    // Signed compares: bytes above 0x7F are negative and never in range
+    const __m128i below = _mm_set1_epi8((char)(lo - 1));
+    const __m128i above = _mm_set1_epi8((char)(hi + 1));
+    const __m128i bit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i in = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, _mm_and_si128(in, bit)));
+    }
+#elif defined(U_SCAN_NEON)
+    const uint8x16_t vlo = vdupq_n_u8(lo);
+    const uint8x16_t vhi = vdupq_n_u8(hi);
+    const uint8x16_t bit = vdupq_n_u8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)data + i);
+        uint8x16_t in = vandq_u8(vcgeq_u8(v, vlo), vcleq_u8(v, vhi));
+        vst1q_u8((uint8_t*)data + i, veorq_u8(v, vandq_u8(in, bit)));
+    }
+#endif
+#if UPRINTF_SIMD
+    // A byte's high bit marks it in range once the top bit is masked off
+    const uint64_t above_lo = U_SWAR_ONES * (unsigned char)(0x80 - lo);
+    const uint64_t above_hi = U_SWAR_ONES * (unsigned char)(0x7F - hi);
+    for (; i + 8 <= len; i += 8) {
+        uint64_t x;
+        memcpy(&x, data + i, 8);
+        uint64_t low7 = x & ~U_SWAR_HIGH;
+        uint64_t mask = (low7 + above_lo) & ~(low7 + above_hi) & ~x & U_SWAR_HIGH;
+        if (mask) {
+            x ^= mask >> 2;
+            memcpy(data + i, &x, 8);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned char c = (unsigned char)data[i];
+        if (c >= lo && c <= hi) data[i] = (char)(c ^ 0x20);
+    }
+}
+#endif
+
+#if UPRINTF_ENABLE_ENCODERS
+// Printable ASCII other than '"' and '\\' is copied by the C-escape encoder
+static inline bool u_escape_plain(unsigned char c) {
+    return c >= 0x20 && c <= 0x7E && c != '"' && c != '\\';
+}
+
+// Length of the run at `data` that needs no escaping
+static size_t u_scan_plain(const unsigned char* data, size_t len) {
+    size_t i = 0;
+    
+#if defined(U_SCAN_SSE2)
+    // Signed compares: bytes above 0x7F are negative and never plain
+    const __m128i below = _mm_set1_epi8(0x1F);
+    const __m128i above = _mm_set1_epi8(0x7F);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i range = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash));
+        unsigned plain = (unsigned)(_mm_movemask_epi8(range) & ~_mm_movemask_epi8(special));
+        if (plain != 0xFFFF) return i + __builtin_ctz(~plain);
+    }
+#elif defined(U_SCAN_NEON)
+    const uint8x16_t lo = vdupq_n_u8(0x20);
+    const uint8x16_t hi = vdupq_n_u8(0x7E);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t slash = vdupq_n_u8('\\');
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(data + i);
+        uint8x16_t range = vandq_u8(vcgeq_u8(v, lo), vcleq_u8(v, hi));
+        uint8x16_t hit = vorrq_u8(vmvnq_u8(range),
+                                  vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, slash)));
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (bits) return i + (__builtin_ctzll(bits) >> 2);
+    }
+#endif
+#if UPRINTF_SIMD
+    // Words of plain bytes are skipped eight at a time; the first word with
+    // a candidate is settled bytewise below
+    const uint64_t above_lo = U_SWAR_ONES * (unsigned char)(0x80 - 0x20);
+    const uint64_t above_hi = U_SWAR_ONES * (unsigned char)(0x7F - 0x7E);
+    for (; i + 8 <= len; i += 8) {
+        uint64_t x;
+        memcpy(&x, data + i, 8);
+        uint64_t low7 = x & ~U_SWAR_HIGH;
+        uint64_t range = (low7 + above_lo) & ~(low7 + above_hi) & ~x & U_SWAR_HIGH;
+        uint64_t special = u_swar_zero(x ^ (U_SWAR_ONES * '"')) |
+                           u_swar_zero(x ^ (U_SWAR_ONES * '\\'));
+        if (range != U_SWAR_HIGH || special) break;
+    }
+#endif
+    while (i < len && u_escape_plain(data[i])) i++;
+    return i;
+}
+#endif
+
+#if UPRINTF_ENABLE_STRING_BUILDER || UPRINTF_ENABLE_STRING_UTILS
+// First occurrence of needle in the `hlen` bytes at hay, or NULL
+static const char* u_find(const char* hay, size_t hlen, const char* needle, size_t nlen) {
+    if (!nlen) return hay;
+    if (nlen > hlen) return NULL;
+    
+    size_t starts = hlen - nlen + 1;
+    size_t i = 0;
+    
+#if defined(U_SCAN_SSE2) || defined(U_SCAN_NEON)
+    // Candidates match the needle's first and last bytes, 16 starts at a time
+    if (nlen > 1) {
+#if defined(U_SCAN_SSE2)
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+        for (; i + 16 <= starts; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(hay + i + nlen - 1));
+            unsigned hit = (unsigned)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while (hit) {
+                const char* p = hay + i + __builtin_ctz(hit);
+                if (memcmp(p + 1, needle + 1, nlen - 2) == 0) return p;
+                hit &= hit - 1;
+            }
+        }
+#else
+        const uint8x16_t first = vdupq_n_u8((uint8_t)needle[0]);
+        const uint8x16_t last = vdupq_n_u8((uint8_t)needle[nlen - 1]);
+        for (; i + 16 <= starts; i += 16) {
+            uint8x16_t a = vld1q_u8((const uint8_t*)hay + i);
+            uint8x16_t b = vld1q_u8((const uint8_t*)hay + i + nlen - 1);
+            uint8x16_t both = vandq_u8(vceqq_u8(a, first), vceqq_u8(b, last));
+            uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(both), 4)), 0);
+            while (bits) {
+                int k = __builtin_ctzll(bits) >> 2;
+                const char* p = hay + i + k;
+                if (memcmp(p + 1, needle + 1, nlen - 2) == 0) return p;
+                bits &= ~((uint64_t)0xF << (k * 4));
+            }
+        }
+#endif
+    }
+#endif
+    
+    // memchr to each first-byte candidate, then compare
+    while (i < starts) {
+        const char* p = (const char*)memchr(hay + i, needle[0], starts - i);
+        if (!p) return NULL;
+        if (memcmp(p, needle, nlen) == 0) return p;
+        i = (size_t)(p - hay) + 1;
+    }
+    return NULL;
+}
+
+// Needles from this length on are searched with Horspool skips; shorter
+// ones do better with the u_find filter
+#if defined(U_SCAN_SSE2) || defined(U_SCAN_NEON)
+#define U_HORSPOOL_MIN 16
+#else
+#define U_HORSPOOL_MIN 4
+#endif
+
+// One needle searched repeatedly
+typedef struct {
+    const char* needle;
+    size_t len;
+    unsigned char skip[256]; // Horspool shifts, capped at 255
+} u_searcher_t;
+
+static void u_searcher_init(u_searcher_t* sr, const char* needle, size_t len) {
+    sr->needle = needle;
+    sr->len = len;
+    if (len < U_HORSPOOL_MIN) return;
+    
+    memset(sr->skip, len < 255 ? (int)len : 255, sizeof(sr->skip));
+    for (size_t i = 0; i + 1 < len; i++) {
+        size_t shift = len - 1 - i;
+        sr->skip[(unsigned char)needle[i]] = (unsigned char)(shift < 255 ? shift : 255);
+    }
+}
+
+static const char* u_searcher_next(const u_searcher_t* sr, const char* hay, size_t hlen) {
+    size_t n = sr->len;
+    if (n < U_HORSPOOL_MIN) return u_find(hay, hlen, sr->needle, n);
+    if (n > hlen) return NULL;
+    
+    const unsigned char last = (unsigned char)sr->needle[n - 1];
+    for (size_t i = 0; i <= hlen - n;) {
+        unsigned char c = (unsigned char)hay[i + n - 1];
+        if (c == last && memcmp(hay + i, sr->needle, n - 1) == 0) return hay + i;
+        i += sr->skip[c];
+    }
+    return NULL;
+}
+#endif
+
+#if UPRINTF_ENABLE_TEXT
+static void u_strrev(char* begin, char* end) {
+    if (!begin || !end || begin >= end) return;
+    
+    while (begin < end) {
+        char temp = *begin;
+        *begin++ = *end;
+        *end-- = temp;
+    }
+}
+#endif
+
+// Two-digit lookup table for decimal conversion
+static const char u_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char u_digits_lower[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+static const char u_digits_upper[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+// Decimal digits of a 32-bit value, written backwards ending at `end`
+static char* u_utoa_dec32(uint32_t value, char* end) {
+    char* ptr = end;
+    
+    while (value >= 100) {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        *--ptr = u_digit_pairs[pair + 1];
+        *--ptr = u_digit_pairs[pair];
+    }
+    
+    if (value >= 10) {
+        *--ptr = u_digit_pairs[value * 2 + 1];
+        *--ptr = u_digit_pairs[value * 2];
+    } else {
+        *--ptr = (char)('0' + value);
+    }
+    return ptr;
+}
+
+#if UPRINTF_ENABLE_64BIT_DIVISION
+// Exactly eight decimal digits of a value below 10^8, written backwards
+static char* u_utoa_dec8(uint32_t value, char* end) {
+    char* ptr = end;
+    
+    for (int i = 0; i < 4; i++) {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        *--ptr = u_digit_pairs[pair + 1];
+        *--ptr = u_digit_pairs[pair];
+    }
+    return ptr;
+}
+#endif
+
+#if !UPRINTF_ENABLE_64BIT_DIVISION
+// Divide by d < 2^16 in place and return the remainder, using 32-bit
+// divisions only: long division over the high word and the two 16-bit
+// halves of the low word
+static uint32_t u_divmod_small(uint64_t* value, uint32_t d) {
+    uint32_t hi = (uint32_t)(*value >> 32);
+    uint32_t lo = (uint32_t)*value;
+    
+    uint32_t q_hi = hi / d;
+    uint32_t n = ((hi % d) << 16) | (lo >> 16);
+    uint32_t q_mid = n / d;
+    n = ((n % d) << 16) | (lo & 0xFFFF);
+    uint32_t q_lo = n / d;
+    
+    *value = ((uint64_t)q_hi << 32) | (q_mid << 16) | q_lo;
+    return n % d;
+}
+#endif
+
+/*
+ * Convert an unsigned value, writing the digits backwards so that the last
+ * digit lands just before `end`. Returns a pointer to the first digit; no
+ * terminator is written. The caller needs room for 64 digits in the worst
+ * case (base 2).
+ * 
+ * Base 10 works two digits at a time on 32-bit chunks, so a 64-bit value
+ * costs at most two 64-bit divisions. Bases 8 and 16 use shifts and masks.
+ * Without UPRINTF_ENABLE_64BIT_DIVISION the part above 32 bits is peeled
+ * off by u_divmod_small instead, four decimal digits at a time.
+ */
+static char* u_utoa_end(uint64_t value, char* end, int base, bool uppercase) {
+    const char* digits = uppercase ? u_digits_upper : u_digits_lower;
+    char* ptr = end;
+    
+    switch (base) {
+        case 10:
+            if (value <= UINT32_MAX) {
+                return u_utoa_dec32((uint32_t)value, ptr);
+            }
+#if UPRINTF_ENABLE_64BIT_DIVISION
+            while (value > UINT32_MAX) {
+                ptr = u_utoa_dec8((uint32_t)(value % 100000000u), ptr);
+                value /= 100000000u;
+            }
+#else
+            while (value > UINT32_MAX) {
+                uint32_t group = u_divmod_small(&value, 10000);
+                uint32_t pair = (group % 100) * 2;
+                *--ptr = u_digit_pairs[pair + 1];
+                *--ptr = u_digit_pairs[pair];
+                pair = (group / 100) * 2;
+                *--ptr = u_digit_pairs[pair + 1];
+                *--ptr = u_digit_pairs[pair];
+            }
+#endif
+            return u_utoa_dec32((uint32_t)value, ptr);
+            
+        case 16:
+            do {
+                *--ptr = digits[value & 0xF];
+                value >>= 4;
+            } while (value);
+            return ptr;
+            
+        case 8:
+            do {
+                *--ptr = (char)('0' + (value & 0x7));
+                value >>= 3;
+            } while (value);
+            return ptr;
+            
+        default: {
+#if UPRINTF_ENABLE_64BIT_DIVISION
+            do {
+                *--ptr = digits[value % base];
+                value /= base;
+            } while (value);
+#else
+            while (value > UINT32_MAX) {
+                *--ptr = digits[u_divmod_small(&value, (uint32_t)base)];
+            }
+            uint32_t rest = (uint32_t)value;
+            do {
+                *--ptr = digits[rest % (uint32_t)base];
+                rest /= (uint32_t)base;
+            } while (rest);
+#endif
+            return ptr;
+        }
+    }
+}
+
+#if UPRINTF_FLOAT_SUPPORT && UPRINTF_FLOAT_ENGINE == UPRINTF_FLOAT_ENGINE_SMALL
+static char* u_utoa(uint64_t value, char* str, int base, bool uppercase) {
+    if (!str || base < 2 || base > 36) {
+        if (str) *str = '\0';
+        return str;
+    }
+
+    char tmp[64];
+    char* start = u_utoa_end(value, tmp + sizeof(tmp), base, uppercase);
+    size_t len = tmp + sizeof(tmp) - start;
+    
+    memcpy(str, start, len);
+    str[len] = '\0';
+    return str;
+}
+
+static char* u_itoa(int64_t value, char* str, int base, bool uppercase) {
+    if (!str || base < 2 || base > 36) {
+        if (str) *str = '\0';
+        return str;
+    }
+
+    char* ptr = str;
+    uint64_t magnitude = (uint64_t)value;
+    
+    if (value < 0 && base == 10) {
+        *ptr++ = '-';
+        magnitude = 0 - magnitude;
+    }
+    
+    u_utoa(magnitude, ptr, base, uppercase);
+    return str;
+}
+
+static char* u_ftoa(double value, char* str, int precision, char decimal_point) {
+    if (!str) return str;
+    
+    if (precision < 0) precision = 6;
+    if (precision > UPRINTF_BUFFER_SIZE - 16) precision = UPRINTF_BUFFER_SIZE - 16;
+    
+    char* ptr = str;
+    
+    // Handle special cases
+    if (value != value) { // NaN
+        const char* nan_str = "nan";
+        while (*nan_str) *ptr++ = *nan_str++;
+        *ptr = '\0';
+        return str;
+    }
+    
+    if (value == 1.0/0.0) { // +Inf
+        const char* inf_str = "inf";
+        while (*inf_str) *ptr++ = *inf_str++;
+        *ptr = '\0';
+        return str;
+    }
+    
+    if (value == -1.0/0.0) { // -Inf
+        const char* inf_str = "-inf";
+        while (*inf_str) *ptr++ = *inf_str++;
+        *ptr = '\0';
+        return str;
+    }
+    
+    // Handle negative numbers
+    if (value < 0) {
+        *ptr++ = '-';
+        value = -value;
+    }
+    
+    // Integer part
+    int64_t int_part = (int64_t)value;
+    value -= int_part;
+    
+    // Convert integer part and advance pointer
+    char* int_str = u_itoa(int_part, ptr, 10, false);
+    ptr += u_strlen(int_str); // Advance to the end of the integer part
+    
+    // Fractional part
+    if (precision > 0) {
+        *ptr++ = decimal_point;
+        
+        // Rounding
+        double rounding = 0.5;
+        for (int i = 0; i < precision; i++) {
+            rounding /= 10.0;
+        }
+        value += rounding;
+        
+        // Convert fractional part
+        for (int i = 0; i < precision; i++) {
+            value *= 10;
+            int digit = (int)value;
+            *ptr++ = '0' + digit;
+            value -= digit;
+            
+            // Prevent buffer overflow
+            if (ptr - str >= UPRINTF_BUFFER_SIZE - 1) {
+                break;
+            }
+        }
+    }
+    
+    *ptr = '\0';
+    return str;
+}
+#endif
+
+#if UPRINTF_ENABLE_TEMPLATES || UPRINTF_ENABLE_TEXT || UPRINTF_ENABLE_TERMINAL
+static void u_output_str(u_output_cb_t output_cb, void* ctx, const char* str, int max_len) {
+    if (!output_cb || !str) {
+        if (!str && output_cb) {
+            u_output_str(output_cb, ctx, "(null)", max_len);
+        }
+        return;
+    }
+    
+    for (int i = 0; (max_len < 0 || i < max_len) && str[i]; i++) {
+        output_cb(str[i], ctx);
+    }
+}
+#endif
+
+#if UPRINTF_ENABLE_TEXT
+static void u_output_repeat(u_output_cb_t output_cb, void* ctx, char c, int count) {
+    if (!output_cb || count <= 0) return;
+    
+    for (int i = 0; i < count; i++) {
+        output_cb(c, ctx);
+    }
+}
+#endif
+
+// Output sink used by the formatting engine. All engine output is written
+// as spans; the per-character view is what custom handlers receive. Buffer
+// sinks bypass the callbacks and copy straight into the destination.
+typedef struct {
+    u_write_cb_t write;
+    void* ctx;
+    u_output_cb_t putc;
+    void* putc_ctx;
+    char* buffer;      // Direct destination, NULL for callback sinks
+    size_t capacity;   // Characters that fit, excluding the terminator
+    size_t pos;        // Characters stored so far
+    const u_context_t* context; // Handlers and locale used while formatting
+    u_write_cb_t ref;  // Takes spans that outlive the call, NULL to write them
+} u_sink_t;
+
+// Adapter state for driving a per-character callback from spans
+typedef struct {
+    u_output_cb_t output_cb;
+    void* ctx;
+} u_char_sink_ctx_t;
+
+static void u_char_sink_write(const char* data, size_t len, void* ctx) {
+    u_char_sink_ctx_t* cctx = (u_char_sink_ctx_t*)ctx;
+    for (size_t i = 0; i < len; i++) {
+        cctx->output_cb(data[i], cctx->ctx);
+    }
+}
+
+static void u_sink_write(u_sink_t* sink, const char* data, size_t len);
+
+static void u_span_sink_putc(char c, void* ctx) {
+    u_sink_write((u_sink_t*)ctx, &c, 1);
+}
+
+static void u_sink_init_char(u_sink_t* sink, u_char_sink_ctx_t* cctx,
+                             u_output_cb_t output_cb, void* ctx) {
+    cctx->output_cb = output_cb;
+    cctx->ctx = ctx;
+    sink->write = u_char_sink_write;
+    sink->ctx = cctx;
+    sink->putc = output_cb; // Handlers talk to the callback directly
+    sink->putc_ctx = ctx;
+    sink->buffer = NULL;
+    sink->capacity = 0;
+    sink->pos = 0;
+    sink->context = &u_state;
+    sink->ref = NULL;
+}
+
+static void u_sink_init_span(u_sink_t* sink, u_write_cb_t write_cb, void* ctx) {
+    sink->write = write_cb;
+    sink->ctx = ctx;
+    sink->putc = u_span_sink_putc;
+    sink->putc_ctx = sink;
+    sink->buffer = NULL;
+    sink->capacity = 0;
+    sink->pos = 0;
+    sink->context = &u_state;
+    sink->ref = NULL;
+}
+
+static void u_sink_init_buffer(u_sink_t* sink, char* buffer, size_t capacity) {
+    sink->write = NULL;
+    sink->ctx = NULL;
+    sink->putc = u_span_sink_putc;
+    sink->putc_ctx = sink;
+    sink->buffer = buffer;
+    sink->capacity = capacity;
+    sink->pos = 0;
+    sink->context = &u_state;
+    sink->ref = NULL;
+}
+
+static void u_sink_write(u_sink_t* sink, const char* data, size_t len) {
+    if (!len) return;
+    
+    if (sink->buffer) {
+        // One bounds check per segment, then a bulk copy
+        size_t room = sink->capacity - sink->pos;
+        if (len > room) len = room;
+        U_STAT_ADD(bytes, len);
+        memcpy(sink->buffer + sink->pos, data, len);
+        sink->pos += len;
+        return;
+    }
+    
+    U_STAT_ADD(bytes, len);
+    U_STAT_ADD(callbacks, sink->write == u_char_sink_write ? len : 1);
+    sink->write(data, len, sink->ctx);
+}
+
+// Write a span that stays valid after the call (format text, string
+// arguments). Scatter/gather sinks point at it instead of copying it.
+static void u_sink_write_ref(u_sink_t* sink, const char* data, size_t len) {
+    if (sink->ref) {
+        if (len) {
+            U_STAT_ADD(bytes, len);
+            sink->ref(data, len, sink->ctx);
+        }
+        return;
+    }
+    u_sink_write(sink, data, len);
+}
+
+#if UPRINTF_ENABLE_IOV
+// Constant runs that scatter/gather sinks reference for padding
+#define U_PAD_RUN 32
+static const char u_pad_spaces[U_PAD_RUN + 1] = "                                ";
+static const char u_pad_zeros[U_PAD_RUN + 1] = "00000000000000000000000000000000";
+#endif // UPRINTF_ENABLE_IOV
+
+static void u_sink_repeat(u_sink_t* sink, char c, int count) {
+    if (count <= 0) return;
+    
+#if UPRINTF_ENABLE_IOV
+    // Any width of padding costs segments, not scratch space
+    if (sink->ref && (c == ' ' || c == '0')) {
+        const char* run = c == ' ' ? u_pad_spaces : u_pad_zeros;
+        while (count > 0) {
+            int len = count < U_PAD_RUN ? count : U_PAD_RUN;
+            u_sink_write_ref(sink, run, (size_t)len);
+            count -= len;
+        }
+        return;
+    }
+#endif // UPRINTF_ENABLE_IOV
+    
+    if (sink->buffer) {
+        size_t room = sink->capacity - sink->pos;
+        size_t len = (size_t)count < room ? (size_t)count : room;
+        U_STAT_ADD(bytes, len);
+        memset(sink->buffer + sink->pos, c, len);
+        sink->pos += len;
+        return;
+    }
+    
+    // Padding goes out in chunks of up to UPRINTF_BUFFER_SIZE characters
+    char chunk[UPRINTF_BUFFER_SIZE];
+    int chunk_len = count < (int)sizeof(chunk) ? count : (int)sizeof(chunk);
+    memset(chunk, c, chunk_len);
+    
+    while (count > 0) {
+        int len = count < chunk_len ? count : chunk_len;
+        U_STAT_ADD(bytes, len);
+        U_STAT_ADD(callbacks, sink->write == u_char_sink_write ? len : 1);
+        sink->write(chunk, len, sink->ctx);
+        count -= len;
+    }
+}
+
+// Stream `total` bytes of a source to the sink. Buffer sinks are read into
+// directly and the part past their capacity is counted, not read; other
+// sinks get one write per chunk. Returns the bytes delivered.
+static size_t u_sink_pull(u_sink_t* sink, const u_source_t* src, size_t total) {
+    size_t done = 0;
+    
+    if (sink->buffer) {
+        while (done < total && sink->pos < sink->capacity) {
+            size_t room = sink->capacity - sink->pos;
+            size_t want = total - done < room ? total - done : room;
+            size_t got = src->read(sink->buffer + sink->pos, want, src->ctx);
+            if (!got) return done;
+            if (got > want) got = want;
+            U_STAT_ADD(bytes, got);
+            sink->pos += got;
+            done += got;
+        }
+        return total;
+    }
+    
+    char chunk[UPRINTF_SOURCE_CHUNK];
+    while (done < total) {
+        size_t want = total - done < sizeof(chunk) ? total - done : sizeof(chunk);
+        size_t got = src->read(chunk, want, src->ctx);
+        if (!got) break;
+        if (got > want) got = want;
+        u_sink_write(sink, chunk, got);
+        done += got;
+    }
+    return done;
+}
+
+#if UPRINTF_ENABLE_ENCODERS || UPRINTF_ENABLE_TIME
+// Built-in handlers reach the engine's sink behind the per-character view,
+// so they can write whole spans; other callbacks get a sink of their own.
+static u_sink_t* u_handler_sink(u_output_cb_t output_cb, void* ctx,
+                                u_sink_t* local, u_char_sink_ctx_t* cctx) {
+    if (output_cb == u_span_sink_putc) return (u_sink_t*)ctx;
+    u_sink_init_char(local, cctx, output_cb, ctx);
+    return local;
+}
+#endif
+
+#if UPRINTF_ENABLE_ENCODERS
+// Data argument of an encoder: a pointer, with the precision as its length
+static const unsigned char* u_handler_data(va_list* args, int precision, size_t* len) {
+    const unsigned char* data = (const unsigned char*)va_arg(*args, const void*);
+    *len = !data ? 0 : precision >= 0 ? (size_t)precision : u_strlen((const char*)data);
+    return data;
+}
+
+static const char u_hex_digits[] = "0123456789abcdef";
+
+// One dump line: offset, hex bytes grouped by `group`, ASCII column
+static size_t u_hex_line(char* out, const unsigned char* data, size_t len,
+                         size_t offset, int group) {
+    char* p = out;
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        *p++ = u_hex_digits[(offset >> shift) & 0xF];
+    }
+    *p++ = ' ';
+    
+    for (size_t i = 0; i < 16; i++) {
+        if (i % (size_t)group == 0) *p++ = ' ';
+        if (i < len) {
+            *p++ = u_hex_digits[data[i] >> 4];
+            *p++ = u_hex_digits[data[i] & 0xF];
+        } else {
+            *p++ = ' ';
+            *p++ = ' ';
+        }
+    }
+    
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = '|';
+    for (size_t i = 0; i < len; i++) {
+        *p++ = data[i] >= 0x20 && data[i] <= 0x7E ? (char)data[i] : '.';
+    }
+    *p++ = '|';
+    *p++ = '\n';
+    return (size_t)(p - out);
+}
+
+int u_hex_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                  const char** fmt, int width, int precision, unsigned int flags) {
+    (void)fmt;
+    u_sink_t local;
+    u_char_sink_ctx_t cctx;
+    u_sink_t* sink = u_handler_sink(output_cb, ctx, &local, &cctx);
+    size_t len;
+    const unsigned char* data = u_handler_data(args, precision, &len);
+    if (!data) {
+        u_sink_write(sink, "(null)", 6);
+        return 6;
+    }
+    
+    size_t written = 0;
+    char out[96];
+    if (flags & U_FLAG_ALT_FORM) {
+        int group = width > 0 && width <= 16 ? width : 1;
+        for (size_t pos = 0; pos < len; pos += 16) {
+            size_t n = u_hex_line(out, data + pos, len - pos < 16 ? len - pos : 16, pos, group);
+            u_sink_write(sink, out, n);
+            written += n;
+        }
+        return (int)written;
+    }
+    
+    // Plain digits, flushed whenever the next byte and separator may not fit
+    size_t group = width > 0 ? (size_t)width : 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (n > sizeof(out) - 3) {
+            u_sink_write(sink, out, n);
+            written += n;
+            n = 0;
+        }
+        if (group && i && i % group == 0) out[n++] = ' ';
+        out[n++] = u_hex_digits[data[i] >> 4];
+        out[n++] = u_hex_digits[data[i] & 0xF];
+    }
+    u_sink_write(sink, out, n);
+    return (int)(written + n);
+}
+
+static const char u_base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char u_base64_url_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+int u_base64_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                     const char** fmt, int width, int precision, unsigned int flags) {
+    (void)fmt;
+    u_sink_t local;
+    u_char_sink_ctx_t cctx;
+    u_sink_t* sink = u_handler_sink(output_cb, ctx, &local, &cctx);
+    size_t len;
+    const unsigned char* data = u_handler_data(args, precision, &len);
+    if (!data) {
+        u_sink_write(sink, "(null)", 6);
+        return 6;
+    }
+    
+    bool url = (flags & U_FLAG_ALT_FORM) != 0;
+    const char* table = url ? u_base64_url_alphabet : u_base64_alphabet;
+    size_t total = url ? (len * 4 + 2) / 3 : (len + 2) / 3 * 4;
+    int padding = width > 0 && (size_t)width > total ? width - (int)total : 0;
+    if (!(flags & U_FLAG_LEFT_ALIGN)) u_sink_repeat(sink, ' ', padding);
+    
+    // 48 input bytes become one 64-character span
+    char out[64];
+    size_t i = 0;
+    while (i + 3 <= len) {
+        size_t n = 0;
+        for (; i + 3 <= len && n < sizeof(out); i += 3) {
+            uint32_t v = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+            out[n++] = table[v >> 18];
+            out[n++] = table[(v >> 12) & 0x3F];
+            out[n++] = table[(v >> 6) & 0x3F];
+            out[n++] = table[v & 0x3F];
+        }
+        u_sink_write(sink, out, n);
+    }
+    if (i < len) {
+        uint32_t v = (uint32_t)data[i] << 16 | (i + 1 < len ? (uint32_t)data[i + 1] << 8 : 0);
+        size_t n = 0;
+        out[n++] = table[v >> 18];
+        out[n++] = table[(v >> 12) & 0x3F];
+        if (i + 1 < len) out[n++] = table[(v >> 6) & 0x3F];
+        if (!url) {
+            while (n < 4) out[n++] = '=';
+        }
+        u_sink_write(sink, out, n);
+    }
+    
+    if (flags & U_FLAG_LEFT_ALIGN) u_sink_repeat(sink, ' ', padding);
+    return (int)total + padding;
+}
+
+// Escape one byte that is not plain; returns its length
+static size_t u_escape_byte(unsigned char c, char* out) {
+    char letter = c == '\n' ? 'n' : c == '\r' ? 'r' : c == '\t' ? 't' : 0;
+    if (c == '"' || c == '\\') letter = (char)c;
+    
+    out[0] = '\\';
+    if (letter) {
+        out[1] = letter;
+        return 2;
+    }
+    // Octal is bounded at three digits, so a following digit stays literal
+    out[1] = (char)('0' + (c >> 6));
+    out[2] = (char)('0' + ((c >> 3) & 7));
+    out[3] = (char)('0' + (c & 7));
+    return 4;
+}
+
+int u_escape_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                     const char** fmt, int width, int precision, unsigned int flags) {
+    (void)fmt;
+    u_sink_t local;
+    u_char_sink_ctx_t cctx;
+    u_sink_t* sink = u_handler_sink(output_cb, ctx, &local, &cctx);
+    size_t len;
+    const unsigned char* data = u_handler_data(args, precision, &len);
+    if (!data) {
+        u_sink_write(sink, "(null)", 6);
+        return 6;
+    }
+    
+    // Padding needs the escaped length first, which costs a measuring pass
+    int padding = 0;
+    if (width > 0) {
+        size_t total = 0;
+        char scratch[4];
+        for (size_t i = 0; i < len; i++) {
+            total += u_escape_plain(data[i]) ? 1 : u_escape_byte(data[i], scratch);
+        }
+        padding = (size_t)width > total ? width - (int)total : 0;
+    }
+    if (!(flags & U_FLAG_LEFT_ALIGN)) u_sink_repeat(sink, ' ', padding);
+    
+    // Plain runs are passed through as they are, escapes in batches
+    size_t written = 0;
+    size_t i = 0;
+    while (i < len) {
+        size_t run = u_scan_plain(data + i, len - i);
+        u_sink_write_ref(sink, (const char*)data + i, run);
+        written += run;
+        i += run;
+        
+        char out[64];
+        size_t n = 0;
+        while (i < len && n <= sizeof(out) - 4 && !u_escape_plain(data[i])) {
+            n += u_escape_byte(data[i++], out + n);
+        }
+        u_sink_write(sink, out, n);
+        written += n;
+    }
+    
+    if (flags & U_FLAG_LEFT_ALIGN) u_sink_repeat(sink, ' ', padding);
+    return (int)written + padding;
+}
+#endif // UPRINTF_ENABLE_ENCODERS
+
+#if UPRINTF_ENABLE_TIME
+// Per-thread where the compiler offers it; define UPRINTF_TIME_THREAD_LOCAL
+// empty on targets without TLS support
+#ifndef UPRINTF_TIME_THREAD_LOCAL
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define UPRINTF_TIME_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define UPRINTF_TIME_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define UPRINTF_TIME_THREAD_LOCAL __thread
+#else
+#define UPRINTF_TIME_THREAD_LOCAL
+#endif
+#endif
+
+// Write a short result padded to `width` like %s
+static int u_handler_field(u_sink_t* sink, const char* text, int len, int width,
+                           unsigned int flags) {
+    int padding = width > len ? width - len : 0;
+    if (!(flags & U_FLAG_LEFT_ALIGN)) u_sink_repeat(sink, ' ', padding);
+    u_sink_write(sink, text, (size_t)len);
+    if (flags & U_FLAG_LEFT_ALIGN) u_sink_repeat(sink, ' ', padding);
+    return len + padding;
+}
+
+// Split off the remainder below d < 2^16, leaving the quotient in *value;
+// no 64-bit division helpers are needed when those are configured out
+static uint32_t u_time_split(uint64_t* value, uint32_t d) {
+#if UPRINTF_ENABLE_64BIT_DIVISION
+    uint32_t rem = (uint32_t)(*value % d);
+    *value /= d;
+    return rem;
+#else
+    return u_divmod_small(value, d);
+#endif
+}
+
+// Floor division for signed values: the remainder is in [0, d) either way
+static uint32_t u_time_floor(int64_t* value, uint32_t d) {
+    if (*value >= 0) {
+        uint64_t u = (uint64_t)*value;
+        uint32_t rem = u_time_split(&u, d);
+        *value = (int64_t)u;
+        return rem;
+    }
+    // -v - 1 = q * d + r, so v = (-q - 1) * d + (d - 1 - r)
+    uint64_t u = (uint64_t)(-(*value + 1));
+    uint32_t rem = u_time_split(&u, d);
+    *value = -(int64_t)u - 1;
+    return d - 1 - rem;
+}
+
+// Nanoseconds of a handler argument: whole seconds go to *seconds
+static uint32_t u_time_value(unsigned long long value, unsigned int flags, uint64_t* seconds) {
+    *seconds = value;
+    if (flags & U_FLAG_ALT_FORM) {
+        uint64_t nanos = (uint64_t)u_time_split(seconds, UPRINTF_TIME_TICK_HZ) * 1000000000u;
+        u_time_split(&nanos, UPRINTF_TIME_TICK_HZ);
+        return (uint32_t)nanos;
+    }
+    uint32_t ns = u_time_split(seconds, 1000);
+    uint32_t us = u_time_split(seconds, 1000);
+    uint32_t ms = u_time_split(seconds, 1000);
+    return ms * 1000000u + us * 1000u + ns;
+}
+
+// Same for an epoch value; times before 1970 round down to earlier seconds
+static uint32_t u_time_epoch(long long value, unsigned int flags, int64_t* seconds) {
+    *seconds = value;
+    if (flags & U_FLAG_ALT_FORM) {
+        uint64_t nanos = (uint64_t)u_time_floor(seconds, UPRINTF_TIME_TICK_HZ) * 1000000000u;
+        u_time_split(&nanos, UPRINTF_TIME_TICK_HZ);
+        return (uint32_t)nanos;
+    }
+    uint32_t ns = u_time_floor(seconds, 1000);
+    uint32_t us = u_time_floor(seconds, 1000);
+    uint32_t ms = u_time_floor(seconds, 1000);
+    return ms * 1000000u + us * 1000u + ns;
+}
+
+static char* u_time_pair(char* p, uint32_t value) {
+    p[0] = u_digit_pairs[value * 2];
+    p[1] = u_digit_pairs[value * 2 + 1];
+    return p + 2;
+}
+
+// "YYYY-MM-DDTHH:MM:" of a minute count since the epoch. Civil date from
+// days after H. Hinnant's days_from_civil inverse; only the 400-year era
+// is signed, the day of the era splits as 146097 = 27 * 5411.
+static void u_time_prefix(char* out, int64_t minutes) {
+    uint32_t minute = u_time_floor(&minutes, 60);
+    uint32_t hour = u_time_floor(&minutes, 24);
+    int64_t era = minutes + 719468;
+    uint32_t doe = u_time_floor(&era, 27);
+    doe += 27 * u_time_floor(&era, 5411);
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t years = era * 400 + yoe + (month <= 2);
+    uint32_t year = u_time_floor(&years, 10000);
+    
+    char* p = u_time_pair(out, year / 100);
+    p = u_time_pair(p, year % 100);
+    *p++ = '-';
+    p = u_time_pair(p, month);
+    *p++ = '-';
+    p = u_time_pair(p, day);
+    *p++ = 'T';
+    p = u_time_pair(p, hour);
+    *p++ = ':';
+    p = u_time_pair(p, minute);
+    *p = ':';
+}
+
+#define U_TIME_PREFIX 17
+
+typedef struct {
+    int64_t minutes;              // Minute the prefix belongs to
+    char prefix[U_TIME_PREFIX];
+} u_time_cache_t;
+
+static UPRINTF_TIME_THREAD_LOCAL u_time_cache_t u_time_cache = {INT64_MIN, {0}};
+
+int u_time_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                   const char** fmt, int width, int precision, unsigned int flags) {
+    (void)fmt;
+    u_sink_t local;
+    u_char_sink_ctx_t cctx;
+    u_sink_t* sink = u_handler_sink(output_cb, ctx, &local, &cctx);
+    
+    int64_t seconds;
+    uint32_t nanos = u_time_epoch(va_arg(*args, long long), flags, &seconds);
+    uint32_t second = u_time_floor(&seconds, 60);
+    
+    // Only a new minute converts the date
+    if (u_time_cache.minutes != seconds) {
+        u_time_prefix(u_time_cache.prefix, seconds);
+        u_time_cache.minutes = seconds;
+    }
+    
+    char out[U_TIME_PREFIX + 13];
+    memcpy(out, u_time_cache.prefix, U_TIME_PREFIX);
+    if (flags & U_FLAG_SPACE_SIGN) out[10] = ' ';
+    char* p = u_time_pair(out + U_TIME_PREFIX, second);
+    
+    int digits = precision < 0 ? 3 : precision > 9 ? 9 : precision;
+    if (digits) {
+        char fraction[10];
+        char* f = u_time_pair(fraction, nanos / 10000000u);
+        f = u_time_pair(f, nanos / 100000u % 100);
+        f = u_time_pair(f, nanos / 1000u % 100);
+        f = u_time_pair(f, nanos / 10u % 100);
+        *f = (char)('0' + nanos % 10);
+        *p++ = '.';
+        memcpy(p, fraction, (size_t)digits);
+        p += digits;
+    }
+    *p++ = 'Z';
+    
+    return u_handler_field(sink, out, (int)(p - out), width, flags);
+}
+
+// value / 10^k rounded to nearest, for k <= 9, in steps below 2^16
+static uint64_t u_time_round(uint64_t value, int k) {
+    static const uint32_t pow10[] = {1, 10, 100, 1000, 10000};
+    uint64_t half = 0;
+    if (k) {
+        half = 5;
+        for (int i = 1; i < k; i++) half *= 10;
+    }
+    value += half;
+    while (k > 0) {
+        int step = k > 4 ? 4 : k;
+        u_time_split(&value, pow10[step]);
+        k -= step;
+    }
+    return value;
+}
+
+int u_duration_handler(u_output_cb_t output_cb, void* ctx, va_list* args,
+                       const char** fmt, int width, int precision, unsigned int flags) {
+    (void)fmt;
+    u_sink_t local;
+    u_char_sink_ctx_t cctx;
+    u_sink_t* sink = u_handler_sink(output_cb, ctx, &local, &cctx);
+    
+    long long raw = va_arg(*args, long long);
+    unsigned long long magnitude = raw < 0 ? 0 - (unsigned long long)raw : (unsigned long long)raw;
+    uint64_t seconds;
+    uint32_t nanos = u_time_value(magnitude, flags, &seconds);
+    
+    char out[32];
+    char* p = out;
+    if (raw < 0) *p++ = '-';
+    
+    // Largest unit that keeps the rounded value under 1000
+    static const char* const units[] = {"ns", "us", "ms", "s"};
+    int decimals = precision < 0 ? 2 : precision > 3 ? 3 : precision;
+    uint64_t limit = 1000;
+    for (int i = 0; i < decimals; i++) limit *= 10;
+    int unit = 3;
+    uint64_t scaled = 0;
+    if (seconds < 60) {
+        uint64_t total = seconds * 1000000000u + nanos;
+        if (total < 1000) {
+            unit = 0;
+            scaled = total;
+            decimals = 0;
+        } else {
+            for (unit = 1; ; unit++) {
+                scaled = u_time_round(total, unit * 3 - decimals);
+                if (unit == 3 || scaled < limit) break;
+            }
+        }
+    }
+    
+    // Past a minute, including 59.999s rounded up: two units, the second
+    // one zero-padded and rounded, 2m05s, 1h02m
+    if (unit == 3 && (seconds >= 60 || scaled >= limit / 1000 * 60)) {
+        uint64_t big = seconds + (nanos >= 500000000u);
+        char unit_char = 'm';
+        char next = 's';
+        if (big >= 3600) {
+            big = seconds;
+            big += u_time_split(&big, 60) >= 30;
+            unit_char = 'h';
+            next = 'm';
+        }
+        uint32_t small = u_time_split(&big, 60);
+        char digits[24];
+        char* d = u_utoa_end(big, digits + sizeof(digits), 10, false);
+        size_t n = (size_t)(digits + sizeof(digits) - d);
+        memcpy(p, d, n);
+        p += n;
+        *p++ = unit_char;
+        p = u_time_pair(p, small);
+        *p++ = next;
+        return u_handler_field(sink, out, (int)(p - out), width, flags);
+    }
+    
+    // Integer part, then the decimals with trailing zeros dropped
+    uint64_t whole = scaled;
+    char frac[3];
+    for (int i = decimals - 1; i >= 0; i--) frac[i] = (char)('0' + u_time_split(&whole, 10));
+    while (decimals && frac[decimals - 1] == '0') decimals--;
+    
+    char digits[24];
+    char* d = u_utoa_end(whole, digits + sizeof(digits), 10, false);
+    size_t n = (size_t)(digits + sizeof(digits) - d);
+    memcpy(p, d, n);
+    p += n;
+    if (decimals) {
+        *p++ = '.';
+        memcpy(p, frac, (size_t)decimals);
+        p += decimals;
+    }
+    n = u_strlen(units[unit]);
+    memcpy(p, units[unit], n);
+    p += n;
+    
+    return u_handler_field(sink, out, (int)(p - out), width, flags);
+}
+#endif // UPRINTF_ENABLE_TIME
+
+#if UPRINTF_FLOAT_SUPPORT && UPRINTF_FLOAT_ENGINE == UPRINTF_FLOAT_ENGINE_FULL
+/*
+ * Full floating point engine.
+ *
+ * %f, %e, %g are exact for any precision: the binary value m * 2^e2 is
+ * expanded into base-10^9 words and rounded half-to-even on the decimal
+ * digits, so there is no int64_t cast, no accumulated rounding error and no
+ * precision clamp. %a formats the mantissa bits directly. %r prints the
+ * shortest digit string that reads back to the same double.
+ */
+
+#define U_FP_MANT_DIG 53
+#define U_FP_MAX_EXP 1024
+// Integer part of DBL_MAX plus the longest fraction, in words of 9 digits
+#define U_FP_WORDS (4 + (U_FP_MAX_EXP + U_FP_MANT_DIG + 28 + 8) / 9)
+// Significant digits kept per value by the shortest round-trip search
+#define U_FP_SHORTEST_DIGITS 20
+
+typedef enum {
+    U_FP_FINITE,
+    U_FP_INFINITE,
+    U_FP_NAN
+} u_fp_class_t;
+
+// Exact decimal expansion: words a..z-1, r is the units word
+typedef struct {
+    uint32_t words[U_FP_WORDS];
+    uint32_t* a;
+    uint32_t* r;
+    uint32_t* z;
+    int e;          // Decimal exponent of the leading digit
+    bool truncated; // Nonzero words past the requested precision were dropped
+} u_fp_big_t;
+
+// Leading significant digits of a value, for the shortest round-trip search
+typedef struct {
+    char digits[U_FP_SHORTEST_DIGITS];
+    int count;
+    int exp10;   // Decimal exponent of digits[0]
+    bool sticky; // Nonzero digits follow the stored ones
+} u_fp_dec_t;
+
+static u_fp_class_t u_fp_decompose(double value, uint64_t* mant, int* exp2, bool* negative) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    int biased = (int)((bits >> 52) & 0x7FF);
+    uint64_t frac = bits & ((1ull << 52) - 1);
+    *negative = (bits >> 63) != 0;
+
+    if (biased == 0x7FF) return frac ? U_FP_NAN : U_FP_INFINITE;
+    if (biased == 0) {
+        *mant = frac;
+        *exp2 = frac ? -1074 : 0;
+    } else {
+        *mant = frac | (1ull << 52);
+        *exp2 = biased - 1075;
+    }
+    return U_FP_FINITE;
+}
+
+// Number of decimal digits below the leading one in the first word
+static int u_fp_leading_exp(const u_fp_big_t* big) {
+    if (big->a >= big->z) return 0;
+    
+    int e = 9 * (int)(big->r - big->a);
+    for (uint32_t i = 10; *big->a >= i; i *= 10) {
+        e++;
+        if (i == 1000000000u) break;
+    }
+    return e;
+}
+
+/*
+ * Expand mant * 2^exp2 into base-10^9 words. `fixed` keeps `precision`
+ * digits after the radix point (%f), otherwise after the leading digit.
+ */
+static void u_fp_expand(u_fp_big_t* big, uint64_t mant, int exp2, bool fixed, int precision) {
+    uint32_t hi = (uint32_t)(mant / 1000000000u);
+    uint32_t lo = (uint32_t)(mant % 1000000000u);
+    uint32_t* d;
+    
+    // Fractions grow towards the end of the array, integers towards the start.
+    // The spare word in front absorbs a rounding carry.
+    uint32_t* units = exp2 < 0 ? big->words + 2 : big->words + U_FP_WORDS - 1;
+    units[-1] = hi;
+    units[0] = lo;
+    big->r = units;
+    big->a = hi ? units - 1 : units;
+    big->z = units + 1;
+    big->truncated = false;
+    
+    while (exp2 > 0) {
+        uint32_t carry = 0;
+        int sh = exp2 < 29 ? exp2 : 29;
+        for (d = big->z - 1; d >= big->a; d--) {
+            uint64_t x = ((uint64_t)*d << sh) + carry;
+            *d = (uint32_t)(x % 1000000000u);
+            carry = (uint32_t)(x / 1000000000u);
+        }
+        if (carry) *--big->a = carry;
+        while (big->z > big->a && !big->z[-1]) big->z--;
+        exp2 -= sh;
+    }
+    
+    // Precision past the longest exact expansion (2^-1074) adds nothing
+    if (precision > U_FP_MAX_EXP + U_FP_MANT_DIG) precision = U_FP_MAX_EXP + U_FP_MANT_DIG;
+    int need = 1 + (precision + U_FP_MANT_DIG / 3 + 8) / 9;
+    while (exp2 < 0) {
+        uint32_t carry = 0;
+        int sh = -exp2 < 9 ? -exp2 : 9;
+        for (d = big->a; d < big->z; d++) {
+            uint32_t rm = *d & ((1u << sh) - 1);
+            *d = (*d >> sh) + carry;
+            carry = (1000000000u >> sh) * rm;
+        }
+        if (!*big->a) big->a++;
+        if (carry) *big->z++ = carry;
+        
+        // Avoid computing digits far past the requested precision
+        uint32_t* base = fixed ? big->r : big->a;
+        while (big->z - base > need) {
+            if (*--big->z) big->truncated = true;
+        }
+        exp2 += sh;
+    }
+    
+    big->e = u_fp_leading_exp(big);
+}
+
+/*
+ * Round the expansion half-to-even so that `keep` digits remain after the
+ * radix point (keep may be negative for %e and %g).
+ */
+static void u_fp_round(u_fp_big_t* big, int keep) {
+    if (keep < 9 * (int)(big->z - big->r - 1)) {
+        // Word holding the last kept digit; avoid C division of negatives
+        uint32_t* d = big->r + 1 + ((keep + 9 * U_FP_MAX_EXP) / 9 - U_FP_MAX_EXP);
+        int j = (keep + 9 * U_FP_MAX_EXP) % 9;
+        uint32_t i = 10;
+        for (j++; j < 9; i *= 10, j++);
+        
+        uint32_t x = *d % i;
+        bool more = d + 1 != big->z || big->truncated;
+        if (x || more) {
+            bool odd = ((*d / i) & 1) || (i == 1000000000u && d > big->a && (d[-1] & 1));
+            bool up = x > i / 2 || (x == i / 2 && (more || odd));
+
+            *d -= x;
+            if (up) {
+                *d += i;
+                while (*d > 999999999u) {
+                    *d-- = 0;
+                    if (d < big->a) *--big->a = 0;
+                    (*d)++;
+                }
+                big->e = u_fp_leading_exp(big);
+            }
+        }
+        if (big->z > d + 1) big->z = d + 1;
+    }
+    
+    while (big->z > big->a && !big->z[-1]) big->z--;
+}
+
+// Decimal digits of a word, written backwards ending at `end`
+static char* u_fp_word(uint32_t word, char* end) {
+    return u_utoa_dec32(word, end);
+}
+
+// Emit the field padding that precedes sign/prefix and the zero padding after it
+static int u_fp_field_begin(u_sink_t* sink, int width, int total, unsigned int flags,
+                            const char* head, int head_len, bool zero_ok) {
+    int pad = width > total ? width - total : 0;
+    bool zeros = zero_ok && (flags & U_FLAG_ZERO_PAD) && !(flags & U_FLAG_LEFT_ALIGN);
+    
+    if (!(flags & U_FLAG_LEFT_ALIGN) && !zeros) u_sink_repeat(sink, ' ', pad);
+    u_sink_write(sink, head, head_len);
+    if (zeros) u_sink_repeat(sink, '0', pad);
+    return pad;
+}
+
+static void u_fp_field_end(u_sink_t* sink, int pad, unsigned int flags) {
+    if (flags & U_FLAG_LEFT_ALIGN) u_sink_repeat(sink, ' ', pad);
+}
+
+// %a / %A: hexadecimal mantissa, binary exponent
+static int u_fp_format_hex(u_sink_t* sink, uint64_t mant, int exp2, int width, int precision,
+                           unsigned int flags, bool upper, char* head, int head_len,
+                           char decimal_point) {
+    const char* xdigits = upper ? u_digits_upper : u_digits_lower;
+    int exp = 0;
+    
+    if (mant) {
+        while (!(mant >> 52)) {
+            mant <<= 1;
+            exp2--;
+        }
+        exp = exp2 + 52;
+    }
+    
+    // 13 hex digits hold the 52 fraction bits; round half-to-even when asked for fewer
+    int count = 13;
+    if (precision >= 0 && precision < 13) {
+        int shift = 4 * (13 - precision);
+        uint64_t rem = mant & ((1ull << shift) - 1);
+        uint64_t half = 1ull << (shift - 1);
+        mant >>= shift;
+        if (rem > half || (rem == half && (mant & 1))) mant++;
+        count = precision;
+    }
+    
+    char lead = xdigits[(mant >> (4 * count)) & 0xF];
+    char frac[13];
+    for (int i = count - 1; i >= 0; i--) {
+        frac[i] = xdigits[mant & 0xF];
+        mant >>= 4;
+    }
+    if (precision < 0) {
+        while (count > 0 && frac[count - 1] == '0') count--;
+    }
+    int frac_len = precision > count ? precision : count;
+    bool point = frac_len > 0 || (flags & U_FLAG_ALT_FORM);
+    
+    char ebuf[8];
+    char* estr = u_utoa_dec32((uint32_t)(exp < 0 ? -exp : exp), ebuf + sizeof(ebuf));
+    *--estr = exp < 0 ? '-' : '+';
+    *--estr = upper ? 'P' : 'p';
+    int elen = (int)(ebuf + sizeof(ebuf) - estr);
+    
+    head[head_len++] = '0';
+    head[head_len++] = upper ? 'X' : 'x';
+    
+    int total = head_len + 1 + (point ? 1 : 0) + frac_len + elen;
+    int pad = u_fp_field_begin(sink, width, total, flags, head, head_len, true);
+    u_sink_write(sink, &lead, 1);
+    if (point) u_sink_write(sink, &decimal_point, 1);
+    u_sink_write(sink, frac, count);
+    u_sink_repeat(sink, '0', frac_len - count);
+    u_sink_write(sink, estr, elen);
+    u_fp_field_end(sink, pad, flags);
+    
+    return total + pad;
+}
+
+// Leading digits of mant * 2^exp2, truncated, with a sticky flag for the rest
+static void u_fp_leading_digits(uint64_t mant, int exp2, u_fp_dec_t* dec) {
+    u_fp_big_t big;
+    u_fp_expand(&big, mant, exp2, false, U_FP_SHORTEST_DIGITS);
+    
+    dec->count = 0;
+    dec->exp10 = big.e;
+    dec->sticky = big.truncated;
+    
+    char buf[9];
+    for (uint32_t* d = big.a; d < big.z; d++) {
+        if (dec->count == U_FP_SHORTEST_DIGITS) {
+            if (*d) dec->sticky = true;
+            continue;
+        }
+        
+        char* s = u_fp_word(*d, buf + 9);
+        if (d != big.a) while (s > buf) *--s = '0';
+        for (; s < buf + 9; s++) {
+            if (dec->count < U_FP_SHORTEST_DIGITS) {
+                dec->digits[dec->count++] = *s;
+            } else if (*s != '0') {
+                dec->sticky = true;
+            }
+        }
+    }
+}
+
+// Decimal digit of x at position 10^pos
+static int u_fp_digit_at(const u_fp_dec_t* x, int pos) {
+    int idx = x->exp10 - pos;
+    return (idx >= 0 && idx < x->count) ? x->digits[idx] - '0' : 0;
+}
+
+// Whether x has nonzero digits strictly below position 10^pos
+static bool u_fp_nonzero_below(const u_fp_dec_t* x, int pos) {
+    if (x->sticky) return true;
+    for (int idx = x->exp10 - pos + 1; idx < x->count; idx++) {
+        if (idx >= 0 && x->digits[idx] != '0') return true;
+    }
+    return false;
+}
+
+// floor(x / 10^pos)
+static uint64_t u_fp_prefix(const u_fp_dec_t* x, int pos) {
+    uint64_t n = 0;
+    for (int p = x->exp10; p >= pos; p--) {
+        n = n * 10 + u_fp_digit_at(x, p);
+    }
+    return n;
+}
+
+// Bounds of the n digit candidates, at the scale of the upper boundary, that
+// fall inside the rounding interval [low, high]
+static bool u_fp_candidates(const u_fp_dec_t* low, const u_fp_dec_t* high, bool inclusive,
+                            int n, uint64_t* lo, uint64_t* hi) {
+    int pos = high->exp10 - n + 1;
+    
+    *hi = u_fp_prefix(high, pos);
+    if (!u_fp_nonzero_below(high, pos) && !inclusive) (*hi)--;
+    
+    *lo = u_fp_prefix(low, pos);
+    if (u_fp_nonzero_below(low, pos) || !inclusive) (*lo)++;
+    
+    return *lo <= *hi;
+}
+
+/*
+ * Shortest digit string that reads back as mant * 2^exp2. The decimal
+ * candidates for each length are checked against the exact rounding
+ * interval around the value; the interval is closed when the mantissa is
+ * even, matching round-half-to-even on input. Returns the digit count and
+ * stores the decimal exponent of the first digit in *exp10.
+ */
+static int u_fp_shortest(uint64_t mant, int exp2, char* digits, int* exp10) {
+    if (mant == 0) {
+        digits[0] = '0';
+        *exp10 = 0;
+        return 1;
+    }
+    
+    // Interval boundaries at a common scale of 2^(exp2 - 2)
+    bool even = !(mant & 1);
+    bool closer_below = mant == (1ull << 52) && exp2 > -1074;
+    u_fp_dec_t low, value, high;
+    u_fp_leading_digits(4 * mant - (closer_below ? 1 : 2), exp2 - 2, &low);
+    u_fp_leading_digits(mant, exp2, &value);
+    u_fp_leading_digits(4 * mant + 2, exp2 - 2, &high);
+    
+    // A longer candidate grid is finer, so the shortest fitting length can be
+    // bisected. 17 digits at the value's exponent always fit, which is at most
+    // 18 at the upper boundary's.
+    uint64_t lo, hi;
+    int min_n = 1, max_n = U_FP_SHORTEST_DIGITS - 2;
+    while (min_n < max_n) {
+        int n = (min_n + max_n) / 2;
+        if (u_fp_candidates(&low, &high, even, n, &lo, &hi)) max_n = n;
+        else min_n = n + 1;
+    }
+    u_fp_candidates(&low, &high, even, max_n, &lo, &hi);
+    
+    // Candidate nearest to the value, kept inside the interval
+    int pos = high.exp10 - max_n + 1;
+    uint64_t n_value = u_fp_prefix(&value, pos);
+    int next = u_fp_digit_at(&value, pos - 1);
+    bool rest = u_fp_nonzero_below(&value, pos - 1);
+    if (next > 5 || (next == 5 && (rest || (n_value & 1)))) n_value++;
+    if (n_value < lo) n_value = lo;
+    if (n_value > hi) n_value = hi;
+    
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* start = u_utoa_end(n_value, end, 10, false);
+    while (end > start + 1 && end[-1] == '0') {
+        end--;
+        pos++;
+    }
+    int count = (int)(end - start);
+    memcpy(digits, start, count);
+    *exp10 = pos + count - 1;
+    return count;
+}
+
+// Length of the exponent suffix for %e style output
+static int u_fp_exp_suffix(int e, char t, char* ebuf_end, char** estr) {
+    char* s = u_utoa_dec32((uint32_t)(e < 0 ? -e : e), ebuf_end);
+    while (ebuf_end - s < 2) *--s = '0';
+    *--s = e < 0 ? '-' : '+';
+    *--s = t;
+    *estr = s;
+    return (int)(ebuf_end - s);
+}
+
+// %r / %R: shortest round-trip digits, fixed or exponent notation like %g
+static int u_fp_format_shortest(u_sink_t* sink, uint64_t mant, int exp2, int width,
+                                unsigned int flags, bool upper, const char* head, int head_len,
+                                char decimal_point) {
+    char digits[U_FP_SHORTEST_DIGITS];
+    int e = 0;
+    int count = u_fp_shortest(mant, exp2, digits, &e);
+    
+    char body[U_FP_SHORTEST_DIGITS + 24];
+    int len = 0;
+    
+    if (e < -4 || e >= 16) {
+        body[len++] = digits[0];
+        if (count > 1 || (flags & U_FLAG_ALT_FORM)) body[len++] = decimal_point;
+        memcpy(body + len, digits + 1, count - 1);
+        len += count - 1;
+        
+        char ebuf[8];
+        char* estr;
+        int elen = u_fp_exp_suffix(e, upper ? 'E' : 'e', ebuf + sizeof(ebuf), &estr);
+        memcpy(body + len, estr, elen);
+        len += elen;
+    } else if (e < 0) {
+        body[len++] = '0';
+        body[len++] = decimal_point;
+        for (int i = -1; i > e; i--) body[len++] = '0';
+        memcpy(body + len, digits, count);
+        len += count;
+    } else {
+        for (int i = 0; i <= e; i++) body[len++] = i < count ? digits[i] : '0';
+        if (count > e + 1 || (flags & U_FLAG_ALT_FORM)) body[len++] = decimal_point;
+        if (count > e + 1) {
+            memcpy(body + len, digits + e + 1, count - e - 1);
+            len += count - e - 1;
+        }
+    }
+    
+    int total = head_len + len;
+    int pad = u_fp_field_begin(sink, width, total, flags, head, head_len, true);
+    u_sink_write(sink, body, len);
+    u_fp_field_end(sink, pad, flags);
+    return total + pad;
+}
+
+/*
+ * Format a double for %f %F %e %E %g %G %a %A %r %R. Returns the number of
+ * characters written.
+ */
+static int u_fp_format(u_sink_t* sink, double value, int width, int precision,
+                       unsigned int flags, char t, char decimal_point) {
+    uint64_t mant = 0;
+    int exp2 = 0;
+    bool negative;
+    u_fp_class_t cls = u_fp_decompose(value, &mant, &exp2, &negative);
+    bool upper = t >= 'A' && t <= 'Z';
+    char lower_t = (char)(t | 32);
+    
+    char head[3];
+    int head_len = 0;
+    if (negative) head[head_len++] = '-';
+    else if (flags & U_FLAG_FORCE_SIGN) head[head_len++] = '+';
+    else if (flags & U_FLAG_SPACE_SIGN) head[head_len++] = ' ';
+    
+    if (cls != U_FP_FINITE) {
+        const char* s = cls == U_FP_NAN ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf");
+        int total = head_len + 3;
+        int pad = u_fp_field_begin(sink, width, total, flags, head, head_len, false);
+        u_sink_write(sink, s, 3);
+        u_fp_field_end(sink, pad, flags);
+        return total + pad;
+    }
+    
+    if (lower_t == 'a') {
+        return u_fp_format_hex(sink, mant, exp2, width, precision, flags, upper,
+                               head, head_len, decimal_point);
+    }
+    if (lower_t == 'r') {
+        return u_fp_format_shortest(sink, mant, exp2, width, flags, upper,
+                                    head, head_len, decimal_point);
+    }
+    
+    int p = precision < 0 ? 6 : precision;
+    u_fp_big_t big;
+    u_fp_expand(&big, mant, exp2, lower_t == 'f', p);
+    
+    // Digits to keep after the radix point (may be negative for %e/%g)
+    int keep = p - (lower_t != 'f') * big.e - (lower_t == 'g' && p);
+    u_fp_round(&big, keep);
+    
+    int e = big.e;
+    if (lower_t == 'g') {
+        if (!p) p++;
+        if (p > e && e >= -4) {
+            t = upper ? 'F' : 'f';
+            p -= e + 1;
+        } else {
+            t = upper ? 'E' : 'e';
+            p--;
+        }
+        lower_t = (char)(t | 32);
+        
+        if (!(flags & U_FLAG_ALT_FORM)) {
+            // Drop trailing zeros of the significant digits
+            int j = 9;
+            if (big.z > big.a && big.z[-1]) {
+                j = 0;
+                for (uint32_t i = 10; big.z[-1] % i == 0; i *= 10) j++;
+            }
+            int avail = lower_t == 'f' ? 9 * (int)(big.z - big.r - 1) - j
+                                       : 9 * (int)(big.z - big.r - 1) + e - j;
+            if (avail < 0) avail = 0;
+            if (p > avail) p = avail;
+        }
+    }
+    
+    bool point = p || (flags & U_FLAG_ALT_FORM);
+    int len = 1 + p + (point ? 1 : 0);
+    char ebuf[8];
+    char* estr = ebuf;
+    int elen = 0;
+    if (lower_t == 'f') {
+        if (e > 0) len += e;
+    } else {
+        elen = u_fp_exp_suffix(e, t, ebuf + sizeof(ebuf), &estr);
+        len += elen;
+    }
+    
+    int total = head_len + len;
+    int pad = u_fp_field_begin(sink, width, total, flags, head, head_len, true);
+    char buf[9];
+    
+    if (lower_t == 'f') {
+        uint32_t* a = big.a > big.r ? big.r : big.a;
+        uint32_t* d;
+        for (d = a; d <= big.r; d++) {
+            char* s = u_fp_word(*d, buf + 9);
+            if (d != a) while (s > buf) *--s = '0';
+            u_sink_write(sink, s, buf + 9 - s);
+        }
+        if (point) u_sink_write(sink, &decimal_point, 1);
+        for (; d < big.z && p > 0; d++, p -= 9) {
+            char* s = u_fp_word(*d, buf + 9);
+            while (s > buf) *--s = '0';
+            u_sink_write(sink, s, p < 9 ? p : 9);
+        }
+        u_sink_repeat(sink, '0', p);
+    } else {
+        uint32_t* z = big.z > big.a ? big.z : big.a + 1;
+        for (uint32_t* d = big.a; d < z && p >= 0; d++) {
+            char* s = u_fp_word(*d, buf + 9);
+            if (d != big.a) {
+                while (s > buf) *--s = '0';
+            } else {
+                u_sink_write(sink, s++, 1);
+                if (point) u_sink_write(sink, &decimal_point, 1);
+            }
+            int n = (int)(buf + 9 - s);
+            u_sink_write(sink, s, n < p ? n : p);
+            p -= n;
+        }
+        u_sink_repeat(sink, '0', p);
+        u_sink_write(sink, estr, elen);
+    }
+    
+    u_fp_field_end(sink, pad, flags);
+    return total + pad;
+}
+#endif
+
+// Fetch integer arguments according to the parsed length modifier
+static int64_t u_fetch_signed(va_list* args, int length_modifier) {
+    switch (length_modifier) {
+        case -2: return (signed char)va_arg(*args, int);
+        case -1: return (short)va_arg(*args, int);
+        case 1:  return va_arg(*args, long);
+        case 2:  return va_arg(*args, long long);
+        case 3:  return (ptrdiff_t)va_arg(*args, size_t);
+        case 4:  return va_arg(*args, ptrdiff_t);
+        case 5:  return va_arg(*args, intmax_t);
+        default: return va_arg(*args, int);
+    }
+}
+
+static uint64_t u_fetch_unsigned(va_list* args, int length_modifier) {
+    switch (length_modifier) {
+        case -2: return (unsigned char)va_arg(*args, unsigned int);
+        case -1: return (unsigned short)va_arg(*args, unsigned int);
+        case 1:  return va_arg(*args, unsigned long);
+        case 2:  return va_arg(*args, unsigned long long);
+        case 3:  return va_arg(*args, size_t);
+        case 4:  return (size_t)va_arg(*args, ptrdiff_t);
+        case 5:  return va_arg(*args, uintmax_t);
+        default: return va_arg(*args, unsigned int);
+    }
+}
+
+// Parse a POSIX "N$" argument number. Returns 0 and leaves `fmt` alone if
+// there is none; numbers past 255 are clamped and rejected by the caller.
+static int u_parse_position(const char** fmt) {
+    const char* p = *fmt;
+    int position = 0;
+    while (*p >= '0' && *p <= '9') {
+        if (position < 256) position = position * 10 + (*p - '0');
+        p++;
+    }
+    if (p == *fmt || *p != '$' || position == 0) return 0;
+    
+    *fmt = p + 1;
+    return position > 255 ? 255 : position;
+}
+
+// Parse the conversion that follows '%' into a descriptor. Returns the
+// position after the specifier, or NULL if the format ends before one.
+static const char* u_parse_spec(const char* fmt, u_format_spec_t* spec) {
+    unsigned int flags = 0;
+    int width = -1;
+    int precision = -1;
+    int length_modifier = 0;
+    int width_position = 0;
+    int precision_position = 0;
+    int position = u_parse_position(&fmt);
+    
+    // Parse flags
+    while (*fmt) {
+        if (*fmt == '-') flags |= U_FLAG_LEFT_ALIGN;
+        else if (*fmt == '+') flags |= U_FLAG_FORCE_SIGN;
+        else if (*fmt == ' ') flags |= U_FLAG_SPACE_SIGN;
+        else if (*fmt == '0') flags |= U_FLAG_ZERO_PAD;
+        else if (*fmt == '#') flags |= U_FLAG_ALT_FORM;
+        else break;
+        fmt++;
+    }
+    
+    // Parse width
+    if (*fmt == '*') {
+        flags |= U_FLAG_WIDTH_ARG;
+        fmt++;
+        width_position = u_parse_position(&fmt);
+    } else {
+        width = 0;
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt - '0');
+            fmt++;
+        }
+        if (width == 0) width = -1;
+    }
+    
+    // Parse precision
+    if (*fmt == '.') {
+        fmt++;
+        if (*fmt == '*') {
+            flags |= U_FLAG_PRECISION_ARG;
+            fmt++;
+            precision_position = u_parse_position(&fmt);
+        } else {
+            precision = 0;
+            while (*fmt >= '0' && *fmt <= '9') {
+                precision = precision * 10 + (*fmt - '0');
+                fmt++;
+            }
+        }
+    }
+    
+    // Parse length modifiers
+    if (*fmt == 'h') {
+        length_modifier = -1;
+        fmt++;
+        if (*fmt == 'h') {
+            length_modifier = -2;
+            fmt++;
+        }
+    } else if (*fmt == 'l') {
+        length_modifier = 1;
+        fmt++;
+        if (*fmt == 'l') {
+            length_modifier = 2;
+            fmt++;
+        }
+    } else if (*fmt == 'z') {
+        length_modifier = 3; // size_t
+        fmt++;
+    } else if (*fmt == 't') {
+        length_modifier = 4; // ptrdiff_t
+        fmt++;
+    } else if (*fmt == 'j') {
+        length_modifier = 5; // intmax_t
+        fmt++;
+    } else if (*fmt == 'L') {
+        length_modifier = 6; // long double
+        fmt++;
+    }
+    
+    spec->flags = flags;
+    spec->width = width;
+    spec->precision = precision;
+    spec->length = (signed char)length_modifier;
+    spec->specifier = *fmt;
+    spec->position = (unsigned char)position;
+    spec->width_position = (unsigned char)width_position;
+    spec->precision_position = (unsigned char)precision_position;
+    return *fmt ? fmt + 1 : NULL;
+}
+
+// Render one conversion whose '*' values are resolved into `spec` and whose
+// value, already read at the width of the length modifier, is in `arg`.
+static int u_render_value(u_sink_t* sink, const u_format_spec_t* spec, const u_arg_t* arg) {
+    int chars_written = 0;
+    unsigned int flags = spec->flags;
+    int width = spec->width;
+    int precision = spec->precision;
+    char specifier = spec->specifier;
+    
+    // Handle standard specifiers. Numbers are converted backwards into the
+    // end of the buffer; sign and "0x" prefixes are emitted separately so
+    // zero padding lands between them and the digits.
+    char buffer[UPRINTF_BUFFER_SIZE < 24 ? 24 : UPRINTF_BUFFER_SIZE];
+    char* digits = buffer + sizeof(buffer);
+    int len = 0;
+    char sign = 0;
+    const char* prefix = NULL;
+    bool number = false;
+    bool integer = false;
+    bool signed_conv = false;
+    
+    switch (specifier) {
+        case 'd':
+        case 'i': {
+            number = integer = signed_conv = true;
+            int64_t value = arg->value.i;
+            uint64_t magnitude = (uint64_t)value;
+            if (value < 0) {
+                sign = '-';
+                magnitude = 0 - magnitude;
+            }
+            
+            digits = u_utoa_end(magnitude, digits, 10, false);
+            len = (int)(buffer + sizeof(buffer) - digits);
+            break;
+        }
+        
+        case 'u': {
+            number = integer = true;
+            uint64_t value = arg->value.u;
+            
+            digits = u_utoa_end(value, digits, 10, false);
+            len = (int)(buffer + sizeof(buffer) - digits);
+            break;
+        }
+        
+        case 'o': {
+            number = integer = true;
+            uint64_t value = arg->value.u;
+            
+            digits = u_utoa_end(value, digits, 8, false);
+            if (flags & U_FLAG_ALT_FORM && value != 0) {
+                *--digits = '0'; // Octal prefix is part of the digits
+            }
+            len = (int)(buffer + sizeof(buffer) - digits);
+            break;
+        }
+        
+        case 'x':
+        case 'X': {
+            number = integer = true;
+            bool uppercase = (specifier == 'X');
+            uint64_t value = arg->value.u;
+            
+            digits = u_utoa_end(value, digits, 16, uppercase);
+            len = (int)(buffer + sizeof(buffer) - digits);
+            if (flags & U_FLAG_ALT_FORM && value != 0) {
+                prefix = uppercase ? "0X" : "0x";
+            }
+            break;
+        }
+        
+#if UPRINTF_FLOAT_SUPPORT && UPRINTF_FLOAT_ENGINE == UPRINTF_FLOAT_ENGINE_FULL
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        case 'r':
+        case 'R': {
+            if (!sink->context->float_support) {
+                // Float support disabled
+                char unknown[2] = {'%', specifier};
+                u_sink_write(sink, unknown, 2);
+                chars_written += 2;
+                return chars_written;
+            }
+            
+            double value = spec->length == 6 ? (double)arg->ld : arg->value.d;
+            chars_written += u_fp_format(sink, value, width, precision, flags,
+                                         specifier, sink->context->decimal_point);
+            return chars_written;
+        }
+#elif UPRINTF_FLOAT_SUPPORT
+        case 'f':
+        case 'F': {
+            if (!sink->context->float_support) {
+                // Float support disabled
+                char unknown[2] = {'%', specifier};
+                u_sink_write(sink, unknown, 2);
+                chars_written += 2;
+                return chars_written;
+            }
+            
+            number = signed_conv = true;
+            double value = spec->length == 6 ? (double)arg->ld : arg->value.d;
+            u_ftoa(value, buffer, precision, sink->context->decimal_point);
+            digits = buffer;
+            if (*digits == '-') {
+                sign = '-';
+                digits++;
+            }
+            len = u_strlen(digits);
+            break;
+        }
+#endif
+        
+        case 'c': {
+            char c = (char)arg->value.i;
+            int padding = width > 1 ? width - 1 : 0;
+            
+            if (!(flags & U_FLAG_LEFT_ALIGN)) {
+                u_sink_repeat(sink, ' ', padding);
+                chars_written += padding;
+            }
+            
+            u_sink_write(sink, &c, 1);
+            chars_written++;
+            
+            if (flags & U_FLAG_LEFT_ALIGN) {
+                u_sink_repeat(sink, ' ', padding);
+                chars_written += padding;
+            }
+            
+            return chars_written;
+        }
+        
+        case 's': {
+            const char* str = arg->value.s;
+            int str_len = str ? u_strlen(str) : 6; // "(null)"
+            
+            // Handle precision for strings (negative precision means no limit)
+            if (precision >= 0 && precision < str_len) {
+                str_len = precision;
+            }
+            
+            int padding = width > str_len ? width - str_len : 0;
+            
+            if (!(flags & U_FLAG_LEFT_ALIGN)) {
+                u_sink_repeat(sink, ' ', padding);
+                chars_written += padding;
+            }
+            
+            u_sink_write_ref(sink, str ? str : "(null)", str_len);
+            chars_written += str_len;
+            
+            if (flags & U_FLAG_LEFT_ALIGN) {
+                u_sink_repeat(sink, ' ', padding);
+                chars_written += padding;
+            }
+            
+            return chars_written;
+        }
+        
+        case 'S': {
+            // The length is known up front, so padding needs no scan
+            const u_source_t* src = (const u_source_t*)arg->value.p;
+            size_t total = src && src->read ? src->length : 0;
+            if (precision >= 0 && (size_t)precision < total) total = (size_t)precision;
+            int padding = width > 0 && (size_t)width > total ? width - (int)total : 0;
+            
+            if (!(flags & U_FLAG_LEFT_ALIGN)) {
+                u_sink_repeat(sink, ' ', padding);
+                chars_written += padding;
+            }
+            
+            if (total) chars_written += (int)u_sink_pull(sink, src, total);
+            
+            if (flags & U_FLAG_LEFT_ALIGN) {
+                u_sink_repeat(sink, ' ', padding);
+                chars_written += padding;
+            }
+            
+            return chars_written;
+        }
+        
+        case 'p': {
+            number = integer = true;
+            uintptr_t value = (uintptr_t)arg->value.p;
+            
+            digits = u_utoa_end(value, digits, 16, false);
+            len = (int)(buffer + sizeof(buffer) - digits);
+            prefix = "0x";
+            break;
+        }
+        
+        case '%': {
+            u_sink_write(sink, "%", 1);
+            chars_written++;
+            return chars_written;
+        }
+        
+        case 'n': {
+            int* ptr = (int*)arg->value.p;
+            if (ptr) *ptr = chars_written;
+            return chars_written;
+        }
+        
+        default: {
+            // Unknown specifier - output as-is
+            char unknown[2] = {'%', specifier};
+            u_sink_write(sink, unknown, 2);
+            chars_written += 2;
+            return chars_written;
+        }
+    }
+    
+    // Handle numbers
+    if (number) {
+        // '+' and ' ' only apply to signed conversions
+        if (!sign && signed_conv && (flags & U_FLAG_FORCE_SIGN)) {
+            sign = '+';
+        } else if (!sign && signed_conv && (flags & U_FLAG_SPACE_SIGN)) {
+            sign = ' ';
+        }
+        
+        // Zero with an explicit precision of zero prints no digits
+        if (integer && precision == 0 && len == 1 && *digits == '0' &&
+            !(specifier == 'o' && (flags & U_FLAG_ALT_FORM))) {
+            len = 0;
+        }
+        
+        char head[3];
+        int head_len = 0;
+        if (sign) head[head_len++] = sign;
+        if (prefix) {
+            head[head_len++] = prefix[0];
+            head[head_len++] = prefix[1];
+        }
+        
+        int zero_padding = (integer && precision > len) ? precision - len : 0;
+        int total_len = head_len + zero_padding + len;
+        int padding = width > total_len ? width - total_len : 0;
+        
+        if (flags & U_FLAG_ZERO_PAD && !(flags & U_FLAG_LEFT_ALIGN) && (!integer || precision < 0)) {
+            zero_padding += padding;
+            padding = 0;
+        }
+        
+        // Output left padding
+        if (!(flags & U_FLAG_LEFT_ALIGN)) {
+            u_sink_repeat(sink, ' ', padding);
+            chars_written += padding;
+        }
+        
+        // Output sign and prefix
+        u_sink_write(sink, head, head_len);
+        chars_written += head_len;
+        
+        // Output zero padding
+        u_sink_repeat(sink, '0', zero_padding);
+        chars_written += zero_padding;
+        
+        // Output number
+        u_sink_write(sink, digits, len);
+        chars_written += len;
+        
+        // Output right padding
+        if (flags & U_FLAG_LEFT_ALIGN) {
+            u_sink_repeat(sink, ' ', padding);
+            chars_written += padding;
+        }
+    }
+    
+    return chars_written;
+}
+
+// Render one parsed conversion, reading its arguments from a va_list.
+// `fmt` points past the specifier and is passed on to custom handlers.
+static int u_render_spec(u_sink_t* sink, const u_format_spec_t* spec, const char** fmt,
+                         va_list* args) {
+    u_format_spec_t resolved = *spec;
+    
+    // '*' arguments come first, in the order they appear in the format.
+    // A negative width means left alignment, a negative precision none.
+    if (spec->flags & U_FLAG_WIDTH_ARG) {
+        resolved.width = va_arg(*args, int);
+        if (resolved.width < 0) {
+            resolved.flags |= U_FLAG_LEFT_ALIGN;
+            resolved.width = -resolved.width;
+        }
+    }
+    if (spec->flags & U_FLAG_PRECISION_ARG) {
+        resolved.precision = va_arg(*args, int);
+        if (resolved.precision < 0) resolved.precision = -1;
+    }
+    
+    U_STAT_ADD(conversions[(unsigned char)spec->specifier & 0x7F], 1);
+    
+    // Check for custom handlers
+    u_format_handler_t handler = u_find_handler(sink->context, spec->specifier);
+    if (handler) {
+        U_STAT_ADD(handler_hits, 1);
+        return handler(sink->putc, sink->putc_ctx, args, fmt, resolved.width,
+                       resolved.precision, resolved.flags);
+    }
+    
+    // Only conversions the renderer knows consume an argument
+    u_arg_t arg = {U_ARG_OTHER, {0}, 0};
+    switch (spec->specifier) {
+        case 'd':
+        case 'i':
+            arg.value.i = u_fetch_signed(args, spec->length);
+            break;
+        
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            arg.value.u = u_fetch_unsigned(args, spec->length);
+            break;
+        
+#if UPRINTF_FLOAT_SUPPORT && UPRINTF_FLOAT_ENGINE == UPRINTF_FLOAT_ENGINE_FULL
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        case 'r':
+        case 'R':
+#elif UPRINTF_FLOAT_SUPPORT
+        case 'f':
+        case 'F':
+#endif
+#if UPRINTF_FLOAT_SUPPORT
+            // With float support disabled the specifier is printed as-is
+            if (sink->context->float_support) {
+                if (spec->length == 6) arg.ld = va_arg(*args, long double);
+                else arg.value.d = va_arg(*args, double);
+            }
+            break;
+#endif
+        
+        case 'c':
+            arg.value.i = va_arg(*args, int);
+            break;
+        
+        case 's':
+            arg.value.s = va_arg(*args, const char*);
+            break;
+        
+        case 'S':
+            arg.value.p = va_arg(*args, const u_source_t*);
+            break;
+        
+        case 'p':
+            arg.value.p = va_arg(*args, void*);
+            break;
+        
+        case 'n':
+            arg.value.p = va_arg(*args, int*);
+            break;
+    }
+    
+    return u_render_value(sink, &resolved, &arg);
+}
+
+// Typed argument packs. Integers are narrowed to the length modifier the
+// same way u_fetch_signed / u_fetch_unsigned read them from a va_list.
+static bool u_arg_is_integer(u_arg_tag_t type) {
+    return type >= U_ARG_INT && type <= U_ARG_ULLONG;
+}
+
+static int64_t u_narrow_signed(long long value, int length_modifier) {
+    switch (length_modifier) {
+        case -2: return (signed char)value;
+        case -1: return (short)value;
+        case 1: return (long)value;
+        case 2: return value;
+        case 3:
+        case 4: return (ptrdiff_t)value;
+        case 5: return (intmax_t)value;
+        default: return (int)value;
+    }
+}
+
+static uint64_t u_narrow_unsigned(unsigned long long value, int length_modifier) {
+    switch (length_modifier) {
+        case -2: return (unsigned char)value;
+        case -1: return (unsigned short)value;
+        case 1: return (unsigned long)value;
+        case 2: return value;
+        case 3:
+        case 4: return (size_t)value;
+        case 5: return (uintmax_t)value;
+        default: return (unsigned int)value;
+    }
+}
+
+// Load the value of one conversion from `in` (NULL once the pack has run
+// out). Returns 1 if a value was taken, 0 if the conversion takes none, and
+// -1 if it is missing or of the wrong kind.
+static int u_arg_load(const u_format_spec_t* spec, const u_arg_t* in, u_arg_t* out) {
+    switch (spec->specifier) {
+        case 'd':
+        case 'i':
+            if (!in || !u_arg_is_integer(in->type)) return -1;
+            out->value.i = u_narrow_signed(in->value.i, spec->length);
+            return 1;
+        
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if (!in || !u_arg_is_integer(in->type)) return -1;
+            out->value.u = u_narrow_unsigned(in->value.u, spec->length);
+            return 1;
+        
+        case 'c':
+            if (!in || !u_arg_is_integer(in->type)) return -1;
+            out->value.i = (int)in->value.i;
+            return 1;
+        
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        case 'r':
+        case 'R':
+            if (!in || (in->type != U_ARG_DOUBLE && in->type != U_ARG_LDOUBLE)) return -1;
+            if (spec->length == 6) {
+                out->ld = in->type == U_ARG_LDOUBLE ? in->ld : in->value.d;
+            } else {
+                out->value.d = in->type == U_ARG_LDOUBLE ? (double)in->ld : in->value.d;
+            }
+            return 1;
+        
+        case 's':
+            if (!in || in->type != U_ARG_STR) return -1;
+            out->value.s = in->value.s;
+            return 1;
+        
+        case 'p':
+            if (!in || (in->type != U_ARG_PTR && in->type != U_ARG_STR)) return -1;
+            out->value.p = in->type == U_ARG_STR ? (const void*)in->value.s : in->value.p;
+            return 1;
+        
+        case 'S':
+        case 'n':
+            if (!in || in->type != U_ARG_PTR) return -1;
+            out->value.p = in->value.p;
+            return 1;
+        
+        default:
+            return 0; // '%' and unknown specifiers
+    }
+}
+
+// Custom handlers read their value with va_arg, so it is passed through a
+// real argument list at the type its tag names.
+static int u_arg_handler_call(u_sink_t* sink, u_format_handler_t handler,
+                              const u_format_spec_t* spec, const char** fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = handler(sink->putc, sink->putc_ctx, &args, fmt, spec->width,
+                         spec->precision, spec->flags);
+    va_end(args);
+    return result;
+}
+
+static int u_arg_handler(u_sink_t* sink, u_format_handler_t handler,
+                         const u_format_spec_t* spec, const char** fmt, const u_arg_t* arg) {
+    if (!arg) return u_arg_handler_call(sink, handler, spec, fmt);
+    
+    switch (arg->type) {
+        case U_ARG_INT: return u_arg_handler_call(sink, handler, spec, fmt, (int)arg->value.i);
+        case U_ARG_UINT:
+            return u_arg_handler_call(sink, handler, spec, fmt, (unsigned int)arg->value.u);
+        case U_ARG_LONG: return u_arg_handler_call(sink, handler, spec, fmt, (long)arg->value.i);
+        case U_ARG_ULONG:
+            return u_arg_handler_call(sink, handler, spec, fmt, (unsigned long)arg->value.u);
+        case U_ARG_LLONG: return u_arg_handler_call(sink, handler, spec, fmt, arg->value.i);
+        case U_ARG_ULLONG: return u_arg_handler_call(sink, handler, spec, fmt, arg->value.u);
+        case U_ARG_DOUBLE: return u_arg_handler_call(sink, handler, spec, fmt, arg->value.d);
+        case U_ARG_LDOUBLE:
+            return u_arg_handler_call(sink, handler, spec, fmt, arg->ld);
+        case U_ARG_STR: return u_arg_handler_call(sink, handler, spec, fmt, arg->value.s);
+        default: return u_arg_handler_call(sink, handler, spec, fmt, arg->value.p);
+    }
+}
+
+// Integer '*' value at "N$" position, or the next one in order. NULL if
+// it is missing or not an integer.
+static const u_arg_t* u_arg_star(const u_arg_t* args, int count, int* next, int position) {
+    int index = position ? position - 1 : (*next)++;
+    if (index >= count || !u_arg_is_integer(args[index].type)) return NULL;
+    return &args[index];
+}
+
+// Render one parsed conversion, taking its arguments from a typed pack:
+// args[N - 1] for "%N$", otherwise args[*next], advancing *next past them.
+static int u_render_arg(u_sink_t* sink, const u_format_spec_t* spec, const char** fmt,
+                        const u_arg_t* args, int count, int* next) {
+    u_format_spec_t resolved = *spec;
+    
+    if (spec->flags & U_FLAG_WIDTH_ARG) {
+        const u_arg_t* width = u_arg_star(args, count, next, spec->width_position);
+        if (!width) return -1;
+        resolved.width = (int)width->value.i;
+        if (resolved.width < 0) {
+            resolved.flags |= U_FLAG_LEFT_ALIGN;
+            resolved.width = -resolved.width;
+        }
+    }
+    if (spec->flags & U_FLAG_PRECISION_ARG) {
+        const u_arg_t* precision = u_arg_star(args, count, next, spec->precision_position);
+        if (!precision) return -1;
+        resolved.precision = (int)precision->value.i;
+        if (resolved.precision < 0) resolved.precision = -1;
+    }
+    
+    U_STAT_ADD(conversions[(unsigned char)spec->specifier & 0x7F], 1);
+    
+    int index = spec->position ? spec->position - 1 : *next;
+    const u_arg_t* in = index < count ? &args[index] : NULL;
+    u_format_handler_t handler = u_find_handler(sink->context, spec->specifier);
+    if (handler) {
+        U_STAT_ADD(handler_hits, 1);
+        if (in && !spec->position) (*next)++;
+        return u_arg_handler(sink, handler, &resolved, fmt, in);
+    }
+    
+    u_arg_t value = {U_ARG_OTHER, {0}, 0};
+    int taken = u_arg_load(spec, in, &value);
+    if (taken < 0) return -1;
+    if (!spec->position) *next += taken;
+    return u_render_value(sink, &resolved, &value);
+}
+
+// Formatting engine over a typed argument pack; mirrors u_format_engine
+static int u_format_engine_args(u_sink_t* sink, const char* fmt, const u_arg_t* args, int count) {
+    int chars_written = 0;
+    int next = 0;
+    int numbered = -1; // Unknown until the first conversion, then 0 or 1
+    
+    while (*fmt) {
+        if (*fmt != '%') {
+            const char* start = fmt;
+            fmt = u_scan_until(fmt, '%');
+            u_sink_write_ref(sink, start, fmt - start);
+            chars_written += (int)(fmt - start);
+            continue;
+        }
+        
+        fmt++; // Skip '%'
+        if (!*fmt) break; // Handle trailing '%'
+        
+        u_format_spec_t spec;
+        const char* after = u_parse_spec(fmt, &spec);
+        if (!after) {
+            // No specifier found - output the entire format sequence
+            int len = (int)u_strlen(fmt);
+            u_sink_write(sink, "%", 1);
+            u_sink_write(sink, fmt, len);
+            chars_written += len + 1;
+            break;
+        }
+        fmt = after;
+        
+        // Numbered and sequential arguments cannot be mixed (undefined in POSIX)
+        if (spec.specifier != '%') {
+            int mine = spec.position != 0;
+            if (((spec.flags & U_FLAG_WIDTH_ARG) && (spec.width_position != 0) != mine) ||
+                ((spec.flags & U_FLAG_PRECISION_ARG) && (spec.precision_position != 0) != mine) ||
+                (numbered >= 0 && numbered != mine)) {
+                return -1;
+            }
+            numbered = mine;
+        }
+        
+        int result = u_render_arg(sink, &spec, &fmt, args, count, &next);
+        if (result < 0) return result;
+        chars_written += result;
+    }
+    
+    return chars_written;
+}
+
+// Record how position `position` is used. Kinds are 'i' (integer, read at
+// `length`), 'f' (floating, 6 for long double), 's' (string), 'p' (pointer).
+// A second use must read the argument the same way.
+static bool u_position_use(char* kinds, signed char* lengths, int* count,
+                           int position, char kind, int length) {
+    if (position < 1 || position > UPRINTF_MAX_POSITIONAL) return false;
+    
+    int index = position - 1;
+    if (kinds[index] && (kinds[index] != kind || lengths[index] != length)) return false;
+    kinds[index] = kind;
+    lengths[index] = (signed char)length;
+    if (position > *count) *count = position;
+    return true;
+}
+
+// Positional formats ("%2$s %1$d"). Re-walking the va_list for every
+// reference would be quadratic, so one pass over the format types each
+// position, one pass over the va_list captures them in order into a pack on
+// the stack, and the typed engine renders the format by direct indexing.
+// The scan covers the whole format from `fmt`, so sequential conversions
+// before the first numbered one are refused too; rendering starts at `from`.
+static int u_format_positional(u_sink_t* sink, const char* fmt, const char* from,
+                               va_list* args) {
+    char kinds[UPRINTF_MAX_POSITIONAL] = {0};
+    signed char lengths[UPRINTF_MAX_POSITIONAL];
+    int count = 0;
+    
+    for (const char* p = fmt; *(p = u_scan_until(p, '%'));) {
+        u_format_spec_t spec;
+        const char* next = u_parse_spec(p + 1, &spec);
+        if (!next) break; // Rendered literally
+        p = next;
+        if (spec.specifier == '%') continue;
+        
+        // Every argument must have a number, '*' ones included
+        if (!spec.position || ((spec.flags & U_FLAG_WIDTH_ARG) && !spec.width_position) ||
+            ((spec.flags & U_FLAG_PRECISION_ARG) && !spec.precision_position)) {
+            return -1;
+        }
+        if ((spec.flags & U_FLAG_WIDTH_ARG) &&
+            !u_position_use(kinds, lengths, &count, spec.width_position, 'i', 0)) {
+            return -1;
+        }
+        if ((spec.flags & U_FLAG_PRECISION_ARG) &&
+            !u_position_use(kinds, lengths, &count, spec.precision_position, 'i', 0)) {
+            return -1;
+        }
+        
+        char kind;
+        int length = 0;
+        switch (spec.specifier) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                kind = 'i';
+                length = spec.length;
+                break;
+            case 'c':
+                kind = 'i';
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            case 'r':
+            case 'R':
+                kind = 'f';
+                length = spec.length == 6 ? 6 : 0;
+                break;
+            case 's':
+                kind = 's';
+                break;
+            case 'p':
+            case 'S':
+            case 'n':
+                kind = 'p';
+                break;
+            default:
+                return -1; // Custom specifiers read arguments of unknown type
+        }
+        if (u_find_handler(sink->context, spec.specifier) ||
+            !u_position_use(kinds, lengths, &count, spec.position, kind, length)) {
+            return -1;
+        }
+    }
+    
+    // A gap would leave the type, and so the place, of later arguments unknown
+    u_arg_t pack[UPRINTF_MAX_POSITIONAL];
+    for (int i = 0; i < count; i++) {
+        switch (kinds[i]) {
+            case 'i':
+                pack[i].type = U_ARG_LLONG;
+                pack[i].value.i = u_fetch_signed(args, lengths[i]);
+                break;
+            case 'f':
+                if (lengths[i] == 6) {
+                    pack[i].type = U_ARG_LDOUBLE;
+                    pack[i].ld = va_arg(*args, long double);
+                } else {
+                    pack[i].type = U_ARG_DOUBLE;
+                    pack[i].value.d = va_arg(*args, double);
+                }
+                break;
+            case 's':
+                pack[i].type = U_ARG_STR;
+                pack[i].value.s = va_arg(*args, const char*);
+                break;
+            case 'p':
+                pack[i].type = U_ARG_PTR;
+                pack[i].value.p = va_arg(*args, void*);
+                break;
+            default:
+                return -1;
+        }
+    }
+    
+    return u_format_engine_args(sink, from, pack, count);
+}
+
+static int u_parse_format(u_sink_t* sink, const char* begin, const char** fmt, va_list* args) {
+    if (!sink || !fmt || !*fmt || !args) return 0;
+    
+    u_format_spec_t spec;
+    const char* next = u_parse_spec(*fmt, &spec);
+    if (!next) {
+        // No specifier found - output the entire format sequence
+        int len = (int)u_strlen(*fmt);
+        u_sink_write(sink, "%", 1);
+        u_sink_write(sink, *fmt, len);
+        *fmt += len;
+        return len + 1;
+    }
+    
+    // The first numbered conversion hands the rest of the format over
+    if (spec.position) {
+        int result = u_format_positional(sink, begin, *fmt - 1, args);
+        *fmt += u_strlen(*fmt);
+        return result;
+    }
+    
+    *fmt = next;
+    return u_render_spec(sink, &spec, fmt, args);
+}
+
+// Formatting engine shared by all public entry points
+static int u_format_engine(u_sink_t* sink, const char* fmt, va_list* args) {
+    const char* begin = fmt;
+    int chars_written = 0;
+    
+    while (*fmt) {
+        if (*fmt != '%') {
+            // Emit the whole literal run up to the next specifier at once
+            const char* start = fmt;
+            fmt = u_scan_until(fmt, '%');
+            u_sink_write_ref(sink, start, fmt - start);
+            chars_written += (int)(fmt - start);
+            continue;
+        }
+        
+        fmt++; // Skip '%'
+        if (!*fmt) break; // Handle trailing '%'
+        
+        int result = u_parse_format(sink, begin, &fmt, args);
+        if (result < 0) {
+            return result; // Error
+        }
+        chars_written += result;
+    }
+    
+    return chars_written;
+}
+
+// Staged formatting: spans are copied straight into the staging storage
+static int u_vprintf_staged(const u_context_t* context, u_output_buffer_t* ob,
+                            const char* fmt, va_list args) {
+    u_sink_t sink;
+    u_sink_init_span(&sink, u_output_buffer_write, ob);
+    sink.context = context;
+    
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
+    
+    if (ob->auto_flush) u_flush(ob);
+    return result;
+}
+
+// Public functions
+int u_context_vprintf(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                      const char* fmt, va_list args) {
+    if (!context || !output_cb || !fmt) {
+        return -1;
+    }
+    
+    if (output_cb == u_output_buffer_cb && ctx) {
+        return u_vprintf_staged(context, (u_output_buffer_t*)ctx, fmt, args);
+    }
+    
+    u_sink_t sink;
+    u_char_sink_ctx_t char_ctx;
+    u_sink_init_char(&sink, &char_ctx, output_cb, ctx);
+    sink.context = context;
+    
+    // Work on a local copy: a va_list parameter cannot be passed by address portably
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
+    return result;
+}
+
+int u_vprintf(u_output_cb_t output_cb, void* ctx, const char* fmt, va_list args) {
+    return u_context_vprintf(&u_state, output_cb, ctx, fmt, args);
+}
+
+int u_context_printf(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                     const char* fmt, ...) {
+    if (!context || !output_cb || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_vprintf(context, output_cb, ctx, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_context_vprintf_span(const u_context_t* context, u_write_cb_t write_cb, void* ctx,
+                           const char* fmt, va_list args) {
+    if (!context || !write_cb || !fmt) {
+        return -1;
+    }
+    
+    if (write_cb == u_output_buffer_write && ctx) {
+        return u_vprintf_staged(context, (u_output_buffer_t*)ctx, fmt, args);
+    }
+    
+    u_sink_t sink;
+    u_sink_init_span(&sink, write_cb, ctx);
+    sink.context = context;
+    
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
+    return result;
+}
+
+int u_vprintf_span(u_write_cb_t write_cb, void* ctx, const char* fmt, va_list args) {
+    return u_context_vprintf_span(&u_state, write_cb, ctx, fmt, args);
+}
+
+int u_context_printf_span(const u_context_t* context, u_write_cb_t write_cb, void* ctx,
+                          const char* fmt, ...) {
+    if (!context || !write_cb || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_vprintf_span(context, write_cb, ctx, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_printf_span(u_write_cb_t write_cb, void* ctx, const char* fmt, ...) {
+    if (!write_cb || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_vprintf_span(write_cb, ctx, fmt, args);
+    va_end(args);
+    return result;
+}
+
+// Whether a conversion can be rendered. Standard specifiers reject length
+// modifiers that do not apply to them.
+static bool u_spec_valid(const u_format_spec_t* spec) {
+    if (spec->position || spec->width_position || spec->precision_position) return false;
+    if (u_find_handler(&u_state, spec->specifier)) return true;
+    
+    switch (spec->specifier) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            return spec->length != 6;
+#if UPRINTF_FLOAT_SUPPORT
+#if UPRINTF_FLOAT_ENGINE == UPRINTF_FLOAT_ENGINE_FULL
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        case 'r':
+        case 'R':
+#endif
+        case 'f':
+        case 'F':
+            return spec->length == 0 || spec->length == 1 || spec->length == 6;
+#endif
+        case 'c':
+        case 's':
+        case 'S':
+        case 'p':
+        case 'n':
+            return spec->length == 0;
+        case '%':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Append a literal op if the span is not empty
+static int u_format_push_literal(u_format_op_t* ops, int capacity, int count,
+                                 const char* start, const char* end) {
+    if (end == start) return count;
+    if (count < capacity) {
+        ops[count].text = start;
+        ops[count].len = (int)(end - start);
+        ops[count].spec.specifier = 0;
+    }
+    return count + 1;
+}
+
+// Split a format into ops, storing at most `capacity` of them. Returns the
+// total number of ops, or -1 if the format is invalid.
+static int u_format_scan(const char* fmt, u_format_op_t* ops, int capacity) {
+    int count = 0;
+    const char* literal = fmt;
+    
+    while (*fmt) {
+        if (*fmt != '%') {
+            fmt = u_scan_until(fmt, '%');
+            continue;
+        }
+        
+        // "%%" ends the literal run with its first '%'
+        if (fmt[1] == '%') {
+            count = u_format_push_literal(ops, capacity, count, literal, fmt + 1);
+            fmt += 2;
+            literal = fmt;
+            continue;
+        }
+        
+        u_format_spec_t spec;
+        const char* next = u_parse_spec(fmt + 1, &spec);
+        if (!next || !u_spec_valid(&spec)) return -1;
+        
+        count = u_format_push_literal(ops, capacity, count, literal, fmt);
+        if (count < capacity) {
+            ops[count].text = next;
+            ops[count].len = 0;
+            ops[count].spec = spec;
+        }
+        count++;
+        fmt = literal = next;
+    }
+    
+    return u_format_push_literal(ops, capacity, count, literal, fmt);
+}
+
+// Bytes for the header and op list, plus slack to align caller storage
+static size_t u_format_compiled_bytes(int count) {
+    return sizeof(void*) - 1 + sizeof(u_format_compiled_t) + (size_t)count * sizeof(u_format_op_t);
+}
+
+size_t u_format_compile_size(const char* fmt) {
+    if (!fmt) return 0;
+    
+    int count = u_format_scan(fmt, NULL, 0);
+    return count < 0 ? 0 : u_format_compiled_bytes(count);
+}
+
+u_format_compiled_t* u_format_compile(const char* fmt, void* storage, size_t size) {
+    if (!fmt || !storage) return NULL;
+    
+    int count = u_format_scan(fmt, NULL, 0);
+    if (count < 0 || size < u_format_compiled_bytes(count)) return NULL;
+    
+    uintptr_t aligned = ((uintptr_t)storage + sizeof(void*) - 1) & ~(uintptr_t)(sizeof(void*) - 1);
+    u_format_compiled_t* compiled = (u_format_compiled_t*)aligned;
+    u_format_op_t* ops = (u_format_op_t*)(compiled + 1);
+    
+    u_format_scan(fmt, ops, count);
+    compiled->ops = ops;
+    compiled->count = count;
+    return compiled;
+}
+
+// Execute a compiled op list
+static int u_compiled_engine(u_sink_t* sink, const u_format_compiled_t* compiled, va_list* args) {
+    int chars_written = 0;
+    
+    for (int i = 0; i < compiled->count; i++) {
+        const u_format_op_t* op = &compiled->ops[i];
+        if (!op->spec.specifier) {
+            u_sink_write_ref(sink, op->text, op->len);
+            chars_written += op->len;
+            continue;
+        }
+        
+        const char* next = op->text;
+        int result = u_render_spec(sink, &op->spec, &next, args);
+        if (result < 0) {
+            return result; // Error
+        }
+        chars_written += result;
+    }
+    
+    return chars_written;
+}
+
+// Sink for a character callback. Returns the staging buffer behind it, if any.
+static u_output_buffer_t* u_sink_init_output(u_sink_t* sink, u_char_sink_ctx_t* cctx,
+                                             u_output_cb_t output_cb, void* ctx) {
+    if (output_cb == u_output_buffer_cb && ctx) {
+        u_sink_init_span(sink, u_output_buffer_write, ctx);
+        return (u_output_buffer_t*)ctx;
+    }
+    u_sink_init_char(sink, cctx, output_cb, ctx);
+    return NULL;
+}
+
+int u_context_vprintf_compiled(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                               const u_format_compiled_t* compiled, va_list args) {
+    if (!context || !output_cb || !compiled) {
+        return -1;
+    }
+    
+    u_sink_t sink;
+    u_char_sink_ctx_t char_ctx;
+    u_output_buffer_t* ob = u_sink_init_output(&sink, &char_ctx, output_cb, ctx);
+    sink.context = context;
+    
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_compiled_engine(&sink, compiled, &ap);
+    va_end(ap);
+    
+    if (ob && ob->auto_flush) u_flush(ob);
+    return result;
+}
+
+int u_vprintf_compiled(u_output_cb_t output_cb, void* ctx, const u_format_compiled_t* compiled,
+                       va_list args) {
+    return u_context_vprintf_compiled(&u_state, output_cb, ctx, compiled, args);
+}
+
+int u_printf_compiled(u_output_cb_t output_cb, void* ctx, const u_format_compiled_t* compiled, ...) {
+    if (!output_cb || !compiled) return -1;
+    
+    va_list args;
+    va_start(args, compiled);
+    int result = u_vprintf_compiled(output_cb, ctx, compiled, args);
+    va_end(args);
+    return result;
+}
+
+// Size of the integer types behind a tag
+static int u_tag_size(unsigned char tag) {
+    switch (tag) {
+        case U_ARG_INT:
+        case U_ARG_UINT: return (int)sizeof(int);
+        case U_ARG_LONG:
+        case U_ARG_ULONG: return (int)sizeof(long);
+        case U_ARG_LLONG:
+        case U_ARG_ULLONG: return (int)sizeof(long long);
+        default: return 0;
+    }
+}
+
+// 1 if an argument with this tag fits the conversion, 0 if not, -1 if the
+// specifier is not a standard one. Signedness is not checked, as in printf.
+static int u_tag_fits(const u_format_spec_t* spec, unsigned char tag) {
+    switch (spec->specifier) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        case 'c':
+            switch (spec->length) {
+                case -2:
+                case -1:
+                case 0: return tag == U_ARG_INT || tag == U_ARG_UINT;
+                case 1: return tag == U_ARG_LONG || tag == U_ARG_ULONG;
+                case 2: return tag == U_ARG_LLONG || tag == U_ARG_ULLONG;
+                case 3: return u_tag_size(tag) == (int)sizeof(size_t);
+                case 4: return u_tag_size(tag) == (int)sizeof(ptrdiff_t);
+                case 5: return u_tag_size(tag) == (int)sizeof(intmax_t);
+                default: return 0;
+            }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        case 'r':
+        case 'R':
+            return spec->length == 6 ? tag == U_ARG_LDOUBLE : tag == U_ARG_DOUBLE;
+        case 's':
+            return tag == U_ARG_STR;
+        case 'p':
+            return tag == U_ARG_PTR || tag == U_ARG_STR;
+        case 'S':
+        case 'n':
+            return tag == U_ARG_PTR;
+        default:
+            return -1;
+    }
+}
+
+int u_format_check(const char* fmt, const unsigned char* tags, int count) {
+    if (!fmt || (count > 0 && !tags)) return -1;
+    
+    int used = 0;
+    while (*(fmt = u_scan_until(fmt, '%'))) {
+        fmt++;
+        
+        u_format_spec_t spec;
+        const char* next = u_parse_spec(fmt, &spec);
+        if (!next) return -1;
+        fmt = next;
+        if (spec.specifier == '%') continue;
+        if (spec.position) return 0; // Positional: checked when rendered
+        
+        if (spec.flags & U_FLAG_WIDTH_ARG) {
+            if (used >= count || tags[used++] != U_ARG_INT) return -1;
+        }
+        if (spec.flags & U_FLAG_PRECISION_ARG) {
+            if (used >= count || tags[used++] != U_ARG_INT) return -1;
+        }
+        
+        int fit = u_tag_fits(&spec, used < count ? tags[used] : U_ARG_OTHER);
+        if (fit < 0) return 0; // Custom handler: argument use is unknown
+        if (!fit || used >= count) return -1;
+        used++;
+    }
+    
+    return used == count ? 0 : -1;
+}
+
+// Called once per call site whose format does not match its arguments
+#ifndef UPRINTF_ON_MISMATCH
+#define UPRINTF_ON_MISMATCH(fmt) ((void)(fmt))
+#endif
+
+// Call site state is claimed with a compare-and-swap and published with a
+// release store, so a thread that reads 1 also sees the compiled format
+#if defined(__GNUC__) || defined(__clang__)
+#define U_CACHE_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define U_CACHE_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+static bool u_cache_claim(int* state) {
+    int expected = 0;
+    return __atomic_compare_exchange_n(state, &expected, 2, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define U_CACHE_LOAD(p) ((int)_InterlockedOr((volatile long*)(p), 0))
+#define U_CACHE_STORE(p, v) ((void)_InterlockedExchange((volatile long*)(p), (long)(v)))
+static bool u_cache_claim(int* state) {
+    return _InterlockedCompareExchange((volatile long*)state, 2, 0) == 0;
+}
+#else
+// No atomics known for this compiler: first calls must not race
+#define U_CACHE_LOAD(p) (*(p))
+#define U_CACHE_STORE(p, v) (*(p) = (v))
+static bool u_cache_claim(int* state) {
+    if (*state) return false;
+    *state = 2;
+    return true;
+}
+#endif
+
+// Check and compile a call site on first use, then render it
+static int u_cached_engine(u_format_cache_t* cache, const unsigned char* tags, int tag_count,
+                           u_sink_t* sink, const char* fmt, va_list* args) {
+    int state = U_CACHE_LOAD(&cache->state);
+    if (state == 0 && u_cache_claim(&cache->state)) {
+        if (u_format_check(fmt, tags, tag_count) != 0) {
+            UPRINTF_ON_MISMATCH(fmt);
+            state = -1;
+        } else {
+            cache->compiled = u_format_compile(fmt, cache->storage, sizeof(cache->storage));
+            state = 1;
+        }
+        U_CACHE_STORE(&cache->state, state);
+    } else if (state == 0 || state == 2) {
+        // Another thread is compiling the site: check and interpret locally
+        if (u_format_check(fmt, tags, tag_count) != 0) return -1;
+        return u_format_engine(sink, fmt, args);
+    }
+    
+    if (state < 0) return -1;
+    if (cache->compiled) return u_compiled_engine(sink, cache->compiled, args);
+    return u_format_engine(sink, fmt, args);
+}
+
+int u_printf_cached(u_format_cache_t* cache, const unsigned char* tags, int tag_count,
+                    u_output_cb_t output_cb, void* ctx, const char* fmt, ...) {
+    if (!cache || !output_cb || !fmt) return -1;
+    
+    u_sink_t sink;
+    u_char_sink_ctx_t char_ctx;
+    u_output_buffer_t* ob = u_sink_init_output(&sink, &char_ctx, output_cb, ctx);
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_cached_engine(cache, tags, tag_count, &sink, fmt, &args);
+    va_end(args);
+    
+    if (ob && ob->auto_flush) u_flush(ob);
+    return result;
+}
+
+int u_printf_simple_cached(u_format_cache_t* cache, const unsigned char* tags, int tag_count,
+                           const char* fmt, ...) {
+    if ((!u_state.default_output_cb && !u_state.default_write_cb) || !cache || !fmt) return -1;
+    
+    u_sink_t sink;
+    u_char_sink_ctx_t char_ctx;
+    u_output_buffer_t* ob = NULL;
+    if (u_state.default_buffer.buffer) {
+        ob = &u_state.default_buffer;
+        u_sink_init_span(&sink, u_output_buffer_write, ob);
+    } else if (u_state.default_write_cb) {
+        u_sink_init_span(&sink, u_state.default_write_cb, u_state.default_ctx);
+    } else {
+        u_sink_init_char(&sink, &char_ctx, u_state.default_output_cb, u_state.default_ctx);
+    }
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_cached_engine(cache, tags, tag_count, &sink, fmt, &args);
+    va_end(args);
+    
+    if (ob && ob->auto_flush) u_flush(ob);
+    return result;
+}
+
+int u_printf(u_output_cb_t output_cb, void* ctx, const char* fmt, ...) {
+    if (!output_cb || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_vprintf(output_cb, ctx, fmt, args);
+    va_end(args);
+    return result;
+}
+
+#if UPRINTF_ENABLE_HANDLERS
+int u_context_register_format_handler(u_context_t* context, char specifier,
+                                      u_format_handler_t handler) {
+    unsigned char index = (unsigned char)specifier;
+    if (!context || !handler || !index || index >= 128) return -1;
+    
+#ifdef UPRINTF_STATIC_HANDLERS
+    return -1; // The table is read-only
+#else
+    if (!context->handlers[index]) {
+        if (context->handler_count >= UPRINTF_MAX_HANDLERS) return -1; // No space
+        context->handler_count++;
+    }
+    context->handlers[index] = handler;
+    return 0;
+#endif
+}
+
+int u_register_format_handler(char specifier, u_format_handler_t handler) {
+    return u_context_register_format_handler(&u_state, specifier, handler);
+}
+
+int u_context_unregister_format_handler(u_context_t* context, char specifier) {
+    unsigned char index = (unsigned char)specifier;
+    if (!context || index >= 128) return -1;
+    
+#ifdef UPRINTF_STATIC_HANDLERS
+    return -1; // The table is read-only
+#else
+    if (!context->handlers[index]) return -1; // Not found
+    context->handlers[index] = NULL;
+    context->handler_count--;
+    return 0;
+#endif
+}
+
+int u_unregister_format_handler(char specifier) {
+    return u_context_unregister_format_handler(&u_state, specifier);
+}
+#endif
+
+// Buffer output functions
+static int u_vsprintf(const u_context_t* context, char* buffer, const char* fmt, va_list* args) {
+    u_sink_t sink;
+    u_sink_init_buffer(&sink, buffer, SIZE_MAX);
+    sink.context = context;
+    int result = u_format_engine(&sink, fmt, args);
+    buffer[sink.pos] = '\0';
+    return result;
+}
+
+int u_context_sprintf(const u_context_t* context, char* buffer, const char* fmt, ...) {
+    if (!context || !buffer || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_vsprintf(context, buffer, fmt, &args);
+    va_end(args);
+    return result;
+}
+
+int u_sprintf(char* buffer, const char* fmt, ...) {
+    if (!buffer || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_vsprintf(&u_state, buffer, fmt, &args);
+    va_end(args);
+    return result;
+}
+
+static void u_discard_write(const char* data, size_t len, void* ctx) {
+    (void)data; (void)len; (void)ctx;
+}
+
+int u_context_vsnprintf(const u_context_t* context, char* buffer, size_t size,
+                        const char* fmt, va_list args) {
+    if (!context || !fmt || (!buffer && size)) return -1;
+    
+    u_sink_t sink;
+    if (size == 0) {
+        u_sink_init_span(&sink, u_discard_write, NULL); // Measuring only
+    } else {
+        u_sink_init_buffer(&sink, buffer, size - 1);
+    }
+    sink.context = context;
+    
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
+    
+    if (size) buffer[sink.pos] = '\0';
+    if (size && result >= (int)size) U_STAT_ADD(truncations, 1);
+    return result;
+}
+
+int u_vsnprintf(char* buffer, size_t size, const char* fmt, va_list args) {
+    return u_context_vsnprintf(&u_state, buffer, size, fmt, args);
+}
+
+// u_snprintf semantics: C99 length or characters actually written
+static int u_snprintf_impl(const u_context_t* context, char* buffer, size_t size,
+                           const char* fmt, va_list args) {
+#if UPRINTF_SNPRINTF_C99
+    return u_context_vsnprintf(context, buffer, size, fmt, args);
+#else
+    if (!buffer || size == 0) return -1;
+    
+    u_sink_t sink;
+    u_sink_init_buffer(&sink, buffer, size - 1);
+    sink.context = context;
+    
+    va_list ap;
+    va_copy(ap, args);
+    int full = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
+    
+    buffer[sink.pos] = '\0';
+    if (full < 0) return full; // Errors are not an empty result
+    if (full > (int)sink.pos) U_STAT_ADD(truncations, 1);
+    return (int)sink.pos; // Return actual number of characters written
+#endif
+}
+
+int u_context_snprintf(const u_context_t* context, char* buffer, size_t size,
+                       const char* fmt, ...) {
+    if (!context || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_snprintf_impl(context, buffer, size, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_snprintf(char* buffer, size_t size, const char* fmt, ...) {
+    if (!fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_snprintf_impl(&u_state, buffer, size, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_context_printf_args(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                          const char* fmt, const u_arg_t* args, int count) {
+    if (!context || !output_cb || !fmt || count < 0 || (count && !args)) return -1;
+    
+    // Same sinks as u_context_vprintf, staged straight into output buffers
+    u_sink_t sink;
+    u_char_sink_ctx_t char_ctx;
+    u_output_buffer_t* ob = u_sink_init_output(&sink, &char_ctx, output_cb, ctx);
+    sink.context = context;
+    
+    int result = u_format_engine_args(&sink, fmt, args, count);
+    if (ob && ob->auto_flush) u_flush(ob);
+    return result;
+}
+
+int u_printf_args(u_output_cb_t output_cb, void* ctx, const char* fmt,
+                  const u_arg_t* args, int count) {
+    return u_context_printf_args(&u_state, output_cb, ctx, fmt, args, count);
+}
+
+int u_context_snprintf_args(const u_context_t* context, char* buffer, size_t size,
+                            const char* fmt, const u_arg_t* args, int count) {
+    if (!context || !fmt || (!buffer && size) || count < 0 || (count && !args)) return -1;
+    
+    u_sink_t sink;
+    if (size == 0) {
+        u_sink_init_span(&sink, u_discard_write, NULL); // Measuring only
+    } else {
+        u_sink_init_buffer(&sink, buffer, size - 1);
+    }
+    sink.context = context;
+    
+    int result = u_format_engine_args(&sink, fmt, args, count);
+    if (size) buffer[sink.pos] = '\0';
+    if (size && result >= (int)size) U_STAT_ADD(truncations, 1);
+    return result;
+}
+
+int u_snprintf_args(char* buffer, size_t size, const char* fmt, const u_arg_t* args, int count) {
+    return u_context_snprintf_args(&u_state, buffer, size, fmt, args, count);
+}
+
+void u_context_set_locale(u_context_t* context, const char* locale) {
+    // Minimal implementation - just set decimal point
+    if (context && locale && *locale) {
+        context->decimal_point = *locale;
+    }
+}
+
+void u_set_locale(const char* locale) {
+    u_context_set_locale(&u_state, locale);
+}
+
+void u_context_set_float_support(u_context_t* context, bool enabled) {
+    if (context) context->float_support = enabled;
+}
+
+void u_set_float_support(bool enabled) {
+    u_context_set_float_support(&u_state, enabled);
+}
+
+// Point the default staging buffer at the current default sink
+static void u_default_buffer_retarget(u_context_t* context) {
+    context->default_buffer.write = context->default_write_cb;
+    context->default_buffer.output = context->default_output_cb;
+    context->default_buffer.ctx = context->default_ctx;
+}
+
+void u_context_set_default_output(u_context_t* context, u_output_cb_t output_cb, void* ctx) {
+    if (!context) return;
+    u_context_flush(context);
+    context->default_output_cb = output_cb;
+    context->default_write_cb = NULL;
+    context->default_ctx = ctx;
+    u_default_buffer_retarget(context);
+}
+
+void u_set_default_output(u_output_cb_t output_cb, void* ctx) {
+    u_context_set_default_output(&u_state, output_cb, ctx);
+}
+
+void u_context_set_default_write(u_context_t* context, u_write_cb_t write_cb, void* ctx) {
+    if (!context) return;
+    u_context_flush(context);
+    context->default_output_cb = NULL;
+    context->default_write_cb = write_cb;
+    context->default_ctx = ctx;
+    u_default_buffer_retarget(context);
+}
+
+void u_set_default_write(u_write_cb_t write_cb, void* ctx) {
+    u_context_set_default_write(&u_state, write_cb, ctx);
+}
+
+void u_context_set_default_output_buffer(u_context_t* context, char* storage, size_t size) {
+    if (!context) return;
+    u_context_flush(context);
+    context->default_buffer.buffer = size ? storage : NULL;
+    context->default_buffer.size = storage ? size : 0;
+    context->default_buffer.pos = 0;
+    context->default_buffer.auto_flush = true;
+    u_default_buffer_retarget(context);
+}
+
+void u_set_default_output_buffer(char* storage, size_t size) {
+    u_context_set_default_output_buffer(&u_state, storage, size);
+}
+
+static int u_vprintf_default(u_context_t* context, const char* fmt, va_list args) {
+    if (context->default_buffer.buffer) {
+        return u_vprintf_staged(context, &context->default_buffer, fmt, args);
+    } else if (context->default_write_cb) {
+        return u_context_vprintf_span(context, context->default_write_cb, context->default_ctx,
+                                      fmt, args);
+    }
+    return u_context_vprintf(context, context->default_output_cb, context->default_ctx,
+                             fmt, args);
+}
+
+int u_context_printf_simple(u_context_t* context, const char* fmt, ...) {
+    if (!context || (!context->default_output_cb && !context->default_write_cb) || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_vprintf_default(context, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_printf_simple(const char* fmt, ...) {
+    if ((!u_state.default_output_cb && !u_state.default_write_cb) || !fmt) return -1;
+    
+    va_list args;
+    va_start(args, fmt);
+    int result = u_vprintf_default(&u_state, fmt, args);
+    va_end(args);
+    return result;
+}
+
+// Staged output buffer implementation
+void u_output_buffer_init(u_output_buffer_t* ob, char* storage, size_t size, 
+                          u_output_cb_t output_cb, void* ctx) {
+    if (!ob) return;
+    ob->buffer = storage;
+    ob->size = storage ? size : 0;
+    ob->pos = 0;
+    ob->write = NULL;
+    ob->output = output_cb;
+    ob->ctx = ctx;
+    ob->auto_flush = true;
+}
+
+void u_output_buffer_init_span(u_output_buffer_t* ob, char* storage, size_t size, 
+                               u_write_cb_t write_cb, void* ctx) {
+    u_output_buffer_init(ob, storage, size, NULL, ctx);
+    if (ob) ob->write = write_cb;
+}
+
+// Send data to the real sink behind a staging buffer
+static void u_output_buffer_emit(u_output_buffer_t* ob, const char* data, size_t len) {
+    if (ob->write) {
+        ob->write(data, len, ob->ctx);
+    } else if (ob->output) {
+        for (size_t i = 0; i < len; i++) {
+            ob->output(data[i], ob->ctx);
+        }
+    }
+}
+
+void u_output_buffer_write(const char* data, size_t len, void* ctx) {
+    u_output_buffer_t* ob = (u_output_buffer_t*)ctx;
+    if (!ob || !data || !len) return;
+    
+    if (ob->pos + len > ob->size) {
+        u_flush(ob);
+        if (len >= ob->size) {
+            // Larger than the staging storage: pass it through untouched
+            u_output_buffer_emit(ob, data, len);
+            return;
+        }
+    }
+    
+    memcpy(ob->buffer + ob->pos, data, len);
+    ob->pos += len;
+}
+
+void u_output_buffer_cb(char c, void* ctx) {
+    u_output_buffer_t* ob = (u_output_buffer_t*)ctx;
+    if (!ob) return;
+    
+    if (ob->pos >= ob->size) {
+        u_flush(ob);
+        if (ob->size == 0) {
+            u_output_buffer_emit(ob, &c, 1);
+            return;
+        }
+    }
+    ob->buffer[ob->pos++] = c;
+}
+
+void u_flush(u_output_buffer_t* ob) {
+    if (!ob) ob = &u_state.default_buffer;
+    if (ob->pos == 0) return;
+    
+    u_output_buffer_emit(ob, ob->buffer, ob->pos);
+    ob->pos = 0;
+}
+
+void u_context_flush(u_context_t* context) {
+    if (context) u_flush(&context->default_buffer);
+}
+
+#if UPRINTF_ENABLE_HOOKS || UPRINTF_ENABLE_PROCESSORS
+// Per-call pipeline state, on the caller's stack: the sink and its ctx,
+// and the stage counts taken once so a registration that lands mid-call
+// is not half seen
+typedef struct {
+    const u_context_t* context;
+    u_output_cb_t output;
+    void* ctx;
+    u_output_buffer_t* ob;   // Staging buffer behind output, written in blocks
+    int processor_count;
     int hook_count;
+} u_pipeline_ctx_t;
+
+#define U_PIPELINE_WORK (2 * UPRINTF_PIPELINE_CHUNK)
+
+// Run one chunk of at most UPRINTF_PIPELINE_CHUNK bytes in a work buffer
+// of U_PIPELINE_WORK through the processors from `stage` on and the hooks,
+// then out. A block processor always gets room to double its input: once
+// an earlier one grew the text past the chunk size, the remaining stages
+// run on it a chunk at a time from fresh buffers, so nothing is dropped.
+static void u_pipeline_chunk(const u_pipeline_ctx_t* pipe, int stage, char* work, size_t len) {
+    const u_context_t* context = pipe->context;
+    
+#if UPRINTF_ENABLE_PROCESSORS
+    // Apply stream processors
+    U_STAT_TIME_BEGIN(processor_start);
+    for (int i = stage; i < pipe->processor_count && len; i++) {
+        if (context->processors[i].block) {
+            if (len > UPRINTF_PIPELINE_CHUNK) {
+                U_STAT_TIME_END(processor_time, processor_start);
+                for (size_t off = 0; off < len; off += UPRINTF_PIPELINE_CHUNK) {
+                    char next[U_PIPELINE_WORK];
+                    size_t n = len - off < UPRINTF_PIPELINE_CHUNK ? len - off : UPRINTF_PIPELINE_CHUNK;
+                    memcpy(next, work + off, n);
+                    u_pipeline_chunk(pipe, i, next, n);
+                }
+                return;
+            }
+            len = context->processors[i].block(work, len, U_PIPELINE_WORK,
+                                               context->processors[i].ctx);
+            if (len > U_PIPELINE_WORK) len = U_PIPELINE_WORK; // Broken processor
+        } else {
+            u_stream_processor_t processor = context->processors[i].processor;
+            void* pctx = context->processors[i].ctx;
+            for (size_t j = 0; j < len; j++) {
+                work[j] = processor(work[j], pctx);
+            }
+        }
+    }
+    U_STAT_TIME_END(processor_time, processor_start);
+    if (!len) return;
+#else
+    (void)stage;
+#endif
+    
+#if UPRINTF_ENABLE_HOOKS
+    // Call hooks
+    U_STAT_TIME_BEGIN(hook_start);
+    for (int i = 0; i < pipe->hook_count; i++) {
+        if (context->hooks[i].block) {
+            context->hooks[i].block(work, len, pipe->ctx, context->hooks[i].user_data);
+        } else {
+            for (size_t j = 0; j < len; j++) {
+                context->hooks[i].hook(work[j], pipe->ctx, context->hooks[i].user_data);
+            }
+        }
+    }
+    U_STAT_TIME_END(hook_time, hook_start);
+#else
+    (void)context;
+#endif
+    
+    // Original output
+    if (pipe->ob) {
+        u_output_buffer_write(work, len, pipe->ob);
+        return;
+    }
+    for (size_t j = 0; j < len; j++) {
+        pipe->output(work[j], pipe->ctx);
+    }
+}
+
+// Formatter spans enter the pipeline in chunks with room to double
+static void u_pipeline_write(const char* data, size_t len, void* ctx) {
+    char work[U_PIPELINE_WORK];
+    
+    while (len) {
+        size_t n = len < UPRINTF_PIPELINE_CHUNK ? len : UPRINTF_PIPELINE_CHUNK;
+        memcpy(work, data, n);
+        u_pipeline_chunk((const u_pipeline_ctx_t*)ctx, 0, work, n);
+        data += n;
+        len -= n;
+    }
+}
+#endif
+
+// Enhanced printf with all new features
+int u_context_vprintf_ex(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                         const char* fmt, va_list args) {
+    if (!context || !output_cb || !fmt) return -1;
+    
+#if UPRINTF_ENABLE_HOOKS || UPRINTF_ENABLE_PROCESSORS
+    u_pipeline_ctx_t pipe;
+    pipe.processor_count = 0;
+    pipe.hook_count = 0;
+#if UPRINTF_ENABLE_PROCESSORS
+    pipe.processor_count = context->processor_count;
+#endif
+#if UPRINTF_ENABLE_HOOKS
+    pipe.hook_count = context->hook_count;
+#endif
+    
+    // Nothing registered: the plain path, untouched
+    if (!pipe.processor_count && !pipe.hook_count) {
+        return u_context_vprintf(context, output_cb, ctx, fmt, args);
+    }
     
-    struct {
-        u_stream_processor_t processor;
-        void* ctx;
-    } processors[16];
-    int processor_count;
+    // Spans go through the processors and hooks a chunk at a time
+    pipe.context = context;
+    pipe.output = output_cb;
+    pipe.ctx = ctx;
+    pipe.ob = output_cb == u_output_buffer_cb ? (u_output_buffer_t*)ctx : NULL;
     
-    u_string_builder_t builders[8];
-    int builder_count;
-} u_state = {
-    .default_output_cb = NULL,
-    .default_ctx = NULL,
-    .decimal_point = '.',
-    .float_support = UPRINTF_FLOAT_SUPPORT ? true : false,
-    .handlers = {{0, NULL}},
-    .stream_count = 0,
-    .template_count = 0,
-    .hook_count = 0,
-    .processor_count = 0,
-    .builder_count = 0
-};
-
-// Internal functions
-static size_t u_strlen(const char* str) {
-    if (!str) return 0;
+    u_sink_t sink;
+    u_sink_init_span(&sink, u_pipeline_write, &pipe);
+    sink.context = context;
+    
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
     
-    const char* s;
-    for (s = str; *s; ++s);
-    return (s - str);
+    if (pipe.ob && pipe.ob->auto_flush) u_flush(pipe.ob);
+    return result;
+#else
+    return u_context_vprintf(context, output_cb, ctx, fmt, args);
+#endif
 }
 
-static void u_strrev(char* begin, char* end) {
-    if (!begin || !end || begin >= end) return;
-    
-    while (begin < end) {
-        char temp = *begin;
-        *begin++ = *end;
-        *end-- = temp;
+int u_vprintf_ex(u_output_cb_t output_cb, void* ctx, const char* fmt, va_list args) {
+    return u_context_vprintf_ex(&u_state, output_cb, ctx, fmt, args);
+}
+
+int u_context_printf_ex(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                        const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_vprintf_ex(context, output_cb, ctx, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_printf_ex(u_output_cb_t output_cb, void* ctx, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_vprintf_ex(&u_state, output_cb, ctx, fmt, args);
+    va_end(args);
+    return result;
+}
+
+#if UPRINTF_ENABLE_TEMPLATES
+// Template system implementation
+
+// Value of the variable named by `len` characters at `name`. Names are
+// compared on their first 63 characters.
+static const char* u_template_value(const char* name, size_t len,
+                                    const u_template_var_t* vars, int count) {
+    if (len > 63) len = 63;
+    for (int i = 0; i < count; i++) {
+        if (strncmp(vars[i].key, name, len) == 0 && vars[i].key[len] == '\0') {
+            return vars[i].value;
+        }
     }
+    return NULL;
 }
 
-static char* u_utoa(uint64_t value, char* str, int base, bool uppercase) {
-    if (!str || base < 2 || base > 36) {
-        if (str) *str = '\0';
-        return str;
+void u_template_format(u_output_cb_t output_cb, void* ctx, 
+                      const char* tmpl, const u_template_var_t* vars, int count) {
+    const char* ptr = tmpl;
+    while (*ptr) {
+        if (*ptr == '{' && *(ptr + 1) == '{') {
+            // Found variable start
+            const char* end = strstr(ptr + 2, "}}");
+            if (!end) break;
+            
+            // Output value or empty string
+            const char* value = u_template_value(ptr + 2, end - (ptr + 2), vars, count);
+            if (value) {
+                u_output_str(output_cb, ctx, value, -1);
+            }
+            
+            ptr = end + 2;
+        } else {
+            output_cb(*ptr++, ctx);
+        }
     }
+}
 
-    char* ptr = str;
-    char* low = ptr;
+// FNV-1a hash of a template name
+static uint32_t u_template_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+static int u_template_push_part(u_template_compiled_t* t, size_t offset, size_t len, int slot) {
+    if (t->part_count >= UPRINTF_TEMPLATE_PARTS) return -1;
+    u_template_part_t* part = &t->parts[t->part_count++];
+    part->offset = (uint16_t)offset;
+    part->len = (uint16_t)len;
+    part->slot = (int8_t)slot;
+    return 0;
+}
+
+// Split a template into literal runs and placeholders the way
+// u_template_format reads it. Leaves part_count at -1 if it does not fit.
+static void u_template_compile(u_template_compiled_t* t) {
+    const char* text = t->tmpl;
+    const char* literal = text;
+    const char* ptr = text;
+    t->part_count = 0;
+    t->slot_count = 0;
     
-    do {
-        int digit = value % base;
-        *ptr++ = digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10;
-        value /= base;
-    } while (value);
+    if (u_strlen(text) > 0xFFFF) {
+        t->part_count = -1;
+        return;
+    }
     
-    *ptr = '\0';
-    u_strrev(low, ptr - 1);
-    return str;
+    while (*ptr) {
+        if (ptr[0] != '{' || ptr[1] != '{') {
+            ptr++;
+            continue;
+        }
+        
+        const char* name = ptr + 2;
+        const char* end = strstr(name, "}}");
+        if (!end) break; // Rendering stops here
+        
+        size_t len = end - name;
+        if (len > 63) len = 63;
+        
+        // One slot per distinct name
+        int slot = 0;
+        while (slot < t->slot_count) {
+            const u_template_part_t* first = &t->parts[t->slot_part[slot]];
+            if (first->len == len && memcmp(text + first->offset, name, len) == 0) break;
+            slot++;
+        }
+        if (slot == t->slot_count && slot >= UPRINTF_TEMPLATE_SLOTS) {
+            t->part_count = -1;
+            return;
+        }
+        
+        if ((ptr > literal && u_template_push_part(t, literal - text, ptr - literal, -1) < 0) ||
+            u_template_push_part(t, name - text, len, slot) < 0) {
+            t->part_count = -1;
+            return;
+        }
+        if (slot == t->slot_count) {
+            t->slot_part[t->slot_count++] = (uint8_t)(t->part_count - 1);
+        }
+        
+        ptr = literal = end + 2;
+    }
+    
+    if (ptr > literal && u_template_push_part(t, literal - text, ptr - literal, -1) < 0) {
+        t->part_count = -1;
+    }
 }
 
-static char* u_itoa(int64_t value, char* str, int base, bool uppercase) {
-    if (!str || base < 2 || base > 36) {
-        if (str) *str = '\0';
-        return str;
+int u_context_template_find(const u_context_t* context, const char* name) {
+    if (!context || !name) return -1;
+    
+    uint32_t hash = u_template_hash(name);
+    for (unsigned int n = 0, i = hash & 63; n < 64; n++, i = (i + 1) & 63) {
+        int entry = context->template_index[i];
+        if (!entry) return -1;
+        
+        const u_template_compiled_t* t = &context->templates[entry - 1];
+        if (t->hash == hash && strcmp(t->name, name) == 0) return entry - 1;
     }
+    return -1;
+}
 
-    char* ptr = str;
+int u_template_find(const char* name) {
+    return u_context_template_find(&u_state, name);
+}
+
+void u_context_template_load(u_context_t* context, const char* name, const char* tmpl) {
+    if (!context || !name || !tmpl) return;
     
-    if (value < 0 && base == 10) {
-        *ptr++ = '-';
-        value = -value;
+    int id = u_context_template_find(context, name);
+    if (id < 0) {
+        if (context->template_count >= 32) return;
+        
+        // Twice as many index slots as templates, so probing always ends
+        id = context->template_count++;
+        uint32_t hash = u_template_hash(name);
+        unsigned int i = hash & 63;
+        while (context->template_index[i]) i = (i + 1) & 63;
+        context->template_index[i] = (unsigned char)(id + 1);
+        context->templates[id].name = name;
+        context->templates[id].hash = hash;
     }
     
-    return u_utoa(value, ptr, base, uppercase);
+    context->templates[id].tmpl = tmpl;
+    u_template_compile(&context->templates[id]);
 }
 
-#if UPRINTF_FLOAT_SUPPORT
-static char* u_ftoa(double value, char* str, int precision, char decimal_point) {
-    if (!str) return str;
+void u_template_load(const char* name, const char* tmpl) {
+    u_context_template_load(&u_state, name, tmpl);
+}
+
+int u_context_template_slot(const u_context_t* context, int id, const char* var) {
+    if (!context || !var || id < 0 || id >= context->template_count) return -1;
     
-    if (precision < 0) precision = 6;
-    if (precision > UPRINTF_BUFFER_SIZE - 16) precision = UPRINTF_BUFFER_SIZE - 16;
+    const u_template_compiled_t* t = &context->templates[id];
+    size_t len = u_strlen(var);
+    for (int slot = 0; slot < t->slot_count; slot++) {
+        const u_template_part_t* first = &t->parts[t->slot_part[slot]];
+        if (first->len == len && memcmp(t->tmpl + first->offset, var, len) == 0) return slot;
+    }
+    return -1;
+}
+
+int u_template_slot(int id, const char* var) {
+    return u_context_template_slot(&u_state, id, var);
+}
+
+// Straight span copy of a pre-parsed template. Returns the characters written.
+static size_t u_template_render_sink(u_sink_t* sink, const u_template_compiled_t* t,
+                                     const char* const* values, int count) {
+    size_t total = 0;
+    for (int i = 0; i < t->part_count; i++) {
+        const u_template_part_t* part = &t->parts[i];
+        if (part->slot < 0) {
+            u_sink_write_ref(sink, t->tmpl + part->offset, part->len);
+            total += part->len;
+        } else if (part->slot < count && values[part->slot]) {
+            size_t len = u_strlen(values[part->slot]);
+            u_sink_write_ref(sink, values[part->slot], len);
+            total += len;
+        }
+    }
+    return total;
+}
+
+static void u_template_render_parts(u_output_cb_t output_cb, void* ctx,
+                                    const u_template_compiled_t* t,
+                                    const char* const* values, int count) {
+    u_sink_t sink;
+    u_char_sink_ctx_t char_ctx;
+    u_output_buffer_t* ob = u_sink_init_output(&sink, &char_ctx, output_cb, ctx);
     
-    char* ptr = str;
+    u_template_render_sink(&sink, t, values, count);
     
-    // Handle special cases
-    if (value != value) { // NaN
-        const char* nan_str = "nan";
-        while (*nan_str) *ptr++ = *nan_str++;
-        *ptr = '\0';
-        return str;
+    if (ob && ob->auto_flush) u_flush(ob);
+}
+
+// Resolve each slot of a template against the vars
+static void u_template_bind(const u_template_compiled_t* t, const u_template_var_t* vars,
+                            int count, const char** values) {
+    for (int slot = 0; slot < t->slot_count; slot++) {
+        const u_template_part_t* first = &t->parts[t->slot_part[slot]];
+        values[slot] = u_template_value(t->tmpl + first->offset, first->len, vars, count);
     }
+}
+
+void u_context_template_render(const u_context_t* context, u_output_cb_t output_cb, void* ctx,
+                               int id, const char* const* values, int count) {
+    if (!context || !output_cb || id < 0 || id >= context->template_count) return;
     
-    if (value == 1.0/0.0) { // +Inf
-        const char* inf_str = "inf";
-        while (*inf_str) *ptr++ = *inf_str++;
-        *ptr = '\0';
-        return str;
+    const u_template_compiled_t* t = &context->templates[id];
+    if (t->part_count < 0) {
+        u_template_format(output_cb, ctx, t->tmpl, NULL, 0);
+        return;
     }
+    u_template_render_parts(output_cb, ctx, t, values, count);
+}
+
+void u_template_render(u_output_cb_t output_cb, void* ctx, int id,
+                       const char* const* values, int count) {
+    u_context_template_render(&u_state, output_cb, ctx, id, values, count);
+}
+
+void u_context_template_format_named(const u_context_t* context, u_output_cb_t output_cb,
+                                     void* ctx, const char* name,
+                                     const u_template_var_t* vars, int count) {
+    if (!context) return;
     
-    if (value == -1.0/0.0) { // -Inf
-        const char* inf_str = "-inf";
-        while (*inf_str) *ptr++ = *inf_str++;
-        *ptr = '\0';
-        return str;
+    int id = u_context_template_find(context, name);
+    if (id >= 0) {
+        const u_template_compiled_t* t = &context->templates[id];
+        if (t->part_count < 0) {
+            u_template_format(output_cb, ctx, t->tmpl, vars, count);
+            return;
+        }
+        
+        // Bind each slot once, then copy spans
+        const char* values[UPRINTF_TEMPLATE_SLOTS];
+        u_template_bind(t, vars, count, values);
+        u_template_render_parts(output_cb, ctx, t, values, t->slot_count);
+        return;
     }
     
-    // Handle negative numbers
-    if (value < 0) {
-        *ptr++ = '-';
-        value = -value;
+    // Template not found - output error
+    u_output_str(output_cb, ctx, "[Template '", -1);
+    u_output_str(output_cb, ctx, name, -1);
+    u_output_str(output_cb, ctx, "' not found]", -1);
+}
+
+void u_template_format_named(u_output_cb_t output_cb, void* ctx, 
+                            const char* name, const u_template_var_t* vars, int count) {
+    u_context_template_format_named(&u_state, output_cb, ctx, name, vars, count);
+}
+#endif // UPRINTF_ENABLE_TEMPLATES
+
+#if UPRINTF_ENABLE_BROADCAST
+// Multi-output system implementation
+void u_context_output_add_stream(u_context_t* context, u_output_stream_t stream) {
+    if (context && context->stream_count < 16) {
+        context->streams[context->stream_count++] = stream;
     }
+}
+
+void u_output_add_stream(u_output_stream_t stream) {
+    u_context_output_add_stream(&u_state, stream);
+}
+
+void u_context_output_remove_stream(u_context_t* context, u_output_cb_t output_cb) {
+    if (!context) return;
     
-    // Integer part
-    int64_t int_part = (int64_t)value;
-    value -= int_part;
+    for (int i = 0; i < context->stream_count; i++) {
+        if (context->streams[i].output == output_cb) {
+            // Remove by shifting
+            for (int j = i; j < context->stream_count - 1; j++) {
+                context->streams[j] = context->streams[j + 1];
+            }
+            context->stream_count--;
+            break;
+        }
+    }
+}
+
+void u_output_remove_stream(u_output_cb_t output_cb) {
+    u_context_output_remove_stream(&u_state, output_cb);
+}
+
+// Hand one block to a stream
+static void u_stream_write(const u_output_stream_t* stream, const char* data, size_t len) {
+    if (stream->buffer) {
+        u_output_buffer_write(data, len, stream->buffer);
+    } else if (stream->write) {
+        stream->write(data, len, stream->ctx);
+    } else if (stream->output) {
+        for (size_t i = 0; i < len; i++) {
+            stream->output(data[i], stream->ctx);
+        }
+    }
+}
+
+// Streams a broadcast reaches, one bit each
+static uint32_t u_stream_mask(const u_context_t* context, int level) {
+    uint32_t mask = 0;
+    for (int i = 0; i < context->stream_count; i++) {
+        if (context->streams[i].enabled && level >= context->streams[i].level) {
+            mask |= (uint32_t)1 << i;
+        }
+    }
+    return mask;
+}
+
+// Fan-out target of the broadcast staging buffer
+typedef struct {
+    const u_context_t* context;
+    uint32_t mask;
+} u_fanout_t;
+
+static void u_fanout_write(const char* data, size_t len, void* ctx) {
+    const u_fanout_t* fanout = (const u_fanout_t*)ctx;
+    for (int i = 0; i < fanout->context->stream_count; i++) {
+        if (fanout->mask & ((uint32_t)1 << i)) {
+            u_stream_write(&fanout->context->streams[i], data, len);
+        }
+    }
+}
+
+void u_context_output_broadcast(const u_context_t* context, char c) {
+    if (!context) return;
     
-    // Convert integer part and advance pointer
-    char* int_str = u_itoa(int_part, ptr, 10, false);
-    ptr += u_strlen(int_str); // Advance to the end of the integer part
+    u_fanout_t fanout = {context, u_stream_mask(context, INT_MAX)};
+    u_fanout_write(&c, 1, &fanout);
+}
+
+void u_output_broadcast(char c) {
+    u_context_output_broadcast(&u_state, c);
+}
+
+void u_context_output_broadcast_str(const u_context_t* context, const char* str) {
+    if (!context || !str) return;
     
-    // Fractional part
-    if (precision > 0) {
-        *ptr++ = decimal_point;
-        
-        // Rounding
-        double rounding = 0.5;
-        for (int i = 0; i < precision; i++) {
-            rounding /= 10.0;
-        }
-        value += rounding;
+    u_fanout_t fanout = {context, u_stream_mask(context, INT_MAX)};
+    u_fanout_write(str, u_strlen(str), &fanout);
+}
+
+void u_output_broadcast_str(const char* str) {
+    u_context_output_broadcast_str(&u_state, str);
+}
+
+int u_context_output_broadcast_vlog(const u_context_t* context, int level,
+                                    const char* fmt, va_list args) {
+    if (!context || !fmt) return -1;
+    
+    // Streams that filter the level out cost nothing, not even formatting
+    u_fanout_t fanout = {context, u_stream_mask(context, level)};
+    if (!fanout.mask) return 0;
+    
+    // Format once; each stream gets every staged block in one call
+    char storage[UPRINTF_BROADCAST_BUFFER_SIZE];
+    u_output_buffer_t ob;
+    u_output_buffer_init_span(&ob, storage, sizeof(storage), u_fanout_write, &fanout);
+    return u_vprintf_staged(context, &ob, fmt, args);
+}
+
+int u_output_broadcast_vlog(int level, const char* fmt, va_list args) {
+    return u_context_output_broadcast_vlog(&u_state, level, fmt, args);
+}
+
+int u_context_output_broadcast_args(const u_context_t* context, const char* fmt,
+                                    const u_arg_t* args, int count) {
+    if (!context || !fmt) return -1;
+    
+    u_fanout_t fanout = {context, u_stream_mask(context, INT_MAX)};
+    if (!fanout.mask) return 0;
+    
+    char storage[UPRINTF_BROADCAST_BUFFER_SIZE];
+    u_output_buffer_t ob;
+    u_output_buffer_init_span(&ob, storage, sizeof(storage), u_fanout_write, &fanout);
+    return u_context_printf_args(context, u_output_buffer_cb, &ob, fmt, args, count);
+}
+
+int u_output_broadcast_args(const char* fmt, const u_arg_t* args, int count) {
+    return u_context_output_broadcast_args(&u_state, fmt, args, count);
+}
+
+int u_context_output_broadcast_log(const u_context_t* context, int level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_output_broadcast_vlog(context, level, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_output_broadcast_log(int level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_output_broadcast_vlog(&u_state, level, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_context_output_broadcast_printf(const u_context_t* context, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_output_broadcast_vlog(context, INT_MAX, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int u_output_broadcast_printf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_output_broadcast_vlog(&u_state, INT_MAX, fmt, args);
+    va_end(args);
+    return result;
+}
+
+void u_context_output_broadcast_flush(const u_context_t* context) {
+    if (!context) return;
+    
+    for (int i = 0; i < context->stream_count; i++) {
+        if (context->streams[i].buffer) u_flush(context->streams[i].buffer);
+    }
+}
+
+void u_output_broadcast_flush(void) {
+    u_context_output_broadcast_flush(&u_state);
+}
+#endif // UPRINTF_ENABLE_BROADCAST
+
+#ifdef UPRINTF_ASYNC
+// Async ring: bounded MPMC queue with per-slot turn counters, drained by one consumer.
+// A slot is free for position p when seq == p and ready to drain when seq == p + 1.
+int u_async_init(u_async_ring_t* ring, u_async_slot_t* slots, size_t count,
+                 const u_context_t* context, bool blocking) {
+    if (!ring || !slots || count == 0 || (count & (count - 1)) != 0) return -1;
+    
+    ring->slots = slots;
+    ring->mask = count - 1;
+    ring->context = context ? context : &u_state;
+    ring->blocking = blocking;
+    ring->wait = NULL;
+    ring->wait_ctx = NULL;
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->overruns, 0);
+    atomic_init(&ring->head, 0);
+    ring->tail = 0;
+    for (size_t i = 0; i < count; i++) {
+        atomic_init(&slots[i].seq, i);
+        slots[i].len = 0;
+    }
+    return 0;
+}
+
+void u_async_set_wait(u_async_ring_t* ring, void (*wait)(void* wait_ctx), void* wait_ctx) {
+    if (!ring) return;
+    ring->wait = wait;
+    ring->wait_ctx = wait_ctx;
+}
+
+// Claim the next free slot, or NULL when full and not blocking
+static u_async_slot_t* u_async_claim(u_async_ring_t* ring, size_t* pos) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        u_async_slot_t* slot = &ring->slots[head & ring->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)(seq - head);
         
-        // Convert fractional part
-        for (int i = 0; i < precision; i++) {
-            value *= 10;
-            int digit = (int)value;
-            *ptr++ = '0' + digit;
-            value -= digit;
-            
-            // Prevent buffer overflow
-            if (ptr - str >= UPRINTF_BUFFER_SIZE - 1) {
-                break;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &head, head + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                *pos = head;
+                return slot;
             }
+        } else if (diff < 0) {
+            // Full: the consumer has not released this slot yet
+            if (!ring->blocking) return NULL;
+            if (ring->wait) ring->wait(ring->wait_ctx);
+            head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        } else {
+            head = atomic_load_explicit(&ring->head, memory_order_relaxed);
         }
     }
-    
-    *ptr = '\0';
-    return str;
 }
-#endif
 
-static void u_output_str(u_output_cb_t output_cb, void* ctx, const char* str, int max_len) {
-    if (!output_cb || !str) {
-        if (!str && output_cb) {
-            u_output_str(output_cb, ctx, "(null)", max_len);
-        }
-        return;
+int u_async_vprintf(u_async_ring_t* ring, const char* fmt, va_list args) {
+    if (!ring || !fmt) return -1;
+    
+    size_t pos;
+    u_async_slot_t* slot = u_async_claim(ring, &pos);
+    if (!slot) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        U_STAT_ADD(stream_drops, 1);
+        return -1;
     }
     
-    for (int i = 0; (max_len < 0 || i < max_len) && str[i]; i++) {
-        output_cb(str[i], ctx);
+    // Format in place; the slot is ours until it is published
+    u_sink_t sink;
+    u_sink_init_buffer(&sink, slot->data, sizeof(slot->data));
+    sink.context = ring->context;
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
+    
+    if (result > (int)sink.pos) {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        U_STAT_ADD(stream_drops, 1);
     }
+    slot->len = sink.pos;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return (int)sink.pos; // The slot may already be reused
 }
 
-static void u_output_repeat(u_output_cb_t output_cb, void* ctx, char c, int count) {
-    if (!output_cb || count <= 0) return;
+int u_async_printf(u_async_ring_t* ring, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_async_vprintf(ring, fmt, args);
+    va_end(args);
+    return result;
+}
+
+size_t u_async_drain(u_async_ring_t* ring, size_t max_messages) {
+    if (!ring) return 0;
     
-    for (int i = 0; i < count; i++) {
-        output_cb(c, ctx);
+    const u_context_t* context = ring->context;
+    size_t drained = 0;
+    while (max_messages == 0 || drained < max_messages) {
+        u_async_slot_t* slot = &ring->slots[ring->tail & ring->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != ring->tail + 1) break; // Empty, or the producer is still formatting
+        
+        u_fanout_t fanout = {context, u_stream_mask(context, INT_MAX)};
+        u_fanout_write(slot->data, slot->len, &fanout);
+        
+        // Hand the slot back to producers one lap later
+        atomic_store_explicit(&slot->seq, ring->tail + ring->mask + 1, memory_order_release);
+        ring->tail++;
+        drained++;
     }
+    return drained;
 }
 
-static int u_parse_format(u_output_cb_t output_cb, void* ctx, const char** fmt, va_list* args) {
-    if (!output_cb || !fmt || !*fmt || !args) return 0;
+void u_async_run(u_async_ring_t* ring, const atomic_bool* stop,
+                 void (*idle)(void* idle_ctx), void* idle_ctx) {
+    if (!ring || !stop) return;
     
-    const char* format_start = *fmt; // Remember start of format specifier
-    int chars_written = 0;
-    unsigned int flags = 0;
-    int width = -1;
-    int precision = -1;
-    int length_modifier = 0;
-    
-    // Parse flags
-    while (**fmt) {
-        if (**fmt == '-') flags |= U_FLAG_LEFT_ALIGN;
-        else if (**fmt == '+') flags |= U_FLAG_FORCE_SIGN;
-        else if (**fmt == ' ') flags |= U_FLAG_SPACE_SIGN;
-        else if (**fmt == '0') flags |= U_FLAG_ZERO_PAD;
-        else if (**fmt == '#') flags |= U_FLAG_ALT_FORM;
-        else break;
-        (*fmt)++;
+    while (!atomic_load_explicit(stop, memory_order_acquire)) {
+        if (u_async_drain(ring, 0) == 0 && idle) idle(idle_ctx);
     }
+    u_async_drain(ring, 0);
+}
+
+unsigned long u_async_dropped(const u_async_ring_t* ring) {
+    return ring ? atomic_load_explicit(&((u_async_ring_t*)ring)->dropped,
+                                       memory_order_relaxed) : 0;
+}
+
+unsigned long u_async_overruns(const u_async_ring_t* ring) {
+    return ring ? atomic_load_explicit(&((u_async_ring_t*)ring)->overruns,
+                                       memory_order_relaxed) : 0;
+}
+#endif // UPRINTF_ASYNC
+
+#if UPRINTF_ENABLE_DEFERRED
+#ifndef UPRINTF_ASYNC
+#define U_SYNC_INIT(p, v) (*(p) = (v))
+#define U_SYNC_LOAD(p) (*(p))
+#define U_SYNC_STORE(p, v) (*(p) = (v))
+#else
+#define U_SYNC_INIT(p, v) atomic_init(p, v)
+#define U_SYNC_LOAD(p) atomic_load_explicit(p, memory_order_acquire)
+#define U_SYNC_STORE(p, v) atomic_store_explicit(p, v, memory_order_release)
+#endif
+
+// Deferred records: [uint16_t size][const char* fmt][arguments in format order].
+// '*' values are ints, integers keep the width the renderer fetches, floats are
+// double or long double and strings are a length (0xFFFF for NULL) plus a
+// NUL-terminated copy. Rendering hands each value back to u_render_spec.
+#define U_DEFERRED_NULL_STR 0xFFFF
+
+static bool u_deferred_put(unsigned char* rec, size_t* pos, const void* data, size_t len) {
+    if (*pos + len > UPRINTF_DEFERRED_RECORD_SIZE) return false;
+    memcpy(rec + *pos, data, len);
+    *pos += len;
+    return true;
+}
+
+static void u_deferred_get(const unsigned char* rec, size_t* pos, void* data, size_t len) {
+    memcpy(data, rec + *pos, len);
+    *pos += len;
+}
+
+// Capture one record. Returns its size, or -1 if it cannot be deferred.
+static int u_deferred_capture(const u_context_t* context, unsigned char* rec, const char* fmt,
+                              va_list* args) {
+    size_t pos = sizeof(uint16_t);
+    if (!u_deferred_put(rec, &pos, &fmt, sizeof(fmt))) return -1;
     
-    // Parse width
-    if (**fmt == '*') {
-        flags |= U_FLAG_WIDTH_ARG;
-        width = va_arg(*args, int);
-        (*fmt)++;
-    } else {
-        width = 0;
-        while (**fmt >= '0' && **fmt <= '9') {
-            width = width * 10 + (**fmt - '0');
-            (*fmt)++;
+    while (*(fmt = u_scan_until(fmt, '%'))) {
+        if (!*++fmt) break;
+        
+        u_format_spec_t spec;
+        const char* next = u_parse_spec(fmt, &spec);
+        if (!next) break; // Rendered literally
+        fmt = next;
+        
+        int precision = spec.precision;
+        if (spec.flags & U_FLAG_WIDTH_ARG) {
+            int width = va_arg(*args, int);
+            if (!u_deferred_put(rec, &pos, &width, sizeof(width))) return -1;
         }
-        if (width == 0) width = -1;
-    }
-    
-    // Parse precision
-    if (**fmt == '.') {
-        (*fmt)++;
-        if (**fmt == '*') {
-            flags |= U_FLAG_PRECISION_ARG;
+        if (spec.flags & U_FLAG_PRECISION_ARG) {
             precision = va_arg(*args, int);
-            (*fmt)++;
-        } else {
-            precision = 0;
-            while (**fmt >= '0' && **fmt <= '9') {
-                precision = precision * 10 + (**fmt - '0');
-                (*fmt)++;
-            }
-        }
-    }
-    
-    // Parse length modifiers
-    if (**fmt == 'h') {
-        length_modifier = -1;
-        (*fmt)++;
-        if (**fmt == 'h') {
-            length_modifier = -2;
-            (*fmt)++;
-        }
-    } else if (**fmt == 'l') {
-        length_modifier = 1;
-        (*fmt)++;
-        if (**fmt == 'l') {
-            length_modifier = 2;
-            (*fmt)++;
+            if (!u_deferred_put(rec, &pos, &precision, sizeof(precision))) return -1;
         }
-    } else if (**fmt == 'z') {
-        length_modifier = 3; // size_t
-        (*fmt)++;
-    } else if (**fmt == 't') {
-        length_modifier = 4; // ptrdiff_t
-        (*fmt)++;
-    } else if (**fmt == 'j') {
-        length_modifier = 5; // intmax_t
-        (*fmt)++;
-    }
-    
-    // Parse specifier
-    char specifier = **fmt;
-    if (!specifier) {
-        // No specifier found - output the entire format sequence
-        output_cb('%', ctx);
-        chars_written++;
-        u_output_str(output_cb, ctx, format_start, *fmt - format_start);
-        chars_written += (*fmt - format_start);
-        return chars_written;
-    }
-    (*fmt)++;
-    
-    // Check for custom handlers
-    for (int i = 0; i < UPRINTF_MAX_HANDLERS; i++) {
-        if (u_state.handlers[i].specifier == specifier && u_state.handlers[i].handler) {
-            return u_state.handlers[i].handler(output_cb, ctx, args, fmt, width, precision, flags);
+        if (u_find_handler(context, spec.specifier) || !u_spec_valid(&spec)) return -1;
+        
+        bool ok = true;
+        switch (spec.specifier) {
+            case 'd':
+            case 'i':
+                if (spec.length <= 0) {
+                    int value = (int)u_fetch_signed(args, spec.length);
+                    ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                } else {
+                    int64_t value = u_fetch_signed(args, spec.length);
+                    ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                }
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                if (spec.length <= 0) {
+                    unsigned int value = (unsigned int)u_fetch_unsigned(args, spec.length);
+                    ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                } else {
+                    uint64_t value = u_fetch_unsigned(args, spec.length);
+                    ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                }
+                break;
+            case 'c': {
+                int value = va_arg(*args, int);
+                ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                break;
+            }
+#if UPRINTF_FLOAT_SUPPORT
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            case 'r':
+            case 'R':
+                if (spec.length == 6) {
+                    long double value = va_arg(*args, long double);
+                    ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                } else {
+                    double value = va_arg(*args, double);
+                    ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                }
+                break;
+#endif
+            case 's': {
+                const char* str = va_arg(*args, const char*);
+                uint16_t len = U_DEFERRED_NULL_STR;
+                if (str) {
+                    size_t n = 0;
+                    if (precision < 0) {
+                        n = u_strlen(str);
+                    } else {
+                        while (n < (size_t)precision && str[n]) n++;
+                    }
+                    if (n >= U_DEFERRED_NULL_STR) return -1;
+                    len = (uint16_t)n;
+                }
+                ok = u_deferred_put(rec, &pos, &len, sizeof(len));
+                if (ok && str) {
+                    ok = u_deferred_put(rec, &pos, str, len) && u_deferred_put(rec, &pos, "", 1);
+                }
+                break;
+            }
+            case 'p': {
+                void* value = va_arg(*args, void*);
+                ok = u_deferred_put(rec, &pos, &value, sizeof(value));
+                break;
+            }
+            case '%':
+                break;
+            default:
+                return -1; // %n points into the caller's frame, %S reads now
         }
+        if (!ok) return -1;
     }
     
-    // Handle standard specifiers
-    char buffer[UPRINTF_BUFFER_SIZE];
-    int len = 0;
-    bool sign = false;
-    bool number = false;
-    int base = 10;
-    bool uppercase = false;
-    
-    switch (specifier) {
+    return (int)pos;
+}
+
+// Hand one value to the renderer through a real argument list
+static int u_deferred_emit(u_sink_t* sink, const u_format_spec_t* spec, const char** fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_render_spec(sink, spec, fmt, &args);
+    va_end(args);
+    return result;
+}
+
+static int u_deferred_render_arg(u_sink_t* sink, const u_format_spec_t* spec, const char** fmt,
+                                 const unsigned char* rec, size_t* pos) {
+    switch (spec->specifier) {
         case 'd':
         case 'i': {
-            number = true;
+            if (spec->length <= 0) {
+                int value;
+                u_deferred_get(rec, pos, &value, sizeof(value));
+                return u_deferred_emit(sink, spec, fmt, value);
+            }
             int64_t value;
-            if (length_modifier == -2) value = (signed char)va_arg(*args, int);
-            else if (length_modifier == -1) value = (short)va_arg(*args, int);
-            else if (length_modifier == 1) value = va_arg(*args, long);
-            else if (length_modifier == 2) value = va_arg(*args, long long);
-            else if (length_modifier == 5) value = va_arg(*args, intmax_t);
-            else value = va_arg(*args, int);
-            
-            u_itoa(value, buffer, 10, false);
-            len = u_strlen(buffer);
-            sign = value < 0;
-            break;
-        }
-        
-        case 'u': {
-            number = true;
-            uint64_t value;
-            if (length_modifier == -2) value = (unsigned char)va_arg(*args, unsigned int);
-            else if (length_modifier == -1) value = (unsigned short)va_arg(*args, unsigned int);
-            else if (length_modifier == 1) value = va_arg(*args, unsigned long);
-            else if (length_modifier == 2) value = va_arg(*args, unsigned long long);
-            else if (length_modifier == 3) value = va_arg(*args, size_t);
-            else if (length_modifier == 5) value = va_arg(*args, uintmax_t);
-            else value = va_arg(*args, unsigned int);
-            
-            u_utoa(value, buffer, 10, false);
-            len = u_strlen(buffer);
-            break;
-        }
-        
-        case 'o': {
-            number = true;
-            base = 8;
-            uint64_t value;
-            if (length_modifier == -2) value = (unsigned char)va_arg(*args, unsigned int);
-            else if (length_modifier == -1) value = (unsigned short)va_arg(*args, unsigned int);
-            else if (length_modifier == 1) value = va_arg(*args, unsigned long);
-            else if (length_modifier == 2) value = va_arg(*args, unsigned long long);
-            else if (length_modifier == 3) value = va_arg(*args, size_t);
-            else if (length_modifier == 5) value = va_arg(*args, uintmax_t);
-            else value = va_arg(*args, unsigned int);
-            
-            u_utoa(value, buffer, 8, false);
-            len = u_strlen(buffer);
-            
-            if (flags & U_FLAG_ALT_FORM && value != 0) {
-                // Add prefix for octal (shift right and add '0')
-                if (len < UPRINTF_BUFFER_SIZE - 1) {
-                    memmove(buffer + 1, buffer, len + 1);
-                    buffer[0] = '0';
-                    len++;
-                }
+            u_deferred_get(rec, pos, &value, sizeof(value));
+            switch (spec->length) {
+                case 1: return u_deferred_emit(sink, spec, fmt, (long)value);
+                case 2: return u_deferred_emit(sink, spec, fmt, (long long)value);
+                case 3: return u_deferred_emit(sink, spec, fmt, (size_t)value);
+                case 4: return u_deferred_emit(sink, spec, fmt, (ptrdiff_t)value);
+                default: return u_deferred_emit(sink, spec, fmt, (intmax_t)value);
             }
-            break;
         }
-        
+        case 'u':
+        case 'o':
         case 'x':
         case 'X': {
-            number = true;
-            base = 16;
-            uppercase = (specifier == 'X');
+            if (spec->length <= 0) {
+                unsigned int value;
+                u_deferred_get(rec, pos, &value, sizeof(value));
+                return u_deferred_emit(sink, spec, fmt, value);
+            }
             uint64_t value;
-            if (length_modifier == -2) value = (unsigned char)va_arg(*args, unsigned int);
-            else if (length_modifier == -1) value = (unsigned short)va_arg(*args, unsigned int);
-            else if (length_modifier == 1) value = va_arg(*args, unsigned long);
-            else if (length_modifier == 2) value = va_arg(*args, unsigned long long);
-            else if (length_modifier == 3) value = va_arg(*args, size_t);
-            else if (length_modifier == 5) value = va_arg(*args, uintmax_t);
-            else value = va_arg(*args, unsigned int);
-            
-            u_utoa(value, buffer, 16, uppercase);
-            len = u_strlen(buffer);
-            
-            if (flags & U_FLAG_ALT_FORM && value != 0) {
-                // Add prefix for hexadecimal
-                if (len < UPRINTF_BUFFER_SIZE - 2) {
-                    memmove(buffer + 2, buffer, len + 1);
-                    buffer[0] = '0';
-                    buffer[1] = uppercase ? 'X' : 'x';
-                    len += 2;
-                }
+            u_deferred_get(rec, pos, &value, sizeof(value));
+            switch (spec->length) {
+                case 1: return u_deferred_emit(sink, spec, fmt, (unsigned long)value);
+                case 2: return u_deferred_emit(sink, spec, fmt, (unsigned long long)value);
+                case 3: return u_deferred_emit(sink, spec, fmt, (size_t)value);
+                case 4: return u_deferred_emit(sink, spec, fmt, (ptrdiff_t)value);
+                default: return u_deferred_emit(sink, spec, fmt, (uintmax_t)value);
             }
-            break;
         }
-        
+        case 'c': {
+            int value;
+            u_deferred_get(rec, pos, &value, sizeof(value));
+            return u_deferred_emit(sink, spec, fmt, value);
+        }
 #if UPRINTF_FLOAT_SUPPORT
         case 'f':
-        case 'F': {
-            if (!u_state.float_support) {
-                // Float support disabled
-                output_cb('%', ctx);
-                output_cb(specifier, ctx);
-                chars_written += 2;
-                return chars_written;
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        case 'r':
+        case 'R':
+            if (spec->length == 6) {
+                long double value;
+                u_deferred_get(rec, pos, &value, sizeof(value));
+                return u_deferred_emit(sink, spec, fmt, value);
+            } else {
+                double value;
+                u_deferred_get(rec, pos, &value, sizeof(value));
+                return u_deferred_emit(sink, spec, fmt, value);
             }
-            
-            number = true;
-            double value = va_arg(*args, double);
-            u_ftoa(value, buffer, precision, u_state.decimal_point);
-            len = u_strlen(buffer);
-            sign = value < 0;
-            break;
-        }
 #endif
-        
-        case 'c': {
-            char c = (char)va_arg(*args, int);
-            int padding = width > 1 ? width - 1 : 0;
-            
-            if (!(flags & U_FLAG_LEFT_ALIGN)) {
-                u_output_repeat(output_cb, ctx, ' ', padding);
-                chars_written += padding;
-            }
-            
-            output_cb(c, ctx);
-            chars_written++;
-            
-            if (flags & U_FLAG_LEFT_ALIGN) {
-                u_output_repeat(output_cb, ctx, ' ', padding);
-                chars_written += padding;
-            }
-            
-            return chars_written;
-        }
-        
         case 's': {
-            const char* str = va_arg(*args, const char*);
-            int str_len = str ? u_strlen(str) : 6; // "(null)"
-            
-            // Handle precision for strings (negative precision means no limit)
-            if (precision >= 0 && precision < str_len) {
-                str_len = precision;
-            }
-            
-            int padding = width > str_len ? width - str_len : 0;
-            
-            if (!(flags & U_FLAG_LEFT_ALIGN)) {
-                u_output_repeat(output_cb, ctx, ' ', padding);
-                chars_written += padding;
-            }
-            
-            u_output_str(output_cb, ctx, str ? str : "(null)", str_len);
-            chars_written += str_len;
-            
-            if (flags & U_FLAG_LEFT_ALIGN) {
-                u_output_repeat(output_cb, ctx, ' ', padding);
-                chars_written += padding;
-            }
-            
-            return chars_written;
-        }
-        
-        case 'p': {
-            number = true;
-            base = 16;
-            void* ptr = va_arg(*args, void*);
-            uintptr_t value = (uintptr_t)ptr;
-            
-            u_utoa(value, buffer, 16, false);
-            len = u_strlen(buffer);
-            
-            // Add prefix for pointers
-            if (len < UPRINTF_BUFFER_SIZE - 2) {
-                memmove(buffer + 2, buffer, len + 1);
-                buffer[0] = '0';
-                buffer[1] = 'x';
-                len += 2;
-            }
-            break;
-        }
-        
-        case '%': {
-            output_cb('%', ctx);
-            chars_written++;
-            return chars_written;
-        }
-        
-        case 'n': {
-            int* ptr = va_arg(*args, int*);
-            if (ptr) *ptr = chars_written;
-            return chars_written;
-        }
-        
-        default: {
-            // Unknown specifier - output as-is
-            output_cb('%', ctx);
-            output_cb(specifier, ctx);
-            chars_written += 2;
-            return chars_written;
+            uint16_t len;
+            u_deferred_get(rec, pos, &len, sizeof(len));
+            if (len == U_DEFERRED_NULL_STR) return u_deferred_emit(sink, spec, fmt, (const char*)NULL);
+            const char* str = (const char*)rec + *pos;
+            *pos += (size_t)len + 1;
+            return u_deferred_emit(sink, spec, fmt, str);
         }
-    }
-    
-    // Handle numbers
-    if (number) {
-        int num_digits = len;
-        int sign_len = sign ? 1 : 0;
-        
-        if (flags & U_FLAG_FORCE_SIGN && !sign) {
-            sign_len = 1;
-        } else if (flags & U_FLAG_SPACE_SIGN && !sign) {
-            sign_len = 1;
-        }
-        
-        int total_len = num_digits + sign_len;
-        int padding = width > total_len ? width - total_len : 0;
-        int zero_padding = 0;
-        
-        if (precision > num_digits) {
-            zero_padding = precision - num_digits;
-            total_len += zero_padding;
-            padding = width > total_len ? width - total_len : 0;
-        }
-        
-        if (flags & U_FLAG_ZERO_PAD && !(flags & U_FLAG_LEFT_ALIGN) && precision < 0) {
-            zero_padding += padding;
-            padding = 0;
-        }
-        
-        // Output left padding
-        if (!(flags & U_FLAG_LEFT_ALIGN)) {
-            u_output_repeat(output_cb, ctx, ' ', padding);
-            chars_written += padding;
-        }
-        
-        // Output sign
-        if (sign) {
-            // sign already output as part of u_itoa in float and integer cases.
-        } else if (flags & U_FLAG_FORCE_SIGN) {
-            output_cb('+', ctx);
-            chars_written++;
-        } else if (flags & U_FLAG_SPACE_SIGN) {
-            output_cb(' ', ctx);
-            chars_written++;
-        }
-        
-        // Output zero padding
-        u_output_repeat(output_cb, ctx, '0', zero_padding);
-        chars_written += zero_padding;
-        
-        // Output number
-        u_output_str(output_cb, ctx, buffer, -1);
-        chars_written += num_digits;
-        
-        // Output right padding
-        if (flags & U_FLAG_LEFT_ALIGN) {
-            u_output_repeat(output_cb, ctx, ' ', padding);
-            chars_written += padding;
+        case 'p': {
+            void* value;
+            u_deferred_get(rec, pos, &value, sizeof(value));
+            return u_deferred_emit(sink, spec, fmt, value);
         }
+        default:
+            return u_deferred_emit(sink, spec, fmt);
     }
-    
-    return chars_written;
 }
 
-// Public functions
-int u_vprintf(u_output_cb_t output_cb, void* ctx, const char* fmt, va_list args) {
+// Render one record the way u_format_engine renders its format
+static int u_deferred_render(u_sink_t* sink, const unsigned char* rec) {
+    size_t pos = sizeof(uint16_t);
+    const char* fmt;
+    u_deferred_get(rec, &pos, &fmt, sizeof(fmt));
     int chars_written = 0;
     
-    if (!output_cb || !fmt) {
-        return -1;
-    }
-    
     while (*fmt) {
         if (*fmt != '%') {
-            output_cb(*fmt++, ctx);
-            chars_written++;
+            const char* start = fmt;
+            fmt = u_scan_until(fmt, '%');
+            u_sink_write(sink, start, fmt - start);
+            chars_written += (int)(fmt - start);
             continue;
         }
         
         fmt++; // Skip '%'
-        if (!*fmt) break; // Handle trailing '%'
+        if (!*fmt) break;
         
-        int result = u_parse_format(output_cb, ctx, &fmt, &args);
-        if (result < 0) {
-            return result; // Error
+        u_format_spec_t spec;
+        const char* next = u_parse_spec(fmt, &spec);
+        if (!next) {
+            int len = (int)u_strlen(fmt);
+            u_sink_write(sink, "%", 1);
+            u_sink_write(sink, fmt, len);
+            return chars_written + len + 1;
+        }
+        fmt = next;
+        
+        // '*' values were captured already: resolve them into the spec
+        if (spec.flags & U_FLAG_WIDTH_ARG) {
+            int width;
+            u_deferred_get(rec, &pos, &width, sizeof(width));
+            if (width < 0) {
+                spec.flags |= U_FLAG_LEFT_ALIGN;
+                width = -width;
+            }
+            spec.width = width;
         }
+        if (spec.flags & U_FLAG_PRECISION_ARG) {
+            int precision;
+            u_deferred_get(rec, &pos, &precision, sizeof(precision));
+            spec.precision = precision < 0 ? -1 : precision;
+        }
+        spec.flags &= ~(unsigned int)(U_FLAG_WIDTH_ARG | U_FLAG_PRECISION_ARG);
+        
+        int result = u_deferred_render_arg(sink, &spec, &fmt, rec, &pos);
+        if (result < 0) return result;
         chars_written += result;
     }
     
     return chars_written;
 }
 
-int u_printf(u_output_cb_t output_cb, void* ctx, const char* fmt, ...) {
-    if (!output_cb || !fmt) return -1;
+int u_deferred_init(u_deferred_log_t* log, void* storage, size_t size,
+                    const u_context_t* context) {
+    if (!log || !storage || size == 0 || (size & (size - 1)) != 0) return -1;
+    
+    log->data = (unsigned char*)storage;
+    log->mask = size - 1;
+    log->context = context ? context : &u_state;
+    U_SYNC_INIT(&log->head, 0);
+    U_SYNC_INIT(&log->tail, 0);
+    U_SYNC_INIT(&log->dropped, 0);
+    return 0;
+}
+
+// Copy between a record and the log storage, wrapping at the end
+static void u_deferred_copy_in(u_deferred_log_t* log, size_t at, const unsigned char* src,
+                               size_t len) {
+    size_t offset = at & log->mask;
+    size_t first = log->mask + 1 - offset;
+    if (first > len) first = len;
+    memcpy(log->data + offset, src, first);
+    memcpy(log->data, src + first, len - first);
+}
+
+static void u_deferred_copy_out(const u_deferred_log_t* log, size_t at, unsigned char* dst,
+                                size_t len) {
+    size_t offset = at & log->mask;
+    size_t first = log->mask + 1 - offset;
+    if (first > len) first = len;
+    memcpy(dst, log->data + offset, first);
+    memcpy(dst + first, log->data, len - first);
+}
+
+int u_deferred_vprintf(u_deferred_log_t* log, const char* fmt, va_list args) {
+    if (!log || !fmt) return -1;
+    
+    size_t head = U_SYNC_LOAD(&log->head);
+    size_t tail = U_SYNC_LOAD(&log->tail);
+    size_t offset = head & log->mask;
+    
+    // Capture in place when a maximal record fits before the end of the
+    // storage, otherwise through a local copy that wraps
+    unsigned char local[UPRINTF_DEFERRED_RECORD_SIZE];
+    unsigned char* rec = local;
+    if (log->mask + 1 - (head - tail) >= UPRINTF_DEFERRED_RECORD_SIZE &&
+        log->mask + 1 - offset >= UPRINTF_DEFERRED_RECORD_SIZE) {
+        rec = log->data + offset;
+    }
+    
+    va_list ap;
+    va_copy(ap, args);
+    int size = u_deferred_capture(log->context, rec, fmt, &ap);
+    va_end(ap);
+    if (size < 0) return -1;
+    
+    if (head - tail + (size_t)size > log->mask + 1) {
+        U_SYNC_STORE(&log->dropped, U_SYNC_LOAD(&log->dropped) + 1);
+        U_STAT_ADD(stream_drops, 1);
+        return -1;
+    }
     
+    uint16_t len = (uint16_t)size;
+    memcpy(rec, &len, sizeof(len));
+    if (rec == local) u_deferred_copy_in(log, head, rec, len);
+    U_SYNC_STORE(&log->head, head + len);
+    return size;
+}
+
+int u_deferred_printf(u_deferred_log_t* log, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    int result = u_vprintf(output_cb, ctx, fmt, args);
+    int result = u_deferred_vprintf(log, fmt, args);
     va_end(args);
     return result;
 }
 
-int u_register_format_handler(char specifier, u_format_handler_t handler) {
-    if (!handler) return -1;
+size_t u_deferred_drain(u_deferred_log_t* log, u_output_cb_t output_cb, void* ctx,
+                        size_t max_records) {
+    if (!log || !output_cb) return 0;
     
-    for (int i = 0; i < UPRINTF_MAX_HANDLERS; i++) {
-        if (u_state.handlers[i].specifier == 0 || u_state.handlers[i].specifier == specifier) {
-            u_state.handlers[i].specifier = specifier;
-            u_state.handlers[i].handler = handler;
-            return 0;
-        }
+    u_sink_t sink;
+    u_char_sink_ctx_t char_ctx;
+    u_output_buffer_t* ob = u_sink_init_output(&sink, &char_ctx, output_cb, ctx);
+    sink.context = log->context;
+    
+    unsigned char rec[UPRINTF_DEFERRED_RECORD_SIZE];
+    size_t rendered = 0;
+    size_t tail = U_SYNC_LOAD(&log->tail);
+    while (max_records == 0 || rendered < max_records) {
+        if (tail == U_SYNC_LOAD(&log->head)) break;
+        
+        uint16_t len;
+        u_deferred_copy_out(log, tail, (unsigned char*)&len, sizeof(len));
+        u_deferred_copy_out(log, tail, rec, len);
+        u_deferred_render(&sink, rec);
+        
+        tail += len;
+        U_SYNC_STORE(&log->tail, tail);
+        rendered++;
     }
-    return -1; // No space
+    
+    if (ob && ob->auto_flush) u_flush(ob);
+    return rendered;
 }
 
-int u_unregister_format_handler(char specifier) {
-    for (int i = 0; i < UPRINTF_MAX_HANDLERS; i++) {
-        if (u_state.handlers[i].specifier == specifier) {
-            u_state.handlers[i].specifier = 0;
-            u_state.handlers[i].handler = NULL;
-            return 0;
+size_t u_deferred_dropped(const u_deferred_log_t* log) {
+    return log ? U_SYNC_LOAD(&((u_deferred_log_t*)log)->dropped) : 0;
+}
+#endif // UPRINTF_ENABLE_DEFERRED
+
+#if UPRINTF_ENABLE_IOV
+// Scatter/gather output implementation
+void u_iov_init(u_iov_list_t* list, u_iovec_t* iov, int capacity,
+                char* scratch, size_t scratch_size) {
+    if (!list) return;
+    list->iov = iov;
+    list->capacity = iov ? capacity : 0;
+    list->scratch = scratch;
+    list->scratch_size = scratch ? scratch_size : 0;
+    list->min_ref = UPRINTF_IOV_MIN_REF;
+    u_iov_reset(list);
+}
+
+void u_iov_reset(u_iov_list_t* list) {
+    if (!list) return;
+    list->count = 0;
+    list->scratch_used = 0;
+    list->total = 0;
+    list->overflow = false;
+}
+
+// Add a segment, extending the last one when the memory is adjacent
+static void u_iov_push(u_iov_list_t* list, const char* data, size_t len) {
+    if (list->count > 0) {
+        u_iovec_t* last = &list->iov[list->count - 1];
+        if ((const char*)last->base + last->len == data) {
+            last->len += len;
+            list->total += len;
+            return;
         }
     }
-    return -1; // Not found
+    if (list->count >= list->capacity) {
+        list->overflow = true;
+        return;
+    }
+    list->iov[list->count].base = data;
+    list->iov[list->count].len = len;
+    list->count++;
+    list->total += len;
 }
 
-// Buffer output functions
-static void buffer_output_cb(char c, void* ctx) {
-    if (!ctx) return;
+// Transient bytes (numbers, short spans) are materialized in the scratch area
+static void u_iov_copy(const char* data, size_t len, void* ctx) {
+    u_iov_list_t* list = (u_iov_list_t*)ctx;
+    if (list->overflow) return;
+    if (len > list->scratch_size - list->scratch_used) {
+        list->overflow = true;
+        return;
+    }
     
-    char** buffer_ptr = (char**)ctx;
-    if (*buffer_ptr) {
-        **buffer_ptr = c;
-        (*buffer_ptr)++;
+    char* dst = list->scratch + list->scratch_used;
+    memcpy(dst, data, len);
+    list->scratch_used += len;
+    u_iov_push(list, dst, len);
+}
+
+static void u_iov_ref(const char* data, size_t len, void* ctx) {
+    u_iov_list_t* list = (u_iov_list_t*)ctx;
+    if (len < list->min_ref) {
+        u_iov_copy(data, len, ctx);
+    } else if (!list->overflow) {
+        u_iov_push(list, data, len);
     }
 }
 
-int u_sprintf(char* buffer, const char* fmt, ...) {
-    if (!buffer || !fmt) return -1;
+static void u_iov_sink_init(u_sink_t* sink, const u_context_t* context, u_iov_list_t* list) {
+    u_sink_init_span(sink, u_iov_copy, list);
+    sink->ref = u_iov_ref;
+    sink->context = context;
+}
+
+// Keep the list as it was before a call that did not fit
+static int u_iov_finish(u_iov_list_t* list, int count, size_t scratch_used, size_t total,
+                        size_t last_len, int result) {
+    if (!list->overflow && result >= 0) return result;
+    
+    list->count = count;
+    list->scratch_used = scratch_used;
+    list->total = total;
+    if (count > 0) list->iov[count - 1].len = last_len;
+    return -1;
+}
+
+int u_context_iov_vprintf(const u_context_t* context, u_iov_list_t* list,
+                          const char* fmt, va_list args) {
+    if (!context || !list || !fmt) return -1;
+    
+    int count = list->count;
+    size_t scratch_used = list->scratch_used;
+    size_t total = list->total;
+    size_t last_len = count > 0 ? list->iov[count - 1].len : 0;
+    list->overflow = false;
+    
+    u_sink_t sink;
+    u_iov_sink_init(&sink, context, list);
+    va_list ap;
+    va_copy(ap, args);
+    int result = u_format_engine(&sink, fmt, &ap);
+    va_end(ap);
     
+    return u_iov_finish(list, count, scratch_used, total, last_len, result);
+}
+
+int u_iov_vprintf(u_iov_list_t* list, const char* fmt, va_list args) {
+    return u_context_iov_vprintf(&u_state, list, fmt, args);
+}
+
+int u_context_iov_printf(const u_context_t* context, u_iov_list_t* list, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    char* ptr = buffer;
-    int result = u_vprintf(buffer_output_cb, &ptr, fmt, args);
-    *ptr = '\0';
+    int result = u_context_iov_vprintf(context, list, fmt, args);
     va_end(args);
     return result;
 }
 
-// Bounded buffer output
-typedef struct {
-    char* buffer;
-    size_t size;
-    size_t pos;
-} bounded_ctx_t;
+int u_iov_printf(u_iov_list_t* list, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = u_context_iov_vprintf(&u_state, list, fmt, args);
+    va_end(args);
+    return result;
+}
 
-static void bounded_output_cb(char c, void* ctx) {
-    if (!ctx) return;
+// Render a template into the list; text templates go through the char view
+#if UPRINTF_ENABLE_TEMPLATES
+static int u_iov_template(const u_context_t* context, u_iov_list_t* list,
+                          const u_template_compiled_t* t, const char* const* values, int count,
+                          const u_template_var_t* vars, int var_count) {
+    int saved_count = list->count;
+    size_t scratch_used = list->scratch_used;
+    size_t total = list->total;
+    size_t last_len = saved_count > 0 ? list->iov[saved_count - 1].len : 0;
+    list->overflow = false;
     
-    bounded_ctx_t* bctx = (bounded_ctx_t*)ctx;
-    if (bctx->pos < bctx->size - 1) {
-        bctx->buffer[bctx->pos] = c;
-        bctx->pos++;
+    u_sink_t sink;
+    u_iov_sink_init(&sink, context, list);
+    if (t->part_count < 0) {
+        u_template_format(sink.putc, sink.putc_ctx, t->tmpl, vars, var_count);
+    } else {
+        u_template_render_sink(&sink, t, values, count);
     }
+    
+    return u_iov_finish(list, saved_count, scratch_used, total, last_len,
+                        (int)(list->total - total));
 }
 
-int u_snprintf(char* buffer, size_t size, const char* fmt, ...) {
-    if (!buffer || size == 0 || !fmt) return -1;
+int u_context_iov_template_render(const u_context_t* context, u_iov_list_t* list, int id,
+                                  const char* const* values, int count) {
+    if (!context || !list || id < 0 || id >= context->template_count) return -1;
+    return u_iov_template(context, list, &context->templates[id], values, count, NULL, 0);
+}
+
+int u_iov_template_render(u_iov_list_t* list, int id, const char* const* values, int count) {
+    return u_context_iov_template_render(&u_state, list, id, values, count);
+}
+
+int u_context_iov_template_format_named(const u_context_t* context, u_iov_list_t* list,
+                                        const char* name, const u_template_var_t* vars,
+                                        int count) {
+    if (!context || !list) return -1;
     
-    va_list args;
-    va_start(args, fmt);
+    int id = u_context_template_find(context, name);
+    if (id < 0) return -1;
     
-    bounded_ctx_t ctx = {buffer, size, 0};
-    u_vprintf(bounded_output_cb, &ctx, fmt, args);
-    buffer[ctx.pos] = '\0';
+    const u_template_compiled_t* t = &context->templates[id];
+    const char* values[UPRINTF_TEMPLATE_SLOTS];
+    if (t->part_count >= 0) u_template_bind(t, vars, count, values);
+    return u_iov_template(context, list, t, values, t->slot_count, vars, count);
+}
+
+int u_iov_template_format_named(u_iov_list_t* list, const char* name,
+                                const u_template_var_t* vars, int count) {
+    return u_context_iov_template_format_named(&u_state, list, name, vars, count);
+}
+#endif
+#endif // UPRINTF_ENABLE_IOV
+
+#if UPRINTF_ENABLE_STRING_BUILDER || UPRINTF_ENABLE_STRING_UTILS
+// Single pass replace: the runs between matches and the replacements go to
+// the sink as spans. Returns the full result length.
+static size_t u_replace_run(u_sink_t* sink, const char* str, const char* find,
+                            const char* replace) {
+    size_t str_len = u_strlen(str);
+    size_t find_len = u_strlen(find);
+    size_t replace_len = u_strlen(replace);
+    const char* end = str + str_len;
+    size_t total = 0;
     
-    va_end(args);
-    return ctx.pos; // Return actual number of characters written
+    if (find_len) {
+        u_searcher_t sr;
+        u_searcher_init(&sr, find, find_len);
+        const char* pos;
+        while ((pos = u_searcher_next(&sr, str, (size_t)(end - str)))) {
+            u_sink_write(sink, str, (size_t)(pos - str));
+            u_sink_write(sink, replace, replace_len);
+            total += (size_t)(pos - str) + replace_len;
+            str = pos + find_len;
+        }
+    }
+    u_sink_write(sink, str, (size_t)(end - str));
+    return total + (size_t)(end - str);
 }
+#endif
 
-void u_set_locale(const char* locale) {
-    // Minimal implementation - just set decimal point
-    if (locale && *locale) {
-        u_state.decimal_point = *locale;
+#if UPRINTF_ENABLE_STRING_BUILDER
+// Allocator implementation
+static void* u_heap_alloc(void* user, size_t size) {
+    (void)user;
+    return malloc(size);
+}
+
+static void* u_heap_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+    (void)user; (void)old_size;
+    return realloc(ptr, new_size);
+}
+
+static void u_heap_free(void* user, void* ptr, size_t size) {
+    (void)user; (void)size;
+    free(ptr);
+}
+
+static const u_allocator_t u_heap_allocator = {u_heap_alloc, u_heap_realloc, u_heap_free, NULL};
+
+const u_allocator_t* u_allocator_heap(void) {
+    return &u_heap_allocator;
+}
+
+// Arena allocations are aligned for any scalar type
+#define U_ARENA_ALIGN (2 * sizeof(void*))
+
+void u_arena_init(u_arena_t* arena, void* storage, size_t size) {
+    if (!arena) return;
+    arena->base = (char*)storage;
+    arena->size = storage ? size : 0;
+    u_arena_reset(arena);
+}
+
+void u_arena_reset(u_arena_t* arena) {
+    if (!arena) return;
+    arena->used = 0;
+    arena->last = (size_t)-1;
+}
+
+static void* u_arena_alloc(void* user, size_t size) {
+    u_arena_t* arena = (u_arena_t*)user;
+    size_t start = (arena->used + U_ARENA_ALIGN - 1) & ~(U_ARENA_ALIGN - 1);
+    if (start > arena->size || size > arena->size - start) return NULL;
+    
+    arena->last = start;
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+static void* u_arena_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+    u_arena_t* arena = (u_arena_t*)user;
+    if (!ptr) return u_arena_alloc(user, new_size);
+    
+    // The most recent allocation grows in place
+    size_t offset = (size_t)((char*)ptr - arena->base);
+    if (offset == arena->last) {
+        if (new_size > arena->size - offset) return NULL;
+        arena->used = offset + new_size;
+        return ptr;
     }
+    
+    void* moved = u_arena_alloc(user, new_size);
+    if (moved) memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    return moved;
 }
 
-void u_set_float_support(bool enabled) {
-    u_state.float_support = enabled;
+static void u_arena_free(void* user, void* ptr, size_t size) {
+    u_arena_t* arena = (u_arena_t*)user;
+    (void)size;
+    if (ptr && (size_t)((char*)ptr - arena->base) == arena->last) {
+        arena->used = arena->last;
+        arena->last = (size_t)-1;
+    }
 }
 
-void u_set_default_output(u_output_cb_t output_cb, void* ctx) {
-    u_state.default_output_cb = output_cb;
-    u_state.default_ctx = ctx;
+u_allocator_t u_arena_allocator(u_arena_t* arena) {
+    u_allocator_t allocator = {u_arena_alloc, u_arena_realloc, u_arena_free, arena};
+    return allocator;
 }
 
-int u_printf_simple(const char* fmt, ...) {
-    if (!u_state.default_output_cb || !fmt) return -1;
+void u_pool_init(u_pool_t* pool, void* storage, size_t block_size, size_t block_count) {
+    if (!pool) return;
+    if (block_size < sizeof(void*)) block_size = sizeof(void*);
+    block_size = (block_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
     
-    va_list args;
-    va_start(args, fmt);
-    int result = u_vprintf(u_state.default_output_cb, u_state.default_ctx, fmt, args);
-    va_end(args);
-    return result;
+    pool->storage = (char*)storage;
+    pool->block_size = block_size;
+    pool->free_list = NULL;
+    
+    // Thread the free list through the blocks, first block first
+    for (size_t i = storage ? block_count : 0; i > 0; i--) {
+        void* block = pool->storage + (i - 1) * block_size;
+        *(void**)block = pool->free_list;
+        pool->free_list = block;
+    }
 }
 
-// Enhanced output function with processors and hooks
-static void enhanced_output_cb(char c, void* ctx) {
-    // Apply stream processors
-    for (int i = 0; i < u_state.processor_count; i++) {
-        c = u_state.processors[i].processor(c, u_state.processors[i].ctx);
+static void* u_pool_alloc(void* user, size_t size) {
+    u_pool_t* pool = (u_pool_t*)user;
+    if (size > pool->block_size || !pool->free_list) return NULL;
+    
+    void* block = pool->free_list;
+    pool->free_list = *(void**)block;
+    return block;
+}
+
+static void* u_pool_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+    u_pool_t* pool = (u_pool_t*)user;
+    (void)old_size;
+    if (!ptr) return u_pool_alloc(user, new_size);
+    return new_size <= pool->block_size ? ptr : NULL;
+}
+
+static void u_pool_free(void* user, void* ptr, size_t size) {
+    u_pool_t* pool = (u_pool_t*)user;
+    (void)size;
+    if (!ptr) return;
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+}
+
+u_allocator_t u_pool_allocator(u_pool_t* pool) {
+    u_allocator_t allocator = {u_pool_alloc, u_pool_realloc, u_pool_free, pool};
+    return allocator;
+}
+
+// String builder implementation
+u_string_builder_t u_string_builder_create_with(size_t initial_size,
+                                                const u_allocator_t* allocator) {
+    u_string_builder_t sb;
+    sb.allocator = allocator ? *allocator : u_heap_allocator;
+    sb.size = initial_size ? initial_size : 1;
+    sb.buffer = (char*)sb.allocator.alloc(sb.allocator.user, sb.size);
+    sb.pos = 0;
+    sb.dynamic = true;
+    if (sb.buffer) {
+        sb.buffer[0] = '\0';
+    } else {
+        sb.size = 0;
+    }
+    return sb;
+}
+
+u_string_builder_t u_string_builder_create(size_t initial_size) {
+    return u_string_builder_create_with(initial_size, NULL);
+}
+
+void u_string_builder_init(u_string_builder_t* sb, char* storage, size_t size,
+                           const u_allocator_t* allocator) {
+    if (!sb) return;
+    sb->buffer = size ? storage : NULL;
+    sb->size = storage ? size : 0;
+    sb->pos = 0;
+    sb->dynamic = false;
+    if (allocator) {
+        sb->allocator = *allocator;
+    } else {
+        memset(&sb->allocator, 0, sizeof(sb->allocator));
+    }
+    if (sb->buffer) sb->buffer[0] = '\0';
+}
+
+// Make room for `extra` more characters plus the terminator, doubling the
+// buffer so repeated appends reallocate O(log n) times
+static bool u_string_builder_reserve(u_string_builder_t* sb, size_t extra) {
+    size_t needed = sb->pos + extra + 1;
+    if (needed <= sb->size) return true;
+    if (!sb->allocator.alloc) {
+        if (!sb->dynamic) return false; // Fixed size
+        sb->allocator = u_heap_allocator; // Heap builder set up by hand
     }
     
-    // Call hooks
-    for (int i = 0; i < u_state.hook_count; i++) {
-        u_state.hooks[i].hook(c, ctx, u_state.hooks[i].user_data);
+    size_t new_size = sb->size < 16 ? 16 : sb->size;
+    while (new_size < needed) {
+        if (new_size > SIZE_MAX / 2) {
+            new_size = needed;
+            break;
+        }
+        new_size *= 2;
     }
     
-    // Original output
-    u_output_cb_t original = (u_output_cb_t)ctx;
-    original(c, ctx);
+    char* new_buffer;
+    if (sb->dynamic) {
+        new_buffer = (char*)sb->allocator.realloc(sb->allocator.user, sb->buffer,
+                                                  sb->size, new_size);
+    } else {
+        // Spill caller storage into the allocator
+        new_buffer = (char*)sb->allocator.alloc(sb->allocator.user, new_size);
+        if (new_buffer && sb->buffer) memcpy(new_buffer, sb->buffer, sb->pos + 1);
+        if (new_buffer && !sb->buffer) new_buffer[0] = '\0';
+    }
+    if (!new_buffer) return false;
+    
+    sb->buffer = new_buffer;
+    sb->size = new_size;
+    sb->dynamic = true;
+    return true;
 }
 
-// Enhanced printf with all new features
-int u_vprintf_ex(u_output_cb_t output_cb, void* ctx, const char* fmt, va_list args) {
-    // Use enhanced output system
-    return u_vprintf(enhanced_output_cb, (void*)output_cb, fmt, args);
+// Append a span; a builder that cannot grow keeps what fits
+static void u_string_builder_write(const char* data, size_t len, void* ctx) {
+    u_string_builder_t* sb = (u_string_builder_t*)ctx;
+    if (!u_string_builder_reserve(sb, len)) {
+        if (!sb->buffer || sb->pos + 1 >= sb->size) return;
+        len = sb->size - sb->pos - 1; // Keep what fits
+    }
+    
+    memcpy(sb->buffer + sb->pos, data, len);
+    sb->pos += len;
+    sb->buffer[sb->pos] = '\0';
 }
 
-int u_printf_ex(u_output_cb_t output_cb, void* ctx, const char* fmt, ...) {
+void u_string_builder_append(u_string_builder_t* sb, const char* str) {
+    if (!sb || !str) return;
+    u_string_builder_write(str, u_strlen(str), sb);
+}
+
+void u_string_builder_append_format(u_string_builder_t* sb, const char* fmt, ...) {
+    if (!sb || !fmt) return;
+    if (!sb->buffer && !u_string_builder_reserve(sb, 0)) return;
+    
     va_list args;
     va_start(args, fmt);
-    int result = u_vprintf_ex(output_cb, ctx, fmt, args);
+    
+    // First pass formats straight into the free tail and reports the full length
+    size_t room = sb->size - sb->pos;
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int needed = u_vsnprintf(sb->buffer + sb->pos, room, fmt, args_copy);
+    va_end(args_copy);
+    
+    if (needed < 0) {
+        va_end(args);
+        return;
+    }
+    
+    if ((size_t)needed < room) {
+        sb->pos += needed;
+        va_end(args);
+        return;
+    }
+    
+    // Did not fit: grow geometrically and format again, or keep the truncated result
+    if (u_string_builder_reserve(sb, (size_t)needed)) {
+        u_vsnprintf(sb->buffer + sb->pos, needed + 1, fmt, args);
+        sb->pos += needed;
+    } else {
+        sb->pos = sb->size - 1;
+        sb->buffer[sb->pos] = '\0';
+    }
+    
     va_end(args);
-    return result;
 }
 
-// Template system implementation
-void u_template_format(u_output_cb_t output_cb, void* ctx, 
-                      const char* template, const u_template_var_t* vars, int count) {
-    const char* ptr = template;
-    while (*ptr) {
-        if (*ptr == '{' && *(ptr + 1) == '{') {
-            // Found variable start
-            const char* end = strstr(ptr + 2, "}}");
-            if (!end) break;
-            
-            // Extract variable name
-            char var_name[64];
-            size_t var_len = end - (ptr + 2);
-            if (var_len >= sizeof(var_name)) var_len = sizeof(var_name) - 1;
-            strncpy(var_name, ptr + 2, var_len);
-            var_name[var_len] = '\0';
-            
-            // Find variable value
-            const char* value = NULL;
-            for (int i = 0; i < count; i++) {
-                if (strcmp(vars[i].key, var_name) == 0) {
-                    value = vars[i].value;
-                    break;
-                }
-            }
-            
-            // Output value or empty string
-            if (value) {
-                u_output_str(output_cb, ctx, value, -1);
-            }
-            
-            ptr = end + 2;
-        } else {
-            output_cb(*ptr++, ctx);
-        }
+void u_string_builder_append_replace(u_string_builder_t* sb, const char* str,
+                                     const char* find, const char* replace) {
+    if (!sb || !str || !find) return;
+    
+    u_sink_t sink;
+    u_sink_init_span(&sink, u_string_builder_write, sb);
+    u_replace_run(&sink, str, find, replace);
+}
+
+void u_string_builder_clear(u_string_builder_t* sb) {
+    if (sb) {
+        sb->pos = 0;
+        if (sb->buffer) sb->buffer[0] = '\0';
     }
 }
 
-void u_template_load(const char* name, const char* template) {
-    for (int i = 0; i < u_state.template_count; i++) {
-        if (strcmp(u_state.templates[i].name, name) == 0) {
-            u_state.templates[i].template = template;
-            return;
+void u_string_builder_free(u_string_builder_t* sb) {
+    if (sb && sb->dynamic && sb->buffer) {
+        if (sb->allocator.free) {
+            sb->allocator.free(sb->allocator.user, sb->buffer, sb->size);
+        } else if (!sb->allocator.alloc) {
+            free(sb->buffer); // Heap builder set up by hand
         }
+        sb->buffer = NULL;
+        sb->size = 0;
+        sb->pos = 0;
     }
-    
-    if (u_state.template_count < 32) {
-        u_state.templates[u_state.template_count].name = name;
-        u_state.templates[u_state.template_count].template = template;
-        u_state.template_count++;
+}
+#endif // UPRINTF_ENABLE_STRING_BUILDER
+
+#if UPRINTF_ENABLE_RECORDS
+// Structured records. Keys carry their separator and value introducer, so
+// a field goes out as one span: the key copied in front of the converted
+// value. JSON opens the record with its first field.
+static void u_record_write(u_record_t* rec, const char* data, size_t len) {
+    if (!len) return;
+    rec->write(data, len, rec->ctx);
+    rec->length += len;
+}
+
+static bool u_json_plain(unsigned char c) {
+    return c >= 0x20 && c != '"' && c != '\\';
+}
+
+// JSON escape of one byte into out (up to 6 bytes), returns the length
+static size_t u_json_escape_byte(unsigned char c, char* out) {
+    out[0] = '\\';
+    switch (c) {
+        case '"': case '\\': out[1] = (char)c; return 2;
+        case '\n': out[1] = 'n'; return 2;
+        case '\r': out[1] = 'r'; return 2;
+        case '\t': out[1] = 't'; return 2;
+        case '\b': out[1] = 'b'; return 2;
+        case '\f': out[1] = 'f'; return 2;
+        default:
+            memcpy(out + 1, "u00", 3);
+            out[4] = u_digits_lower[c >> 4];
+            out[5] = u_digits_lower[c & 15];
+            return 6;
     }
 }
 
-void u_template_format_named(u_output_cb_t output_cb, void* ctx, 
-                            const char* name, const u_template_var_t* vars, int count) {
-    for (int i = 0; i < u_state.template_count; i++) {
-        if (strcmp(u_state.templates[i].name, name) == 0) {
-            u_template_format(output_cb, ctx, u_state.templates[i].template, vars, count);
-            return;
+int u_record_key_init(u_record_key_t* key, u_record_format_t format, const char* name) {
+    if (!key) return -1;
+    key->length = 0;
+    if (!name) return -1;
+    
+    bool json = format == U_RECORD_JSON;
+    char* out = key->text;
+    size_t n = 0;
+    out[n++] = json ? ',' : ' ';
+    if (json) out[n++] = '"';
+    for (; *name; name++) {
+        unsigned char c = (unsigned char)*name;
+        char esc[6];
+        size_t len = 1;
+        if (!json) {
+            esc[0] = c <= ' ' || c == '=' || c == '"' ? '_' : (char)c;
+        } else if (u_json_plain(c)) {
+            esc[0] = (char)c;
+        } else {
+            len = u_json_escape_byte(c, esc);
         }
+        if (n + len + 2 > sizeof(key->text)) return -1;
+        memcpy(out + n, esc, len);
+        n += len;
+    }
+    if (json) out[n++] = '"';
+    out[n++] = json ? ':' : '=';
+    key->length = (unsigned short)n;
+    return 0;
+}
+
+void u_record_begin(u_record_t* rec, u_record_format_t format, u_write_cb_t write_cb, void* ctx) {
+    if (!rec) return;
+    rec->write = write_cb;
+    rec->ctx = ctx;
+    rec->length = 0;
+    rec->fields = 0;
+    rec->format = format;
+}
+
+#if UPRINTF_ENABLE_STRING_BUILDER
+void u_record_begin_builder(u_record_t* rec, u_record_format_t format, u_string_builder_t* sb) {
+    u_record_begin(rec, format, u_string_builder_write, sb);
+}
+#endif
+
+// Copy the key of the next field to out and return its length, 0 to skip
+// the field. The first field drops the separator; in JSON it becomes '{'.
+static size_t u_record_field(u_record_t* rec, const u_record_key_t* key, char* out) {
+    if (!rec || !rec->write || !key || !key->length) return 0;
+    size_t n = 0;
+    if (rec->fields++) {
+        out[n++] = key->text[0];
+    } else if (rec->format == U_RECORD_JSON) {
+        out[n++] = '{';
     }
+    memcpy(out + n, key->text + 1, key->length - 1u);
+    return n + key->length - 1u;
+}
+
+void u_record_int(u_record_t* rec, const u_record_key_t* key, long long value) {
+    char out[UPRINTF_RECORD_KEY_SIZE + 24];
+    size_t n = u_record_field(rec, key, out);
+    if (!n) return;
     
-    // Template not found - output error
-    u_output_str(output_cb, ctx, "[Template '", -1);
-    u_output_str(output_cb, ctx, name, -1);
-    u_output_str(output_cb, ctx, "' not found]", -1);
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    char* d = u_utoa_end(magnitude, end, 10, false);
+    if (value < 0) *--d = '-';
+    memcpy(out + n, d, (size_t)(end - d));
+    u_record_write(rec, out, n + (size_t)(end - d));
 }
 
-// Multi-output system implementation
-void u_output_add_stream(u_output_stream_t stream) {
-    if (u_state.stream_count < 16) {
-        u_state.streams[u_state.stream_count++] = stream;
+void u_record_str(u_record_t* rec, const u_record_key_t* key, const char* value) {
+    char chunk[UPRINTF_RECORD_KEY_SIZE + 64];
+    size_t n = u_record_field(rec, key, chunk);
+    if (!n) return;
+    if (!value) {
+        memcpy(chunk + n, "null", 4);
+        u_record_write(rec, chunk, n + 4);
+        return;
+    }
+    
+    size_t len = u_strlen(value);
+    bool quote = rec->format == U_RECORD_JSON || len == 0;
+    for (size_t i = 0; i < len && !quote; i++) {
+        unsigned char c = (unsigned char)value[i];
+        quote = c <= ' ' || c == '=' || c == '"';
+    }
+    if (!quote) {
+        // Plain logfmt value: referenced, nothing to escape
+        u_record_write(rec, chunk, n);
+        u_record_write(rec, value, len);
+        return;
+    }
+    
+    // Plain runs and escapes are batched behind the key; runs longer than
+    // the chunk go out directly
+    chunk[n++] = '"';
+    size_t i = 0;
+    while (i < len) {
+        size_t start = i;
+        while (i < len && u_json_plain((unsigned char)value[i])) i++;
+        size_t run = i - start;
+        if (n + run + 6 > sizeof(chunk)) {
+            u_record_write(rec, chunk, n);
+            n = 0;
+            if (run + 6 > sizeof(chunk)) {
+                u_record_write(rec, value + start, run);
+                run = 0;
+            }
+        }
+        memcpy(chunk + n, value + start, run);
+        n += run;
+        if (i < len) n += u_json_escape_byte((unsigned char)value[i++], chunk + n);
+    }
+    if (n == sizeof(chunk)) {
+        u_record_write(rec, chunk, n);
+        n = 0;
     }
+    chunk[n++] = '"';
+    u_record_write(rec, chunk, n);
 }
 
-void u_output_remove_stream(u_output_cb_t output_cb) {
-    for (int i = 0; i < u_state.stream_count; i++) {
-        if (u_state.streams[i].output == output_cb) {
-            // Remove by shifting
-            for (int j = i; j < u_state.stream_count - 1; j++) {
-                u_state.streams[j] = u_state.streams[j + 1];
+#if UPRINTF_FLOAT_SUPPORT
+// Most logged values have a few decimals: find the fewest (up to 9) that
+// read back to the same double and print them with the integer converter.
+// Returns 0 for values left to the float engine.
+static size_t u_record_fixed(double value, char* out) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+    double magnitude = value < 0 ? -value : value;
+    if (!(magnitude >= 1e-9 && magnitude < 1e15)) return 0;
+    
+    for (int k = 0; k <= 9; k++) {
+        // Below 2^50 the scaled value is within half a unit of the integer
+        // a shorter representation would have, so the first hit is shortest
+        double scaled = magnitude * pow10[k];
+        if (scaled >= 1e15) return 0;
+        uint64_t n = (uint64_t)(scaled + 0.5);
+        if ((double)n / pow10[k] != magnitude) continue;
+        
+        char digits[24];
+        char* end = digits + sizeof(digits);
+        char* d = u_utoa_end(n, end, 10, false);
+        int count = (int)(end - d);
+        char* p = out;
+        if (value < 0) *p++ = '-';
+        if (count <= k) {
+            *p++ = '0';
+            *p++ = '.';
+            for (int i = count; i < k; i++) *p++ = '0';
+            memcpy(p, d, (size_t)count);
+            p += count;
+        } else {
+            memcpy(p, d, (size_t)(count - k));
+            p += count - k;
+            if (k) {
+                *p++ = '.';
+                memcpy(p, end - k, (size_t)k);
+                p += k;
             }
-            u_state.stream_count--;
-            break;
         }
+        return (size_t)(p - out);
     }
+    return 0;
 }
+#endif
 
-void u_output_broadcast(char c) {
-    for (int i = 0; i < u_state.stream_count; i++) {
-        if (u_state.streams[i].enabled) {
-            u_state.streams[i].output(c, u_state.streams[i].ctx);
+void u_record_float(u_record_t* rec, const u_record_key_t* key, double value) {
+    char out[UPRINTF_RECORD_KEY_SIZE + (UPRINTF_BUFFER_SIZE < 32 ? 32 : UPRINTF_BUFFER_SIZE)];
+    size_t n = u_record_field(rec, key, out);
+    if (!n) return;
+    
+#if UPRINTF_FLOAT_SUPPORT
+    if (rec->format != U_RECORD_JSON || value - value == 0) {
+        size_t len = u_record_fixed(value, out + n);
+        if (len) {
+            u_record_write(rec, out, n + len);
+            return;
         }
+#if UPRINTF_FLOAT_ENGINE == UPRINTF_FLOAT_ENGINE_FULL
+        u_sink_t sink;
+        u_sink_init_buffer(&sink, out + n, sizeof(out) - n);
+        u_fp_format(&sink, value, 0, -1, 0, 'r', '.');
+        u_record_write(rec, out, n + sink.pos);
+#else
+        char digits[UPRINTF_BUFFER_SIZE];
+        len = u_strlen(u_ftoa(value, digits, 6, '.'));
+        memcpy(out + n, digits, len);
+        u_record_write(rec, out, n + len);
+#endif
+        return;
     }
+#else
+    (void)value;
+#endif
+    memcpy(out + n, "null", 4);
+    u_record_write(rec, out, n + 4);
 }
 
-void u_output_broadcast_str(const char* str) {
-    for (int i = 0; str[i]; i++) {
-        u_output_broadcast(str[i]);
+int u_record_end(u_record_t* rec) {
+    if (!rec) return -1;
+    if (rec->format == U_RECORD_JSON && rec->write) {
+        u_record_write(rec, rec->fields ? "}" : "{}", rec->fields ? 1 : 2);
     }
+    return (int)rec->length;
 }
+#endif // UPRINTF_ENABLE_RECORDS
 
-// String builder implementation
-u_string_builder_t u_string_builder_create(size_t initial_size) {
-    u_string_builder_t sb = {
-        .buffer = malloc(initial_size),
-        .size = initial_size,
-        .pos = 0,
-        .dynamic = true
-    };
-    if (sb.buffer) sb.buffer[0] = '\0';
-    return sb;
+#if UPRINTF_ENABLE_TEXT
+// Text layout engine. Lines are assembled in a bounded staging buffer and
+// flushed one span per line; text of any length is laid out in one pass.
+typedef struct {
+    u_output_buffer_t ob;
+    const u_text_layout_t* layout;
+    const char* text; // Start of the input, which all copied text points into
+    size_t prefix_len;
+    char fill;
+    bool word_start;  // Capitalize state: the previous character was blank
+} u_layout_ctx_t;
+
+// Whitespace that separates words on a line
+static inline bool u_layout_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
 }
 
-void u_string_builder_append(u_string_builder_t* sb, const char* str) {
-    if (!sb || !str) return;
-    
-    size_t len = strlen(str);
-    if (sb->pos + len + 1 >= sb->size) {
-        if (sb->dynamic) {
-            size_t new_size = sb->size * 2;
-            if (new_size < sb->pos + len + 1) new_size = sb->pos + len + 1;
-            char* new_buffer = realloc(sb->buffer, new_size);
-            if (!new_buffer) return;
-            sb->buffer = new_buffer;
-            sb->size = new_size;
-        } else {
-            len = sb->size - sb->pos - 1;
-        }
+static void u_layout_begin(u_layout_ctx_t* lc, char* storage, size_t size,
+                           u_output_cb_t output_cb, u_write_cb_t write_cb, void* ctx,
+                           const u_text_layout_t* layout, const char* text) {
+    // Staging buffers behind the callback take whole lines directly
+    if (output_cb == u_output_buffer_cb && ctx) {
+        write_cb = u_output_buffer_write;
     }
-    
-    strncpy(sb->buffer + sb->pos, str, len);
-    sb->pos += len;
-    sb->buffer[sb->pos] = '\0';
+    if (write_cb) {
+        u_output_buffer_init_span(&lc->ob, storage, size, write_cb, ctx);
+    } else {
+        u_output_buffer_init(&lc->ob, storage, size, output_cb, ctx);
+    }
+    lc->layout = layout;
+    lc->text = text;
+    lc->prefix_len = layout->prefix ? u_strlen(layout->prefix) : 0;
+    lc->fill = layout->fill ? layout->fill : ' ';
+    lc->word_start = true;
 }
 
-void u_string_builder_append_format(u_string_builder_t* sb, const char* fmt, ...) {
-    if (!sb || !fmt) return;
-    
-    va_list args;
-    va_start(args, fmt);
-    
-    // Calculate required size
-    va_list args_copy;
-    va_copy(args_copy, args);
-    int needed = vsnprintf(NULL, 0, fmt, args_copy);
-    va_end(args_copy);
+// Copy text into the line, transforming it in place
+static void u_layout_text(u_layout_ctx_t* lc, const char* data, size_t len) {
+    u_output_buffer_t* ob = &lc->ob;
     
-    if (needed < 0) {
-        va_end(args);
-        return;
-    }
+    // Words start after blanks in the input; dropped breaks and fill do not count
+    if (data > lc->text) lc->word_start = isspace((unsigned char)data[-1]) != 0;
     
-    // Ensure enough space
-    if (sb->pos + needed + 1 >= sb->size) {
-        if (sb->dynamic) {
-            size_t new_size = sb->size + needed + 1;
-            char* new_buffer = realloc(sb->buffer, new_size);
-            if (!new_buffer) {
-                va_end(args);
-                return;
-            }
-            sb->buffer = new_buffer;
-            sb->size = new_size;
-        } else {
-            needed = sb->size - sb->pos - 1;
+    while (len) {
+        if (ob->pos == ob->size) u_flush(ob);
+        size_t n = ob->size - ob->pos < len ? ob->size - ob->pos : len;
+        char* p = ob->buffer + ob->pos;
+        memcpy(p, data, n);
+        
+        switch (lc->layout->transform) {
+            case U_TRANSFORM_UPPERCASE:
+                u_case_span(p, n, 'a', 'z');
+                break;
+                
+            case U_TRANSFORM_LOWERCASE:
+                u_case_span(p, n, 'A', 'Z');
+                break;
+                
+            case U_TRANSFORM_CAPITALIZE:
+                for (size_t i = 0; i < n; i++) {
+                    if (lc->word_start) p[i] = (char)toupper((unsigned char)p[i]);
+                    lc->word_start = isspace((unsigned char)p[i]) != 0;
+                }
+                break;
+                
+            case U_TRANSFORM_ROT13:
+                for (size_t i = 0; i < n; i++) {
+                    char c = p[i];
+                    if (c >= 'a' && c <= 'z') {
+                        p[i] = (char)('a' + (c - 'a' + 13) % 26);
+                    } else if (c >= 'A' && c <= 'Z') {
+                        p[i] = (char)('A' + (c - 'A' + 13) % 26);
+                    }
+                }
+                break;
+                
+            default:
+                break;
         }
+        
+        ob->pos += n;
+        data += n;
+        len -= n;
     }
-    
-    // Format directly into buffer
-    vsnprintf(sb->buffer + sb->pos, needed + 1, fmt, args);
-    sb->pos += needed;
-    
-    va_end(args);
 }
 
-void u_string_builder_clear(u_string_builder_t* sb) {
-    if (sb) {
-        sb->pos = 0;
-        if (sb->buffer) sb->buffer[0] = '\0';
+static void u_layout_fill(u_layout_ctx_t* lc, int count) {
+    u_output_buffer_t* ob = &lc->ob;
+    
+    while (count > 0) {
+        if (ob->pos == ob->size) u_flush(ob);
+        size_t room = ob->size - ob->pos;
+        size_t n = (size_t)count < room ? (size_t)count : room;
+        memset(ob->buffer + ob->pos, lc->fill, n);
+        ob->pos += n;
+        count -= (int)n;
     }
 }
 
-void u_string_builder_free(u_string_builder_t* sb) {
-    if (sb && sb->dynamic && sb->buffer) {
-        free(sb->buffer);
-        sb->buffer = NULL;
-        sb->size = 0;
-        sb->pos = 0;
+// Justified line: words keep their order, the gaps share the slack and the
+// leftmost gaps take the remainder. False if there is nothing to stretch.
+static bool u_layout_justify(u_layout_ctx_t* lc, const char* s, const char* e, int width) {
+    int words = 0;
+    int letters = 0;
+    for (const char* p = s; p < e;) {
+        while (p < e && u_layout_blank(*p)) p++;
+        if (p == e) break;
+        const char* w = p;
+        while (p < e && !u_layout_blank(*p)) p++;
+        words++;
+        letters += (int)(p - w);
+    }
+    
+    int gaps = words - 1;
+    int slack = width - letters;
+    if (gaps <= 0 || slack < gaps) return false;
+    
+    int gap = 0;
+    for (const char* p = s; p < e;) {
+        while (p < e && u_layout_blank(*p)) p++;
+        if (p == e) break;
+        const char* w = p;
+        while (p < e && !u_layout_blank(*p)) p++;
+        if (gap) u_layout_fill(lc, slack / gaps + (gap <= slack % gaps ? 1 : 0));
+        u_layout_text(lc, w, (size_t)(p - w));
+        gap++;
     }
+    return true;
 }
 
-// Text alignment implementation
-void u_text_align(u_output_cb_t output_cb, void* ctx, const char* text, 
-                 int width, u_text_align_t align) {
-    int text_len = strlen(text);
-    int padding = width - text_len;
+// One aligned line of content [s, e), without the newline
+static void u_layout_line(u_layout_ctx_t* lc, const char* s, const char* e, int width,
+                          u_text_align_t align, bool stretch, bool pad) {
+    int len = (int)(e - s);
+    int slack = width > len ? width - len : 0;
     
-    if (padding <= 0) {
-        u_output_str(output_cb, ctx, text, -1);
-        return;
-    }
+    if (lc->prefix_len) u_output_buffer_write(lc->layout->prefix, lc->prefix_len, &lc->ob);
     
     switch (align) {
-        case U_ALIGN_LEFT:
-            u_output_str(output_cb, ctx, text, -1);
-            u_output_repeat(output_cb, ctx, ' ', padding);
-            break;
-            
         case U_ALIGN_RIGHT:
-            u_output_repeat(output_cb, ctx, ' ', padding);
-            u_output_str(output_cb, ctx, text, -1);
+            u_layout_fill(lc, slack);
+            u_layout_text(lc, s, (size_t)len);
             break;
             
         case U_ALIGN_CENTER:
-            u_output_repeat(output_cb, ctx, ' ', padding / 2);
-            u_output_str(output_cb, ctx, text, -1);
-            u_output_repeat(output_cb, ctx, ' ', padding - padding / 2);
+            u_layout_fill(lc, slack / 2);
+            u_layout_text(lc, s, (size_t)len);
+            if (pad) u_layout_fill(lc, slack - slack / 2);
             break;
             
-        case U_ALIGN_JUSTIFY:
-            // Simple justification for demonstration
-            u_output_str(output_cb, ctx, text, -1);
-            // TODO: Implement proper justification
+        default:
+            // Justified lines that cannot stretch, such as the last line
+            // of a paragraph, stay ragged
+            if (align == U_ALIGN_JUSTIFY && stretch && slack &&
+                u_layout_justify(lc, s, e, width)) {
+                break;
+            }
+            u_layout_text(lc, s, (size_t)len);
+            if (pad) u_layout_fill(lc, slack);
             break;
     }
 }
 
+// Lay out `len` characters: paragraphs end at '\n', lines break at blanks,
+// and words longer than the width are split
+static void u_layout_run(u_layout_ctx_t* lc, const char* text, size_t len) {
+    const u_text_layout_t* layout = lc->layout;
+    const char* end = text + len;
+    const char* p = text;
+    int width = layout->width;
+    
+    while (p < end) {
+        const char* para = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!para) para = end;
+        
+        if (width <= 0) {
+            u_layout_line(lc, p, para, 0, U_ALIGN_LEFT, false, false);
+        } else {
+            bool first = true;
+            for (;;) {
+                // Wrapped lines drop the blanks they break at
+                if (!first) while (p < para && u_layout_blank(*p)) p++;
+                first = false;
+                
+                // Take words while they fit
+                const char* fit = NULL;
+                const char* q = p;
+                while (q < para) {
+                    const char* w = q;
+                    while (w < para && u_layout_blank(*w)) w++;
+                    if (w == para) break;
+                    const char* we = w;
+                    while (we < para && !u_layout_blank(*we)) we++;
+                    if (we - p > width) break;
+                    fit = q = we;
+                }
+                
+                const char* next;
+                if (!fit) {
+                    // Nothing fits, or a blank-only rest: split at the width
+                    fit = para - p > width ? p + width : para;
+                    if (fit == para) while (fit > p && u_layout_blank(fit[-1])) fit--;
+                    next = p + width < para ? p + width : para;
+                } else {
+                    next = fit;
+                }
+                
+                const char* rest = next;
+                while (rest < para && u_layout_blank(*rest)) rest++;
+                bool last = rest == para;
+                
+                u_layout_line(lc, p, fit, width, layout->align, !last, layout->pad);
+                if (last) break;
+                u_output_buffer_write("\n", 1, &lc->ob);
+                u_flush(&lc->ob);
+                p = next;
+            }
+        }
+        
+        if (para == end) break;
+        u_output_buffer_write("\n", 1, &lc->ob);
+        u_flush(&lc->ob);
+        p = para + 1;
+    }
+    u_flush(&lc->ob);
+}
+
+void u_text_layout(u_output_cb_t output_cb, void* ctx, const char* text,
+                   const u_text_layout_t* layout) {
+    if (!output_cb || !text || !layout) return;
+    
+    char storage[UPRINTF_LAYOUT_BUFFER];
+    u_layout_ctx_t lc;
+    u_layout_begin(&lc, storage, sizeof(storage), output_cb, NULL, ctx, layout, text);
+    u_layout_run(&lc, text, u_strlen(text));
+}
+
+void u_text_layout_span(u_write_cb_t write_cb, void* ctx, const char* text,
+                        const u_text_layout_t* layout) {
+    if (!write_cb || !text || !layout) return;
+    
+    char storage[UPRINTF_LAYOUT_BUFFER];
+    u_layout_ctx_t lc;
+    u_layout_begin(&lc, storage, sizeof(storage), NULL, write_cb, ctx, layout, text);
+    u_layout_run(&lc, text, u_strlen(text));
+}
+
+// Single-line alignment shared by u_text_align and u_format_fill
+static void u_layout_align(u_output_cb_t output_cb, void* ctx, const char* text,
+                           int width, u_text_align_t align, char fill_char) {
+    if (!output_cb || !text) return;
+    
+    u_text_layout_t layout = {width, align, U_TRANSFORM_NONE, NULL, fill_char, true};
+    char storage[UPRINTF_LAYOUT_BUFFER];
+    u_layout_ctx_t lc;
+    u_layout_begin(&lc, storage, sizeof(storage), output_cb, NULL, ctx, &layout, text);
+    const char* end = text + u_strlen(text);
+    u_layout_line(&lc, text, end, width, align, true, true);
+    u_flush(&lc.ob);
+}
+
+// Text alignment implementation
+void u_text_align(u_output_cb_t output_cb, void* ctx, const char* text, 
+                 int width, u_text_align_t align) {
+    u_layout_align(output_cb, ctx, text, width, align, ' ');
+}
+
 // Text transformation implementation
 void u_text_transform(u_output_cb_t output_cb, void* ctx, const char* text, 
                      u_text_transform_t transform) {
-    char buffer[256];
-    size_t len = strlen(text);
-    if (len >= sizeof(buffer)) len = sizeof(buffer) - 1;
+    if (!output_cb || !text) return;
     
-    strncpy(buffer, text, len);
-    buffer[len] = '\0';
+    u_text_layout_t layout = {0, U_ALIGN_LEFT, transform, NULL, ' ', false};
+    char storage[UPRINTF_LAYOUT_BUFFER];
+    u_layout_ctx_t lc;
+    u_layout_begin(&lc, storage, sizeof(storage), output_cb, NULL, ctx, &layout, text);
+    size_t len = u_strlen(text);
     
-    switch (transform) {
-        case U_TRANSFORM_UPPERCASE:
-            for (char* p = buffer; *p; p++) *p = toupper(*p);
-            break;
-            
-        case U_TRANSFORM_LOWERCASE:
-            for (char* p = buffer; *p; p++) *p = tolower(*p);
-            break;
-            
-        case U_TRANSFORM_CAPITALIZE:
-            if (buffer[0]) buffer[0] = toupper(buffer[0]);
-            for (char* p = buffer + 1; *p; p++) {
-                if (isspace(*(p - 1))) *p = toupper(*p);
-            }
-            break;
-            
-        case U_TRANSFORM_REVERSE:
-            u_strrev(buffer, buffer + len - 1);
-            break;
-            
-        case U_TRANSFORM_ROT13:
-            for (char* p = buffer; *p; p++) {
-                if (*p >= 'a' && *p <= 'z') {
-                    *p = 'a' + (*p - 'a' + 13) % 26;
-                } else if (*p >= 'A' && *p <= 'Z') {
-                    *p = 'A' + (*p - 'A' + 13) % 26;
-                }
-            }
-            break;
-            
-        default:
-            break;
+    if (transform != U_TRANSFORM_REVERSE) {
+        u_layout_text(&lc, text, len);
+        u_flush(&lc.ob);
+        return;
     }
     
-    u_output_str(output_cb, ctx, buffer, -1);
+    // Reverse: walk back from the end a staging buffer at a time
+    while (len) {
+        size_t n = len < sizeof(storage) ? len : sizeof(storage);
+        memcpy(storage, text + len - n, n);
+        u_strrev(storage, storage + n - 1);
+        lc.ob.pos = n;
+        u_flush(&lc.ob);
+        len -= n;
+    }
 }
 
 // Text wrapping implementation
 void u_text_wrap(u_output_cb_t output_cb, void* ctx, const char* text, 
                 int width, const char* prefix) {
-    const char* start = text;
-    const char* end = text;
-    int current_line_length = 0;
-    int prefix_len = prefix ? strlen(prefix) : 0;
-    
-    while (*end) {
-        // Find next word boundary
-        const char* word_end = end;
-        while (*word_end && !isspace(*word_end)) word_end++;
-        
-        int word_len = word_end - end;
-        
-        if (current_line_length + word_len > width) {
-            // Output current line
-            if (prefix && start != end) {
-                u_output_str(output_cb, ctx, prefix, prefix_len);
-            }
-            u_output_str(output_cb, ctx, start, end - start);
-            u_output_str(output_cb, ctx, "\n", 1);
-            
-            // Start new line
-            start = end;
-            current_line_length = 0;
-        }
-        
-        // Skip whitespace
-        while (*word_end && isspace(*word_end)) word_end++;
-        
-        current_line_length += word_len + (word_end - end - word_len);
-        end = word_end;
-    }
-    
-    // Output remaining text
-    if (start < end) {
-        if (prefix) {
-            u_output_str(output_cb, ctx, prefix, prefix_len);
-        }
-        u_output_str(output_cb, ctx, start, end - start);
-    }
+    u_text_layout_t layout = {width, U_ALIGN_LEFT, U_TRANSFORM_NONE, prefix, ' ', false};
+    u_text_layout(output_cb, ctx, text, &layout);
 }
 
 // Pattern-based formatting
@@ -1598,51 +8571,233 @@ void u_format_pattern(u_output_cb_t output_cb, void* ctx, const char* pattern,
         }
     }
 }
+#endif // UPRINTF_ENABLE_TEXT
 
+#if UPRINTF_ENABLE_HOOKS
 // Event system implementation
+void u_context_add_output_hook(u_context_t* context, u_output_hook_t hook, void* user_data) {
+    if (context && hook && context->hook_count < 16) {
+        context->hooks[context->hook_count].hook = hook;
+        context->hooks[context->hook_count].block = NULL;
+        context->hooks[context->hook_count].user_data = user_data;
+        context->hook_count++;
+    }
+}
+
 void u_add_output_hook(u_output_hook_t hook, void* user_data) {
-    if (u_state.hook_count < 16) {
-        u_state.hooks[u_state.hook_count].hook = hook;
-        u_state.hooks[u_state.hook_count].user_data = user_data;
-        u_state.hook_count++;
+    u_context_add_output_hook(&u_state, hook, user_data);
+}
+
+void u_context_remove_output_hook(u_context_t* context, u_output_hook_t hook) {
+    if (!context || !hook) return;
+    
+    for (int i = 0; i < context->hook_count; i++) {
+        if (context->hooks[i].hook == hook) {
+            // Remove by shifting
+            for (int j = i; j < context->hook_count - 1; j++) {
+                context->hooks[j] = context->hooks[j + 1];
+            }
+            context->hook_count--;
+            break;
+        }
     }
 }
 
 void u_remove_output_hook(u_output_hook_t hook) {
-    for (int i = 0; i < u_state.hook_count; i++) {
-        if (u_state.hooks[i].hook == hook) {
+    u_context_remove_output_hook(&u_state, hook);
+}
+
+void u_context_add_block_hook(u_context_t* context, u_block_hook_t hook, void* user_data) {
+    if (context && hook && context->hook_count < 16) {
+        context->hooks[context->hook_count].hook = NULL;
+        context->hooks[context->hook_count].block = hook;
+        context->hooks[context->hook_count].user_data = user_data;
+        context->hook_count++;
+    }
+}
+
+void u_add_block_hook(u_block_hook_t hook, void* user_data) {
+    u_context_add_block_hook(&u_state, hook, user_data);
+}
+
+void u_context_remove_block_hook(u_context_t* context, u_block_hook_t hook) {
+    if (!context || !hook) return;
+    
+    for (int i = 0; i < context->hook_count; i++) {
+        if (context->hooks[i].block == hook) {
             // Remove by shifting
-            for (int j = i; j < u_state.hook_count - 1; j++) {
-                u_state.hooks[j] = u_state.hooks[j + 1];
+            for (int j = i; j < context->hook_count - 1; j++) {
+                context->hooks[j] = context->hooks[j + 1];
             }
-            u_state.hook_count--;
+            context->hook_count--;
             break;
         }
     }
 }
 
+void u_remove_block_hook(u_block_hook_t hook) {
+    u_context_remove_block_hook(&u_state, hook);
+}
+#endif // UPRINTF_ENABLE_HOOKS
+
+#if UPRINTF_ENABLE_PROCESSORS
 // Stream processors implementation
+void u_context_add_stream_processor(u_context_t* context, u_stream_processor_t processor,
+                                    void* ctx) {
+    if (context && processor && context->processor_count < 16) {
+        context->processors[context->processor_count].processor = processor;
+        context->processors[context->processor_count].block = NULL;
+        context->processors[context->processor_count].ctx = ctx;
+        context->processor_count++;
+    }
+}
+
 void u_add_stream_processor(u_stream_processor_t processor, void* ctx) {
-    if (u_state.processor_count < 16) {
-        u_state.processors[u_state.processor_count].processor = processor;
-        u_state.processors[u_state.processor_count].ctx = ctx;
-        u_state.processor_count++;
+    u_context_add_stream_processor(&u_state, processor, ctx);
+}
+
+void u_context_remove_stream_processor(u_context_t* context, u_stream_processor_t processor) {
+    if (!context || !processor) return;
+    
+    for (int i = 0; i < context->processor_count; i++) {
+        if (context->processors[i].processor == processor) {
+            // Remove by shifting
+            for (int j = i; j < context->processor_count - 1; j++) {
+                context->processors[j] = context->processors[j + 1];
+            }
+            context->processor_count--;
+            break;
+        }
     }
 }
 
 void u_remove_stream_processor(u_stream_processor_t processor) {
-    for (int i = 0; i < u_state.processor_count; i++) {
-        if (u_state.processors[i].processor == processor) {
+    u_context_remove_stream_processor(&u_state, processor);
+}
+
+void u_context_add_block_processor(u_context_t* context, u_block_processor_t processor,
+                                   void* ctx) {
+    if (context && processor && context->processor_count < 16) {
+        context->processors[context->processor_count].processor = NULL;
+        context->processors[context->processor_count].block = processor;
+        context->processors[context->processor_count].ctx = ctx;
+        context->processor_count++;
+    }
+}
+
+void u_add_block_processor(u_block_processor_t processor, void* ctx) {
+    u_context_add_block_processor(&u_state, processor, ctx);
+}
+
+void u_context_remove_block_processor(u_context_t* context, u_block_processor_t processor) {
+    if (!context || !processor) return;
+    
+    for (int i = 0; i < context->processor_count; i++) {
+        if (context->processors[i].block == processor) {
             // Remove by shifting
-            for (int j = i; j < u_state.processor_count - 1; j++) {
-                u_state.processors[j] = u_state.processors[j + 1];
+            for (int j = i; j < context->processor_count - 1; j++) {
+                context->processors[j] = context->processors[j + 1];
             }
-            u_state.processor_count--;
+            context->processor_count--;
             break;
         }
     }
 }
 
+void u_remove_block_processor(u_block_processor_t processor) {
+    u_context_remove_block_processor(&u_state, processor);
+}
+
+// Built-in processors
+
+size_t u_processor_upper(char* data, size_t len, size_t capacity, void* ctx) {
+    (void)capacity;
+    (void)ctx;
+    u_case_span(data, len, 'a', 'z');
+    return len;
+}
+
+size_t u_processor_lower(char* data, size_t len, size_t capacity, void* ctx) {
+    (void)capacity;
+    (void)ctx;
+    u_case_span(data, len, 'A', 'Z');
+    return len;
+}
+
+size_t u_processor_crlf(char* data, size_t len, size_t capacity, void* ctx) {
+    (void)ctx;
+    
+    size_t lines = 0;
+    for (const char* p = data; (p = (const char*)memchr(p, '\n', len - (size_t)(p - data))); p++) {
+        lines++;
+    }
+    if (!lines) return len;
+    
+    // Expand from the back so every byte moves once; what exceeds the
+    // capacity is dropped from the end
+    size_t out = len + lines;
+    size_t end = out < capacity ? out : capacity;
+    size_t w = out;
+    for (size_t r = len; r-- > 0;) {
+        char c = data[r];
+        if (--w < end) data[w] = c;
+        if (c == '\n' && --w < end) data[w] = '\r';
+    }
+    return end;
+}
+
+size_t u_processor_strip_ansi(char* data, size_t len, size_t capacity, void* ctx) {
+    (void)capacity;
+    u_ansi_strip_t local = {0};
+    u_ansi_strip_t* st = ctx ? (u_ansi_strip_t*)ctx : &local;
+    
+    // Plain text needs no copying
+    if (st->state == 0 && !memchr(data, '\x1b', len)) return len;
+    
+    size_t w = 0;
+    for (size_t r = 0; r < len; r++) {
+        unsigned char c = (unsigned char)data[r];
+        if (st->state == 0) {
+            if (c == 0x1B) st->state = 1;
+            else data[w++] = (char)c;
+        } else if (st->state == 1) {
+            // ESC [ opens a CSI sequence; any other ESC pair is dropped whole
+            st->state = c == '[' ? 2 : 0;
+        } else if (c >= 0x40 && c <= 0x7E) {
+            st->state = 0;
+        }
+    }
+    return w;
+}
+#endif // UPRINTF_ENABLE_PROCESSORS
+
+#if UPRINTF_ENABLE_HOOKS
+// CRC-32 a nibble at a time: a 64-byte table suits small targets
+static const uint32_t u_crc32_nibble[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+    0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t u_crc32_update(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        crc = (crc >> 4) ^ u_crc32_nibble[crc & 15];
+        crc = (crc >> 4) ^ u_crc32_nibble[crc & 15];
+    }
+    return ~crc;
+}
+
+void u_hook_crc32(const char* data, size_t len, void* ctx, void* user_data) {
+    (void)ctx;
+    uint32_t* crc = (uint32_t*)user_data;
+    if (crc) *crc = u_crc32_update(*crc, data, len);
+}
+#endif
+
+#if UPRINTF_ENABLE_STATE_MACHINE
 // State machine implementation
 struct u_state_machine {
     struct {
@@ -1656,7 +8811,7 @@ struct u_state_machine {
 };
 
 u_state_machine_t* u_state_machine_create(void) {
-    u_state_machine_t* sm = malloc(sizeof(u_state_machine_t));
+    u_state_machine_t* sm = (u_state_machine_t*)malloc(sizeof(u_state_machine_t));
     if (sm) {
         sm->state_count = 0;
         sm->current_state = -1;
@@ -1704,11 +8859,13 @@ void u_state_machine_transition(u_state_machine_t* sm, const char* state) {
 void u_state_machine_free(u_state_machine_t* sm) {
     if (sm) free(sm);
 }
+#endif // UPRINTF_ENABLE_STATE_MACHINE
 
+#if UPRINTF_ENABLE_TERMINAL
 // Position-aware output implementation
 void u_output_move_to(u_output_cb_t output_cb, void* ctx, int x, int y) {
     char buffer[16];
-    snprintf(buffer, sizeof(buffer), "\033[%d;%dH", y, x);
+    u_snprintf(buffer, sizeof(buffer), "\033[%d;%dH", y, x);
     u_output_str(output_cb, ctx, buffer, -1);
 }
 
@@ -1727,106 +8884,137 @@ void u_output_clear_line(u_output_cb_t output_cb, void* ctx) {
 void u_output_clear_screen(u_output_cb_t output_cb, void* ctx) {
     u_output_str(output_cb, ctx, "\033[2J", -1);
 }
+#endif // UPRINTF_ENABLE_TERMINAL
 
 // Utility functions implementation
+#if UPRINTF_ENABLE_TEXT
 void u_format_repeat(u_output_cb_t output_cb, void* ctx, char c, int count) {
     u_output_repeat(output_cb, ctx, c, count);
 }
 
 void u_format_fill(u_output_cb_t output_cb, void* ctx, const char* text, 
                   int width, u_text_align_t align, char fill_char) {
-    int text_len = strlen(text);
-    int padding = width - text_len;
+    u_layout_align(output_cb, ctx, text, width, align, fill_char);
+}
+#endif
+
+#if UPRINTF_ENABLE_STRING_UTILS
+// Whether `len` characters match a glob segment without '*'
+static bool u_glob_equal(const char* str, const char* seg, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (seg[i] != '?' && seg[i] != str[i]) return false;
+    }
+    return true;
+}
+
+// Leftmost place of a glob segment in the `n` characters at str, or NULL
+static const char* u_glob_find(const char* str, size_t n, const char* seg, size_t len) {
+    if (!memchr(seg, '?', len)) return u_find(str, n, seg, len);
     
-    if (padding <= 0) {
-        u_output_str(output_cb, ctx, text, -1);
-        return;
+    for (size_t i = 0; i + len <= n; i++) {
+        if (u_glob_equal(str + i, seg, len)) return str + i;
     }
+    return NULL;
+}
+
+void u_pattern_compile(u_pattern_t* p, const char* pattern) {
+    if (!p) return;
     
-    switch (align) {
-        case U_ALIGN_LEFT:
-            u_output_str(output_cb, ctx, text, -1);
-            u_output_repeat(output_cb, ctx, fill_char, padding);
-            break;
-            
-        case U_ALIGN_RIGHT:
-            u_output_repeat(output_cb, ctx, fill_char, padding);
-            u_output_str(output_cb, ctx, text, -1);
-            break;
-            
-        case U_ALIGN_CENTER:
-            u_output_repeat(output_cb, ctx, fill_char, padding / 2);
-            u_output_str(output_cb, ctx, text, -1);
-            u_output_repeat(output_cb, ctx, fill_char, padding - padding / 2);
-            break;
-            
-        case U_ALIGN_JUSTIFY:
-            u_output_str(output_cb, ctx, text, -1);
-            // TODO: Implement proper justification with fill character
-            break;
+    p->pattern = pattern;
+    p->length = u_strlen(pattern);
+    p->has_star = false;
+    p->prefix_len = p->length;
+    p->suffix_len = p->length;
+    p->min_len = p->length;
+    
+    for (size_t i = 0; i < p->length; i++) {
+        if (pattern[i] != '*') continue;
+        if (!p->has_star) p->prefix_len = i;
+        p->has_star = true;
+        p->suffix_len = p->length - 1 - i;
+        p->min_len--;
     }
 }
 
-bool u_str_match_pattern(const char* str, const char* pattern) {
-    while (*pattern) {
-        if (*pattern == '*') {
-            pattern++;
-            while (*str) {
-                if (u_str_match_pattern(str, pattern)) {
-                    return true;
-                }
-                str++;
-            }
-            return !*pattern;
-        } else if (*pattern == '?') {
-            if (!*str) return false;
-            pattern++;
-            str++;
-        } else {
-            if (*pattern != *str) return false;
-            pattern++;
-            str++;
+bool u_pattern_match_n(const u_pattern_t* p, const char* str, size_t len) {
+    if (!p || !p->pattern || !str) return false;
+    
+    const char* pat = p->pattern;
+    if (len < p->min_len) return false;
+    if (!p->has_star) return len == p->length && u_glob_equal(str, pat, len);
+    
+    // Anchored ends; min_len keeps them from overlapping
+    if (!u_glob_equal(str, pat, p->prefix_len)) return false;
+    if (!u_glob_equal(str + len - p->suffix_len, pat + p->length - p->suffix_len,
+                      p->suffix_len)) {
+        return false;
+    }
+    
+    // Each middle segment at its leftmost place: a later one never helps
+    const char* s = str + p->prefix_len;
+    const char* end = str + len - p->suffix_len;
+    const char* seg = pat + p->prefix_len + 1;
+    const char* last_star = pat + p->length - p->suffix_len - 1;
+    while (seg <= last_star) {
+        const char* star = (const char*)memchr(seg, '*', (size_t)(last_star - seg) + 1);
+        size_t seg_len = (size_t)(star - seg);
+        if (seg_len) {
+            const char* at = u_glob_find(s, (size_t)(end - s), seg, seg_len);
+            if (!at) return false;
+            s = at + seg_len;
         }
+        seg = star + 1;
     }
-    return !*str;
+    return true;
 }
 
+bool u_pattern_match(const u_pattern_t* p, const char* str) {
+    return str && u_pattern_match_n(p, str, u_strlen(str));
+}
+
+bool u_str_match_pattern(const char* str, const char* pattern) {
+    if (!str || !pattern) return false;
+    
+    u_pattern_t p;
+    u_pattern_compile(&p, pattern);
+    return u_pattern_match(&p, str);
+}
+
+#if UPRINTF_ENABLE_STRING_BUILDER
 char* u_str_replace(const char* str, const char* find, const char* replace) {
     if (!str || !find) return NULL;
     
-    // Count occurrences
-    int count = 0;
-    const char* pos = str;
-    size_t find_len = strlen(find);
-    while ((pos = strstr(pos, find))) {
-        count++;
-        pos += find_len;
-    }
-    
-    // Calculate new string length
-    size_t str_len = strlen(str);
-    size_t replace_len = strlen(replace);
-    size_t new_len = str_len + count * (replace_len - find_len) + 1;
-    
-    // Allocate new string
-    char* result = malloc(new_len);
-    if (!result) return NULL;
-    
-    // Build new string
-    char* dst = result;
-    const char* src = str;
-    while (*src) {
-        if (strstr(src, find) == src) {
-            strcpy(dst, replace);
-            dst += replace_len;
-            src += find_len;
-        } else {
-            *dst++ = *src++;
-        }
+    // One pass into a growing heap builder; its buffer is the result
+    u_string_builder_t sb = u_string_builder_create(u_strlen(str) + 1);
+    if (!sb.buffer) return NULL;
+    
+    u_sink_t sink;
+    u_sink_init_span(&sink, u_string_builder_write, &sb);
+    size_t len = u_replace_run(&sink, str, find, replace);
+    if (sb.pos != len) {
+        // Out of memory part way
+        u_string_builder_free(&sb);
+        return NULL;
+    }
+    return sb.buffer;
+}
+#endif
+
+size_t u_str_replace_buffer(char* buffer, size_t size, const char* str,
+                            const char* find, const char* replace) {
+    if (!str || !find) {
+        if (buffer && size) buffer[0] = '\0';
+        return 0;
     }
-    *dst = '\0';
     
-    return result;
+    // Without room the sink still needs somewhere to point
+    char none;
+    bool room = buffer && size;
+    u_sink_t sink;
+    u_sink_init_buffer(&sink, room ? buffer : &none, room ? size - 1 : 0);
+    size_t len = u_replace_run(&sink, str, find, replace);
+    if (room) buffer[sink.pos] = '\0';
+    return len;
 }
 
 void u_str_trim(const char* str, char* output, size_t max_len) {
@@ -1836,7 +9024,7 @@ void u_str_trim(const char* str, char* output, size_t max_len) {
     while (isspace(*str)) str++;
     
     // Find end of string
-    const char* end = str + strlen(str) - 1;
+    const char* end = str + u_strlen(str) - 1;
     while (end > str && isspace(*end)) end--;
     
     // Copy trimmed string
@@ -1846,5 +9034,30 @@ void u_str_trim(const char* str, char* output, size_t max_len) {
     strncpy(output, str, len);
     output[len] = '\0';
 }
+#endif // UPRINTF_ENABLE_STRING_UTILS
+
+// Performance counters
+void u_stats_get(u_stats_t* stats) {
+    if (!stats) return;
+#if UPRINTF_STATS
+    *stats = u_stats;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void u_stats_reset(void) {
+#if UPRINTF_STATS
+    memset(&u_stats, 0, sizeof(u_stats));
+#endif
+}
+
+void u_stats_set_clock(u_stats_clock_t clock) {
+#if UPRINTF_STATS
+    u_stats_clock = clock;
+#else
+    (void)clock;
+#endif
+}
 
 #endif // UPRINTF_IMPLEMENTATION
\ No newline at end of file